@@ -25,7 +25,12 @@ int Config::Serialize(char **out, int *out_len) {
   auto config =
       gamma_api::CreateConfig(builder, builder.CreateString(path_),
                               builder.CreateString(log_dir_),
-                              cache_vec);
+                              cache_vec, indexing_freshness_ms_,
+                              wal_sync_policy_, huge_page_, numa_policy_,
+                              numa_node_, search_capacity_, search_queue_size_,
+                              search_timeout_ms_, search_trace_sample_,
+                              unindexed_search_limit_, cache_budget_mb_,
+                              malloc_thresholds_);
 
   builder.Finish(config);
   *out_len = builder.GetSize();
@@ -49,6 +54,18 @@ void Config::Deserialize(const char *data, int len) {
     cache_info.cache_size = c->cache_size();
     cache_infos_[i] = cache_info;
   }
+  indexing_freshness_ms_ = config_->indexing_freshness_ms();
+  wal_sync_policy_ = config_->wal_sync_policy();
+  huge_page_ = config_->huge_page();
+  numa_policy_ = config_->numa_policy();
+  numa_node_ = config_->numa_node();
+  search_capacity_ = config_->search_capacity();
+  search_queue_size_ = config_->search_queue_size();
+  search_timeout_ms_ = config_->search_timeout_ms();
+  search_trace_sample_ = config_->search_trace_sample();
+  unindexed_search_limit_ = config_->unindexed_search_limit();
+  cache_budget_mb_ = config_->cache_budget_mb();
+  malloc_thresholds_ = config_->malloc_thresholds();
 }
 
 const std::string &Config::Path() {
@@ -39,7 +39,21 @@ struct CacheInfo {
 
 class Config : public RawData {
  public:
-  Config() { config_ = nullptr; }
+  Config() {
+    config_ = nullptr;
+    indexing_freshness_ms_ = 0;
+    wal_sync_policy_ = 0;
+    huge_page_ = 0;
+    numa_policy_ = 0;
+    numa_node_ = 0;
+    search_capacity_ = 0;
+    search_queue_size_ = 0;
+    search_timeout_ms_ = 0;
+    search_trace_sample_ = 0;
+    unindexed_search_limit_ = 0;
+    cache_budget_mb_ = 0;
+    malloc_thresholds_ = 0;
+  }
 
   virtual int Serialize(char **out, int *out_len);
 
@@ -63,12 +77,68 @@ class Config : public RawData {
 
   void ClearCacheInfos() { cache_infos_.resize(0); }
 
+  int IndexingFreshnessMs() { return indexing_freshness_ms_; }
+
+  void SetIndexingFreshnessMs(int freshness_ms) {
+    indexing_freshness_ms_ = freshness_ms;
+  }
+
+  int WalSyncPolicy() { return wal_sync_policy_; }
+
+  void SetWalSyncPolicy(int sync_policy) { wal_sync_policy_ = sync_policy; }
+
+  int HugePage() { return huge_page_; }
+
+  int NumaPolicy() { return numa_policy_; }
+
+  int NumaNode() { return numa_node_; }
+
+  int SearchCapacity() { return search_capacity_; }
+
+  int SearchQueueSize() { return search_queue_size_; }
+
+  int SearchTimeoutMs() { return search_timeout_ms_; }
+
+  void SetSearchAdmission(int capacity, int queue_size, int timeout_ms) {
+    search_capacity_ = capacity;
+    search_queue_size_ = queue_size;
+    search_timeout_ms_ = timeout_ms;
+  }
+
+  int SearchTraceSample() { return search_trace_sample_; }
+
+  void SetSearchTraceSample(int sample) { search_trace_sample_ = sample; }
+
+  int UnindexedSearchLimit() { return unindexed_search_limit_; }
+
+  void SetUnindexedSearchLimit(int limit) { unindexed_search_limit_ = limit; }
+
+  int CacheBudgetMb() { return cache_budget_mb_; }
+
+  void SetCacheBudgetMb(int budget_mb) { cache_budget_mb_ = budget_mb; }
+
+  int MallocThresholds() { return malloc_thresholds_; }
+
+  void SetMallocThresholds(int thresholds) { malloc_thresholds_ = thresholds; }
+
  private:
   gamma_api::Config *config_;
 
   std::string path_;
   std::string log_dir_;
   std::vector<CacheInfo> cache_infos_;
+  int indexing_freshness_ms_;
+  int wal_sync_policy_;
+  int huge_page_;
+  int numa_policy_;
+  int numa_node_;
+  int search_capacity_;
+  int search_queue_size_;
+  int search_timeout_ms_;
+  int search_trace_sample_;
+  int unindexed_search_limit_;
+  int cache_budget_mb_;
+  int malloc_thresholds_;
 };
 
 }  // namespace tig_gamma
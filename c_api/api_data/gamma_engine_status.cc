@@ -9,14 +9,52 @@
 
 namespace tig_gamma {
 
-EngineStatus::EngineStatus() { engine_status_ = nullptr; }
+EngineStatus::EngineStatus() {
+  engine_status_ = nullptr;
+  unsearched_num_ = 0;
+  indexing_lag_ms_ = 0;
+  vector_hot_hit_ratio_ = 0;
+  vector_cold_hit_ratio_ = 0;
+  search_admitted_ = 0;
+  search_queued_ = 0;
+  search_timed_out_ = 0;
+  search_rejected_ = 0;
+  lists_probed_ = 0;
+  codes_scanned_ = 0;
+  reranked_ = 0;
+  heap_mem_bytes_ = 0;
+  heap_free_mem_bytes_ = 0;
+  arena_mem_bytes_ = 0;
+  arena_free_mem_bytes_ = 0;
+  returned_mem_bytes_ = 0;
+  mem_reclaims_ = 0;
+}
 
 int EngineStatus::Serialize(char **out, int *out_len) {
   flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<gamma_api::StageLatency>> latencies;
+  for (const auto &latency : stage_latencies_) {
+    latencies.emplace_back(gamma_api::CreateStageLatency(
+        builder, builder.CreateString(latency.stage), latency.count,
+        latency.p50_us, latency.p99_us, latency.p999_us, latency.max_us));
+  }
+  auto latency_vec = builder.CreateVector(latencies);
+  std::vector<flatbuffers::Offset<gamma_api::TombstoneRatios>> tombstones;
+  for (const auto &tombstone : tombstones_) {
+    tombstones.emplace_back(gamma_api::CreateTombstoneRatios(
+        builder, builder.CreateString(tombstone.index_name),
+        builder.CreateVector(tombstone.bucket_ratios), tombstone.max_ratio));
+  }
+  auto tombstone_vec = builder.CreateVector(tombstones);
   auto table = gamma_api::CreateEngineStatus(
       builder, index_status_, table_mem_bytes_, index_mem_bytes_,
       vector_mem_bytes_, field_range_mem_bytes_, bitmap_mem_bytes_, doc_num_,
-      max_docid_, min_indexed_num_);
+      max_docid_, min_indexed_num_, unsearched_num_, indexing_lag_ms_,
+      vector_hot_hit_ratio_, vector_cold_hit_ratio_, search_admitted_,
+      search_queued_, search_timed_out_, search_rejected_, latency_vec,
+      lists_probed_, codes_scanned_, reranked_, heap_mem_bytes_,
+      heap_free_mem_bytes_, arena_mem_bytes_, arena_free_mem_bytes_,
+      returned_mem_bytes_, mem_reclaims_, tombstone_vec);
   builder.Finish(table);
   *out_len = builder.GetSize();
   *out = (char *)malloc(*out_len * sizeof(char));
@@ -38,6 +76,47 @@ void EngineStatus::Deserialize(const char *data, int len) {
   doc_num_ = engine_status_->doc_num();
   max_docid_ = engine_status_->max_docid();
   min_indexed_num_ = engine_status_->min_indexed_num();
+  unsearched_num_ = engine_status_->unsearched_num();
+  indexing_lag_ms_ = engine_status_->indexing_lag_ms();
+  vector_hot_hit_ratio_ = engine_status_->vector_hot_hit_ratio();
+  vector_cold_hit_ratio_ = engine_status_->vector_cold_hit_ratio();
+  search_admitted_ = engine_status_->search_admitted();
+  search_queued_ = engine_status_->search_queued();
+  search_timed_out_ = engine_status_->search_timed_out();
+  search_rejected_ = engine_status_->search_rejected();
+
+  auto latencies = engine_status_->stage_latencies();
+  size_t latency_num = latencies ? latencies->size() : 0;
+  stage_latencies_.resize(latency_num);
+  for (size_t i = 0; i < latency_num; ++i) {
+    auto latency = latencies->Get(i);
+    stage_latencies_[i].stage = latency->stage()->str();
+    stage_latencies_[i].count = latency->count();
+    stage_latencies_[i].p50_us = latency->p50_us();
+    stage_latencies_[i].p99_us = latency->p99_us();
+    stage_latencies_[i].p999_us = latency->p999_us();
+    stage_latencies_[i].max_us = latency->max_us();
+  }
+  lists_probed_ = engine_status_->lists_probed();
+  codes_scanned_ = engine_status_->codes_scanned();
+  reranked_ = engine_status_->reranked();
+  heap_mem_bytes_ = engine_status_->heap_mem();
+  heap_free_mem_bytes_ = engine_status_->heap_free_mem();
+  arena_mem_bytes_ = engine_status_->arena_mem();
+  arena_free_mem_bytes_ = engine_status_->arena_free_mem();
+  returned_mem_bytes_ = engine_status_->returned_mem();
+  mem_reclaims_ = engine_status_->mem_reclaims();
+
+  auto tombstones = engine_status_->tombstone_ratios();
+  size_t tombstone_num = tombstones ? tombstones->size() : 0;
+  tombstones_.resize(tombstone_num);
+  for (size_t i = 0; i < tombstone_num; ++i) {
+    auto tombstone = tombstones->Get(i);
+    tombstones_[i].index_name = tombstone->index_name()->str();
+    auto ratios = tombstone->bucket_ratios();
+    tombstones_[i].bucket_ratios.assign(ratios->begin(), ratios->end());
+    tombstones_[i].max_ratio = tombstone->max_ratio();
+  }
 }
 
 int EngineStatus::IndexStatus() { return index_status_; }
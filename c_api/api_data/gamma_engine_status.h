@@ -7,11 +7,29 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "api_data/gamma_raw_data.h"
 #include "engine_status_generated.h"
 
 namespace tig_gamma {
 
+struct StageLatency {
+  std::string stage;
+  long count;
+  long p50_us;
+  long p99_us;
+  long p999_us;
+  long max_us;
+};
+
+struct TombstoneRatios {
+  std::string index_name;
+  std::vector<float> bucket_ratios;
+  float max_ratio;
+};
+
 class EngineStatus : public RawData {
  public:
   EngineStatus();
@@ -58,6 +76,83 @@ class EngineStatus : public RawData {
     min_indexed_num_ = min_indexed_num;
   }
 
+  int UnsearchedNum() { return unsearched_num_; }
+
+  void SetUnsearchedNum(int unsearched_num) {
+    unsearched_num_ = unsearched_num;
+  }
+
+  long IndexingLagMs() { return indexing_lag_ms_; }
+
+  void SetIndexingLagMs(long indexing_lag_ms) {
+    indexing_lag_ms_ = indexing_lag_ms;
+  }
+
+  float VectorHotHitRatio() { return vector_hot_hit_ratio_; }
+
+  void SetVectorHotHitRatio(float ratio) { vector_hot_hit_ratio_ = ratio; }
+
+  float VectorColdHitRatio() { return vector_cold_hit_ratio_; }
+
+  void SetVectorColdHitRatio(float ratio) { vector_cold_hit_ratio_ = ratio; }
+
+  long SearchAdmitted() { return search_admitted_; }
+
+  long SearchQueued() { return search_queued_; }
+
+  long SearchTimedOut() { return search_timed_out_; }
+
+  long SearchRejected() { return search_rejected_; }
+
+  void SetSearchAdmission(long admitted, long queued, long timed_out,
+                          long rejected) {
+    search_admitted_ = admitted;
+    search_queued_ = queued;
+    search_timed_out_ = timed_out;
+    search_rejected_ = rejected;
+  }
+
+  std::vector<struct StageLatency> &StageLatencies() {
+    return stage_latencies_;
+  }
+
+  long ListsProbed() { return lists_probed_; }
+
+  long CodesScanned() { return codes_scanned_; }
+
+  long Reranked() { return reranked_; }
+
+  void SetSearchCounters(long lists_probed, long codes_scanned,
+                         long reranked) {
+    lists_probed_ = lists_probed;
+    codes_scanned_ = codes_scanned;
+    reranked_ = reranked;
+  }
+
+  long HeapMem() { return heap_mem_bytes_; }
+
+  long HeapFreeMem() { return heap_free_mem_bytes_; }
+
+  long ArenaMem() { return arena_mem_bytes_; }
+
+  long ArenaFreeMem() { return arena_free_mem_bytes_; }
+
+  long ReturnedMem() { return returned_mem_bytes_; }
+
+  long MemReclaims() { return mem_reclaims_; }
+
+  void SetMemStats(long heap_mem, long heap_free_mem, long arena_mem,
+                   long arena_free_mem, long returned_mem, long reclaims) {
+    heap_mem_bytes_ = heap_mem;
+    heap_free_mem_bytes_ = heap_free_mem;
+    arena_mem_bytes_ = arena_mem;
+    arena_free_mem_bytes_ = arena_free_mem;
+    returned_mem_bytes_ = returned_mem;
+    mem_reclaims_ = reclaims;
+  }
+
+  std::vector<struct TombstoneRatios> &Tombstones() { return tombstones_; }
+
  private:
   gamma_api::EngineStatus *engine_status_;
 
@@ -72,6 +167,25 @@ class EngineStatus : public RawData {
   int max_docid_;
 
   int min_indexed_num_;
+  int unsearched_num_;
+  long indexing_lag_ms_;
+  float vector_hot_hit_ratio_;
+  float vector_cold_hit_ratio_;
+  long search_admitted_;
+  long search_queued_;
+  long search_timed_out_;
+  long search_rejected_;
+  std::vector<struct StageLatency> stage_latencies_;
+  long lists_probed_;
+  long codes_scanned_;
+  long reranked_;
+  long heap_mem_bytes_;
+  long heap_free_mem_bytes_;
+  long arena_mem_bytes_;
+  long arena_free_mem_bytes_;
+  long returned_mem_bytes_;
+  long mem_reclaims_;
+  std::vector<struct TombstoneRatios> tombstones_;
 };
 
 }  // namespace tig_gamma
@@ -73,7 +73,8 @@ int Request::Serialize(char **out, int *out_len) {
       builder.CreateVector(range_filter_vector),
       builder.CreateVector(term_filter_vector),
       builder.CreateString(retrieval_params_), has_rank_,
-      builder.CreateString(online_log_level_), multi_vector_rank_, l2_sqrt_);
+      builder.CreateString(online_log_level_), multi_vector_rank_, l2_sqrt_,
+      priority_, timeout_ms_);
 
   builder.Finish(res);
   *out_len = builder.GetSize();
@@ -144,6 +145,8 @@ void Request::Deserialize(const char *data, int len) {
   has_rank_ = request_->has_rank();
   multi_vector_rank_ = request_->multi_vector_rank();
   l2_sqrt_ = request_->l2_sqrt();
+  priority_ = request_->priority();
+  timeout_ms_ = request_->timeout_ms();
 }
 
 int Request::ReqNum() {
@@ -44,6 +44,8 @@ class Request : public RawData {
     request_ = nullptr;
     req_num_ = 0;
     topn_ = 0;
+    priority_ = 0;
+    timeout_ms_ = 0;
   }
 
   virtual int Serialize(char **out, int *out_len);
@@ -98,6 +100,14 @@ class Request : public RawData {
 
   void SetL2Sqrt(bool l2_sqrt);
 
+  int Priority() { return priority_; }
+
+  void SetPriority(int priority) { priority_ = priority; }
+
+  int TimeoutMs() { return timeout_ms_; }
+
+  void SetTimeoutMs(int timeout_ms) { timeout_ms_ = timeout_ms; }
+
  private:
   gamma_api::Request *request_;
 
@@ -117,6 +127,8 @@ class Request : public RawData {
   bool has_rank_;
   int multi_vector_rank_;
   bool l2_sqrt_;
+  int priority_;
+  int timeout_ms_;
 };
 
 }  // namespace tig_gamma
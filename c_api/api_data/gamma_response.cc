@@ -24,18 +24,27 @@ int Response::Serialize(char **out, int *out_len) {
 
       std::vector<flatbuffers::Offset<gamma_api::Attribute>> attributes;
       for (size_t k = 0; k < result_item.names.size(); ++k) {
-        std::vector<uint8_t> it(result_item.values[k].size());
-        memcpy(it.data(), result_item.values[k].data(),
-               result_item.values[k].size());
         attributes.emplace_back(gamma_api::CreateAttribute(
             builder, builder.CreateString(result_item.names[k]),
-            builder.CreateVector(it)));
+            builder.CreateVector(
+                (const uint8_t *)result_item.ValueData(k),
+                result_item.ValueSize(k))));
+      }
+
+      std::vector<flatbuffers::Offset<gamma_api::VectorFieldResult>>
+          vector_results;
+      for (const auto &vec_result : result_item.vector_results) {
+        vector_results.emplace_back(gamma_api::CreateVectorFieldResult(
+            builder, builder.CreateString(vec_result.field),
+            builder.CreateVector((const uint8_t *)vec_result.source.data(),
+                                 vec_result.source.size()),
+            vec_result.score));
       }
 
       std::string &extra = result_item.extra;
       result_items.emplace_back(gamma_api::CreateResultItem(
           builder, score, builder.CreateVector(attributes),
-          builder.CreateString(extra)));
+          builder.CreateString(extra), builder.CreateVector(vector_results)));
     }
 
     auto item_vec = builder.CreateVector(result_items);
@@ -96,6 +105,18 @@ void Response::Deserialize(const char *data, int len) {
         item.values[k] = std::move(item_value);
       }
 
+      auto fbs_vec_results = fbs_result_item->vector_results();
+      size_t vec_result_num = fbs_vec_results ? fbs_vec_results->size() : 0;
+      item.vector_results.resize(vec_result_num);
+      for (size_t k = 0; k < vec_result_num; ++k) {
+        auto vec_result = fbs_vec_results->Get(k);
+        item.vector_results[k].field = vec_result->field()->str();
+        item.vector_results[k].source = std::string(
+            reinterpret_cast<const char *>(vec_result->source()->Data()),
+            vec_result->source()->size());
+        item.vector_results[k].score = vec_result->score();
+      }
+
       result.result_items[j] = std::move(item);
     }
     results_[i] = std::move(result);
@@ -21,21 +21,30 @@ enum class SearchResultCode : std::uint16_t {
   SEARCH_ERROR
 };
 
+// the score of a hit on a vector field
+struct VectorFieldResult {
+  std::string field;
+  std::string source;
+  double score;
+};
+
 struct ResultItem {
   ResultItem() { score = -1; }
 
-  ResultItem(const ResultItem &other) {
-    score = other.score;
-    names = other.names;
-    values = other.values;
-    extra = other.extra;
-  }
+  // pinned strings are copied into values
+  ResultItem(const ResultItem &other) { *this = other; }
 
   ResultItem &operator=(const ResultItem &other) {
+    if (this == &other) return *this;
     score = other.score;
     names = other.names;
     values = other.values;
     extra = other.extra;
+    vector_results = other.vector_results;
+    refs.clear();
+    for (size_t i = 0; i < other.refs.size(); ++i) {
+      if (other.refs[i].Valid()) values[i] = other.refs[i].Str();
+    }
     return *this;
   }
 
@@ -44,6 +53,8 @@ struct ResultItem {
     names = std::move(other.names);
     values = std::move(other.values);
     extra = std::move(other.extra);
+    vector_results = std::move(other.vector_results);
+    refs = std::move(other.refs);
   }
 
   ResultItem &operator=(ResultItem &&other) {
@@ -51,13 +62,28 @@ struct ResultItem {
     names = std::move(other.names);
     values = std::move(other.values);
     extra = std::move(other.extra);
+    vector_results = std::move(other.vector_results);
+    refs = std::move(other.refs);
     return *this;
   }
 
+  const char *ValueData(size_t i) const {
+    return i < refs.size() && refs[i].Valid() ? refs[i].Data()
+                                              : values[i].data();
+  }
+
+  size_t ValueSize(size_t i) const {
+    return i < refs.size() && refs[i].Valid() ? refs[i].Size()
+                                              : values[i].size();
+  }
+
   double score;
   std::vector<std::string> names;
   std::vector<std::string> values;
-  std::string extra;
+  std::string extra;  // deprecated, the json of vector_results
+  std::vector<struct VectorFieldResult> vector_results;
+  // empty or one per value, a valid ref holds the value instead of values[i]
+  std::vector<StringRef> refs;
 };
 
 struct SearchResult {
@@ -20,8 +20,11 @@
 #include "api_data/gamma_engine_status.h"
 #include "api_data/gamma_response.h"
 #include "api_data/gamma_table.h"
+#include "cache_quota.h"
 #include "gamma_engine.h"
+#include "large_alloc.h"
 #include "log.h"
+#include "search_stats.h"
 #include "utils.h"
 
 INITIALIZE_EASYLOGGINGPP
@@ -39,6 +42,11 @@ void *Init(const char *config_str, int len) {
   if (flag == 0) {
     const std::string &log_dir = config.LogDir();
     SetLogDictionary(log_dir);
+    // before the engine allocates anything
+    large_alloc::SetPolicy((large_alloc::HugePage)config.HugePage(),
+                           (large_alloc::NumaPolicy)config.NumaPolicy(),
+                           config.NumaNode());
+    if (config.MallocThresholds() == 1) large_alloc::SetMallocThresholds();
   }
 
   const std::string &path = config.Path();
@@ -48,7 +56,12 @@ void *Init(const char *config_str, int len) {
     return nullptr;
   }
 
-  tig_gamma::RequestConcurrentController::GetInstance();
+  tig_gamma::RequestConcurrentController::GetInstance().SetLimits(
+      config.SearchCapacity(), config.SearchQueueSize(),
+      config.SearchTimeoutMs());
+  if (config.CacheBudgetMb() != 0) {
+    tig_gamma::CacheQuota::GetInstance().SetBudget(config.CacheBudgetMb());
+  }
   LOG(INFO) << "Engine init successed!";
   return static_cast<void *>(engine);
 }
@@ -153,14 +166,42 @@ int Search(void *engine, const char *request_str, int req_len,
   tig_gamma::Request request;
   request.Deserialize(request_str, req_len);
 
-  int ret =
-      static_cast<tig_gamma::GammaEngine *>(engine)->Search(request, response);
+  tig_gamma::GammaEngine *gamma = static_cast<tig_gamma::GammaEngine *>(engine);
+  int ret = gamma->Search(request, response);
 
+  double start_ms = utils::getmillisecs();
   response.Serialize(response_str, res_len);
+  gamma->GetSearchStats().Record(
+      search_stats::Stage::Serialize,
+      (long)((utils::getmillisecs() - start_ms) * 1000));
+
+  return ret;
+}
+
+int OpenCursor(void *engine, const char *request_str, int req_len,
+               long *cursor_id) {
+  tig_gamma::Request request;
+  request.Deserialize(request_str, req_len);
+  long id = 0;
+  int ret = static_cast<tig_gamma::GammaEngine *>(engine)->OpenCursor(request,
+                                                                       id);
+  *cursor_id = id;
+  return ret;
+}
 
+int CursorNext(void *engine, long cursor_id, int page_size,
+               char **response_str, int *res_len) {
+  tig_gamma::Response response;
+  int ret = static_cast<tig_gamma::GammaEngine *>(engine)->CursorNext(
+      cursor_id, page_size, response);
+  response.Serialize(response_str, res_len);
   return ret;
 }
 
+int CloseCursor(void *engine, long cursor_id) {
+  return static_cast<tig_gamma::GammaEngine *>(engine)->CloseCursor(cursor_id);
+}
+
 int DeleteDoc(void *engine, const char *docid, int docid_len) {
   std::string id = std::string(docid, docid_len);
   int ret = static_cast<tig_gamma::GammaEngine *>(engine)->Delete(id);
@@ -199,6 +240,12 @@ int Dump(void *engine) {
   return ret;
 }
 
+int Compact(void *engine, int io_mb_per_sec) {
+  int ret =
+      static_cast<tig_gamma::GammaEngine *>(engine)->Compact(io_mb_per_sec);
+  return ret;
+}
+
 int Load(void *engine) {
   int ret = static_cast<tig_gamma::GammaEngine *>(engine)->Load();
   return ret;
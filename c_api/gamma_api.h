@@ -137,6 +137,14 @@ int BuildIndex(void *engine);
  */
 int Dump(void *engine);
 
+/** reclaim the disk space of deleted docs and updated strings online
+ *
+ * @param engine
+ * @param io_mb_per_sec  io budget of the compaction, <= 0 is unlimited
+ * @return 0 successed, others failed
+ */
+int Compact(void *engine, int io_mb_per_sec);
+
 /** load datas from disk accord to Config
  *
  * @param engine
@@ -153,6 +161,36 @@ int Load(void *engine);
 int Search(void *engine, const char *request_str, int req_len,
            char **response_str, int *res_len);
 
+/** open a cursor over the docs matching the filters of a request, for deep
+ * pagination and export, the vector queries of the request are not supported
+ *
+ * @param engine     search engine pointer
+ * @param request    search request's serialized string
+ * @param cursor_id  (output) cursor id
+ * @return 0 successed, others failed
+ */
+int OpenCursor(void *engine, const char *request_str, int req_len,
+               long *cursor_id);
+
+/** get the next page of a cursor with serialized response, the page is one
+ * search result of the requested fields in docid order
+ *
+ * @param engine     search engine pointer
+ * @param cursor_id  cursor id
+ * @param page_size  max docs of the page
+ * @return number of docs in the page, 0 at the end, < 0 failed
+ */
+int CursorNext(void *engine, long cursor_id, int page_size,
+               char **response_str, int *res_len);
+
+/** close a cursor, the cursors idle for 10 minutes are closed by the engine
+ *
+ * @param engine     search engine pointer
+ * @param cursor_id  cursor id
+ * @return 0 successed, others failed
+ */
+int CloseCursor(void *engine, long cursor_id);
+
 /** delete docs from table by query
  *
  * @param engine  search engine pointer
@@ -5,6 +5,7 @@
 #include <string>
 #include <thread>
 #include <vector>
+#include "background_pool.h"
 #include "error_code.h"
 #include "log.h"
 #include "utils.h"
@@ -33,63 +34,46 @@ struct AsyncFlusher {
   std::atomic<long> nflushed_;
 };
 
+// the flushers of a table run as one task of the shared background pool
 struct AsyncFlushExecutor {
   std::vector<AsyncFlusher *> async_flushers_;
-  std::thread *runner_;
-  bool stopped_;
+  long task_id_;
   int interval_;
 
   AsyncFlushExecutor() {
-    stopped_ = false;
+    task_id_ = 0;
     interval_ = 100;  // ms
-    runner_ = nullptr;
   }
 
-  ~AsyncFlushExecutor() {
-    if (runner_) delete runner_;
-  }
+  ~AsyncFlushExecutor() { Stop(); }
 
-  void Start() {
-    if (!stopped_) {
-      Stop();
-    }
-    stopped_ = false;
-    runner_ = new std::thread(Handler, this);
+  int Start() {
+    Stop();
+    tig_gamma::BackgroundPool *pool = tig_gamma::BackgroundPool::GetInstance();
+    if (pool == nullptr) return INTERNAL_ERR;
+    task_id_ = pool->Add([this]() -> long { return Flush(); }, 0);
+    LOG(INFO) << "async flush executor is started!";
+    return 0;
   }
 
   void Stop() {
-    stopped_ = true;
-    if (runner_) {
-      runner_->join();
-      delete runner_;
-      runner_ = nullptr;
-    }
+    if (task_id_ == 0) return;
+    tig_gamma::BackgroundPool::GetInstance()->Remove(task_id_);
+    task_id_ = 0;
+    LOG(INFO) << "async flush executor is stopped!";
   }
 
-  static void Handler(AsyncFlushExecutor *executor) {
-    LOG(INFO) << "async flush executor is started!";
-    int ret = executor->Flush();
-    if (ret != 0) {
-      LOG(ERROR) << "async flush executor exit unexpectedly! ret=" << ret;
-    } else {
-      LOG(INFO) << "async flush executor exit successfully!";
-    }
-  }
-
-  int Flush() {
-    while (!stopped_) {
-      for (AsyncFlusher *af : async_flushers_) {
-        int ret = af->FlushOnce();
-        if (ret) {
-          LOG(ERROR) << "aysnc flush error, ret=" << ret
-                     << ", name=" << af->name_;
-          return ret;
-        }
-        if (stopped_) return 0;
+  long Flush() {
+    for (AsyncFlusher *af : async_flushers_) {
+      int ret = af->FlushOnce();
+      if (ret) {
+        LOG(ERROR) << "aysnc flush error, ret=" << ret
+                   << ", name=" << af->name_;
+        LOG(ERROR) << "async flush executor exit unexpectedly! ret=" << ret;
+        return -1;
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(interval_));
     }
-    return 0;
+    return interval_;
   }
 
   void Add(AsyncFlusher *af) { async_flushers_.push_back(af); }
@@ -18,6 +18,7 @@
 
 namespace tig_gamma {
 
+// keys of the deprecated json extra of a result item, see vector_results
 const std::string EXTRA_VECTOR_FIELD_SOURCE = "source";
 const std::string EXTRA_VECTOR_FIELD_SCORE = "score";
 const std::string EXTRA_VECTOR_FIELD_NAME = "field";
@@ -32,7 +33,12 @@ enum class ResultCode : std::uint16_t {
   Undefined
 };
 
-enum class VectorStorageType : std::uint8_t { MemoryOnly, Mmap, RocksDB };
+enum class VectorStorageType : std::uint8_t {
+  MemoryOnly,
+  Mmap,
+  RocksDB,
+  Tiered
+};
 
 struct VectorDocField {
   std::string name;
@@ -119,6 +125,7 @@ class GammaSearchCondition : public RetrievalContext {
     brute_force_search = condition->brute_force_search;
     l2_sqrt = condition->l2_sqrt;
     has_rank = condition->has_rank;
+    search_threads_ = condition->search_threads_;
 
 #ifdef BUILD_GPU
     range_filters = condition->range_filters;
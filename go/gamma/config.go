@@ -13,9 +13,21 @@ import (
 )
 
 type Config struct {
-	Path       string
-	LogDir     string
-	config     *gamma_api.Config
+	Path                 string
+	LogDir               string
+	IndexingFreshnessMs  int32
+	WalSyncPolicy        int32
+	HugePage             int32
+	NumaPolicy           int32
+	NumaNode             int32
+	SearchCapacity       int32
+	SearchQueueSize      int32
+	SearchTimeoutMs      int32
+	SearchTraceSample    int32
+	UnindexedSearchLimit int32
+	CacheBudgetMb        int32
+	MallocThresholds     int32
+	config               *gamma_api.Config
 }
 
 func (conf *Config) Serialize(buffer *[]byte) int {
@@ -25,6 +37,18 @@ func (conf *Config) Serialize(buffer *[]byte) int {
 	gamma_api.ConfigStart(builder)
 	gamma_api.ConfigAddPath(builder, path)
 	gamma_api.ConfigAddLogDir(builder, logDir)
+	gamma_api.ConfigAddIndexingFreshnessMs(builder, conf.IndexingFreshnessMs)
+	gamma_api.ConfigAddWalSyncPolicy(builder, conf.WalSyncPolicy)
+	gamma_api.ConfigAddHugePage(builder, conf.HugePage)
+	gamma_api.ConfigAddNumaPolicy(builder, conf.NumaPolicy)
+	gamma_api.ConfigAddNumaNode(builder, conf.NumaNode)
+	gamma_api.ConfigAddSearchCapacity(builder, conf.SearchCapacity)
+	gamma_api.ConfigAddSearchQueueSize(builder, conf.SearchQueueSize)
+	gamma_api.ConfigAddSearchTimeoutMs(builder, conf.SearchTimeoutMs)
+	gamma_api.ConfigAddSearchTraceSample(builder, conf.SearchTraceSample)
+	gamma_api.ConfigAddUnindexedSearchLimit(builder, conf.UnindexedSearchLimit)
+	gamma_api.ConfigAddCacheBudgetMb(builder, conf.CacheBudgetMb)
+	gamma_api.ConfigAddMallocThresholds(builder, conf.MallocThresholds)
 	builder.Finish(builder.EndObject())
 	bufferLen := len(builder.FinishedBytes())
 	*buffer = make([]byte, bufferLen)
@@ -36,4 +60,16 @@ func (conf *Config) DeSerialize(buffer []byte) {
 	conf.config = gamma_api.GetRootAsConfig(buffer, 0)
 	conf.Path = string(conf.config.Path())
 	conf.LogDir = string(conf.config.LogDir())
+	conf.IndexingFreshnessMs = conf.config.IndexingFreshnessMs()
+	conf.WalSyncPolicy = conf.config.WalSyncPolicy()
+	conf.HugePage = conf.config.HugePage()
+	conf.NumaPolicy = conf.config.NumaPolicy()
+	conf.NumaNode = conf.config.NumaNode()
+	conf.SearchCapacity = conf.config.SearchCapacity()
+	conf.SearchQueueSize = conf.config.SearchQueueSize()
+	conf.SearchTimeoutMs = conf.config.SearchTimeoutMs()
+	conf.SearchTraceSample = conf.config.SearchTraceSample()
+	conf.UnindexedSearchLimit = conf.config.UnindexedSearchLimit()
+	conf.CacheBudgetMb = conf.config.CacheBudgetMb()
+	conf.MallocThresholds = conf.config.MallocThresholds()
 }
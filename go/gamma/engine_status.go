@@ -12,6 +12,21 @@ import (
 	flatbuffers "github.com/google/flatbuffers/go"
 )
 
+type StageLatency struct {
+	Stage  string
+	Count  int64
+	P50Us  int64
+	P99Us  int64
+	P999Us int64
+	MaxUs  int64
+}
+
+type TombstoneRatios struct {
+	IndexName    string
+	BucketRatios []float32
+	MaxRatio     float32
+}
+
 type EngineStatus struct {
 	IndexStatus   int32
 	TableMem      int64
@@ -20,6 +35,30 @@ type EngineStatus struct {
 	BitmapMem     int64
 	DocNum        int32
 	MaxDocID      int32
+	UnsearchedNum int32
+	IndexingLagMs int64
+
+	VectorHotHitRatio  float32
+	VectorColdHitRatio float32
+
+	SearchAdmitted int64
+	SearchQueued   int64
+	SearchTimedOut int64
+	SearchRejected int64
+
+	StageLatencies []StageLatency
+	ListsProbed    int64
+	CodesScanned   int64
+	Reranked       int64
+
+	HeapMem      int64
+	HeapFreeMem  int64
+	ArenaMem     int64
+	ArenaFreeMem int64
+	ReturnedMem  int64
+	MemReclaims  int64
+
+	TombstoneRatios []TombstoneRatios
 
 	engineStatus *gamma_api.EngineStatus
 }
@@ -27,6 +66,45 @@ type EngineStatus struct {
 func (status *EngineStatus) Serialize(buffer *[]byte) int {
 	builder := flatbuffers.NewBuilder(0)
 
+	latencies := make([]flatbuffers.UOffsetT, len(status.StageLatencies))
+	for i := 0; i < len(status.StageLatencies); i++ {
+		stage := builder.CreateString(status.StageLatencies[i].Stage)
+		gamma_api.StageLatencyStart(builder)
+		gamma_api.StageLatencyAddStage(builder, stage)
+		gamma_api.StageLatencyAddCount(builder, status.StageLatencies[i].Count)
+		gamma_api.StageLatencyAddP50Us(builder, status.StageLatencies[i].P50Us)
+		gamma_api.StageLatencyAddP99Us(builder, status.StageLatencies[i].P99Us)
+		gamma_api.StageLatencyAddP999Us(builder, status.StageLatencies[i].P999Us)
+		gamma_api.StageLatencyAddMaxUs(builder, status.StageLatencies[i].MaxUs)
+		latencies[i] = gamma_api.StageLatencyEnd(builder)
+	}
+	gamma_api.EngineStatusStartStageLatenciesVector(builder, len(latencies))
+	for i := len(latencies) - 1; i >= 0; i-- {
+		builder.PrependUOffsetT(latencies[i])
+	}
+	latencyVec := builder.EndVector(len(latencies))
+
+	tombstones := make([]flatbuffers.UOffsetT, len(status.TombstoneRatios))
+	for i := 0; i < len(status.TombstoneRatios); i++ {
+		name := builder.CreateString(status.TombstoneRatios[i].IndexName)
+		ratios := status.TombstoneRatios[i].BucketRatios
+		gamma_api.TombstoneRatiosStartBucketRatiosVector(builder, len(ratios))
+		for j := len(ratios) - 1; j >= 0; j-- {
+			builder.PrependFloat32(ratios[j])
+		}
+		ratioVec := builder.EndVector(len(ratios))
+		gamma_api.TombstoneRatiosStart(builder)
+		gamma_api.TombstoneRatiosAddIndexName(builder, name)
+		gamma_api.TombstoneRatiosAddBucketRatios(builder, ratioVec)
+		gamma_api.TombstoneRatiosAddMaxRatio(builder, status.TombstoneRatios[i].MaxRatio)
+		tombstones[i] = gamma_api.TombstoneRatiosEnd(builder)
+	}
+	gamma_api.EngineStatusStartTombstoneRatiosVector(builder, len(tombstones))
+	for i := len(tombstones) - 1; i >= 0; i-- {
+		builder.PrependUOffsetT(tombstones[i])
+	}
+	tombstoneVec := builder.EndVector(len(tombstones))
+
 	gamma_api.EngineStatusStart(builder)
 	gamma_api.EngineStatusAddIndexStatus(builder, status.IndexStatus)
 	gamma_api.EngineStatusAddTableMem(builder, status.TableMem)
@@ -35,6 +113,25 @@ func (status *EngineStatus) Serialize(buffer *[]byte) int {
 	gamma_api.EngineStatusAddBitmapMem(builder, status.BitmapMem)
 	gamma_api.EngineStatusAddDocNum(builder, status.DocNum)
 	gamma_api.EngineStatusAddMaxDocid(builder, status.MaxDocID)
+	gamma_api.EngineStatusAddUnsearchedNum(builder, status.UnsearchedNum)
+	gamma_api.EngineStatusAddIndexingLagMs(builder, status.IndexingLagMs)
+	gamma_api.EngineStatusAddVectorHotHitRatio(builder, status.VectorHotHitRatio)
+	gamma_api.EngineStatusAddVectorColdHitRatio(builder, status.VectorColdHitRatio)
+	gamma_api.EngineStatusAddSearchAdmitted(builder, status.SearchAdmitted)
+	gamma_api.EngineStatusAddSearchQueued(builder, status.SearchQueued)
+	gamma_api.EngineStatusAddSearchTimedOut(builder, status.SearchTimedOut)
+	gamma_api.EngineStatusAddSearchRejected(builder, status.SearchRejected)
+	gamma_api.EngineStatusAddStageLatencies(builder, latencyVec)
+	gamma_api.EngineStatusAddListsProbed(builder, status.ListsProbed)
+	gamma_api.EngineStatusAddCodesScanned(builder, status.CodesScanned)
+	gamma_api.EngineStatusAddReranked(builder, status.Reranked)
+	gamma_api.EngineStatusAddHeapMem(builder, status.HeapMem)
+	gamma_api.EngineStatusAddHeapFreeMem(builder, status.HeapFreeMem)
+	gamma_api.EngineStatusAddArenaMem(builder, status.ArenaMem)
+	gamma_api.EngineStatusAddArenaFreeMem(builder, status.ArenaFreeMem)
+	gamma_api.EngineStatusAddReturnedMem(builder, status.ReturnedMem)
+	gamma_api.EngineStatusAddMemReclaims(builder, status.MemReclaims)
+	gamma_api.EngineStatusAddTombstoneRatios(builder, tombstoneVec)
 	builder.Finish(builder.EndObject())
 	bufferLen := len(builder.FinishedBytes())
 	*buffer = make([]byte, bufferLen)
@@ -51,4 +148,43 @@ func (status *EngineStatus) DeSerialize(buffer []byte) {
 	status.BitmapMem = status.engineStatus.BitmapMem()
 	status.DocNum = status.engineStatus.DocNum()
 	status.MaxDocID = status.engineStatus.MaxDocid()
+	status.UnsearchedNum = status.engineStatus.UnsearchedNum()
+	status.IndexingLagMs = status.engineStatus.IndexingLagMs()
+	status.VectorHotHitRatio = status.engineStatus.VectorHotHitRatio()
+	status.VectorColdHitRatio = status.engineStatus.VectorColdHitRatio()
+	status.SearchAdmitted = status.engineStatus.SearchAdmitted()
+	status.SearchQueued = status.engineStatus.SearchQueued()
+	status.SearchTimedOut = status.engineStatus.SearchTimedOut()
+	status.SearchRejected = status.engineStatus.SearchRejected()
+	status.StageLatencies = make([]StageLatency, status.engineStatus.StageLatenciesLength())
+	for i := 0; i < status.engineStatus.StageLatenciesLength(); i++ {
+		var latency gamma_api.StageLatency
+		status.engineStatus.StageLatencies(&latency, i)
+		status.StageLatencies[i].Stage = string(latency.Stage())
+		status.StageLatencies[i].Count = latency.Count()
+		status.StageLatencies[i].P50Us = latency.P50Us()
+		status.StageLatencies[i].P99Us = latency.P99Us()
+		status.StageLatencies[i].P999Us = latency.P999Us()
+		status.StageLatencies[i].MaxUs = latency.MaxUs()
+	}
+	status.ListsProbed = status.engineStatus.ListsProbed()
+	status.CodesScanned = status.engineStatus.CodesScanned()
+	status.Reranked = status.engineStatus.Reranked()
+	status.HeapMem = status.engineStatus.HeapMem()
+	status.HeapFreeMem = status.engineStatus.HeapFreeMem()
+	status.ArenaMem = status.engineStatus.ArenaMem()
+	status.ArenaFreeMem = status.engineStatus.ArenaFreeMem()
+	status.ReturnedMem = status.engineStatus.ReturnedMem()
+	status.MemReclaims = status.engineStatus.MemReclaims()
+	status.TombstoneRatios = make([]TombstoneRatios, status.engineStatus.TombstoneRatiosLength())
+	for i := 0; i < status.engineStatus.TombstoneRatiosLength(); i++ {
+		var tombstone gamma_api.TombstoneRatios
+		status.engineStatus.TombstoneRatios(&tombstone, i)
+		status.TombstoneRatios[i].IndexName = string(tombstone.IndexName())
+		status.TombstoneRatios[i].BucketRatios = make([]float32, tombstone.BucketRatiosLength())
+		for j := 0; j < tombstone.BucketRatiosLength(); j++ {
+			status.TombstoneRatios[i].BucketRatios[j] = tombstone.BucketRatios(j)
+		}
+		status.TombstoneRatios[i].MaxRatio = tombstone.MaxRatio()
+	}
 }
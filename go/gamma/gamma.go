@@ -102,6 +102,10 @@ func Dump(engine unsafe.Pointer) int {
 	return int(C.Dump(engine))
 }
 
+func Compact(engine unsafe.Pointer, ioMBPerSec int) int {
+	return int(C.Compact(engine, C.int(ioMBPerSec)))
+}
+
 func Load(engine unsafe.Pointer) int {
 	return int(C.Load(engine))
 }
@@ -124,6 +128,34 @@ func Search(engine unsafe.Pointer, request *Request, response *Response) int {
 	return ret
 }
 
+func OpenCursor(engine unsafe.Pointer, request *Request) (int64, int) {
+	var buffer []byte
+	request.Serialize(&buffer)
+
+	var cursorID C.long
+	ret := int(C.OpenCursor(engine,
+		(*C.char)(unsafe.Pointer(&buffer[0])), C.int(len(buffer)), &cursorID))
+	return int64(cursorID), ret
+}
+
+func CursorNext(engine unsafe.Pointer, cursorID int64, pageSize int, response *Response) int {
+	var CBuffer *C.char
+	zero := 0
+	length := &zero
+
+	ret := int(C.CursorNext(engine, C.long(cursorID), C.int(pageSize),
+		(**C.char)(unsafe.Pointer(&CBuffer)),
+		(*C.int)(unsafe.Pointer(length))))
+	defer C.free(unsafe.Pointer(CBuffer))
+	res := C.GoBytes(unsafe.Pointer(CBuffer), C.int(*length))
+	response.DeSerialize(res)
+	return ret
+}
+
+func CloseCursor(engine unsafe.Pointer, cursorID int64) int {
+	return int(C.CloseCursor(engine, C.long(cursorID)))
+}
+
 func DelDocByQuery(engine unsafe.Pointer, request *Request) int {
 	var buffer []byte
 	request.Serialize(&buffer)
@@ -52,6 +52,8 @@ type Request struct {
 	ParallelBasedOnQuery bool
 	L2Sqrt               bool
 	IvfFlat              bool
+	Priority             int32 // 0 normal, 1 high, 2 low
+	TimeoutMs            int32 // max wait for admission, 0 default, < 0 no wait
 
 	request *gamma_api.Request
 }
@@ -162,6 +164,8 @@ func (request *Request) Serialize(buffer *[]byte) int {
 	gamma_api.RequestAddHasRank(builder, request.HasRank)
 	gamma_api.RequestAddMultiVectorRank(builder, request.MultiVectorRank)
 	gamma_api.RequestAddL2Sqrt(builder, request.L2Sqrt)
+	gamma_api.RequestAddPriority(builder, request.Priority)
+	gamma_api.RequestAddTimeoutMs(builder, request.TimeoutMs)
 
 	builder.Finish(builder.EndObject())
 
@@ -25,10 +25,17 @@ type Attribute struct {
 	Value []byte
 }
 
+type VectorFieldResult struct {
+	Field  string
+	Source []byte
+	Score  float64
+}
+
 type ResultItem struct {
-	Score      float64
-	Attributes []Attribute
-	Extra      string
+	Score         float64
+	Attributes    []Attribute
+	Extra         string // Deprecated: the json of VectorResults
+	VectorResults []VectorFieldResult
 }
 
 type SearchResult struct {
@@ -78,12 +85,30 @@ func (response *Response) Serialize(buffer *[]byte) int {
 			}
 			attrs := builder.EndVector(len(response.Results[i].ResultItems[j].Attributes))
 
+			vecResults := response.Results[i].ResultItems[j].VectorResults
+			vectorResults := make([]flatbuffers.UOffsetT, len(vecResults))
+			for k := 0; k < len(vecResults); k++ {
+				source := builder.CreateByteVector(vecResults[k].Source)
+				field := builder.CreateString(vecResults[k].Field)
+				gamma_api.VectorFieldResultStart(builder)
+				gamma_api.VectorFieldResultAddField(builder, field)
+				gamma_api.VectorFieldResultAddSource(builder, source)
+				gamma_api.VectorFieldResultAddScore(builder, vecResults[k].Score)
+				vectorResults[k] = gamma_api.VectorFieldResultEnd(builder)
+			}
+			gamma_api.ResultItemStartVectorResultsVector(builder, len(vecResults))
+			for k := len(vecResults) - 1; k >= 0; k-- {
+				builder.PrependUOffsetT(vectorResults[k])
+			}
+			vecs := builder.EndVector(len(vecResults))
+
 			extra := builder.CreateString(response.Results[i].ResultItems[j].Extra)
 
 			gamma_api.ResultItemStart(builder)
 			gamma_api.ResultItemAddScore(builder, response.Results[i].ResultItems[j].Score)
 			gamma_api.ResultItemAddAttributes(builder, attrs)
 			gamma_api.ResultItemAddExtra(builder, extra)
+			gamma_api.ResultItemAddVectorResults(builder, vecs)
 			resultItems[j] = gamma_api.ResultItemEnd(builder)
 		}
 
@@ -150,6 +175,16 @@ func (response *Response) DeSerialize(buffer []byte) {
 				response.Results[i].ResultItems[j].Attributes[k].Name = string(attrs.Name())
 				response.Results[i].ResultItems[j].Attributes[k].Value = attrs.ValueBytes()
 			}
+
+			response.Results[i].ResultItems[j].VectorResults = make([]VectorFieldResult, item.VectorResultsLength())
+			for k := 0; k < item.VectorResultsLength(); k++ {
+				var vecResult gamma_api.VectorFieldResult
+				item.VectorResults(&vecResult, k)
+
+				response.Results[i].ResultItems[j].VectorResults[k].Field = string(vecResult.Field())
+				response.Results[i].ResultItems[j].VectorResults[k].Source = vecResult.SourceBytes()
+				response.Results[i].ResultItems[j].VectorResults[k].Score = vecResult.Score()
+			}
 		}
 	}
 }
\ No newline at end of file
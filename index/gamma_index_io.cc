@@ -118,22 +118,26 @@ int WriteInvertedLists(faiss::IOWriter *f,
   WRITE1(list_type);
 
   std::vector<size_t> sizes;
+  std::vector<realtime::RTBucketChunks *> buckets;
   sizes.resize(rt_data->buckets_num_);
+  buckets.resize(rt_data->buckets_num_);
   for (size_t i = 0; i < rt_data->buckets_num_; ++i) {
-    size_t size = rt_data->cur_invert_ptr_->retrieve_idx_pos_[i];
-    sizes[i] = size;
+    rt_data->GetIvtList(i, buckets[i], sizes[i]);
   }
-  // memcpy((void *)sizes.data(), rt_data->cur_invert_ptr_->retrieve_idx_pos_,
-  //        sizeof(size_t) * rt_data->buckets_num_);
   WRITEVECTOR(sizes);
 
+  // the same layout as contiguous lists: all codes then all ids of a bucket
   for (size_t i = 0; i < rt_data->buckets_num_; i++) {
-    if (sizes[i] > 0) {
-      {
-        WRITEANDCHECK(rt_data->cur_invert_ptr_->codes_array_[i],
-                      sizes[i] * rt_data->code_bytes_per_vec_);
-      }
-      WRITEANDCHECK(rt_data->cur_invert_ptr_->idx_array_[i], sizes[i]);
+    realtime::RTBucketChunks *chunks = buckets[i];
+    for (int c = 0; c < chunks->chunk_num_; c++) {
+      size_t n = chunks->ChunkSize(c, sizes[i]);
+      if (n == 0) break;
+      WRITEANDCHECK(chunks->codes_chunks_[c], n * rt_data->code_bytes_per_vec_);
+    }
+    for (int c = 0; c < chunks->chunk_num_; c++) {
+      size_t n = chunks->ChunkSize(c, sizes[i]);
+      if (n == 0) break;
+      WRITEANDCHECK(chunks->idx_chunks_[c], n);
     }
   }
   size_t ntotal = std::accumulate(sizes.data(), sizes.data() + sizes.size(), 0);
@@ -164,6 +168,7 @@ int ReadInvertedLists(faiss::IOReader *f,
   READVECTOR(sizes);
   assert(sizes.size() == rt_data->buckets_num_);
 
+  std::lock_guard<std::mutex> lock(rt_data->write_mutex_);
   for (long bno = 0; (size_t)bno < rt_data->buckets_num_; ++bno) {
     if (sizes[bno] == 0) continue;
 
@@ -171,26 +176,37 @@ int ReadInvertedLists(faiss::IOReader *f,
       LOG(ERROR) << "loading, extend bucket error";
       return INTERNAL_ERR;
     }
-    uint8_t *codes = rt_data->cur_invert_ptr_->codes_array_[bno];
-    long *ids = rt_data->cur_invert_ptr_->idx_array_[bno];
-    READANDCHECK(codes, sizes[bno] * rt_data->code_bytes_per_vec_);
-    READANDCHECK(ids, sizes[bno]);
+    realtime::RTBucketChunks *chunks = rt_data->cur_invert_ptr_->buckets_[bno];
+    for (int c = 0; c < chunks->chunk_num_; c++) {
+      size_t n = chunks->ChunkSize(c, sizes[bno]);
+      if (n == 0) break;
+      uint8_t *codes = chunks->codes_chunks_[c];
+      READANDCHECK(codes, n * rt_data->code_bytes_per_vec_);
+    }
+    for (int c = 0; c < chunks->chunk_num_; c++) {
+      size_t n = chunks->ChunkSize(c, sizes[bno]);
+      if (n == 0) break;
+      long *ids = chunks->idx_chunks_[c];
+      READANDCHECK(ids, n);
+    }
 
     for (int pos = 0; pos < (int)sizes[bno]; pos++) {
-      if (ids[pos] & realtime::kDelIdxMask) {
+      long id = *chunks->Ids(pos);
+      if (id & realtime::kDelIdxMask) {
         rt_data->cur_invert_ptr_->deleted_nums_[bno]++;
+        rt_data->cur_invert_ptr_->free_slots_[bno].push_back(pos);
         continue;
       }
-      if ((size_t)ids[pos] >= rt_data->cur_invert_ptr_->nids_) {
+      if ((size_t)id >= rt_data->cur_invert_ptr_->nids_) {
         rt_data->cur_invert_ptr_->ExtendIDs();
-        while ((size_t)ids[pos] >= rt_data->cur_invert_ptr_->nids_) {
+        while ((size_t)id >= rt_data->cur_invert_ptr_->nids_) {
           rt_data->cur_invert_ptr_->ExtendIDs();
         }
       }
-      rt_data->cur_invert_ptr_->vid_bucket_no_pos_[ids[pos]] = bno << 32 | pos;
+      rt_data->cur_invert_ptr_->vid_bucket_no_pos_[id] = bno << 32 | pos;
     }
 
-    rt_data->cur_invert_ptr_->retrieve_idx_pos_[bno] = sizes[bno];
+    chunks->size_ = sizes[bno];
   }
   return 0;
 }
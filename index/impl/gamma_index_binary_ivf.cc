@@ -100,8 +100,8 @@ int GammaIndexBinaryIVF::Init(const std::string &model_parameters, int indexing_
 
   int bucket_keys = std::max(1000, this->indexing_size_ / binary_param.ncentroids);
   rt_invert_index_ptr_ = new realtime::RTInvertIndex(
-      this->nlist, this->code_size, raw_vec->VidMgr(), raw_vec->Bitmap(), bucket_keys,
-      1280000);
+      this->nlist, this->code_size, raw_vec->VidMgr(), raw_vec->Bitmap(),
+      bucket_keys);
   // default is true in faiss
   is_trained = false;
 
@@ -267,6 +267,11 @@ long GammaIndexBinaryIVF::GetTotalMemBytes() {
   return rt_invert_index_ptr_->GetTotalMemBytes();
 }
 
+void GammaIndexBinaryIVF::GetTombstoneRatios(std::vector<float> &ratios) {
+  ratios.clear();
+  if (rt_invert_index_ptr_) rt_invert_index_ptr_->GetTombstoneRatios(ratios);
+}
+
 int GammaIndexBinaryIVF::Delete(const std::vector<int64_t> &ids) {
   std::vector<int> vids(ids.begin(), ids.end());
   int ret = rt_invert_index_ptr_->Delete(vids.data(), ids.size());
@@ -336,8 +341,12 @@ void GammaIndexBinaryIVF::search_knn_hamming_heap(
 
   using HeapForIP = faiss::CMin<int32_t, idx_t>;
   using HeapForL2 = faiss::CMax<int32_t, idx_t>;
+  const realtime::RTInvertedLists *rt_invlists =
+      dynamic_cast<const realtime::RTInvertedLists *>(invlists);
+
+  int threads = retrieval_context->SearchThreads();
 
-#pragma omp parallel if (n > 1)
+#pragma omp parallel if (n > 1) num_threads(threads)
   {
     std::unique_ptr<GammaBinaryInvertedListScanner> scanner(
         get_GammaInvertedListScanner(store_pairs));
@@ -372,18 +381,28 @@ void GammaIndexBinaryIVF::search_knn_hamming_heap(
 
         scanner->set_list(key, coarse_dis[i * nprobe + ik]);
 
-        size_t list_size = invlists->list_size(key);
-        faiss::InvertedLists::ScopedCodes scodes(invlists, key);
-        std::unique_ptr<faiss::InvertedLists::ScopedIds> sids;
-        const faiss::Index::idx_t *ids = nullptr;
-
-        if (!store_pairs) {
-          sids.reset(new faiss::InvertedLists::ScopedIds(invlists, key));
-          ids = sids->get();
+        size_t list_size = 0;
+        if (rt_invlists) {
+          list_size = rt_invlists->scan_chunks(
+              key, store_pairs,
+              [&](const idx_t *ids, const uint8_t *codes, size_t n) {
+                scanner->scan_codes(n, codes, store_pairs ? nullptr : ids,
+                                    simi, idxi, k);
+              });
+        } else {
+          list_size = invlists->list_size(key);
+          faiss::InvertedLists::ScopedCodes scodes(invlists, key);
+          std::unique_ptr<faiss::InvertedLists::ScopedIds> sids;
+          const faiss::Index::idx_t *ids = nullptr;
+
+          if (!store_pairs) {
+            sids.reset(new faiss::InvertedLists::ScopedIds(invlists, key));
+            ids = sids->get();
+          }
+
+          scanner->scan_codes(list_size, scodes.get(), ids, simi, idxi, k);
         }
 
-        scanner->scan_codes(list_size, scodes.get(), ids, simi, idxi, k);
-
         nscan += list_size;
         if (max_codes && nscan >= (size_t)max_codes) break;
       }
@@ -424,7 +443,7 @@ struct GammaIVFBinaryScannerL2 : GammaBinaryInvertedListScanner {
 
     size_t nup = 0;
     for (size_t j = 0; j < n; j++, codes += code_size) {
-      idx_t id = store_pairs ? (list_no << 32 | j) : ids[j];
+      idx_t id = store_pairs ? (list_no << 32 | j) : realtime::LoadId(ids + j);
       if (retrieval_context_->IsValid(id) == false) {
         continue;
       }
@@ -96,6 +96,8 @@ class GammaIndexBinaryIVF : public RetrievalModel, faiss::IndexBinaryIVF {
 
   long GetTotalMemBytes();
 
+  void GetTombstoneRatios(std::vector<float> &ratios);
+
   int Dump(const std::string &dir) { return 0; }
   int Load(const std::string &index_dir) { return 0; }
 
@@ -157,7 +157,7 @@ int GammaFLATIndex::Search(RetrievalContext *retrieval_context, int n,
 
   {
     // we must obtain the num of threads in *THE* parallel area.
-    int num_threads = omp_get_max_threads();
+    int num_threads = retrieval_context->SearchThreads();
 
     /*****************************************************
      * Depending on parallel_mode, there are two possible ways
@@ -235,7 +235,7 @@ int GammaFLATIndex::Search(RetrievalContext *retrieval_context, int n,
         (retrieval_params->ParallelOnQueries() == true) && (n > 1);
 
     if (parallel_on_queries) {  // parallelize over queries
-#pragma omp for
+#pragma omp parallel for num_threads(num_threads)
       for (int i = 0; i < n; i++) {
         const float *xi = xq + i * d;
 
@@ -260,7 +260,7 @@ int GammaFLATIndex::Search(RetrievalContext *retrieval_context, int n,
         idx_t *idxi = (idx_t *)labels + i * k;
         init_result(k, simi, idxi);
 
-#pragma omp parallel for schedule(dynamic)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
         for (int ik = 0; ik < num_threads; ik++) {
           std::vector<idx_t> local_idx(k);
           std::vector<float> local_dis(k);
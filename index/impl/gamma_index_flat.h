@@ -88,6 +88,8 @@ class GammaFLATIndex : public RetrievalModel {
 
   long GetTotalMemBytes() override;
 
+  bool CoversUnindexed() override { return true; }
+
   int Dump(const std::string &dir) override;
 
   int Load(const std::string &index_dir) override;
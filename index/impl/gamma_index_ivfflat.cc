@@ -30,6 +30,7 @@
 #include "gamma_common_data.h"
 #include "gamma_index_ivfflat.h"
 #include "rocksdb_raw_vector.h"
+#include "search_stats.h"
 
 namespace tig_gamma {
 
@@ -133,7 +134,7 @@ int GammaIndexIVFFlat::Init(const std::string &model_parameters, int indexing_si
 
   rt_invert_index_ptr_ = new realtime::RTInvertIndex(
       this->nlist, this->code_size, raw_vec->VidMgr(), raw_vec->Bitmap(),
-      100000, 12800000);
+      100000);
 
   if (this->invlists) {
     delete this->invlists;
@@ -329,21 +330,32 @@ bool GammaIndexIVFFlat::Add(int n, const uint8_t *vec) {
 
 int GammaIndexIVFFlat::Update(const std::vector<int64_t> &ids,
                               const std::vector<const uint8_t *> &vecs) {
-  for (size_t i = 0; i < ids.size(); i++) {
-    const float *vec = reinterpret_cast<const float *>(vecs[i]);
-    idx_t idx = -1;
-    quantizer->assign(1, vec, &idx);
-    std::vector<uint8_t> code;
-    code.resize(this->code_size);
-    memcpy(code.data(), (void *)vec, this->code_size);
-    rt_invert_index_ptr_->Update(idx, ids[i], code);
+  int n = ids.size();
+  if (n == 0) return 0;
+  float *vec = new float[(size_t)n * d];
+  utils::ScopeDeleter<float> del_vec(vec);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    memcpy(vec + (size_t)i * d, vecs[i], sizeof(float) * d);
   }
+  idx_t *idx = new idx_t[n];
+  utils::ScopeDeleter<idx_t> del_idx(idx);
+  quantizer->assign(n, vec, idx);
+
+  std::map<int, std::vector<long>> new_keys;
+  std::map<int, std::vector<uint8_t>> new_codes;
+  for (int i = 0; i < n; i++) {
+    if (idx[i] < 0) continue;
+    new_keys[idx[i]].push_back(ids[i]);
+    const uint8_t *code = reinterpret_cast<const uint8_t *>(vec + (size_t)i * d);
+    new_codes[idx[i]].insert(new_codes[idx[i]].end(), code, code + code_size);
+  }
+  int ret = rt_invert_index_ptr_->Update(new_keys, new_codes);
   updated_num_ += ids.size();
   LOG(INFO) << "update index success! size=" << ids.size()
             << ", total=" << updated_num_;
-  // now check id need to do compaction
-  rt_invert_index_ptr_->CompactIfNeed();
-  return 0;
+  // tombstones are compacted by the background compaction thread
+  return ret;
 }
 
 int GammaIndexIVFFlat::Delete(const std::vector<int64_t> &ids) {
@@ -381,7 +393,13 @@ int GammaIndexIVFFlat::Search(RetrievalContext *retrieval_context, int n,
   std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
   std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
 
+  double quantize_ms = faiss::getmillisecs();
   quantizer->search(n, x, nprobe, coarse_dis.get(), idx.get());
+  retrieval_context->RecordStage(
+      search_stats::Stage::Quantize,
+      (long)((faiss::getmillisecs() - quantize_ms) * 1000));
+  retrieval_context->AddCounter(search_stats::Counter::ListsProbed,
+                                (long)n * nprobe);
 
   SearchPreassgined(retrieval_context, n, x, k, idx.get(), coarse_dis.get(),
                     distances, labels, nprobe, false);
@@ -421,8 +439,12 @@ void GammaIndexIVFFlat::search_preassigned(RetrievalContext *retrieval_context,
 
   int pmode = retrieval_params->ParallelOnQueries() ? 0 : 1;
   bool do_parallel = pmode == 0 ? n > 1 : nprobe > 1;
+  int threads = retrieval_context->SearchThreads();
+  const realtime::RTInvertedLists *rt_invlists =
+      dynamic_cast<const realtime::RTInvertedLists *>(invlists);
 
-#pragma omp parallel if (do_parallel) reduction(+ : nlistv, ndis, nheap)
+#pragma omp parallel if (do_parallel) num_threads(threads) \
+    reduction(+ : nlistv, ndis, nheap)
   {
     GammaInvertedListScanner *scanner =
         GetGammaInvertedListScanner(store_pairs, metric_type);
@@ -476,6 +498,16 @@ void GammaIndexIVFFlat::search_preassigned(RetrievalContext *retrieval_context,
 
       nlistv++;
 
+      if (rt_invlists) {
+        return rt_invlists->scan_chunks(
+            key, store_pairs,
+            [&](const idx_t *ids, const uint8_t *codes, size_t n) {
+              nheap += scanner->scan_codes(n, codes,
+                                           store_pairs ? nullptr : ids, simi,
+                                           idxi, k);
+            });
+      }
+
       InvertedLists::ScopedCodes scodes(invlists, key);
 
       std::unique_ptr<InvertedLists::ScopedIds> sids;
@@ -571,6 +603,7 @@ void GammaIndexIVFFlat::search_preassigned(RetrievalContext *retrieval_context,
       FAISS_THROW_FMT("parallel_mode %d not supported\n", pmode);
     }
   }  // parallel section
+  retrieval_context->AddCounter(search_stats::Counter::CodesScanned, ndis);
 
   if (interrupt) {
     FAISS_THROW_MSG("computation interrupted");
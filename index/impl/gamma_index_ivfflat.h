@@ -54,10 +54,10 @@ struct GammaIVFFlatScanner1 : GammaInvertedListScanner {
     const float *list_vecs = (const float *)codes;
     size_t nup = 0;
     for (size_t j = 0; j < list_size; j++) {
-      if (ids[j] & realtime::kDelIdxMask) {
+      idx_t vid = realtime::LoadId(ids + j);
+      if (vid & realtime::kDelIdxMask) {
         continue;
       }
-      idx_t vid = ids[j] & realtime::kRecoverIdxMask;
       if (!retrieval_context_->IsValid(vid)) {
         continue;
       }
@@ -142,6 +142,11 @@ struct GammaIndexIVFFlat : faiss::IndexIVFFlat, public RetrievalModel {
 
   long GetTotalMemBytes() override { return 0; };
 
+  void GetTombstoneRatios(std::vector<float> &ratios) override {
+    ratios.clear();
+    if (rt_invert_index_ptr_) rt_invert_index_ptr_->GetTombstoneRatios(ratios);
+  }
+
   int Dump(const std::string &dir) override;
   int Load(const std::string &dir) override;
 
@@ -21,18 +21,25 @@
 
 #include <algorithm>
 #include <stdexcept>
+#include <unordered_set>
 #include <vector>
 
 #include "bitmap.h"
 #include "error_code.h"
 #include "faiss/IndexFlat.h"
 #include "gamma_index_io.h"
+#include "large_alloc.h"
 #include "mmap_raw_vector.h"
 #include "omp.h"
+#include "search_stats.h"
 #include "utils.h"
 
 namespace tig_gamma {
 
+// scratch slots of the recall buffers, see large_alloc::Scratch
+static const int kRecallDistancesSlot = 0;
+static const int kRecallLabelsSlot = 1;
+
 static inline void ConvertVectorDim(size_t num, int raw_d, int d,
                                     const float *raw_vec, float *vec) {
   memset(vec, 0, num * d * sizeof(float));
@@ -58,8 +65,9 @@ struct IVFPQModelParams {
   int efSearch;        // search parameter for search in hnsw graph
   bool has_opq;
   int opq_nsubvector;  // number of sub cluster center of opq
-  int bucket_init_size; // original size of RTInvertIndex bucket
-  int bucket_max_size; // max size of RTInvertIndex bucket
+  int bucket_init_size; // keys of each RTInvertIndex bucket chunk
+  // share of a core the realtime compaction thread may use
+  double compact_cpu_ratio;
 
   IVFPQModelParams() {
     ncentroids = 2048;
@@ -73,7 +81,7 @@ struct IVFPQModelParams {
     has_opq = false;
     opq_nsubvector = 64;
     bucket_init_size = 1000;
-    bucket_max_size = 1280000;
+    compact_cpu_ratio = realtime::kCompactCpuRatio;
   }
 
   int Parse(const char *str) {
@@ -119,7 +127,6 @@ struct IVFPQModelParams {
     }
 
     int bucket_init_size;
-    int bucket_max_size;
 
     // -1 as default
     if (!jp.GetInt("bucket_init_size", bucket_init_size)) {
@@ -130,12 +137,13 @@ struct IVFPQModelParams {
       if (bucket_init_size > 0) this->bucket_init_size = bucket_init_size;
     }
 
-    if (!jp.GetInt("bucket_max_size", bucket_max_size)) {
-      if (bucket_max_size < -1) {
-        LOG(ERROR) << "invalid bucket_max_size =" << bucket_max_size;
+    double compact_cpu_ratio;
+    if (!jp.GetDouble("compact_cpu_ratio", compact_cpu_ratio)) {
+      if (compact_cpu_ratio <= 0 || compact_cpu_ratio > 1) {
+        LOG(ERROR) << "invalid compact_cpu_ratio =" << compact_cpu_ratio;
         return -1;
       }
-      if (bucket_max_size > 0) this->bucket_max_size = bucket_max_size;
+      this->compact_cpu_ratio = compact_cpu_ratio;
     }
 
     std::string metric_type;
@@ -219,7 +227,7 @@ struct IVFPQModelParams {
     ss << "nbits_per_idx =" << nbits_per_idx << ", ";
     ss << "metric_type =" << (int)metric_type << ", ";
     ss << "bucket_init_size =" << bucket_init_size << ", ";
-    ss << "bucket_max_size =" << bucket_max_size;
+    ss << "compact_cpu_ratio =" << compact_cpu_ratio;
 
     if (has_hnsw) {
       ss << ", hnsw: nlinks=" << nlinks << ", ";
@@ -239,6 +247,7 @@ struct IVFPQModelParams {
 REGISTER_MODEL(IVFPQ, GammaIVFPQIndex)
 
 GammaIVFPQIndex::GammaIVFPQIndex() : indexed_vec_count_(0) {
+  rt_invert_index_ptr_ = nullptr;
   compaction_ = false;
   compact_bucket_no_ = 0;
   compacted_num_ = 0;
@@ -376,13 +385,16 @@ int GammaIVFPQIndex::Init(const std::string &model_parameters, int indexing_size
   // the size of RTInvertIndex bucket should be smaller
   rt_invert_index_ptr_ = new realtime::RTInvertIndex(
     this->nlist, this->code_size, raw_vec->VidMgr(), raw_vec->Bitmap(), 
-    ivfpq_param.bucket_init_size, ivfpq_param.bucket_max_size);
+    ivfpq_param.bucket_init_size);
 
   if (this->invlists) {
     delete this->invlists;
     this->invlists = nullptr;
   }
   d_ = d;
+  rt_invert_index_ptr_->SetCompactBudget(realtime::kCompactIntervalMs,
+                                         realtime::kCompactBytesBudget,
+                                         ivfpq_param.compact_cpu_ratio);
   bool ret = rt_invert_index_ptr_->Init();
 
   if (ret) {
@@ -569,102 +581,88 @@ int GammaIVFPQIndex::Delete(const std::vector<int64_t> &ids) {
 
 int GammaIVFPQIndex::Update(const std::vector<int64_t> &ids,
                             const std::vector<const uint8_t *> &vecs) {
+  int n = ids.size();
+  if (n == 0) return 0;
   int raw_d = vector_->MetaInfo()->Dimension();
-  for (size_t i = 0; i < ids.size(); i++) {
-    const float *vec = nullptr;
-    utils::ScopeDeleter1<float> del_vec;
-    const float *add_vec = reinterpret_cast<const float *>(vecs[i]);
-    if (d_ > raw_d) {
-      float *extend_vec = new float[d_];
-      ConvertVectorDim(1, raw_d, d_, add_vec, extend_vec);
-      vec = (const float *)extend_vec;
-      del_vec.set(vec);
-    } else {
-      vec = add_vec;
-    }
-    const float *applied_vec = nullptr;
-    utils::ScopeDeleter1<float> del_applied;
-    if (opq_ != nullptr) {
-      applied_vec = opq_->apply(1, vec);
-      del_applied.set(applied_vec == vec ? nullptr : applied_vec);
-    } else {
-      applied_vec = vec;
-    }
-    idx_t idx = -1;
-    quantizer->assign(1, applied_vec, &idx);
+  float *vec = new float[(size_t)n * raw_d];
+  utils::ScopeDeleter<float> del_vec(vec);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+    memcpy(vec + (size_t)i * raw_d, vecs[i], sizeof(float) * raw_d);
+  }
 
-    std::vector<uint8_t> xcodes;
-    xcodes.resize(code_size);
-    const float *to_encode = nullptr;
-    utils::ScopeDeleter1<float> del_to_encode;
+  // the whole batch is re-encoded at once, faiss parallelizes it
+  idx_t *idx = new idx_t[n];
+  utils::ScopeDeleter<idx_t> del_idx(idx);
+  uint8_t *xcodes = new uint8_t[(size_t)n * code_size];
+  utils::ScopeDeleter<uint8_t> del_xcodes(xcodes);
+  EncodeVectors(n, vec, idx, xcodes);
 
-    if (by_residual) {
-      to_encode = compute_residuals(quantizer, 1, applied_vec, &idx);
-      del_to_encode.set(to_encode);
-    } else {
-      to_encode = applied_vec;
-    }
-    pq.compute_codes(to_encode, xcodes.data(), 1);
-    rt_invert_index_ptr_->Update(idx, ids[i], xcodes);
+  std::map<int, std::vector<long>> new_keys;
+  std::map<int, std::vector<uint8_t>> new_codes;
+  for (int i = 0; i < n; i++) {
+    if (idx[i] < 0) continue;
+    new_keys[idx[i]].push_back(ids[i]);
+    uint8_t *code = xcodes + (size_t)i * code_size;
+    new_codes[idx[i]].insert(new_codes[idx[i]].end(), code, code + code_size);
   }
+  int ret = rt_invert_index_ptr_->Update(new_keys, new_codes);
   updated_num_ += ids.size();
   LOG(INFO) << "update index success! size=" << ids.size()
             << ", total=" << updated_num_;
-
-  // now check id need to do compaction
-  rt_invert_index_ptr_->CompactIfNeed();
-  return 0;
+  // tombstones are compacted by the background compaction thread
+  return ret;
 }
 
-bool GammaIVFPQIndex::Add(int n, const uint8_t *vec) {
-#ifdef PERFORMANCE_TESTING
-  double t0 = faiss::getmillisecs();
-#endif
-  std::map<int, std::vector<long>> new_keys;
-  std::map<int, std::vector<uint8_t>> new_codes;
-
-  idx_t *idx;
-  utils::ScopeDeleter<idx_t> del_idx;
-  const float *add_vec = reinterpret_cast<const float *>(vec);
-  const float *add_vec_head = nullptr;
+void GammaIVFPQIndex::EncodeVectors(int n, const float *vec, idx_t *list_nos,
+                                    uint8_t *codes) {
+  const float *vec_head = nullptr;
   utils::ScopeDeleter<float> del_vec;
   int raw_d = vector_->MetaInfo()->Dimension();
   if (d_ > raw_d) {
     float *vector = new float[n * d_];
-    ConvertVectorDim(n, raw_d, d, add_vec, vector);
-    add_vec_head = vector;
-    del_vec.set(add_vec_head);
+    ConvertVectorDim(n, raw_d, d, vec, vector);
+    vec_head = vector;
+    del_vec.set(vec_head);
   } else {
-    add_vec_head = add_vec;
+    vec_head = vec;
   }
 
   const float *applied_vec = nullptr;
-  utils::ScopeDeleter1<float> del_applied;
+  utils::ScopeDeleter<float> del_applied;
   if (opq_ != nullptr) {
-    applied_vec = opq_->apply(n, add_vec_head);
-    del_applied.set(applied_vec == add_vec_head ? nullptr : applied_vec);
+    applied_vec = opq_->apply(n, vec_head);
+    del_applied.set(applied_vec == vec_head ? nullptr : applied_vec);
   } else {
-    applied_vec = add_vec_head;
+    applied_vec = vec_head;
   }
 
-  idx_t *idx0 = new idx_t[n];
-  quantizer->assign(n, applied_vec, idx0);
-  idx = idx0;
-  del_idx.set(idx);
-
-  uint8_t *xcodes = new uint8_t[n * code_size];
-  utils::ScopeDeleter<uint8_t> del_xcodes(xcodes);
+  quantizer->assign(n, applied_vec, list_nos);
 
   const float *to_encode = nullptr;
   utils::ScopeDeleter<float> del_to_encode;
-  
+
   if (by_residual) {
-    to_encode = compute_residuals(quantizer, n, applied_vec, idx);
+    to_encode = compute_residuals(quantizer, n, applied_vec, list_nos);
     del_to_encode.set(to_encode);
   } else {
     to_encode = applied_vec;
   }
-  pq.compute_codes(to_encode, xcodes, n);
+  pq.compute_codes(to_encode, codes, n);
+}
+
+bool GammaIVFPQIndex::Add(int n, const uint8_t *vec) {
+#ifdef PERFORMANCE_TESTING
+  double t0 = faiss::getmillisecs();
+#endif
+  std::map<int, std::vector<long>> new_keys;
+  std::map<int, std::vector<uint8_t>> new_codes;
+
+  idx_t *idx = new idx_t[n];
+  utils::ScopeDeleter<idx_t> del_idx(idx);
+  uint8_t *xcodes = new uint8_t[n * code_size];
+  utils::ScopeDeleter<uint8_t> del_xcodes(xcodes);
+  EncodeVectors(n, reinterpret_cast<const float *>(vec), idx, xcodes);
 
   size_t n_ignore = 0;
   long vid = indexed_vec_count_;
@@ -754,11 +752,17 @@ int GammaIVFPQIndex::Search(RetrievalContext *retrieval_context, int n,
   std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
   std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
 
+  double quantize_ms = utils::getmillisecs();
   if (retrieval_params->IvfFlat() == true) {
     quantizer->search(n, xq, nprobe, coarse_dis.get(), idx.get());
   } else {
     quantizer->search(n, applied_xq, nprobe, coarse_dis.get(), idx.get());
   }
+  retrieval_context->RecordStage(
+      search_stats::Stage::Quantize,
+      (long)((utils::getmillisecs() - quantize_ms) * 1000));
+  retrieval_context->AddCounter(search_stats::Counter::ListsProbed,
+                                (long)n * nprobe);
   this->invlists->prefetch_lists(idx.get(), n * nprobe);
 
   if (retrieval_params->IvfFlat() == true) {
@@ -822,6 +826,21 @@ size_t scan_one_list(GammaInvertedListScanner *scanner, idx_t key,
     return 0;
   }
 
+  scanner->set_list(key, coarse_dis_i);
+
+  const realtime::RTInvertedLists *rt_invlists =
+      dynamic_cast<const realtime::RTInvertedLists *>(invlists);
+  if (rt_invlists) {
+    // scan_codes need uint8_t *
+    const uint8_t *flat_codes = reinterpret_cast<uint8_t *>(mem_raw_vec);
+    return rt_invlists->scan_chunks(
+        key, store_pairs,
+        [&](const idx_t *ids, const uint8_t *codes, size_t n) {
+          scanner->scan_codes(n, ivf_flat ? flat_codes : codes,
+                              store_pairs ? nullptr : ids, simi, idxi, k);
+        });
+  }
+
   std::unique_ptr<faiss::InvertedLists::ScopedIds> sids;
   const idx_t *ids = nullptr;
 
@@ -830,27 +849,54 @@ size_t scan_one_list(GammaInvertedListScanner *scanner, idx_t key,
     ids = sids->get();
   }
 
-  scanner->set_list(key, coarse_dis_i);
-
   // scan_codes need uint8_t *
   const uint8_t *codes = nullptr;
+  std::unique_ptr<faiss::InvertedLists::ScopedCodes> scodes;
 
   if (ivf_flat) {
     codes = reinterpret_cast<uint8_t *>(mem_raw_vec);
   } else {
-    faiss::InvertedLists::ScopedCodes scodes(invlists, key);
-    codes = scodes.get();
+    scodes.reset(new faiss::InvertedLists::ScopedCodes(invlists, key));
+    codes = scodes->get();
   }
   scanner->scan_codes(list_size, codes, ids, simi, idxi, k);
 
   return list_size;
 };
 
+/** hints the store with the recall candidates which are not hinted yet
+ * after each probed list, so the blocks of the re-rank reads are loaded while
+ * the other lists are scanned. It stops if the store doesn't take hints.
+ */
+struct RecallPrefetcher {
+  const VectorReader *vec;
+  bool enabled;
+  std::unordered_set<idx_t> hinted;
+  std::vector<int64_t> vids;
+
+  RecallPrefetcher(const VectorReader *vec, bool enabled)
+      : vec(vec), enabled(enabled) {}
+
+  void Reset() { hinted.clear(); }
+
+  void Hint(const idx_t *idxi, int n) {
+    if (not enabled) return;
+    vids.clear();
+    for (int j = 0; j < n; j++) {
+      if (idxi[j] >= 0 && hinted.insert(idxi[j]).second) {
+        vids.push_back(idxi[j]);
+      }
+    }
+    if (vids.size() > 0 && vec->PrefetchHint(vids) < 0) enabled = false;
+  }
+};
+
 void compute_dis(int k, const float *xi, float *simi, idx_t *idxi,
                  float *recall_simi, idx_t *recall_idxi, int recall_num,
                  bool has_rank, faiss::MetricType metric_type,
                  VectorReader *vec, RetrievalContext *retrieval_context) {
   if (has_rank == true) {
+    double rerank_ms = utils::getmillisecs();
     ScopeVectors scope_vecs;
     std::vector<idx_t> vids(recall_idxi, recall_idxi + recall_num);
     vec->Gets(vids, scope_vecs);
@@ -882,6 +928,9 @@ void compute_dis(int k, const float *xi, float *simi, idx_t *idxi,
       }
     }
     reorder_result(metric_type, k, simi, idxi);
+    retrieval_context->RecordStage(
+        search_stats::Stage::Rerank,
+        (long)((utils::getmillisecs() - rerank_ms) * 1000));
   } else {
     // compute without rank
     int i = 0;
@@ -946,7 +995,8 @@ void GammaIVFPQIndex::search_ivf_flat(
   bool do_parallel = parallel_mode == 0 ? n > 1 : nprobe > 1;
 
   size_t ndis = 0;
-#pragma omp parallel if (do_parallel) reduction(+ : ndis)
+  int threads = retrieval_context->SearchThreads();
+#pragma omp parallel if (do_parallel) num_threads(threads) reduction(+ : ndis)
   {
     GammaInvertedListScanner *scanner =
         GetGammaIVFFlatScanner(raw_d, metric_type);
@@ -1027,6 +1077,7 @@ void GammaIVFPQIndex::search_ivf_flat(
       }
     }
   }  // parallel section
+  retrieval_context->AddCounter(search_stats::Counter::CodesScanned, ndis);
 #ifdef PERFORMANCE_TESTING
   std::string compute_msg = "ivf flat compute ";
   compute_msg += std::to_string(n);
@@ -1100,10 +1151,11 @@ void GammaIVFPQIndex::search_preassigned(
     recall_num = k;
   }
 
-  float *recall_distances = new float[n * recall_num];
-  idx_t *recall_labels = new idx_t[n * recall_num];
-  utils::ScopeDeleter<float> del1(recall_distances);
-  utils::ScopeDeleter<idx_t> del2(recall_labels);
+  // reused by the requests of the thread instead of fragmenting the heap
+  float *recall_distances = (float *)large_alloc::Scratch(
+      kRecallDistancesSlot, sizeof(float) * n * recall_num);
+  idx_t *recall_labels = (idx_t *)large_alloc::Scratch(
+      kRecallLabelsSlot, sizeof(idx_t) * n * recall_num);
 
 #ifdef PERFORMANCE_TESTING
   retrieval_context->GetPerfTool().Perf("search prepare");
@@ -1113,13 +1165,15 @@ void GammaIVFPQIndex::search_preassigned(
 
   // don't start parallel section if single query
   bool do_parallel = parallel_mode == 0 ? n > 1 : nprobe > 1;
+  int threads = retrieval_context->SearchThreads();
 
-#pragma omp parallel if (do_parallel) reduction(+ : ndis)
+#pragma omp parallel if (do_parallel) num_threads(threads) reduction(+ : ndis)
   {
     GammaInvertedListScanner *scanner =
         GetGammaInvertedListScanner(store_pairs, metric_type);
     utils::ScopeDeleter1<GammaInvertedListScanner> del(scanner);
     scanner->set_search_context(retrieval_context);
+    RecallPrefetcher prefetcher(vector_, context->has_rank && !store_pairs);
 
     if (parallel_mode == 0) {  // parallelize over queries
 #pragma omp for
@@ -1137,6 +1191,7 @@ void GammaIVFPQIndex::search_preassigned(
         init_result(metric_type, recall_num, recall_simi, recall_idxi);
 
         long nscan = 0;
+        prefetcher.Reset();
 
         // loop over probes
         for (int ik = 0; ik < nprobe; ik++) {
@@ -1144,6 +1199,7 @@ void GammaIVFPQIndex::search_preassigned(
               scanner, keys[i * nprobe + ik], coarse_dis[i * nprobe + ik],
               recall_simi, recall_idxi, recall_num, this->nlist, this->invlists,
               store_pairs, retrieval_params->IvfFlat());
+          prefetcher.Hint(recall_idxi, recall_num);
 
           if (max_codes && nscan >= max_codes) break;
         }
@@ -1162,6 +1218,7 @@ void GammaIVFPQIndex::search_preassigned(
 
         init_result(metric_type, recall_num, local_dis.data(),
                     local_idx.data());
+        prefetcher.Reset();
 
 #pragma omp for schedule(dynamic)
         for (int ik = 0; ik < nprobe; ik++) {
@@ -1169,6 +1226,7 @@ void GammaIVFPQIndex::search_preassigned(
               scanner, keys[i * nprobe + ik], coarse_dis[i * nprobe + ik],
               local_dis.data(), local_idx.data(), recall_num, this->nlist,
               this->invlists, store_pairs, retrieval_params->IvfFlat());
+          prefetcher.Hint(local_idx.data(), recall_num);
 
           // can't do the test on max_codes
         }
@@ -1217,6 +1275,11 @@ void GammaIVFPQIndex::search_preassigned(
       }
     }
   }  // parallel
+  retrieval_context->AddCounter(search_stats::Counter::CodesScanned, ndis);
+  if (context->has_rank) {
+    retrieval_context->AddCounter(search_stats::Counter::Reranked,
+                                  (long)n * recall_num);
+  }
 
 #ifdef PERFORMANCE_TESTING
   std::string compute_msg = "compute ";
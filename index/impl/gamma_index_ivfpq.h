@@ -566,8 +566,8 @@ struct GammaIVFFlatScanner : GammaInvertedListScanner {
     RawVector *raw_vec = (RawVector *)codes;
     size_t nup = 0;
     for (size_t j = 0; j < list_size; j++) {
-      if (ids[j] & realtime::kDelIdxMask) continue;
-      idx_t vid = ids[j] & realtime::kRecoverIdxMask;
+      idx_t vid = realtime::LoadId(ids + j);
+      if (vid & realtime::kDelIdxMask) continue;
       if (vid < 0) continue;
       if (retrieval_context_->IsValid(vid) == false) continue;
 
@@ -674,6 +674,13 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
   int Update(const std::vector<int64_t> &ids,
              const std::vector<const uint8_t *> &vecs);
 
+  /** assign n raw vectors to buckets and compute their pq codes
+   *
+   * @param list_nos  size n, assigned bucket of each vector
+   * @param codes     size n * code_size
+   */
+  void EncodeVectors(int n, const float *vec, idx_t *list_nos, uint8_t *codes);
+
   // assign the vectors, then call search_preassign
   int Search(RetrievalContext *retrieval_context, int n, const uint8_t *x,
              int k, float *distances, idx_t *labels);
@@ -690,6 +697,8 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
                        int nprobe, bool store_pairs,
                        const faiss::IVFSearchParameters *params = nullptr);
 
+  bool CoversUnindexed() override { return false; }
+
   long GetTotalMemBytes() override {
     if (!rt_invert_index_ptr_) {
       return 0;
@@ -697,6 +706,11 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
     return rt_invert_index_ptr_->GetTotalMemBytes();
   }
 
+  void GetTombstoneRatios(std::vector<float> &ratios) override {
+    ratios.clear();
+    if (rt_invert_index_ptr_) rt_invert_index_ptr_->GetTombstoneRatios(ratios);
+  }
+
   int Dump(const std::string &dir) override;
 
   int Load(const std::string &index_dir) override;
@@ -742,13 +756,13 @@ struct GammaIVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
                             SearchResultType &res) const {
     size_t j = 0;
     for (; j < ncode; j++) {
-      if (res.ids[j] & realtime::kDelIdxMask) {
+      idx_t id = realtime::LoadId(res.ids + j);
+      if (id & realtime::kDelIdxMask) {
         codes += this->pq.M;
         continue;
       }
 
-      if (!retrieval_context_->IsValid(res.ids[j] &
-                                       realtime::kRecoverIdxMask)) {
+      if (!retrieval_context_->IsValid(id)) {
         codes += this->pq.M;
         continue;
       }
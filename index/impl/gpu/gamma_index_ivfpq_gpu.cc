@@ -456,7 +456,6 @@ int GammaIVFPQGPUIndex::AddRTVecsToIndex() {
 #ifdef DEBUG
     LOG(INFO) << "no extra vectors existed for indexing";
 #endif
-    cpu_index_->rt_invert_index_ptr_->CompactIfNeed();
   } else {
     int MAX_NUM_PER_INDEX = 1000;
     int index_count = (total_stored_vecs - cpu_index_->indexed_vec_count_) /
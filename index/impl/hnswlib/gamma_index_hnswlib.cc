@@ -176,7 +176,8 @@ int GammaIndexHNSWLIB::Init(const std::string &model_parameters, int indexing_si
   label_offset_ = size_links_level0_ + data_size_;
   offsetLevel0_ = 0;
 
-  data_level0_memory_ = (char *)malloc(max_elements_ * size_data_per_element_);
+  data_level0_memory_ =
+      (char *)large_alloc::Alloc(max_elements_ * size_data_per_element_);
   if (data_level0_memory_ == nullptr)
     throw std::runtime_error("Not enough memory");
 
@@ -314,7 +315,8 @@ int GammaIndexHNSWLIB::Search(RetrievalContext *retrieval_context, int n,
   } else {
     fstdistfunc = space_interface_->get_dist_func();
   }
-  int threads_num = n < omp_get_max_threads() ? n : omp_get_max_threads();
+  int threads_num = retrieval_context->SearchThreads();
+  if (n < threads_num) threads_num = n;
 
 #pragma omp parallel for schedule(dynamic) num_threads(threads_num)
   for (int i = 0; i < n; ++i) {
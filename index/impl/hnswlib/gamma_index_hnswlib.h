@@ -82,6 +82,8 @@ struct GammaIndexHNSWLIB : public GammaFLATIndex,
 
   long GetTotalMemBytes() override;
 
+  bool CoversUnindexed() override { return false; }
+
   int Dump(const std::string &dir) override;
 
   int Load(const std::string &index_dir) override;
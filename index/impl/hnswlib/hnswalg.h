@@ -26,6 +26,7 @@
 #include <unordered_set>
 
 #include "hnswlib.h"
+#include "large_alloc.h"
 #include "thread_util.h"
 #include "visited_list_pool.h"
 #include "log.h"
@@ -54,7 +55,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
   };
 
   ~HierarchicalNSW() {
-    free(data_level0_memory_);
+    large_alloc::Free(data_level0_memory_,
+                      max_elements_ * size_data_per_element_);
     for (tableint i = 0; i < cur_element_count; i++) {
       if (element_levels_[i] > 0) free(linkLists_[i]);
     }
@@ -577,14 +579,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
     // Reallocate base layer
-    char *data_level0_memory_new =
-        (char *)malloc(new_max_elements * size_data_per_element_);
+    char *data_level0_memory_new = (char *)large_alloc::Alloc(
+        new_max_elements * size_data_per_element_);
     if (data_level0_memory_new == nullptr)
       throw std::runtime_error(
           "Not enough memory: resizeIndex failed to allocate base layer");
     memcpy(data_level0_memory_new, data_level0_memory_,
            cur_element_count * size_data_per_element_);
-    free(data_level0_memory_);
+    large_alloc::Free(data_level0_memory_,
+                      max_elements_ * size_data_per_element_);
     data_level0_memory_ = data_level0_memory_new;
 
     // Reallocate all other layers
@@ -694,7 +697,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     input.seekg(pos, input.beg);
 
-    data_level0_memory_ = (char *)malloc(max_elements * size_data_per_element_);
+    data_level0_memory_ =
+        (char *)large_alloc::Alloc(max_elements * size_data_per_element_);
     if (data_level0_memory_ == nullptr)
       throw std::runtime_error(
           "Not enough memory: loadIndex failed to allocate level0");
@@ -7,12 +7,16 @@
 
 #pragma once
 
+#include <omp.h>
+
+#include <atomic>
 #include <vector>
 #include <tbb/concurrent_queue.h>
 
 
 // #include "concurrentqueue/concurrentqueue.h"
 #include "reflector.h"
+#include "search_stats.h"
 #include "utils.h"
 
 enum class VectorValueType : std::uint8_t { FLOAT = 0, BINARY = 1, INT8 = 2 };
@@ -76,7 +80,11 @@ class RetrievalParameters {
 // it also provides performance tool to record performance info
 class RetrievalContext {
  public:
-  RetrievalContext() { retrieval_params_ = nullptr; }
+  RetrievalContext() {
+    retrieval_params_ = nullptr;
+    search_threads_ = 0;
+    search_stats_ = nullptr;
+  }
 
   virtual ~RetrievalContext() {
     if (retrieval_params_ != nullptr) {
@@ -95,8 +103,33 @@ class RetrievalContext {
 
   PerfTool &GetPerfTool() { return perf_tool_; }
 
+  // max threads of the parallel regions of this search, it is set by the
+  // engine according to the concurrent searches, 0 means omp's default
+  int SearchThreads() const {
+    return search_threads_ > 0 ? search_threads_ : omp_get_max_threads();
+  }
+
+  void SetSearchThreads(int search_threads) { search_threads_ = search_threads; }
+
+  // stats of the engine owning the index, nullptr if not recorded
+  search_stats::SearchStats *GetSearchStats() { return search_stats_; }
+
+  void SetSearchStats(search_stats::SearchStats *search_stats) {
+    search_stats_ = search_stats;
+  }
+
+  void RecordStage(search_stats::Stage stage, long us) {
+    if (search_stats_) search_stats_->Record(stage, us);
+  }
+
+  void AddCounter(search_stats::Counter counter, long n) {
+    if (search_stats_) search_stats_->Add(counter, n);
+  }
+
   RetrievalParameters *retrieval_params_;
   PerfTool perf_tool_;
+  int search_threads_;
+  search_stats::SearchStats *search_stats_;
 };
 
 // Store vector meta infos
@@ -200,6 +233,22 @@ class VectorReader {
   virtual int Gets(const std::vector<int64_t> &vids,
                    ScopeVectors &vecs) const = 0;
 
+  /** hint that vids will be read soon, a store on disk starts loading them
+   * in the background and returns at once
+   *
+   * @return < 0 if the store doesn't take hints
+   */
+  virtual int PrefetchHint(const std::vector<int64_t> &vids) const {
+    return -1;
+  }
+
+  /** load vids of a store on disk in one batch and return when they are
+   * loaded, the missing blocks are read once in sorted order
+   *
+   * @return < 0 if error
+   */
+  virtual int Prefetch(const std::vector<int64_t> &vids) const { return 0; }
+
   // Return meta info
   VectorMetaInfo *MetaInfo() { return meta_info_; };
 
@@ -279,6 +328,19 @@ class RetrievalModel {
   // Return model memory usage
   virtual long GetTotalMemBytes() = 0;
 
+  /** tombstone ratio of each realtime bucket, empty if the model doesn't
+   * keep tombstones
+   */
+  virtual void GetTombstoneRatios(std::vector<float> &ratios) {
+    ratios.clear();
+  }
+
+  /** true if Search itself covers the stored vectors which are not added
+   * yet, otherwise the framework brute-forces a bounded part of them after
+   * Search, see VectorManager::UnsearchedNum
+   */
+  virtual bool CoversUnindexed() { return false; }
+
   /** Dump model and index
    *
    * @param dir   dump directory
@@ -296,6 +358,8 @@ class RetrievalModel {
   VectorReader *vector_;
   tbb::concurrent_bounded_queue<int> updated_vids_;
   // warining: indexed_count_ is only used by framework, sub-class cann't use it
-  int indexed_count_;
+  // it's read by searches while the indexing thread moves it, so a vector is
+  // added to the index before the count covers it
+  std::atomic<int> indexed_count_;
   int indexing_size_;
 };
@@ -6,6 +6,10 @@
  */
 
 #include "realtime_invert_index.h"
+
+#include <time.h>
+
+#include "background_pool.h"
 #include "log.h"
 #include "utils.h"
 
@@ -14,17 +18,21 @@ namespace realtime {
 
 RTInvertIndex::RTInvertIndex(size_t nlist, size_t code_size,
                              VIDMgr *vid_mgr, const char *docids_bitmap,
-                             size_t bucket_keys, size_t bucket_keys_limit)
+                             size_t bucket_keys)
     : nlist_(nlist),
       code_size_(code_size),
       bucket_keys_(bucket_keys),
-      bucket_keys_limit_(bucket_keys_limit),
       vid_mgr_(vid_mgr),
       docids_bitmap_(docids_bitmap) {
   cur_ptr_ = nullptr;
+  compact_task_id_ = 0;
+  compact_interval_ms_ = kCompactIntervalMs;
+  compact_bytes_budget_ = kCompactBytesBudget;
+  compact_cpu_ratio_ = kCompactCpuRatio;
 }
 
 RTInvertIndex::~RTInvertIndex() {
+  StopCompaction();
   if (cur_ptr_) {
     delete cur_ptr_;
     cur_ptr_ = nullptr;
@@ -32,16 +40,69 @@ RTInvertIndex::~RTInvertIndex() {
 }
 
 bool RTInvertIndex::Init() {
+  StopCompaction();
   CHECK_DELETE(cur_ptr_);
   cur_ptr_ = new (std::nothrow)
       RealTimeMemData(nlist_, vid_mgr_, docids_bitmap_,
-                      bucket_keys_, bucket_keys_limit_, code_size_);
+                      bucket_keys_, code_size_);
   if (nullptr == cur_ptr_) return false;
 
   if (!cur_ptr_->Init()) return false;
+
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  if (pool == nullptr) {
+    LOG(ERROR) << "start realtime compaction error";
+    return false;
+  }
+  compact_task_id_ =
+      pool->Add([this]() { return CompactOnce(); },
+                compact_interval_ms_);
   return true;
 }
 
+void RTInvertIndex::SetCompactBudget(int interval_ms, size_t bytes_budget,
+                                     float cpu_ratio) {
+  std::lock_guard<std::mutex> lock(compact_mutex_);
+  compact_interval_ms_ = interval_ms;
+  compact_bytes_budget_ = bytes_budget;
+  compact_cpu_ratio_ = cpu_ratio;
+}
+
+static long ThreadCpuMs() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long RTInvertIndex::CompactOnce() {
+  size_t keys_budget;
+  float cpu_ratio;
+  {
+    std::lock_guard<std::mutex> lock(compact_mutex_);
+    keys_budget = compact_bytes_budget_ / (code_size_ + sizeof(long)) + 1;
+    cpu_ratio = compact_cpu_ratio_;
+  }
+  long begin_ms = ThreadCpuMs();
+  if (cur_ptr_->CompactIfNeed(keys_budget) < 0) {
+    LOG(ERROR) << "realtime compaction error";
+  }
+  long cost_ms = ThreadCpuMs() - begin_ms;
+
+  std::lock_guard<std::mutex> lock(compact_mutex_);
+  long wait_ms = compact_interval_ms_;
+  if (cpu_ratio > 0 && cpu_ratio < 1) {
+    long throttle_ms = (long)(cost_ms * (1 - cpu_ratio) / cpu_ratio);
+    if (throttle_ms > wait_ms) wait_ms = throttle_ms;
+  }
+  return wait_ms;
+}
+
+void RTInvertIndex::StopCompaction() {
+  if (compact_task_id_ == 0) return;
+  BackgroundPool::GetInstance()->Remove(compact_task_id_);
+  compact_task_id_ = 0;
+}
+
 bool RTInvertIndex::AddKeys(std::map<int, std::vector<long>> &new_keys,
                             std::map<int, std::vector<uint8_t>> &new_codes) {
   std::map<int, std::vector<long>>::iterator new_keys_iter = new_keys.begin();
@@ -74,10 +135,29 @@ int RTInvertIndex::Update(int bucket_no, int vid, std::vector<uint8_t> &codes) {
   return cur_ptr_->Update(bucket_no, vid, codes);
 }
 
-bool RTInvertIndex::GetIvtList(const size_t &bucket_no, long *&ivt_list,
-                               size_t &ivt_size, uint8_t *&ivt_codes_list) {
-  ivt_size = cur_ptr_->cur_invert_ptr_->retrieve_idx_pos_[bucket_no];
-  return cur_ptr_->GetIvtList(bucket_no, ivt_list, ivt_codes_list);
+int RTInvertIndex::Update(std::map<int, std::vector<long>> &new_keys,
+                          std::map<int, std::vector<uint8_t>> &new_codes) {
+  int ret = 0;
+  for (auto &iter : new_keys) {
+    int bucket_no = iter.first;
+    auto codes_iter = new_codes.find(bucket_no);
+    if (codes_iter == new_codes.end() ||
+        iter.second.size() * code_size_ != codes_iter->second.size()) {
+      LOG(ERROR) << "the pairs of new_keys and new_codes are not suitable!";
+      continue;
+    }
+    if (cur_ptr_->Update(bucket_no, iter.second, codes_iter->second)) {
+      LOG(ERROR) << "update keys error, bucket no=" << bucket_no
+                 << ", key size=" << iter.second.size();
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+bool RTInvertIndex::GetIvtList(const size_t &bucket_no,
+                               RTBucketChunks *&chunks, size_t &ivt_size) {
+  return cur_ptr_->GetIvtList(bucket_no, chunks, ivt_size);
 }
 
 void RTInvertIndex::PrintBucketSize() { cur_ptr_->PrintBucketSize(); }
@@ -95,36 +175,65 @@ RTInvertedLists::RTInvertedLists(realtime::RTInvertIndex *rt_invert_index_ptr,
 
 size_t RTInvertedLists::list_size(size_t list_no) const {
   if (!rt_invert_index_ptr_) return 0;
-  long *ivt_list = nullptr;
+  RTBucketChunks *chunks = nullptr;
   size_t list_size = 0;
-  uint8_t *ivt_codes_list = nullptr;
-  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, ivt_list, list_size,
-                                              ivt_codes_list);
+  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size);
   if (!ret) return 0;
   return list_size;
 }
 
 const uint8_t *RTInvertedLists::get_codes(size_t list_no) const {
   if (!rt_invert_index_ptr_) return nullptr;
-  long *ivt_list = nullptr;
+  ScopeBucketReader reader(rt_invert_index_ptr_, list_no);
+  RTBucketChunks *chunks = nullptr;
   size_t list_size = 0;
-  uint8_t *ivt_codes_list = nullptr;
-  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, ivt_list, list_size,
-                                              ivt_codes_list);
+  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size);
   if (!ret) return nullptr;
-  return ivt_codes_list;
+  uint8_t *codes = new uint8_t[list_size * code_size];
+  chunks->Retrieve(0, list_size, code_size, nullptr, codes);
+  return codes;
 }
 
 const idx_t *RTInvertedLists::get_ids(size_t list_no) const {
   if (!rt_invert_index_ptr_) return nullptr;
-  long *ivt_list = nullptr;
+  ScopeBucketReader reader(rt_invert_index_ptr_, list_no);
+  RTBucketChunks *chunks = nullptr;
   size_t list_size = 0;
-  uint8_t *ivt_codes_list = nullptr;
-  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, ivt_list, list_size,
-                                              ivt_codes_list);
+  bool ret = rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size);
   if (!ret) return nullptr;
-  idx_t *ivt_lists = reinterpret_cast<idx_t *>(ivt_list);
-  return ivt_lists;
+  long *ids = new long[list_size];
+  chunks->Retrieve(0, list_size, code_size, ids, nullptr);
+  return reinterpret_cast<idx_t *>(ids);
+}
+
+void RTInvertedLists::release_codes(size_t list_no,
+                                    const uint8_t *codes) const {
+  delete[] codes;
+}
+
+void RTInvertedLists::release_ids(size_t list_no, const idx_t *ids) const {
+  delete[] ids;
+}
+
+idx_t RTInvertedLists::get_single_id(size_t list_no, size_t offset) const {
+  RTBucketChunks *chunks = nullptr;
+  size_t list_size = 0;
+  rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size);
+  assert(offset < list_size);
+  return LoadId(chunks->Ids(offset));
+}
+
+const uint8_t *RTInvertedLists::get_single_code(size_t list_no,
+                                                size_t offset) const {
+  ScopeBucketReader reader(rt_invert_index_ptr_, list_no);
+  RTBucketChunks *chunks = nullptr;
+  size_t list_size = 0;
+  rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size);
+  assert(offset < list_size);
+  // copied as well, it is released by release_codes
+  uint8_t *code = new uint8_t[code_size];
+  memcpy(code, chunks->Codes(offset, code_size), code_size);
+  return code;
 }
 
 size_t RTInvertedLists::add_entries(size_t list_no, size_t n_entry,
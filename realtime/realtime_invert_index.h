@@ -11,6 +11,7 @@
 #include <stdlib.h>
 
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include "bitmap.h"
@@ -21,12 +22,17 @@
 namespace tig_gamma {
 namespace realtime {
 
+const static int kCompactIntervalMs = 1000;
+const static size_t kCompactBytesBudget = 256 * 1024 * 1024;  // 256MB
+// the compaction task uses at most this share of a core
+const static float kCompactCpuRatio = 0.1f;
+
 struct RTInvertIndex {
  public:
-  // bucket_keys should not be larger than bucket_keys_limit
+  // bucket_keys is the number of keys of each bucket chunk
   RTInvertIndex(size_t nlist, size_t code_size,
                 VIDMgr *vid_mgr, const char *docids_bitmap,
-                size_t bucket_keys = 10000, size_t bucket_keys_limit = 1000000);
+                size_t bucket_keys = 10000);
 
   ~RTInvertIndex();
 
@@ -40,28 +46,85 @@ struct RTInvertIndex {
 
   int Update(int bucket_no, int vid, std::vector<uint8_t> &codes);
 
-  bool GetIvtList(const size_t &bucket_no, long *&ivt_list, size_t &ivt_size,
-                  uint8_t *&ivt_codes_list);
+  /*  @param new_keys : updated vids grouped by their new bucket
+   *  @param new_codes : new codes of the updated vids */
+  int Update(std::map<int, std::vector<long>> &new_keys,
+             std::map<int, std::vector<uint8_t>> &new_codes);
+
+  /*  @param chunks : snapshot of the bucket, valid for the current search
+   *  @param ivt_size : count of keys in chunks */
+  bool GetIvtList(const size_t &bucket_no, RTBucketChunks *&chunks,
+                  size_t &ivt_size);
 
   long GetTotalMemBytes() {
     return cur_ptr_ ? cur_ptr_->GetTotalMemBytes() : 0;
   }
 
+  void AddScanHeat(size_t bucket_no) { cur_ptr_->AddScanHeat(bucket_no); }
+
+  int EnterBucket(size_t bucket_no) { return cur_ptr_->EnterBucket(bucket_no); }
+
+  void LeaveBucket(size_t bucket_no, int parity) {
+    cur_ptr_->LeaveBucket(bucket_no, parity);
+  }
+
   void PrintBucketSize();
+  // one compaction round, it is run by the compaction task
   int CompactIfNeed();
   int Delete(int *vids, int n);
 
+  void GetTombstoneRatios(std::vector<float> &ratios) {
+    if (cur_ptr_) cur_ptr_->GetTombstoneRatios(ratios);
+  }
+
+  /** the compaction task runs a round every interval_ms on the background
+   * pool, each round copies
+   * at most bytes_budget of codes and ids. A round taking t of cpu is followed
+   * by at least t * (1 - cpu_ratio) / cpu_ratio of sleep
+   */
+  void SetCompactBudget(int interval_ms, size_t bytes_budget,
+                        float cpu_ratio = kCompactCpuRatio);
+
   size_t nlist_;
   size_t code_size_;
   size_t bucket_keys_;
-  size_t bucket_keys_limit_;
   VIDMgr *vid_mgr_;
   const char *docids_bitmap_;
 
   RealTimeMemData *cur_ptr_;
+
+ private:
+  // returns the ms to wait before the next round
+  long CompactOnce();
+  void StopCompaction();
+
+  long compact_task_id_;  // task of the background pool
+  std::mutex compact_mutex_;
+  int compact_interval_ms_;
+  size_t compact_bytes_budget_;
+  float compact_cpu_ratio_;
 };
 
 using idx_t = faiss::Index::idx_t;
+
+// holds a bucket while its slots are read, so that they are not reused and
+// its replaced chunks are not freed
+struct ScopeBucketReader {
+  ScopeBucketReader(RTInvertIndex *rt_invert_index, size_t bucket_no)
+      : rt_invert_index_(rt_invert_index), bucket_no_(bucket_no) {
+    parity_ = rt_invert_index_->EnterBucket(bucket_no_);
+  }
+
+  ~ScopeBucketReader() { rt_invert_index_->LeaveBucket(bucket_no_, parity_); }
+
+  RTInvertIndex *rt_invert_index_;
+  size_t bucket_no_;
+  int parity_;  // of the entered epoch
+};
+
+/** get_codes/get_ids return copies of the chunked lists for generic faiss
+ * code, the search paths should use scan_chunks instead.
+ */
 struct RTInvertedLists : faiss::InvertedLists {
   RTInvertedLists(realtime::RTInvertIndex *rt_invert_index_ptr, size_t nlist,
                   size_t code_size);
@@ -69,6 +132,40 @@ struct RTInvertedLists : faiss::InvertedLists {
   /*************************
    *  Read only functions */
 
+  /** call func(ids, codes, n) on each chunk of the list without copying.
+   * With store_pairs the list is copied and visited as one chunk, so the
+   * offsets built by the scanner stay relative to the list.
+   *
+   * @return count of keys visited
+   */
+  template <typename Func>
+  size_t scan_chunks(size_t list_no, bool store_pairs, Func func) const {
+    if (!rt_invert_index_ptr_) return 0;
+    ScopeBucketReader reader(rt_invert_index_ptr_, list_no);
+    RTBucketChunks *chunks = nullptr;
+    size_t list_size = 0;
+    if (!rt_invert_index_ptr_->GetIvtList(list_no, chunks, list_size) ||
+        list_size == 0) {
+      return 0;
+    }
+    rt_invert_index_ptr_->AddScanHeat(list_no);
+    if (store_pairs && list_size > chunks->chunk_keys_) {
+      std::vector<long> ids(list_size);
+      std::vector<uint8_t> codes(list_size * code_size);
+      chunks->Retrieve(0, list_size, code_size, ids.data(), codes.data());
+      func(reinterpret_cast<const idx_t *>(ids.data()), codes.data(),
+           list_size);
+      return list_size;
+    }
+    for (int c = 0; c < chunks->chunk_num_; c++) {
+      size_t n = chunks->ChunkSize(c, list_size);
+      if (n == 0) break;
+      func(reinterpret_cast<const idx_t *>(chunks->idx_chunks_[c]),
+           chunks->codes_chunks_[c], n);
+    }
+    return list_size;
+  }
+
   // get the size of a list
   size_t list_size(size_t list_no) const override;
 
@@ -86,6 +183,15 @@ struct RTInvertedLists : faiss::InvertedLists {
    */
   const idx_t *get_ids(size_t list_no) const override;
 
+  // the lists are copied out of the chunks, these free the copies
+  void release_codes(size_t list_no, const uint8_t *codes) const override;
+
+  void release_ids(size_t list_no, const idx_t *ids) const override;
+
+  idx_t get_single_id(size_t list_no, size_t offset) const override;
+
+  const uint8_t *get_single_code(size_t list_no, size_t offset) const override;
+
   /*************************
    * writing functions     */
 
@@ -8,6 +8,7 @@
 #include "realtime_mem_data.h"
 
 #include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -15,38 +16,65 @@
 #include "bitmap.h"
 #include "error_code.h"
 #include "faiss/impl/io.h"
+#include "large_alloc.h"
 #include "log.h"
 #include "utils.h"
 
 namespace tig_gamma {
 namespace realtime {
 
-RTInvertBucketData::RTInvertBucketData(RTInvertBucketData *other) {
-  idx_array_ = other->idx_array_;
-  retrieve_idx_pos_ = other->retrieve_idx_pos_;
-  cur_bucket_keys_ = other->cur_bucket_keys_;
-  bucket_extend_time_ = other->bucket_extend_time_;
-  codes_array_ = other->codes_array_;
-  vid_mgr_ = other->vid_mgr_;
-  docids_bitmap_ = other->docids_bitmap_;
-  vid_bucket_no_pos_ = other->vid_bucket_no_pos_;
-  deleted_nums_ = other->deleted_nums_;
-  compacted_num_ = other->compacted_num_;
-  buckets_num_ = other->buckets_num_;
-  nids_ = other->nids_;
+RTBucketChunks::RTBucketChunks(size_t chunk_keys, int capacity)
+    : chunk_num_(0), capacity_(capacity), chunk_keys_(chunk_keys), size_(0) {
+  idx_chunks_ = new long *[capacity_];
+  codes_chunks_ = new uint8_t *[capacity_];
+  std::fill_n(idx_chunks_, capacity_, nullptr);
+  std::fill_n(codes_chunks_, capacity_, nullptr);
+}
+
+RTBucketChunks::~RTBucketChunks() {
+  CHECK_DELETE_ARRAY(idx_chunks_);
+  CHECK_DELETE_ARRAY(codes_chunks_);
+}
+
+void RTBucketChunks::FreeChunks(size_t code_bytes_per_vec) {
+  for (int c = 0; c < chunk_num_; c++) {
+    large_alloc::Free(idx_chunks_[c], chunk_keys_ * sizeof(long));
+    large_alloc::Free(codes_chunks_[c], chunk_keys_ * code_bytes_per_vec);
+    idx_chunks_[c] = nullptr;
+    codes_chunks_[c] = nullptr;
+  }
+}
+
+void RTBucketChunks::Retrieve(size_t pos, size_t n, size_t code_bytes_per_vec,
+                              long *ids, uint8_t *codes) const {
+  while (n) {
+    size_t offset = pos % chunk_keys_;
+    size_t len = chunk_keys_ - offset;
+    if (len > n) len = n;
+    if (ids) {
+      memcpy((void *)ids, (void *)Ids(pos), len * sizeof(long));
+      ids += len;
+    }
+    if (codes) {
+      memcpy((void *)codes, (void *)Codes(pos, code_bytes_per_vec),
+             len * code_bytes_per_vec);
+      codes += len * code_bytes_per_vec;
+    }
+    pos += len;
+    n -= len;
+  }
 }
 
 RTInvertBucketData::RTInvertBucketData(VIDMgr *vid_mgr,
                                        const char *docids_bitmap) {
-  idx_array_ = nullptr;
-  retrieve_idx_pos_ = nullptr;
-  cur_bucket_keys_ = nullptr;
-  bucket_extend_time_ = nullptr;
-  codes_array_ = nullptr;
+  buckets_ = nullptr;
   vid_mgr_ = vid_mgr;
   docids_bitmap_ = docids_bitmap;
   vid_bucket_no_pos_ = nullptr;
   deleted_nums_ = nullptr;
+  scan_heats_ = nullptr;
+  epochs_ = nullptr;
+  readers_ = nullptr;
   compacted_num_ = 0;
   buckets_num_ = 0;
   nids_ = 0;
@@ -58,89 +86,114 @@ bool RTInvertBucketData::Init(const size_t &buckets_num,
                               const size_t &bucket_keys,
                               const size_t &code_bytes_per_vec,
                               std::atomic<long> &total_mem_bytes) {
-  idx_array_ = new (std::nothrow) long *[buckets_num];
-  codes_array_ = new (std::nothrow) uint8_t *[buckets_num];
-  cur_bucket_keys_ = new (std::nothrow) int[buckets_num];
-  bucket_extend_time_ = new (std::nothrow) uint8_t[buckets_num];
-  memset(bucket_extend_time_, 0, buckets_num * sizeof(uint8_t));
+  buckets_ = new (std::nothrow) std::atomic<RTBucketChunks *>[buckets_num];
   deleted_nums_ = new (std::nothrow) std::atomic<int>[buckets_num];
-  if (idx_array_ == nullptr || codes_array_ == nullptr ||
-      cur_bucket_keys_ == nullptr || deleted_nums_ == nullptr)
+  scan_heats_ = new (std::nothrow) std::atomic<long>[buckets_num];
+  epochs_ = new (std::nothrow) std::atomic<long>[buckets_num];
+  readers_ = new (std::nothrow) std::atomic<int>[buckets_num * 2];
+  if (buckets_ == nullptr || deleted_nums_ == nullptr ||
+      scan_heats_ == nullptr || epochs_ == nullptr || readers_ == nullptr)
     return false;
   for (size_t i = 0; i < buckets_num; i++) {
-    idx_array_[i] = new (std::nothrow) long[bucket_keys];
-    codes_array_[i] =
-        new (std::nothrow) uint8_t[bucket_keys * code_bytes_per_vec];
-    if (idx_array_[i] == nullptr || codes_array_[i] == nullptr) return false;
-    cur_bucket_keys_[i] = bucket_keys;
+    buckets_[i] = nullptr;
     deleted_nums_[i] = 0;
+    scan_heats_[i] = 0;
+    epochs_[i] = 0;
+    readers_[i * 2] = 0;
+    readers_[i * 2 + 1] = 0;
+  }
+  buckets_num_ = buckets_num;
+  free_slots_.resize(buckets_num);
+  pending_slots_.resize(buckets_num);
+  retired_chunks_.resize(buckets_num);
+  for (size_t i = 0; i < buckets_num; i++) {
+    RTBucketChunks *chunks =
+        new (std::nothrow) RTBucketChunks(bucket_keys, kInitChunkSlots);
+    if (chunks == nullptr) return false;
+    buckets_[i] = chunks;
+    if (!AllocChunk(chunks, code_bytes_per_vec, total_mem_bytes)) return false;
   }
   nids_ = buckets_num * bucket_keys;
   vid_bucket_no_pos_ = new std::atomic<long>[nids_];
   for (size_t i = 0; i < nids_; i++) vid_bucket_no_pos_[i] = -1;
 
-  total_mem_bytes += buckets_num * bucket_keys * sizeof(long);
-  total_mem_bytes +=
-      buckets_num * bucket_keys * code_bytes_per_vec * sizeof(uint8_t);
-  total_mem_bytes += buckets_num * sizeof(int);
-
-  retrieve_idx_pos_ = new (std::nothrow) size_t[buckets_num];
-  if (retrieve_idx_pos_ == nullptr) return false;
-  memset(retrieve_idx_pos_, 0, buckets_num * sizeof(retrieve_idx_pos_[0]));
-  total_mem_bytes += buckets_num * sizeof(size_t);
-  buckets_num_ = buckets_num;
+  total_mem_bytes += buckets_num * (sizeof(int) + sizeof(long));
 
   LOG(INFO) << "init success! total_mem_bytes=" << total_mem_bytes
             << ", current max size=" << nids_;
   return true;
 }
 
-void RTInvertBucketData::CompactOne(const size_t &bucket_no, long *&dst_idx,
-                                    uint8_t *&dst_code, long *&src_idx,
-                                    uint8_t *&src_code, int &pos,
-                                    const size_t &code_bytes_per_vec) {
-  if (!(*src_idx & kDelIdxMask) &&
-      !bitmap::test(docids_bitmap_,
-                    vid_mgr_->VID2DocID(*src_idx & kRecoverIdxMask))) {
-    *dst_idx = *src_idx;
-    memcpy((void *)dst_code, (void *)(src_code), (size_t)code_bytes_per_vec);
-    vid_bucket_no_pos_[*dst_idx] = bucket_no << 32 | pos++;
-    ++dst_idx;
-    dst_code += code_bytes_per_vec;
+bool RTInvertBucketData::AllocChunk(RTBucketChunks *chunks,
+                                    const size_t &code_bytes_per_vec,
+                                    std::atomic<long> &total_mem_bytes) {
+  if (chunks->chunk_num_ >= chunks->capacity_) return false;
+  size_t chunk_keys = chunks->chunk_keys_;
+  long *idx = (long *)large_alloc::Alloc(chunk_keys * sizeof(long));
+  uint8_t *codes =
+      (uint8_t *)large_alloc::Alloc(chunk_keys * code_bytes_per_vec);
+  if (idx == nullptr || codes == nullptr) {
+    LOG(ERROR) << "memory bucket chunk alloc error, chunk keys=" << chunk_keys;
+    large_alloc::Free(idx, chunk_keys * sizeof(long));
+    large_alloc::Free(codes, chunk_keys * code_bytes_per_vec);
+    return false;
   }
-  ++src_idx;
-  src_code += code_bytes_per_vec;
-}
-
-double RTInvertBucketData::ExtendCoefficient(uint8_t extend_time) {
-  double result = 1.1 + PI / 2 - atan (extend_time);
-  return result;
+  chunks->idx_chunks_[chunks->chunk_num_] = idx;
+  chunks->codes_chunks_[chunks->chunk_num_] = codes;
+  ++chunks->chunk_num_;
+  total_mem_bytes += chunk_keys * (sizeof(long) + code_bytes_per_vec);
+  return true;
 }
 
 bool RTInvertBucketData::CompactBucket(const size_t &bucket_no,
-                                       const size_t &code_bytes_per_vec) {
-  int old_pos = retrieve_idx_pos_[bucket_no];
-  long *old_idx_ptr = idx_array_[bucket_no];
-  uint8_t *old_codes_ptr = codes_array_[bucket_no];
-
-  int pos = 0;
-  long *idx_array = (long *)malloc(sizeof(long) * cur_bucket_keys_[bucket_no]);
-  uint8_t *codes_array =
-      (uint8_t *)malloc(code_bytes_per_vec * cur_bucket_keys_[bucket_no]);
-  long *idx_ptr = idx_array;
-  uint8_t *codes_ptr = codes_array;
-
-  for (int i = 0; i < old_pos; i++) {
-    CompactOne(bucket_no, idx_ptr, codes_ptr, old_idx_ptr, old_codes_ptr, pos,
-               code_bytes_per_vec);
+                                       const size_t &code_bytes_per_vec,
+                                       std::atomic<long> &total_mem_bytes,
+                                       RTBucketChunks *&old_chunks) {
+  RTBucketChunks *src = buckets_[bucket_no];
+  size_t old_pos = src->size_;
+
+  RTBucketChunks *dst =
+      new (std::nothrow) RTBucketChunks(src->chunk_keys_, src->capacity_);
+  if (dst == nullptr) return false;
+
+  size_t pos = 0;
+  for (size_t i = 0; i < old_pos; i++) {
+    long id = *src->Ids(i);
+    if ((id & kDelIdxMask) ||
+        bitmap::test(docids_bitmap_, vid_mgr_->VID2DocID(id))) {
+      continue;
+    }
+    if (pos >= dst->Capacity() &&
+        !AllocChunk(dst, code_bytes_per_vec, total_mem_bytes)) {
+      dst->FreeChunks(code_bytes_per_vec);
+      total_mem_bytes -= dst->Capacity() * (sizeof(long) + code_bytes_per_vec);
+      delete dst;
+      return false;
+    }
+    *dst->Ids(pos) = id;
+    memcpy((void *)dst->Codes(pos, code_bytes_per_vec),
+           (void *)src->Codes(i, code_bytes_per_vec), code_bytes_per_vec);
+    vid_bucket_no_pos_[id] = bucket_no << 32 | pos;
+    ++pos;
   }
+  if (dst->chunk_num_ == 0 &&
+      !AllocChunk(dst, code_bytes_per_vec, total_mem_bytes)) {
+    delete dst;
+    return false;
+  }
+  dst->size_ = pos;
+
+  // readers holding src keep scanning its chunks until they are retired
+  buckets_[bucket_no] = dst;
+  old_chunks = src;
+  std::vector<int>().swap(free_slots_[bucket_no]);
+  std::vector<std::pair<long, int>>().swap(pending_slots_[bucket_no]);
 
-  idx_array_[bucket_no] = idx_array;
-  codes_array_[bucket_no] = codes_array;
-  int n = retrieve_idx_pos_[bucket_no] - pos;
+  long n = old_pos - pos;
   compacted_num_ += n;
-  retrieve_idx_pos_[bucket_no] = pos;
-  deleted_nums_[bucket_no] = 0;
+  // keep the deletions which come after the copy
+  int deleted = deleted_nums_[bucket_no].fetch_sub((int)n) - (int)n;
+  if (deleted < 0) deleted_nums_[bucket_no] = 0;
 
 #ifdef DEBUG
   LOG(INFO) << "compact bucket=" << bucket_no
@@ -151,41 +204,38 @@ bool RTInvertBucketData::CompactBucket(const size_t &bucket_no,
 }
 
 bool RTInvertBucketData::ExtendBucketMem(const size_t &bucket_no,
-                                         const int &increment,
+                                         const size_t &least,
                                          const size_t &code_bytes_per_vec,
-                                         std::atomic<long> &total_mem_bytes) {
-  int least = retrieve_idx_pos_[bucket_no] + increment;
-  double coefficient = ExtendCoefficient(++bucket_extend_time_[bucket_no]);
-  int extend_size = (int)(cur_bucket_keys_[bucket_no] * coefficient);
-  while (extend_size < least) {
-    coefficient = ExtendCoefficient(++bucket_extend_time_[bucket_no]);
-    extend_size = (int)(extend_size * coefficient);
+                                         std::atomic<long> &total_mem_bytes,
+                                         RTBucketChunks *&old_chunks) {
+  RTBucketChunks *chunks = buckets_[bucket_no];
+  size_t chunk_keys = chunks->chunk_keys_;
+  int need_num = (int)((least + chunk_keys - 1) / chunk_keys);
+
+  if (need_num > chunks->capacity_) {
+    // only the chunk pointers are copied, the keys stay where they are
+    int capacity = chunks->capacity_ * 2;
+    while (capacity < need_num) capacity *= 2;
+    RTBucketChunks *extend =
+        new (std::nothrow) RTBucketChunks(chunk_keys, capacity);
+    if (extend == nullptr) {
+      LOG(ERROR) << "memory bucket chunk directory alloc error!";
+      return false;
+    }
+    memcpy((void *)extend->idx_chunks_, (void *)chunks->idx_chunks_,
+           sizeof(long *) * chunks->chunk_num_);
+    memcpy((void *)extend->codes_chunks_, (void *)chunks->codes_chunks_,
+           sizeof(uint8_t *) * chunks->chunk_num_);
+    extend->chunk_num_ = chunks->chunk_num_;
+    extend->size_ = (size_t)chunks->size_;
+    buckets_[bucket_no] = extend;
+    old_chunks = chunks;
+    chunks = extend;
   }
 
-
-  uint8_t *extend_code_bytes_array =
-      new (std::nothrow) uint8_t[extend_size * code_bytes_per_vec];
-  if (extend_code_bytes_array == nullptr) {
-    LOG(ERROR) << "memory extend_code_bytes_array alloc error!";
-    return false;
-  }
-  memcpy((void *)extend_code_bytes_array, (void *)codes_array_[bucket_no],
-         sizeof(uint8_t) * retrieve_idx_pos_[bucket_no] * code_bytes_per_vec);
-  codes_array_[bucket_no] = extend_code_bytes_array;
-  total_mem_bytes += extend_size * code_bytes_per_vec * sizeof(uint8_t);
-
-  long *extend_idx_array = new (std::nothrow) long[extend_size];
-  if (extend_idx_array == nullptr) {
-    LOG(ERROR) << "memory extend_idx_array alloc error!";
-    return false;
+  while (chunks->chunk_num_ < need_num) {
+    if (!AllocChunk(chunks, code_bytes_per_vec, total_mem_bytes)) return false;
   }
-  memcpy((void *)extend_idx_array, (void *)idx_array_[bucket_no],
-         sizeof(long) * retrieve_idx_pos_[bucket_no]);
-  idx_array_[bucket_no] = extend_idx_array;
-  total_mem_bytes += extend_size * sizeof(long);
-
-  cur_bucket_keys_[bucket_no] = extend_size;
-
   return true;
 }
 
@@ -217,37 +267,37 @@ void RTInvertBucketData::ExtendIDs() {
 
 RealTimeMemData::RealTimeMemData(size_t buckets_num, VIDMgr *vid_mgr,
                                  const char *docids_bitmap, size_t bucket_keys,
-                                 size_t bucket_keys_limit,
                                  size_t code_bytes_per_vec)
     : buckets_num_(buckets_num),
       bucket_keys_(bucket_keys),
-      bucket_keys_limit_(bucket_keys_limit),
       code_bytes_per_vec_(code_bytes_per_vec),
       vid_mgr_(vid_mgr),
       docids_bitmap_(docids_bitmap) {
   cur_invert_ptr_ = nullptr;
-  extend_invert_ptr_ = nullptr;
   total_mem_bytes_ = 0;
 }
 
 RealTimeMemData::~RealTimeMemData() {
   if (cur_invert_ptr_) {
-    for (size_t i = 0; i < buckets_num_; i++) {
-      if (cur_invert_ptr_->idx_array_)
-        CHECK_DELETE_ARRAY(cur_invert_ptr_->idx_array_[i]);
-      if (cur_invert_ptr_->codes_array_)
-        CHECK_DELETE_ARRAY(cur_invert_ptr_->codes_array_[i]);
+    if (cur_invert_ptr_->buckets_) {
+      for (size_t i = 0; i < buckets_num_; i++) {
+        RTBucketChunks *chunks = cur_invert_ptr_->buckets_[i];
+        if (chunks == nullptr) continue;
+        chunks->FreeChunks(code_bytes_per_vec_);
+        delete chunks;
+      }
     }
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->idx_array_);
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->retrieve_idx_pos_);
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->cur_bucket_keys_);
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->bucket_extend_time_);
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->codes_array_);
+    for (auto &retired : cur_invert_ptr_->retired_chunks_) {
+      for (RTRetiredChunks &r : retired) FreeOldData(r.chunks, r.free_chunks);
+    }
+    CHECK_DELETE_ARRAY(cur_invert_ptr_->buckets_);
     CHECK_DELETE_ARRAY(cur_invert_ptr_->vid_bucket_no_pos_);
     CHECK_DELETE_ARRAY(cur_invert_ptr_->deleted_nums_);
+    CHECK_DELETE_ARRAY(cur_invert_ptr_->scan_heats_);
+    CHECK_DELETE_ARRAY(cur_invert_ptr_->epochs_);
+    CHECK_DELETE_ARRAY(cur_invert_ptr_->readers_);
   }
   CHECK_DELETE(cur_invert_ptr_);
-  CHECK_DELETE(extend_invert_ptr_);
 }
 
 bool RealTimeMemData::Init() {
@@ -261,26 +311,34 @@ bool RealTimeMemData::Init() {
 
 bool RealTimeMemData::AddKeys(size_t list_no, size_t n, std::vector<long> &keys,
                               std::vector<uint8_t> &keys_codes) {
-  if (ExtendBucketIfNeed(list_no, n)) return false;
-
   if (keys.size() * code_bytes_per_vec_ != keys_codes.size()) {
     LOG(ERROR) << "number of key and key codes not match!";
     return false;
   }
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  return AppendKeys(list_no, keys, keys_codes);
+}
 
-  int retrive_pos = cur_invert_ptr_->retrieve_idx_pos_[list_no];
-  // copy new added idx to idx buffer
-
-  if (nullptr == cur_invert_ptr_->idx_array_[list_no]) {
-    LOG(ERROR) << "-------idx_array is nullptr!--------";
+bool RealTimeMemData::AppendKeys(size_t list_no, std::vector<long> &keys,
+                                 std::vector<uint8_t> &keys_codes) {
+  if (ExtendBucketIfNeed(list_no, keys.size())) return false;
+
+  RTBucketChunks *chunks = cur_invert_ptr_->buckets_[list_no];
+  size_t retrive_pos = chunks->size_;
+
+  // copy new added idx and codes to the chunks after the retriving pos
+  size_t copied = 0;
+  while (copied < keys.size()) {
+    size_t pos = retrive_pos + copied;
+    size_t len = chunks->chunk_keys_ - pos % chunks->chunk_keys_;
+    if (len > keys.size() - copied) len = keys.size() - copied;
+    memcpy((void *)chunks->Ids(pos), (void *)(keys.data() + copied),
+           sizeof(long) * len);
+    memcpy((void *)chunks->Codes(pos, code_bytes_per_vec_),
+           (void *)(keys_codes.data() + copied * code_bytes_per_vec_),
+           sizeof(uint8_t) * len * code_bytes_per_vec_);
+    copied += len;
   }
-  memcpy((void *)(cur_invert_ptr_->idx_array_[list_no] + retrive_pos),
-         (void *)(keys.data()), sizeof(long) * keys.size());
-
-  // copy new added codes to codes buffer
-  memcpy((void *)(cur_invert_ptr_->codes_array_[list_no] +
-                  retrive_pos * code_bytes_per_vec_),
-         (void *)(keys_codes.data()), sizeof(uint8_t) * keys_codes.size());
 
   for (size_t i = 0; i < keys.size(); i++) {
     while ((size_t)keys[i] >= cur_invert_ptr_->nids_) {
@@ -295,33 +353,129 @@ bool RealTimeMemData::AddKeys(size_t list_no, size_t n, std::vector<long> &keys,
   }
 
   // atomic switch retriving pos of list_no
-  cur_invert_ptr_->retrieve_idx_pos_[list_no] = retrive_pos;
+  chunks->size_ = retrive_pos;
 
   return true;
 }
 
 int RealTimeMemData::Update(int bucket_no, int vid,
                             std::vector<uint8_t> &codes) {
-  if (vid >= cur_invert_ptr_->nids_) return 0;
-  long bucket_no_pos = cur_invert_ptr_->vid_bucket_no_pos_[vid];
-  if (bucket_no_pos == -1) return 0;  // do nothing
-  int old_bucket_no = bucket_no_pos >> 32;
-  int old_pos = bucket_no_pos & 0xffffffff;
-  assert(code_bytes_per_vec_ == codes.size());
-  if (old_bucket_no == bucket_no) {
-    uint8_t *codes_array = cur_invert_ptr_->codes_array_[old_bucket_no];
-    memcpy(codes_array + old_pos * code_bytes_per_vec_, codes.data(),
-           codes.size() * sizeof(uint8_t));
-    return 0;
-  }
+  std::vector<long> vids(1, vid);
+  return Update(bucket_no, vids, codes);
+}
 
-  // mark deleted
-  cur_invert_ptr_->idx_array_[old_bucket_no][old_pos] |= kDelIdxMask;
-  cur_invert_ptr_->deleted_nums_[old_bucket_no]++;
+int RealTimeMemData::Update(int bucket_no, std::vector<long> &vids,
+                            std::vector<uint8_t> &codes) {
+  assert(code_bytes_per_vec_ * vids.size() == codes.size());
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  ReclaimBucket(bucket_no);
+  std::vector<int> &free_slots = cur_invert_ptr_->free_slots_[bucket_no];
   std::vector<long> keys;
-  keys.push_back(vid);
+  std::vector<uint8_t> keys_codes;
+  for (size_t i = 0; i < vids.size(); i++) {
+    long vid = vids[i];
+    if ((size_t)vid >= cur_invert_ptr_->nids_) continue;
+    long bucket_no_pos = cur_invert_ptr_->vid_bucket_no_pos_[vid];
+    if (bucket_no_pos == -1) continue;  // do nothing
+    int old_bucket_no = bucket_no_pos >> 32;
+    int old_pos = bucket_no_pos & 0xffffffff;
+    const uint8_t *code = codes.data() + i * code_bytes_per_vec_;
+    RTBucketChunks *old_chunks = cur_invert_ptr_->buckets_[old_bucket_no];
+    if (old_bucket_no == bucket_no) {
+      memcpy(old_chunks->Codes(old_pos, code_bytes_per_vec_), code,
+             code_bytes_per_vec_);
+      continue;
+    }
 
-  return AddKeys(bucket_no, 1, keys, codes);
+    // mark deleted, a search which loaded the id before may still read the
+    // codes so the slot is not reused until the searches of its epoch left
+    __atomic_fetch_or(old_chunks->Ids(old_pos), kDelIdxMask, __ATOMIC_RELEASE);
+    cur_invert_ptr_->deleted_nums_[old_bucket_no]++;
+    long epoch = cur_invert_ptr_->epochs_[old_bucket_no].load(
+        std::memory_order_relaxed);
+    cur_invert_ptr_->pending_slots_[old_bucket_no].push_back(
+        std::make_pair(epoch, old_pos));
+
+    if (free_slots.size() > 0) {
+      int pos = free_slots.back();
+      free_slots.pop_back();
+      RTBucketChunks *chunks = cur_invert_ptr_->buckets_[bucket_no];
+      memcpy(chunks->Codes(pos, code_bytes_per_vec_), code,
+             code_bytes_per_vec_);
+      // the slot is visible to readers once its id is unmasked
+      StoreId(chunks->Ids(pos), vid);
+      cur_invert_ptr_->deleted_nums_[bucket_no]--;
+      cur_invert_ptr_->vid_bucket_no_pos_[vid] = (long)bucket_no << 32 | pos;
+      continue;
+    }
+    keys.push_back(vid);
+    keys_codes.insert(keys_codes.end(), code, code + code_bytes_per_vec_);
+  }
+  if (keys.size() == 0) return 0;
+  return AppendKeys(bucket_no, keys, keys_codes) ? 0 : -1;
+}
+
+long RealTimeMemData::DrainedEpoch(int bucket_no) {
+  std::atomic<long> &epochs = cur_invert_ptr_->epochs_[bucket_no];
+  std::atomic<int> *readers = cur_invert_ptr_->readers_ + bucket_no * 2;
+  // a search entering after the fence sees the tombstones and the replaced
+  // chunks, one entered before is counted in the readers of its epoch
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long epoch = epochs.load(std::memory_order_relaxed);
+  if (readers[(epoch + 1) & 1].load() > 0) return epoch - 1;
+
+  // the searches of the previous epoch left, the new ones enter the next
+  epochs.store(epoch + 1, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (readers[epoch & 1].load() > 0) return epoch;
+  return epoch + 1;
+}
+
+void RealTimeMemData::ReclaimBucket(int bucket_no) {
+  std::vector<std::pair<long, int>> &pending =
+      cur_invert_ptr_->pending_slots_[bucket_no];
+  std::vector<RTRetiredChunks> &retired =
+      cur_invert_ptr_->retired_chunks_[bucket_no];
+  if (pending.size() == 0 && retired.size() == 0) return;
+  long drained = DrainedEpoch(bucket_no);
+
+  std::vector<int> &free_slots = cur_invert_ptr_->free_slots_[bucket_no];
+  size_t kept = 0;
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (pending[i].first < drained) {
+      free_slots.push_back(pending[i].second);
+    } else {
+      pending[kept++] = pending[i];
+    }
+  }
+  pending.resize(kept);
+
+  // the searches which skip the gate (single key reads, dump) are given
+  // one more second
+  std::function<void(RTBucketChunks *, bool)> func_free =
+      std::bind(&RealTimeMemData::FreeOldData, this, std::placeholders::_1,
+                std::placeholders::_2);
+  kept = 0;
+  for (size_t i = 0; i < retired.size(); i++) {
+    if (retired[i].epoch < drained) {
+      utils::AsyncWait(1000, func_free, retired[i].chunks,
+                       retired[i].free_chunks);
+    } else {
+      retired[kept++] = retired[i];
+    }
+  }
+  retired.resize(kept);
+}
+
+void RealTimeMemData::RetireChunks(int bucket_no, RTBucketChunks *chunks,
+                                   bool free_chunks) {
+  RTRetiredChunks retired;
+  retired.epoch =
+      cur_invert_ptr_->epochs_[bucket_no].load(std::memory_order_relaxed);
+  retired.chunks = chunks;
+  retired.free_chunks = free_chunks;
+  cur_invert_ptr_->retired_chunks_[bucket_no].push_back(retired);
+  ReclaimBucket(bucket_no);
 }
 
 int RealTimeMemData::Delete(int *vids, int n) {
@@ -332,150 +486,114 @@ int RealTimeMemData::Delete(int *vids, int n) {
   return 0;
 }
 
-void RealTimeMemData::FreeOldData(long *idx, uint8_t *codes,
-                                  RTInvertBucketData *invert, long size) {
-  if (idx) {
-    delete idx;
-    idx = nullptr;
-  }
-  if (codes) {
-    delete codes;
-    codes = nullptr;
-  }
-  if (invert) {
-    delete invert;
-    invert = nullptr;
+void RealTimeMemData::FreeOldData(RTBucketChunks *chunks, bool free_chunks) {
+  if (chunks == nullptr) return;
+  if (free_chunks) {
+    chunks->FreeChunks(code_bytes_per_vec_);
+    total_mem_bytes_ -=
+        chunks->Capacity() * (sizeof(long) + code_bytes_per_vec_);
   }
-  total_mem_bytes_ -= size;
+  delete chunks;
 }
 
-int RealTimeMemData::CompactIfNeed() {
-  long last_compacted_num = cur_invert_ptr_->compacted_num_;
+int RealTimeMemData::CompactIfNeed(size_t keys_budget) {
+  std::vector<std::pair<float, int>> candidates;
   for (int i = 0; i < (int)buckets_num_; i++) {
-    if (Compactable(i)) {
-      if (!CompactBucket(i)) {
-        LOG(ERROR) << "compact bucket=" << i << " error!";
-        return -2;
-      }
-    }
+    // heat decays by half each round
+    long heat = cur_invert_ptr_->scan_heats_[i].load();
+    cur_invert_ptr_->scan_heats_[i] -= heat - heat / 2;
+    float score = CompactScore(i, heat);
+    if (score >= kCompactScore) candidates.push_back(std::make_pair(score, i));
   }
-  if (cur_invert_ptr_->compacted_num_ > last_compacted_num) {
-    LOG(INFO) << "Compaction happened, compacted num="
-              << cur_invert_ptr_->compacted_num_ - last_compacted_num
-              << ", last compacted num=" << last_compacted_num
-              << ", current compacted num=" << cur_invert_ptr_->compacted_num_;
+  {
+    // the chunks retired by the last rounds are freed once unread
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    for (int i = 0; i < (int)buckets_num_; i++) ReclaimBucket(i);
   }
-  return 0;
-}
-
-bool RealTimeMemData::Compactable(int bucket_no) {
-  return (float)cur_invert_ptr_->deleted_nums_[bucket_no] /
-             cur_invert_ptr_->retrieve_idx_pos_[bucket_no] >=
-         0.3f;
-}
-
-bool RealTimeMemData::CompactBucket(int bucket_no) {
-  return AdjustBucketMem(bucket_no, 1);
-}
+  if (candidates.size() == 0) return 0;
+  std::sort(candidates.begin(), candidates.end(),
+            [](const std::pair<float, int> &a, const std::pair<float, int> &b) {
+              return a.first > b.first;
+            });
 
-int RealTimeMemData::ExtendBucketIfNeed(int bucket_no, size_t keys_size) {
-  if (cur_invert_ptr_->retrieve_idx_pos_[bucket_no] + (int)keys_size <=
-      (size_t)cur_invert_ptr_->cur_bucket_keys_[bucket_no]) {
-    return 0;
-  } else {  // can not add new keys any more
-    if (cur_invert_ptr_->cur_bucket_keys_[bucket_no] * 2 >=
-        (int)bucket_keys_limit_) {
-      LOG(WARNING) << "exceed the max bucket keys [" << bucket_keys_limit_
-                   << "], not extend memory any more!"
-                   << " keys_size [" << keys_size << "] "
-                   << "bucket_no [" << bucket_no << "]"
-                   << " cur_invert_ptr_->cur_bucket_keys_[bucket_no] ["
-                   << cur_invert_ptr_->cur_bucket_keys_[bucket_no] << "]";
-      return -1;
-    } else {
-#if 0  // memory limit
-        utils::MEM_PACK *p = utils::get_memoccupy();
-        if (p->used_rate > 80) {
-          LOG(WARNING)
-              << "System memory used [" << p->used_rate
-              << "]%, cannot add doc, keys_size [" << keys_size << "]"
-              << "bucket_no [" << bucket_no << "]"
-              << " cur_invert_ptr_->cur_bucket_keys_[bucket_no] ["
-              << cur_invert_ptr_->cur_bucket_keys_[bucket_no] << "]";
-          free(p);
-          return false;
-        } else {
-          LOG(INFO) << "System memory used [" << p->used_rate << "]%";
-          free(p);
-        }
-#endif
-      if (!ExtendBucketMem(bucket_no, (int)keys_size)) {
-        return -2;
-      }
+  long last_compacted_num = cur_invert_ptr_->compacted_num_;
+  size_t copied = 0;
+  int compacted = 0;
+  for (const auto &candidate : candidates) {
+    int bucket_no = candidate.second;
+    size_t size = cur_invert_ptr_->buckets_[bucket_no].load()->size_;
+    // at least one bucket is compacted each round
+    if (keys_budget > 0 && compacted > 0 && copied + size > keys_budget) break;
+    // writers are blocked for one bucket at a time
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (!CompactBucket(bucket_no)) {
+      LOG(ERROR) << "compact bucket=" << bucket_no << " error!";
+      return -2;
     }
+    copied += size;
+    ++compacted;
   }
-  return 0;
+  LOG(INFO) << "Compaction happened, compacted buckets=" << compacted << "/"
+            << candidates.size() << ", copied keys=" << copied
+            << ", compacted num="
+            << cur_invert_ptr_->compacted_num_ - last_compacted_num
+            << ", total compacted num=" << cur_invert_ptr_->compacted_num_;
+  return compacted;
 }
 
-bool RealTimeMemData::ExtendBucketMem(const size_t &bucket_no, int increment) {
-  return AdjustBucketMem(bucket_no, 0, increment);
+float RealTimeMemData::CompactScore(int bucket_no, long scan_heat) {
+  size_t size = cur_invert_ptr_->buckets_[bucket_no].load()->size_;
+  int deleted = cur_invert_ptr_->deleted_nums_[bucket_no];
+  if (size == 0 || deleted <= 0) return 0;
+  // frequently scanned buckets pay more for their tombstones
+  return (float)deleted / size * (1 + log10f(1 + scan_heat));
 }
 
-bool RealTimeMemData::AdjustBucketMem(const size_t &bucket_no, int type,
-                                      int increment) {
-  extend_invert_ptr_ = new (std::nothrow) RTInvertBucketData(cur_invert_ptr_);
-  if (!extend_invert_ptr_) {
-    LOG(ERROR) << "memory extend_invert_ptr_ alloc error!";
-    return false;
+void RealTimeMemData::GetTombstoneRatios(std::vector<float> &ratios) {
+  ratios.resize(buckets_num_);
+  for (size_t i = 0; i < buckets_num_; i++) {
+    size_t size = cur_invert_ptr_->buckets_[i].load()->size_;
+    int deleted = cur_invert_ptr_->deleted_nums_[i];
+    ratios[i] = size == 0 ? 0 : (float)deleted / size;
   }
+}
 
-  long *old_idx_array = cur_invert_ptr_->idx_array_[bucket_no];
-  uint8_t *old_codes_array = cur_invert_ptr_->codes_array_[bucket_no];
-  int old_keys = cur_invert_ptr_->cur_bucket_keys_[bucket_no];
-  long free_size = old_keys * sizeof(long) +
-                   old_keys * code_bytes_per_vec_ * sizeof(uint8_t);
-
-  if (type == 0) {  // extend bucket
-    // WARNING:
-    // the above idx_array_ and codes_array_ pointer would be changed by
-    // extendBucketMem()
-    if (!extend_invert_ptr_->ExtendBucketMem(
-            bucket_no, increment, code_bytes_per_vec_, total_mem_bytes_)) {
-      LOG(ERROR) << "extendBucketMem error!";
-      return false;
-    }
-  } else {  // compact bucket
-    if (!extend_invert_ptr_->CompactBucket(bucket_no, code_bytes_per_vec_)) {
-      LOG(ERROR) << "compact error!";
-      return false;
-    }
-    free_size = 0;
+bool RealTimeMemData::CompactBucket(int bucket_no) {
+  RTBucketChunks *old_chunks = nullptr;
+  if (!cur_invert_ptr_->CompactBucket(bucket_no, code_bytes_per_vec_,
+                                      total_mem_bytes_, old_chunks)) {
+    LOG(ERROR) << "compact error!";
+    return false;
   }
-
-  RTInvertBucketData *old_invert_ptr = cur_invert_ptr_;
-  cur_invert_ptr_ = extend_invert_ptr_;
-
-  std::function<void(long *, uint8_t *, RTInvertBucketData *, long)> func_free =
-      std::bind(&RealTimeMemData::FreeOldData, this, std::placeholders::_1,
-                std::placeholders::_2, std::placeholders::_3,
-                std::placeholders::_4);
-
-  utils::AsyncWait(1000, func_free, old_idx_array, old_codes_array,
-                   old_invert_ptr, free_size);
-
-  old_idx_array = nullptr;
-  old_codes_array = nullptr;
-  old_invert_ptr = nullptr;
-  extend_invert_ptr_ = nullptr;
-
+  // searching threads may still scan the old chunks
+  RetireChunks(bucket_no, old_chunks, true);
   return true;
 }
 
-bool RealTimeMemData::GetIvtList(const size_t &bucket_no, long *&ivt_list,
-                                 uint8_t *&ivt_codes_list) {
-  ivt_list = cur_invert_ptr_->idx_array_[bucket_no];
-  ivt_codes_list = (uint8_t *)(cur_invert_ptr_->codes_array_[bucket_no]);
+int RealTimeMemData::ExtendBucketIfNeed(int bucket_no, size_t keys_size) {
+  RTBucketChunks *chunks = cur_invert_ptr_->buckets_[bucket_no];
+  size_t least = chunks->size_ + keys_size;
+  if (least <= chunks->Capacity()) return 0;
+
+  RTBucketChunks *old_chunks = nullptr;
+  bool ret = cur_invert_ptr_->ExtendBucketMem(
+      bucket_no, least, code_bytes_per_vec_, total_mem_bytes_, old_chunks);
+  if (old_chunks) {
+    // only the directory is replaced, chunks are shared with the new one
+    RetireChunks(bucket_no, old_chunks, false);
+  }
+  if (!ret) {
+    LOG(ERROR) << "extend bucket=" << bucket_no << " error, keys_size ["
+               << keys_size << "]";
+    return -2;
+  }
+  return 0;
+}
 
+bool RealTimeMemData::GetIvtList(const size_t &bucket_no,
+                                 RTBucketChunks *&chunks, size_t &size) {
+  chunks = cur_invert_ptr_->buckets_[bucket_no];
+  size = chunks->size_;
   return true;
 }
 
@@ -483,7 +601,7 @@ void RealTimeMemData::PrintBucketSize() {
   std::vector<std::pair<size_t, int>> buckets;
 
   for (size_t bucket_id = 0; bucket_id < buckets_num_; ++bucket_id) {
-    int bucket_size = cur_invert_ptr_->retrieve_idx_pos_[bucket_id];
+    int bucket_size = cur_invert_ptr_->buckets_[bucket_id].load()->size_;
     buckets.push_back(std::make_pair(bucket_id, bucket_size));
   }
 
@@ -503,12 +621,8 @@ void RealTimeMemData::PrintBucketSize() {
 
 void RealTimeMemData::RetrieveCodes(int bucket_no, int pos, int n,
                                     uint8_t *codes, long *vids) {
-  memcpy((void *)vids, (void *)(cur_invert_ptr_->idx_array_[bucket_no] + pos),
-         n * sizeof(long));
-
-  uint8_t *src_codes =
-      cur_invert_ptr_->codes_array_[bucket_no] + pos * code_bytes_per_vec_;
-  memcpy((void *)codes, (void *)src_codes, n * code_bytes_per_vec_);
+  RTBucketChunks *chunks = cur_invert_ptr_->buckets_[bucket_no];
+  chunks->Retrieve(pos, n, code_bytes_per_vec_, vids, codes);
 }
 
 }  // namespace realtime
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "raw_vector_common.h"
@@ -19,13 +20,72 @@ namespace tig_gamma {
 
 namespace realtime {
 
-#define PI 3.14159265
-
 const static long kDelIdxMask = (long)1 << 63;     // 0x8000000000000000
 const static long kRecoverIdxMask = ~kDelIdxMask;  // 0x7fffffffffffffff
+const static int kInitChunkSlots = 8;  // initial chunk directory slots
+// a bucket is compacted when tombstone ratio * scan heat factor reaches it
+const static float kCompactScore = 0.3f;
+
+// the id of a slot is published after its codes, readers load it with acquire
+inline long LoadId(const long *id) {
+  return __atomic_load_n(id, __ATOMIC_ACQUIRE);
+}
+
+inline void StoreId(long *id, long value) {
+  __atomic_store_n(id, value, __ATOMIC_RELEASE);
+}
+
+/** keys of a bucket are stored in fixed-size chunks, growing a bucket only
+ * allocates a new chunk and never moves the keys readers are scanning.
+ * Readers take the bucket pointer once and use its size_, the chunk
+ * directory is replaced (not modified) when it is full or compacted.
+ */
+struct RTBucketChunks {
+  RTBucketChunks(size_t chunk_keys, int capacity);
+  // only frees the directory, chunks are owned by the bucket data
+  ~RTBucketChunks();
+
+  long *Ids(size_t pos) const {
+    return idx_chunks_[pos / chunk_keys_] + pos % chunk_keys_;
+  }
+
+  uint8_t *Codes(size_t pos, size_t code_bytes_per_vec) const {
+    return codes_chunks_[pos / chunk_keys_] +
+           pos % chunk_keys_ * code_bytes_per_vec;
+  }
+
+  // number of keys of chunk chunk_no when the bucket holds size keys
+  size_t ChunkSize(int chunk_no, size_t size) const {
+    size_t begin = (size_t)chunk_no * chunk_keys_;
+    if (begin >= size) return 0;
+    return size - begin < chunk_keys_ ? size - begin : chunk_keys_;
+  }
+
+  size_t Capacity() const { return (size_t)chunk_num_ * chunk_keys_; }
+
+  // free the chunks, they are shared by the replaced directories
+  void FreeChunks(size_t code_bytes_per_vec);
+
+  // copy n keys starting at pos, ids or codes can be nullptr
+  void Retrieve(size_t pos, size_t n, size_t code_bytes_per_vec, long *ids,
+                uint8_t *codes) const;
+
+  long **idx_chunks_;
+  uint8_t **codes_chunks_;
+  int chunk_num_;  // allocated chunks
+  int capacity_;   // slots of the chunk directory
+  size_t chunk_keys_;
+  std::atomic<size_t> size_;  // total nb of realtime added indexed vectors
+};
+
+// chunks replaced in a bucket, they are freed once no search reads them
+struct RTRetiredChunks {
+  long epoch;  // of the bucket when they were replaced
+  RTBucketChunks *chunks;
+  bool free_chunks;  // false if only the directory was replaced
+};
 
 struct RTInvertBucketData {
-  RTInvertBucketData(RTInvertBucketData *other);
   RTInvertBucketData(VIDMgr *vid_mgr, const char *docids_bitmap);
 
   bool Init(const size_t &buckets_num, const size_t &bucket_keys,
@@ -33,33 +93,40 @@ struct RTInvertBucketData {
             std::atomic<long> &total_mem_bytes);
   ~RTInvertBucketData();
 
-  bool ExtendBucketMem(const size_t &bucket_no, const int &increment,
+  // old_chunks is set when the chunk directory of the bucket is replaced
+  bool ExtendBucketMem(const size_t &bucket_no, const size_t &least,
                        const size_t &code_bytes_per_vec,
-                       std::atomic<long> &total_mem_bytes);
+                       std::atomic<long> &total_mem_bytes,
+                       RTBucketChunks *&old_chunks);
 
-  bool CompactBucket(const size_t &bucket_no, const size_t &code_bytes_per_vec);
+  bool CompactBucket(const size_t &bucket_no, const size_t &code_bytes_per_vec,
+                     std::atomic<long> &total_mem_bytes,
+                     RTBucketChunks *&old_chunks);
 
   void Delete(int vid);
   void ExtendIDs();
 
  private:
-  inline void CompactOne(const size_t &bucket_no, long *&dst_idx,
-                         uint8_t *&dst_code, long *&src_idx, uint8_t *&src_code,
-                         int &pos, const size_t &code_bytes_per_vec);
-
-  double ExtendCoefficient(uint8_t extend_time);
+  bool AllocChunk(RTBucketChunks *chunks, const size_t &code_bytes_per_vec,
+                  std::atomic<long> &total_mem_bytes);
 
  public:
-  long **idx_array_;
-  size_t *retrieve_idx_pos_;  // total nb of realtime added indexed vectors
-  int *cur_bucket_keys_;
-  uint8_t *bucket_extend_time_;
-  uint8_t **codes_array_;
-  // int *dump_latest_pos_;
+  std::atomic<RTBucketChunks *> *buckets_;
   VIDMgr *vid_mgr_;
   const char *docids_bitmap_;
   std::atomic<long> *vid_bucket_no_pos_;
   std::atomic<int> *deleted_nums_;
+  std::atomic<long> *scan_heats_;  // scans of each bucket since last round
+  // a search enters the current epoch of a bucket, it is counted in the
+  // readers of the epoch parity (2 per bucket) until it leaves
+  std::atomic<long> *epochs_;
+  std::atomic<int> *readers_;
+  // tombstoned slots of each bucket which can be reused by updates
+  std::vector<std::vector<int>> free_slots_;
+  // (epoch, slot) tombstoned slots which a running search may still read,
+  // they become free once the searches entered before the epoch left
+  std::vector<std::vector<std::pair<long, int>>> pending_slots_;
+  std::vector<std::vector<RTRetiredChunks>> retired_chunks_;
   long compacted_num_;
   size_t buckets_num_;
   size_t nids_;
@@ -69,7 +136,6 @@ struct RealTimeMemData {
  public:
   RealTimeMemData(size_t buckets_num, VIDMgr *vid_mgr,
                   const char *docids_bitmap, size_t bucket_keys = 500,
-                  size_t bucket_keys_limit = 1000000,
                   size_t code_bytes_per_vec = 512 * sizeof(float));
   ~RealTimeMemData();
 
@@ -80,13 +146,39 @@ struct RealTimeMemData {
 
   int Update(int bucket_no, int vid, std::vector<uint8_t> &codes);
 
-  void FreeOldData(long *idx, uint8_t *codes, RTInvertBucketData *invert,
-                   long size);
+  /** update vids whose new codes belong to bucket_no, the codes are
+   * rewritten in place if the vid stays in the bucket, otherwise the old slot
+   * is tombstoned and a free slot of bucket_no is reused before appending
+   */
+  int Update(int bucket_no, std::vector<long> &vids,
+             std::vector<uint8_t> &codes);
+
+  void FreeOldData(RTBucketChunks *chunks, bool free_chunks);
   int ExtendBucketIfNeed(int bucket_no, size_t keys_size);
-  bool ExtendBucketMem(const size_t &bucket_no, int increment);
-  bool AdjustBucketMem(const size_t &bucket_no, int type, int increment = 0);
-  bool GetIvtList(const size_t &bucket_no, long *&ivt_list,
-                  uint8_t *&ivt_codes_list);
+  bool GetIvtList(const size_t &bucket_no, RTBucketChunks *&chunks,
+                  size_t &size);
+  void AddScanHeat(size_t bucket_no) {
+    cur_invert_ptr_->scan_heats_[bucket_no].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  /** a search holds the bucket from before it loads the ids until it is
+   * done, it returns the epoch parity to pass to LeaveBucket
+   */
+  int EnterBucket(size_t bucket_no) {
+    RTInvertBucketData *invert_ptr = cur_invert_ptr_;
+    int parity = invert_ptr->epochs_[bucket_no].load(
+                     std::memory_order_acquire) & 1;
+    invert_ptr->readers_[bucket_no * 2 + parity].fetch_add(1);
+    // pairs with the fences of DrainedEpoch
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return parity;
+  }
+
+  void LeaveBucket(size_t bucket_no, int parity) {
+    cur_invert_ptr_->readers_[bucket_no * 2 + parity].fetch_sub(
+        1, std::memory_order_release);
+  }
 
   long GetTotalMemBytes() { return total_mem_bytes_; }
 
@@ -95,17 +187,43 @@ struct RealTimeMemData {
 
   void PrintBucketSize();
 
-  int CompactIfNeed();
-  bool Compactable(int bucket_no);
+  /** compact the buckets by priority, tombstone ratio weighted by scan heat
+   *
+   * @param keys_budget  max keys copied in this round, 0 means no limit
+   * @return number of compacted buckets, < 0 if error
+   */
+  int CompactIfNeed(size_t keys_budget = 0);
+  float CompactScore(int bucket_no, long scan_heat);
   bool CompactBucket(int bucket_no);
   int Delete(int *vids, int n);
 
+  // tombstone ratio of each bucket
+  void GetTombstoneRatios(std::vector<float> &ratios);
+
+ private:
+  bool AppendKeys(size_t list_no, std::vector<long> &keys,
+                  std::vector<uint8_t> &keys_codes);
+
+  /** by write_mutex_, the slots and chunks retired in an epoch before the
+   * returned one are not read by any search. It moves the bucket to the next
+   * epoch when the searches of the previous one left.
+   */
+  long DrainedEpoch(int bucket_no);
+
+  // by write_mutex_, free the pending slots and retired chunks of the bucket
+  // which no search reads
+  void ReclaimBucket(int bucket_no);
+
+  // by write_mutex_, the chunks are freed by ReclaimBucket
+  void RetireChunks(int bucket_no, RTBucketChunks *chunks, bool free_chunks);
+
+ public:
   RTInvertBucketData *cur_invert_ptr_;
-  RTInvertBucketData *extend_invert_ptr_;
+  // serializes writers (add, update, compaction and loading) of the buckets
+  std::mutex write_mutex_;
 
   size_t buckets_num_;  // count of buckets
-  size_t bucket_keys_;  // max bucket keys
-  size_t bucket_keys_limit_;
+  size_t bucket_keys_;  // keys of each bucket chunk
 
   size_t code_bytes_per_vec_;
   std::atomic<long> total_mem_bytes_;
@@ -9,30 +9,33 @@
 
 #include <fcntl.h>
 #include <locale.h>
-#ifndef __APPLE__
-#include <malloc.h>
-#endif
 #include <string.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "bitmap.h"
+#include "cache_quota.h"
 #include "cJSON.h"
 #include "error_code.h"
 #include "gamma_common_data.h"
 #include "gamma_table_io.h"
+#include "large_alloc.h"
 #include "log.h"
 #include "omp.h"
 #include "raw_vector_io.h"
+#include "search_stats.h"
+#include "thread_util.h"
 #include "utils.h"
 
 using std::string;
@@ -40,44 +43,184 @@ using namespace tig_gamma::table;
 
 namespace tig_gamma {
 
-bool RequestConcurrentController::Acquire(int req_num) {
-#ifndef __APPLE__
-  int num = __sync_fetch_and_add(&cur_concurrent_num_, req_num);
+static const SearchPriority kSearchPriorityOrder[kSearchPriorityNum] = {
+    SearchPriority::High, SearchPriority::Normal, SearchPriority::Low};
 
-  if (num < concurrent_threshold_) {
+bool RequestConcurrentController::Acquire(long &cost, SearchPriority priority,
+                                          int timeout_ms, int table_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // a search costlier than the capacity runs alone
+  if (cost > capacity_) cost = capacity_;
+  if (cost < 1) cost = 1;
+
+  // it doesn't overtake the waiters of the same or a higher priority
+  bool waiting = false;
+  for (SearchPriority p : kSearchPriorityOrder) {
+    if (queues_[(int)p].size() > 0) waiting = true;
+    if (p == priority) break;
+  }
+  if (!waiting && used_ + cost <= capacity_) {
+    Admit(cost, table_id);
     return true;
-  } else {
-    LOG(WARNING) << "cur_threads_num [" << num << "] concurrent_threshold ["
-                 << concurrent_threshold_ << "]";
+  }
+
+  if (timeout_ms == 0) timeout_ms = timeout_ms_;
+  int shed_size =
+      priority == SearchPriority::Low ? queue_size_ / 2 : queue_size_;
+  TableUsage &usage = tables_[table_id];
+  // half of the queue is left to the other tables
+  bool table_full = tables_.size() > 1 && usage.waiting >= queue_size_ / 2;
+  if (timeout_ms < 0 || waiting_num_ >= shed_size || table_full) {
+    usage.rejected++;
+    LOG(WARNING) << "search rejected, used [" << used_ << "] capacity ["
+                 << capacity_ << "] waiting [" << waiting_num_ << "]";
     return false;
   }
-#else
+
+  Waiter waiter;
+  waiter.cost = cost;
+  waiter.table_id = table_id;
+  waiter.admitted = false;
+  std::deque<Waiter *> &queue = queues_[(int)priority];
+  queue.push_back(&waiter);
+  ++waiting_num_;
+  usage.waiting++;
+  usage.queued++;
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeout_ms);
+  while (!waiter.admitted) {
+    if (waiter.cv.wait_until(lock, deadline) == std::cv_status::timeout &&
+        !waiter.admitted) {
+      queue.erase(std::find(queue.begin(), queue.end(), &waiter));
+      --waiting_num_;
+      tables_[table_id].waiting--;
+      tables_[table_id].timed_out++;
+      // the later waiters may fit now
+      Dispatch();
+      LOG(WARNING) << "search timed out in the queue, timeout [" << timeout_ms
+                   << "]ms cost [" << cost << "]";
+      return false;
+    }
+  }
   return true;
-#endif
 }
 
-void RequestConcurrentController::Release(int req_num) {
-#ifndef __APPLE__
-  __sync_fetch_and_sub(&cur_concurrent_num_, req_num);
-#else
-  return;
-#endif
+void RequestConcurrentController::Release(long cost, int table_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  used_ -= cost;
+  --running_;
+  tables_[table_id].used -= cost;
+  Dispatch();
+}
+
+void RequestConcurrentController::Admit(long cost, int table_id) {
+  TableUsage &usage = tables_[table_id];
+  used_ += cost;
+  ++running_;
+  usage.used += cost;
+  usage.admitted++;
+}
+
+void RequestConcurrentController::Dispatch() {
+  for (SearchPriority priority : kSearchPriorityOrder) {
+    std::deque<Waiter *> &queue = queues_[(int)priority];
+    while (queue.size() > 0) {
+      auto pick = queue.begin();
+      long pick_used = tables_[(*pick)->table_id].used;
+      for (auto it = pick + 1; it != queue.end(); ++it) {
+        long used = tables_[(*it)->table_id].used;
+        if (used < pick_used) {
+          pick = it;
+          pick_used = used;
+        }
+      }
+      Waiter *waiter = *pick;
+      if (used_ + waiter->cost > capacity_) return;
+      Admit(waiter->cost, waiter->table_id);
+      waiter->admitted = true;
+      queue.erase(pick);
+      --waiting_num_;
+      tables_[waiter->table_id].waiting--;
+      waiter->cv.notify_one();
+    }
+  }
+}
+
+int RequestConcurrentController::RegisterTable() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int table_id = next_table_id_++;
+  tables_[table_id] = TableUsage();
+  return table_id;
+}
+
+void RequestConcurrentController::UnregisterTable(int table_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  tables_.erase(table_id);
+}
+
+void RequestConcurrentController::SetLimits(long capacity, int queue_size,
+                                            int timeout_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (capacity > 0) capacity_ = capacity;
+  if (queue_size > 0) queue_size_ = queue_size;
+  if (timeout_ms > 0) timeout_ms_ = timeout_ms;
+  Dispatch();
+  LOG(INFO) << "search admission capacity [" << capacity_ << "] queue size ["
+            << queue_size_ << "] timeout [" << timeout_ms_ << "]ms";
+}
+
+void RequestConcurrentController::GetLimits(long &capacity, int &queue_size,
+                                            int &timeout_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity = capacity_;
+  queue_size = queue_size_;
+  timeout_ms = timeout_ms_;
+}
+
+void RequestConcurrentController::GetStats(int table_id, long &admitted,
+                                           long &queued, long &timed_out,
+                                           long &rejected) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const TableUsage &usage = tables_[table_id];
+  admitted = usage.admitted;
+  queued = usage.queued;
+  timed_out = usage.timed_out;
+  rejected = usage.rejected;
+}
+
+int RequestConcurrentController::SearchThreads() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int running = running_ > 0 ? running_ : 1;
+  return std::max(1, search_threads_ / running);
+}
+
+int RequestConcurrentController::Running() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_ + waiting_num_;
 }
 
 RequestConcurrentController::RequestConcurrentController() {
   concurrent_threshold_ = 0;
   max_threads_ = 0;
-  cur_concurrent_num_ = 0;
+  search_threads_ = omp_get_max_threads();
+  waiting_num_ = 0;
+  running_ = 0;
+  used_ = 0;
+  queue_size_ = kDefaultSearchQueueSize;
+  timeout_ms_ = kDefaultSearchTimeoutMs;
+  next_table_id_ = 0;
   GetMaxThread();
+  capacity_ = concurrent_threshold_ > 0 ? concurrent_threshold_ : 1;
 }
 
 int RequestConcurrentController::GetMaxThread() {
 #ifndef __APPLE__
   // Get system config and calculate max threads
   int omp_max_threads = omp_get_max_threads();
-  int threads_max = GetSystemInfo("cat /proc/sys/kernel/threads-max");
-  int max_map_count = GetSystemInfo("cat /proc/sys/vm/max_map_count");
-  int pid_max = GetSystemInfo("cat /proc/sys/kernel/pid_max");
+  int threads_max = GetSystemInfo("/proc/sys/kernel/threads-max");
+  int max_map_count = GetSystemInfo("/proc/sys/vm/max_map_count");
+  int pid_max = GetSystemInfo("/proc/sys/kernel/pid_max");
   LOG(INFO) << "System info: threads_max [" << threads_max
             << "] max_map_count [" << max_map_count << "] pid_max [" << pid_max
             << "]";
@@ -92,28 +235,65 @@ int RequestConcurrentController::GetMaxThread() {
   }
   return max_threads_;
 #else
+  concurrent_threshold_ = kDefaultSearchQueueSize;
   return 0;
 #endif
 }
 
-int RequestConcurrentController::GetSystemInfo(const char *cmd) {
-  int num = 0;
-
-  char buff[1024];
-  memset(buff, 0, sizeof(buff));
-
-  FILE *fstream = popen(cmd, "r");
-  if (fstream == nullptr) {
-    LOG(ERROR) << "execute command failed: " << strerror(errno);
+int RequestConcurrentController::GetSystemInfo(const char *path) {
+  int num = -1;
+  std::ifstream f(path);
+  if (!f.is_open() || !(f >> num)) {
+    LOG(ERROR) << "read system info failed, path=" << path;
     num = -1;
-  } else {
-    fgets(buff, sizeof(buff), fstream);
-    num = atoi(buff);
-    pclose(fstream);
   }
   return num;
 }
 
+IndexingScheduler::IndexingScheduler() {
+  next_ticket_ = 0;
+  running_ = 0;
+  slots_ = std::max(1, omp_get_max_threads() / kIndexingThreadsPerSlot);
+  LOG(INFO) << "indexing scheduler slots [" << slots_ << "]";
+}
+
+void IndexingScheduler::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  long ticket = next_ticket_++;
+  tickets_.push_back(ticket);
+  cv_.wait(lock, [this, ticket] {
+    return running_ < slots_ && tickets_.front() == ticket;
+  });
+  tickets_.pop_front();
+  ++running_;
+  // the next ticket may fit too
+  cv_.notify_all();
+}
+
+void IndexingScheduler::Release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+  }
+  cv_.notify_all();
+}
+
+// cost of a search in admission units
+static long SearchCost(Request &request) {
+  long nprobe = 80;
+  cJSON *params = cJSON_Parse(request.RetrievalParams().c_str());
+  if (params != nullptr) {
+    cJSON *item = cJSON_GetObjectItem(params, "nprobe");
+    if (item != nullptr && cJSON_IsNumber(item) && item->valueint > 0) {
+      nprobe = item->valueint;
+    }
+    cJSON_Delete(params);
+  }
+  long work = std::max(request.TopN(), 1) * nprobe;
+  return request.ReqNum() *
+         std::max(1L, (work + kSearchUnitWork - 1) / kSearchUnitWork);
+}
+
 #ifdef DEBUG
 static string float_array_to_string(float *data, int len) {
   if (data == nullptr) return "";
@@ -158,21 +338,40 @@ static string VectorQueryToString(VectorQuery *vector_query) {
 #endif  // DEBUG
 
 #ifndef __APPLE__
-static std::thread *gMemTrimThread = nullptr;
-void MemTrimHandler() {
-  LOG(INFO) << "memory trim thread start......";
+// the free memory is returned while no search is running, or after
+// kMemReclaimMaxDeferMs if the engine is never idle. The malloc heap is
+// only trimmed while idle, the forced reclaim returns the arenas
+const static int kMemReclaimIntervalMs = 1000;
+const static int kMemReclaimMaxDeferMs = 60 * 1000;
+const static size_t kMemReclaimRetainBytes = 256UL << 20;
+
+static std::thread *gMemReclaimThread = nullptr;
+void MemReclaimHandler() {
+  LOG(INFO) << "memory reclaim thread start......";
+  double last_ms = utils::getmillisecs();
   while (1) {
-    malloc_trim(0);
-    std::this_thread::sleep_for(std::chrono::seconds(60));  // 1 minute
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kMemReclaimIntervalMs));
+    double now_ms = utils::getmillisecs();
+    bool idle = RequestConcurrentController::GetInstance().Running() == 0;
+    if (not idle && now_ms - last_ms < kMemReclaimMaxDeferMs) {
+      continue;
+    }
+    size_t returned = large_alloc::Reclaim(kMemReclaimRetainBytes, idle);
+    double end_ms = utils::getmillisecs();
+    if (returned > 0) {
+      LOG(INFO) << "memory reclaim returned [" << (returned >> 20)
+                << "]M, cost [" << end_ms - now_ms << "]ms";
+    }
+    last_ms = end_ms;
   }
-  LOG(INFO) << "memory trim thread exit!";
+  LOG(INFO) << "memory reclaim thread exit!";
 }
 #endif
 
 GammaEngine::GammaEngine(const string &index_root_path)
     : index_root_path_(index_root_path),
       date_time_format_("%Y-%m-%d-%H:%M:%S") {
-  docids_bitmap_ = nullptr;
   table_ = nullptr;
   vec_manager_ = nullptr;
   index_status_ = IndexStatus::UNINDEXED;
@@ -180,7 +379,6 @@ GammaEngine::GammaEngine(const string &index_root_path)
   b_running_ = 0;
   b_field_running_ = false;
   is_dirty_ = false;
-  bitmap_bytes_size_ = 0;
   field_range_index_ = nullptr;
   created_table_ = false;
   b_loading_ = false;
@@ -188,11 +386,26 @@ GammaEngine::GammaEngine(const string &index_root_path)
   search_num_ = 0;
 #endif
   af_exector_ = nullptr;
+  indexing_pending_ = false;
+  unindexed_since_ms_ = 0;
+  indexing_since_ms_ = 0;
+  indexing_freshness_ms_ = kDefaultIndexingFreshnessMs;
+  search_trace_sample_ = 0;
+  search_seq_ = 0;
+  next_cursor_id_ = 1;
+  wal_ = nullptr;
+  wal_sync_policy_ = disk_io::SyncPolicy::Interval;
+  pthread_rwlock_init(&wal_apply_lock_, nullptr);
+  table_id_ = RequestConcurrentController::GetInstance().RegisterTable();
 }
 
 GammaEngine::~GammaEngine() {
   if (b_running_) {
-    b_running_ = 0;
+    {
+      std::lock_guard<std::mutex> lk(indexing_mutex_);
+      b_running_ = 0;
+    }
+    indexing_cv_.notify_one();
     std::mutex running_mutex;
     std::unique_lock<std::mutex> lk(running_mutex);
     running_cv_.wait(lk);
@@ -220,15 +433,13 @@ GammaEngine::~GammaEngine() {
     table_ = nullptr;
   }
 
-  if (docids_bitmap_) {
-    delete docids_bitmap_;
-    docids_bitmap_ = nullptr;
-  }
-
   if (field_range_index_) {
     delete field_range_index_;
     field_range_index_ = nullptr;
   }
+  CHECK_DELETE(wal_);
+  pthread_rwlock_destroy(&wal_apply_lock_);
+  RequestConcurrentController::GetInstance().UnregisterTable(table_id_);
 }
 
 GammaEngine *GammaEngine::GetInstance(const string &index_root_path) {
@@ -251,37 +462,36 @@ int GammaEngine::Setup() {
     mkdir(dump_path_.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
   }
 
-  if (!docids_bitmap_) {
-    if (bitmap::create(docids_bitmap_, bitmap_bytes_size_,
-                       std::numeric_limits<int>::max()) != 0) {
+  if (!docids_bitmap_.Data()) {
+    if (docids_bitmap_.Init(std::numeric_limits<int>::max()) != 0) {
       LOG(ERROR) << "Cannot create bitmap!";
       return INTERNAL_ERR;
     }
   }
 
   if (!table_) {
-    table_ = new Table(index_root_path_);
+    table_ = new Table(index_root_path_, false, table_id_);
   }
 
   if (!vec_manager_) {
-    vec_manager_ = new VectorManager(VectorStorageType::Mmap, docids_bitmap_,
-                                     index_root_path_);
+    vec_manager_ =
+        new VectorManager(VectorStorageType::Mmap, docids_bitmap_.Data(),
+                          index_root_path_, table_id_);
   }
 
 #ifndef __APPLE__
-  if (gMemTrimThread == nullptr) {
-    gMemTrimThread = new std::thread(MemTrimHandler);
-    if (gMemTrimThread) {
-      gMemTrimThread->detach();
+  if (gMemReclaimThread == nullptr) {
+    gMemReclaimThread = new std::thread(MemReclaimHandler);
+    if (gMemReclaimThread) {
+      gMemReclaimThread->detach();
     } else {
-      LOG(ERROR) << "create memory trim thread error";
+      LOG(ERROR) << "create memory reclaim thread error";
     }
   }
 #endif
 
   max_docid_ = 0;
-  LOG(INFO) << "GammaEngine setup successed! bitmap_bytes_size="
-            << bitmap_bytes_size_;
+  LOG(INFO) << "GammaEngine setup successed!";
   return 0;
 }
 
@@ -299,12 +509,33 @@ int GammaEngine::Search(Request &request, Response &response_results) {
     return -1;
   }
 
-  bool req_permit = RequestConcurrentController::GetInstance().Acquire(req_num);
+  long cost = SearchCost(request);
+  int priority = request.Priority();
+  if (priority < 0 || priority >= kSearchPriorityNum) priority = 0;
+  bool req_permit = RequestConcurrentController::GetInstance().Acquire(
+      cost, (SearchPriority)priority, request.TimeoutMs(), table_id_);
   if (not req_permit) {
     LOG(WARNING) << "Resource temporarily unavailable";
-    RequestConcurrentController::GetInstance().Release(req_num);
     return -1;
   }
+  ScopeAdmission admission(cost, table_id_);
+  // the vectors are on the bound numa node, they are scanned from its cpus.
+  // The workers of the caller's thread are pinned by its first search, the
+  // caller is not the engine's thread and gets its affinity back after
+  large_alloc::PinOmpThreads();
+  large_alloc::ScopePin pin;
+
+  // the stage latencies are always recorded in search_stats_
+  long stage_us[search_stats::kStageNum] = {0};
+  double start_ms = utils::getmillisecs();
+  double stage_begin_ms = start_ms;
+  auto end_stage = [&](search_stats::Stage stage) {
+    double now_ms = utils::getmillisecs();
+    long us = (long)((now_ms - stage_begin_ms) * 1000);
+    search_stats_.Record(stage, us);
+    stage_us[(int)stage] += us;
+    stage_begin_ms = now_ms;
+  };
 
   // TODO: it may be opened later
   // utils::OnlineLogger logger;
@@ -324,7 +555,6 @@ int GammaEngine::Search(Request &request, Response &response_results) {
       result.result_code = SearchResultCode::INDEX_NOT_TRAINED;
       response_results.AddResults(std::move(result));
     }
-    RequestConcurrentController::GetInstance().Release(req_num);
     return -2;
   }
 
@@ -340,6 +570,9 @@ int GammaEngine::Search(Request &request, Response &response_results) {
   gamma_query.condition->l2_sqrt = request.L2Sqrt();
   gamma_query.condition->retrieval_parameters = request.RetrievalParams();
   gamma_query.condition->has_rank = request.HasRank();
+  gamma_query.condition->SetSearchThreads(
+      RequestConcurrentController::GetInstance().SearchThreads());
+  gamma_query.condition->SetSearchStats(&search_stats_);
 
 #ifdef BUILD_GPU
   gamma_query.condition->range_filters = request.RangeFilters();
@@ -357,8 +590,8 @@ int GammaEngine::Search(Request &request, Response &response_results) {
   if (range_filters_num > 0 || term_filters_num > 0) {
     int num = MultiRangeQuery(request, gamma_query.condition, response_results,
                               &range_query_result);
+    end_stage(search_stats::Stage::Filter);
     if (num == 0) {
-      RequestConcurrentController::GetInstance().Release(req_num);
       return 0;
     }
   }
@@ -377,6 +610,7 @@ int GammaEngine::Search(Request &request, Response &response_results) {
     }
 
     ret = vec_manager_->Search(gamma_query, gamma_results);
+    end_stage(search_stats::Stage::Search);
     if (ret != 0) {
       string msg = "search error [" + std::to_string(ret) + "]";
       for (int i = 0; i < req_num; ++i) {
@@ -385,14 +619,17 @@ int GammaEngine::Search(Request &request, Response &response_results) {
         result.result_code = SearchResultCode::SEARCH_ERROR;
         response_results.AddResults(std::move(result));
       }
-      RequestConcurrentController::GetInstance().Release(req_num);
       return -3;
     }
 
 #ifdef PERFORMANCE_TESTING
     gamma_query.condition->GetPerfTool().Perf("search total");
 #endif
-    PackResults(gamma_results, response_results, request);
+    ResultFields result_fields;
+    GetResultFields(request, result_fields);
+    PackResults(gamma_results, req_num, result_fields, response_results,
+                gamma_query.condition->SearchThreads());
+    end_stage(search_stats::Stage::Pack);
 #ifdef PERFORMANCE_TESTING
     gamma_query.condition->GetPerfTool().Perf("pack results");
 #endif
@@ -445,7 +682,7 @@ int GammaEngine::Search(Request &request, Response &response_results) {
       gamma_result.init(topn, nullptr, 0);
       for (int docid = 0; docid < max_docid_; ++docid) {
         if (range_query_result.Has(docid) &&
-            !bitmap::test(docids_bitmap_, docid)) {
+            !docids_bitmap_.Test(docid)) {
           ++gamma_result.total;
           if (gamma_result.results_count < topn) {
             gamma_result.docs[gamma_result.results_count++]->docid = docid;
@@ -453,11 +690,27 @@ int GammaEngine::Search(Request &request, Response &response_results) {
         }
       }
     }
+    end_stage(search_stats::Stage::Filter);
     // response_results.req_num = 1;  // only one result
-    PackResults(&gamma_result, response_results, request);
+    ResultFields result_fields;
+    GetResultFields(request, result_fields);
+    PackResults(&gamma_result, 1, result_fields, response_results,
+                gamma_query.condition->SearchThreads());
+    end_stage(search_stats::Stage::Pack);
   }
 #endif
 
+  long total_us = (long)((utils::getmillisecs() - start_ms) * 1000);
+  search_stats_.Record(search_stats::Stage::Total, total_us);
+  int trace_sample = search_trace_sample_;
+  if (trace_sample > 0 && search_seq_.fetch_add(1) % trace_sample == 0) {
+    LOG(INFO) << "search trace: req_num [" << req_num << "] filter ["
+              << stage_us[(int)search_stats::Stage::Filter] << "]us search ["
+              << stage_us[(int)search_stats::Stage::Search] << "]us pack ["
+              << stage_us[(int)search_stats::Stage::Pack] << "]us total ["
+              << total_us << "]us";
+  }
+
 #ifdef PERFORMANCE_TESTING
   LOG(INFO) << gamma_query.condition->GetPerfTool().OutputPerf().str();
 #endif
@@ -468,7 +721,6 @@ int GammaEngine::Search(Request &request, Response &response_results) {
         gamma_query.condition->GetPerfTool().OutputPerf().str());
   }
 
-  RequestConcurrentController::GetInstance().Release(req_num);
   return ret;
 }
 
@@ -476,6 +728,27 @@ int GammaEngine::MultiRangeQuery(Request &request,
                                  GammaSearchCondition *condition,
                                  Response &response_results,
                                  MultiRangeQueryResults *range_query_result) {
+  int retval = RangeQuery(request, range_query_result);
+
+  if (retval == 0) {
+    string msg = "No result: numeric filter return 0 result";
+    LOG(INFO) << msg;
+    for (int i = 0; i < request.ReqNum(); ++i) {
+      SearchResult result;
+      result.msg = msg;
+      result.result_code = SearchResultCode::SUCCESS;
+      response_results.AddResults(std::move(result));
+    }
+  } else if (retval < 0) {
+    condition->range_query_result = nullptr;
+  } else {
+    condition->range_query_result = range_query_result;
+  }
+  return retval;
+}
+
+int GammaEngine::RangeQuery(Request &request,
+                            MultiRangeQueryResults *range_query_result) {
   std::vector<FilterInfo> filters;
   std::vector<struct RangeFilter> &range_filters = request.RangeFilters();
   std::vector<struct TermFilter> &term_filters = request.TermFilters();
@@ -506,23 +779,130 @@ int GammaEngine::MultiRangeQuery(Request &request,
     ++idx;
   }
 
-  int retval = field_range_index_->Search(filters, range_query_result);
+  return field_range_index_->Search(filters, range_query_result);
+}
 
-  if (retval == 0) {
-    string msg = "No result: numeric filter return 0 result";
-    LOG(INFO) << msg;
-    for (int i = 0; i < request.ReqNum(); ++i) {
-      SearchResult result;
-      result.msg = msg;
-      result.result_code = SearchResultCode::SUCCESS;
-      response_results.AddResults(std::move(result));
+// cost of a cursor page in admission units
+static long CursorPageCost(int page_size) {
+  return std::max(1L, (page_size + kSearchUnitWork - 1) / kSearchUnitWork);
+}
+
+int GammaEngine::OpenCursor(Request &request, long &cursor_id) {
+  if (request.VecFields().size() > 0) {
+    LOG(ERROR) << "vector query is not supported by cursor";
+    return -1;
+  }
+  std::shared_ptr<SearchCursor> cursor(new (std::nothrow) SearchCursor);
+  if (cursor == nullptr) {
+    LOG(ERROR) << "new search cursor error";
+    return -1;
+  }
+  cursor->priority = request.Priority();
+  if (cursor->priority < 0 || cursor->priority >= kSearchPriorityNum) {
+    cursor->priority = 0;
+  }
+  cursor->timeout_ms = request.TimeoutMs();
+
+  // the filter is evaluated like a search
+  long cost = CursorPageCost(kMaxCursorPageSize);
+  if (!RequestConcurrentController::GetInstance().Acquire(
+          cost, (SearchPriority)cursor->priority, cursor->timeout_ms,
+          table_id_)) {
+    LOG(WARNING) << "Resource temporarily unavailable";
+    return -3;
+  }
+  ScopeAdmission admission(cost, table_id_);
+  cursor->has_filter =
+      request.RangeFilters().size() > 0 || request.TermFilters().size() > 0;
+  cursor->next_docid = 0;
+  cursor->end_docid = max_docid_;
+  if (cursor->has_filter) {
+    int num = RangeQuery(request, &cursor->range_result);
+    if (num < 0) {
+      LOG(ERROR) << "cursor filter error, ret=" << num;
+      return -1;
     }
-  } else if (retval < 0) {
-    condition->range_query_result = nullptr;
-  } else {
-    condition->range_query_result = range_query_result;
+    // the range of the results doesn't bound a "not in" term filter
+    if (num == 0) cursor->end_docid = 0;
   }
-  return retval;
+  GetResultFields(request, cursor->result_fields);
+  cursor->last_ms = utils::getmillisecs();
+
+  std::lock_guard<std::mutex> lock(cursors_mutex_);
+  for (auto it = cursors_.begin(); it != cursors_.end();) {
+    if (cursor->last_ms - it->second->last_ms > kCursorIdleMs) {
+      LOG(INFO) << "cursor [" << it->first << "] is idle, closed";
+      it = cursors_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (cursors_.size() >= (size_t)kMaxCursors) {
+    LOG(ERROR) << "too many cursors [" << cursors_.size() << "]";
+    return -2;
+  }
+  cursor_id = next_cursor_id_++;
+  cursors_[cursor_id] = cursor;
+  return 0;
+}
+
+int GammaEngine::CursorNext(long cursor_id, int page_size,
+                            Response &response_results) {
+  std::shared_ptr<SearchCursor> cursor;
+  {
+    std::lock_guard<std::mutex> lock(cursors_mutex_);
+    auto it = cursors_.find(cursor_id);
+    if (it == cursors_.end()) {
+      LOG(ERROR) << "cursor [" << cursor_id << "] not found";
+      return -1;
+    }
+    cursor = it->second;
+  }
+  if (page_size <= 0 || page_size > kMaxCursorPageSize) {
+    LOG(ERROR) << "page size [" << page_size << "] should be in (0, "
+               << kMaxCursorPageSize << "]";
+    return -2;
+  }
+
+  long cost = CursorPageCost(page_size);
+  if (!RequestConcurrentController::GetInstance().Acquire(
+          cost, (SearchPriority)cursor->priority, cursor->timeout_ms,
+          table_id_)) {
+    LOG(WARNING) << "Resource temporarily unavailable";
+    return -4;
+  }
+  ScopeAdmission admission(cost, table_id_);
+
+  std::lock_guard<std::mutex> lock(cursor->mutex);
+  cursor->last_ms = utils::getmillisecs();
+  GammaResult gamma_result;
+  if (!gamma_result.init(page_size, nullptr, 0)) {
+    LOG(ERROR) << "init cursor page error, page size=" << page_size;
+    return -3;
+  }
+  int docid = cursor->next_docid;
+  for (; docid < cursor->end_docid && gamma_result.results_count < page_size;
+       ++docid) {
+    if (docids_bitmap_.Test(docid)) continue;
+    if (cursor->has_filter && !cursor->range_result.Has(docid)) continue;
+    gamma_result.docs[gamma_result.results_count++]->docid = docid;
+  }
+  cursor->next_docid = docid;
+  gamma_result.total = gamma_result.results_count;
+
+  int threads = RequestConcurrentController::GetInstance().SearchThreads();
+  PackResults(&gamma_result, 1, cursor->result_fields, response_results,
+              threads);
+  return gamma_result.results_count;
+}
+
+int GammaEngine::CloseCursor(long cursor_id) {
+  std::lock_guard<std::mutex> lock(cursors_mutex_);
+  if (cursors_.erase(cursor_id) == 0) {
+    LOG(ERROR) << "cursor [" << cursor_id << "] not found";
+    return -1;
+  }
+  return 0;
 }
 
 int GammaEngine::CreateTable(TableInfo &table) {
@@ -572,6 +952,17 @@ int GammaEngine::CreateTable(TableInfo &table) {
 
   af_exector_ = new AsyncFlushExecutor();
 
+  string wal_dir = index_root_path_ + "/wal";
+  if (!meta_jp && utils::isFolderExist(wal_dir.c_str())) {
+    // logs of a former table
+    utils::remove_dir(wal_dir.c_str());
+  }
+  wal_ = new WriteAheadLog(wal_dir);
+  if (wal_->Open(wal_sync_policy_)) {
+    LOG(ERROR) << "open wal error, dir=" << wal_dir;
+    return -2;
+  }
+
   if (!meta_jp) {
     utils::JsonParser dump_meta_;
     dump_meta_.PutInt("version", 320);  // version=3.2.0
@@ -623,7 +1014,10 @@ int GammaEngine::CreateTable(TableInfo &table) {
     LOG(ERROR) << "write table schema error, path=" << path;
   }
 
-  af_exector_->Start();
+  if (af_exector_->Start()) {
+    LOG(ERROR) << "start async flush error";
+    return -2;
+  }
 
   LOG(INFO) << "create table [" << table_name << "] success!";
   created_table_ = true;
@@ -631,6 +1025,18 @@ int GammaEngine::CreateTable(TableInfo &table) {
 }
 
 int GammaEngine::AddOrUpdate(Doc &doc) {
+  if (vec_manager_->CheckFields(doc.VectorFields())) return -4;
+  // the doc is logged before it is applied, a failed apply aborts it
+  ReadThreadLock wal_lock(wal_apply_lock_);
+  std::vector<Doc *> docs{&doc};
+  long lsn = 0;
+  if (LogDocs(docs, lsn)) return -5;
+  int ret = ApplyDoc(doc);
+  if (ret) AbortDocs(std::vector<long>{lsn});
+  return ret;
+}
+
+int GammaEngine::ApplyDoc(Doc &doc) {
 #ifdef PERFORMANCE_TESTING
   double start = utils::getmillisecs();
 #endif
@@ -656,6 +1062,7 @@ int GammaEngine::AddOrUpdate(Doc &doc) {
       LOG(ERROR) << "update error, key=" << key << ", docid=" << docid;
       return -3;
     }
+    NotifyIndexing();
     is_dirty_ = true;
     return 0;
   }
@@ -669,6 +1076,7 @@ int GammaEngine::AddOrUpdate(Doc &doc) {
     return -4;
   }
   ++max_docid_;
+  NotifyIndexing();
 
   if (not b_running_ and index_status_ == UNINDEXED) {
     if (max_docid_ >= indexing_size_) {
@@ -692,65 +1100,147 @@ int GammaEngine::AddOrUpdateDocs(Docs &docs, BatchResult &result) {
   double start = utils::getmillisecs();
 #endif
   std::vector<Doc> &doc_vec = docs.GetDocs();
-  int batch_size = 0, start_id = 0;
-
-  auto batchAdd = [&](int start_id, int batch_size) {
-    if (batch_size <= 0) return;
+  int n = doc_vec.size();
 
-    int ret =
-        table_->BatchAdd(start_id, batch_size, max_docid_, doc_vec, result);
-    if (ret != 0) {
-      LOG(ERROR) << "Add to table error";
-      return;
+  // resolve the keys in parallel, the key map is concurrent
+  std::vector<int> docids(n, -1);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    table_->GetDocIDByKey(doc_vec[i].Key(), docids[i]);
+  }
+
+  // reserve a docid range for the new keys, a key repeated in the batch
+  // updates the doc added by its first occurrence. Invalid docs are
+  // rejected before they are logged.
+  std::vector<int> add_idxs, update_idxs;
+  std::vector<Doc *> log_docs;
+  std::vector<int> log_idxs;
+  std::unordered_map<std::string, int> batch_keys;
+  for (int i = 0; i < n; ++i) {
+    if (vec_manager_->CheckFields(doc_vec[i].VectorFields())) {
+      result.SetResult(i, -1, "invalid vector field");
+      continue;
+    }
+    std::string &key = doc_vec[i].Key();
+    if (docids[i] == -1 && key.size() == 0) {
+      result.SetResult(i, -1, "Add item error : _id is null!");
+      continue;
+    }
+    // a new key is added with every field, an update may carry some of them
+    size_t field_num = doc_vec[i].TableFields().size();
+    if (docids[i] == -1 && batch_keys.count(key) == 0 &&
+        field_num != (size_t)table_->FieldsNum()) {
+      result.SetResult(i, -1, "Field num [" + std::to_string(field_num) +
+                                  "] not equal to [" +
+                                  std::to_string(table_->FieldsNum()) + "]");
+      continue;
+    }
+    log_docs.push_back(&doc_vec[i]);
+    log_idxs.push_back(i);
+    if (docids[i] == -1) {
+      int docid = max_docid_ + add_idxs.size();
+      auto res = batch_keys.emplace(key, docid);
+      if (!res.second) {
+        docids[i] = res.first->second;
+        update_idxs.push_back(i);
+        continue;
+      }
+      docids[i] = docid;
+      add_idxs.push_back(i);
+    } else {
+      update_idxs.push_back(i);
     }
+  }
+
+  // the whole batch is committed to the log before it is applied
+  ReadThreadLock wal_lock(wal_apply_lock_);
+  long first_lsn = 0;
+  if (LogDocs(log_docs, first_lsn)) {
+    for (int i : log_idxs) result.SetResult(i, -5, "append to wal error");
+    return -5;
+  }
+  std::vector<long> lsns(n, 0);
+  for (size_t k = 0; k < log_idxs.size() && first_lsn > 0; ++k) {
+    lsns[log_idxs[k]] = first_lsn + k;
+  }
+  std::vector<long> aborted;
+  std::vector<int> dropped;
+  int docid_begin = max_docid_;
 
-    for (int i = start_id; i < start_id + batch_size; ++i) {
-      Doc &doc = doc_vec[i];
+  if (add_idxs.size() > 0 &&
+      table_->BatchAdd(add_idxs, max_docid_, doc_vec, result) == 0) {
 #ifndef BUILD_GPU
-      std::vector<struct Field> &fields_table = doc.TableFields();
-      for (size_t j = 0; j < fields_table.size(); ++j) {
-        struct Field &field = fields_table[j];
-        int idx = table_->GetAttrIdx(field.name);
-        field_range_index_->Add(max_docid_ + i - start_id, idx);
+    // table fields are in the order of the attributes, see Table::BatchAdd
+    int field_num = table_->FieldsNum();
+    for (size_t i = 0; i < add_idxs.size(); ++i) {
+      for (int j = 0; j < field_num; ++j) {
+        field_range_index_->Add(max_docid_ + i, j);
       }
+    }
 #endif  // BUILD_GPU
-      // add vectors by VectorManager
-      std::vector<struct Field> &fields_vec = doc.VectorFields();
-      ret = vec_manager_->AddToStore(max_docid_ + i - start_id, fields_vec);
-      if (ret != 0) {
-        std::string msg = "Add to vector manager error";
-        result.SetResult(i, -1, msg);
-        LOG(ERROR) << msg;
-        continue;
+
+    std::vector<std::vector<struct Field> *> fields_vec(add_idxs.size());
+    for (size_t i = 0; i < add_idxs.size(); ++i) {
+      fields_vec[i] = &doc_vec[add_idxs[i]].VectorFields();
+    }
+    std::vector<int> failed;
+    if (vec_manager_->BatchAddToStore(max_docid_, fields_vec, failed)) {
+      std::string msg = "Add to vector manager error";
+      for (int i : failed) {
+        result.SetResult(add_idxs[i], -1, msg);
+        dropped.push_back(max_docid_ + i);
       }
+      LOG(ERROR) << msg << ", failed num=" << failed.size();
     }
+    // searches see the docs once all of their parts are stored
+    max_docid_ += add_idxs.size();
+  } else if (add_idxs.size() > 0) {
+    LOG(ERROR) << "Add to table error";
+    for (int i : add_idxs) {
+      result.SetResult(i, -1, "Add to table error");
+      aborted.push_back(lsns[i]);
+    }
+  }
 
-    max_docid_ += batch_size;
-  };
-
-  for (size_t i = 0; i < doc_vec.size(); ++i) {
+  for (int i : update_idxs) {
     Doc &doc = doc_vec[i];
-    std::string &key = doc.Key();
-    // add fields into table
-    int docid = -1;
-    table_->GetDocIDByKey(key, docid);
-    if (docid == -1) {
-      ++batch_size;
+    if (docids[i] >= max_docid_) {
+      // the add of the key failed
+      result.SetResult(i, -1, "Add to table error");
+      aborted.push_back(lsns[i]);
       continue;
-    } else {
-      batchAdd(start_id, batch_size);
-      batch_size = 0;
-      start_id = i;
-      std::vector<struct Field> &fields_table = doc.TableFields();
-      std::vector<struct Field> &fields_vec = doc.VectorFields();
-      if (Update(docid, fields_table, fields_vec)) {
-        LOG(ERROR) << "update error, key=" << key << ", docid=" << docid;
-        continue;
+    }
+    std::vector<struct Field> &fields_table = doc.TableFields();
+    std::vector<struct Field> &fields_vec = doc.VectorFields();
+    if (Update(docids[i], fields_table, fields_vec)) {
+      LOG(ERROR) << "update error, key=" << doc.Key()
+                 << ", docid=" << docids[i];
+      result.SetResult(i, -1, "update error");
+      aborted.push_back(lsns[i]);
+    }
+  }
+  AbortDocs(aborted);
+  // the docids of the docs with unstored vectors are taken, they are
+  // deleted with their keys so a retry adds the key again, the deletes are
+  // logged first and the replay which stores them ends in the same state
+  if (dropped.size() > 0) {
+    if (wal_ && !b_loading_) {
+      std::vector<WalRecord> records(dropped.size());
+      for (size_t k = 0; k < dropped.size(); ++k) {
+        std::string &key = doc_vec[add_idxs[dropped[k] - docid_begin]].Key();
+        records[k] = {WalOpType::Delete, key.data(), (int)key.size()};
       }
+      if (wal_->Append(records)) {
+        LOG(ERROR) << "append delete of failed docs to wal error";
+      }
+    }
+    for (int docid : dropped) {
+      table_->Delete(doc_vec[add_idxs[docid - docid_begin]].Key());
     }
+    DeleteDocids(dropped.data(), dropped.size());
   }
 
-  batchAdd(start_id, batch_size);
+  NotifyIndexing();
   if (not b_running_ and index_status_ == UNINDEXED) {
     if (max_docid_ >= indexing_size_) {
       LOG(INFO) << "Begin indexing.";
@@ -767,6 +1257,40 @@ int GammaEngine::AddOrUpdateDocs(Docs &docs, BatchResult &result) {
   return 0;
 }
 
+int GammaEngine::LogDocs(std::vector<Doc *> &docs, long &first_lsn) {
+  first_lsn = 0;
+  int n = docs.size();
+  if (wal_ == nullptr || b_loading_ || n <= 0) return 0;
+  std::vector<char *> bufs(n);
+  std::vector<WalRecord> records(n);
+  for (int i = 0; i < n; ++i) {
+    docs[i]->Serialize(&bufs[i], &records[i].len);
+    records[i].type = WalOpType::AddOrUpdate;
+    records[i].data = bufs[i];
+  }
+  int ret = wal_->Append(records, &first_lsn);
+  for (char *buf : bufs) free(buf);
+  if (ret) {
+    first_lsn = 0;
+    LOG(ERROR) << "append docs to wal error, num=" << n << ", ret=" << ret;
+  }
+  return ret;
+}
+
+int GammaEngine::AbortDocs(const std::vector<long> &lsns) {
+  if (wal_ == nullptr || b_loading_) return 0;
+  std::vector<long> logged;
+  for (long lsn : lsns) {
+    if (lsn > 0) logged.push_back(lsn);
+  }
+  int ret = wal_->Abort(logged);
+  if (ret) {
+    LOG(ERROR) << "append abort to wal error, num=" << logged.size()
+               << ", ret=" << ret;
+  }
+  return ret;
+}
+
 int GammaEngine::Update(Doc *doc) { return -1; }
 
 int GammaEngine::Update(int doc_id, std::vector<struct Field> &fields_table,
@@ -809,16 +1333,21 @@ int GammaEngine::Delete(std::string &key) {
   ret = table_->GetDocIDByKey(key, docid);
   if (ret != 0 || docid < 0) return -1;
 
-  if (bitmap::test(docids_bitmap_, docid)) {
+  if (docids_bitmap_.Test(docid)) {
     return ret;
   }
+  ReadThreadLock wal_lock(wal_apply_lock_);
+  if (wal_ && !b_loading_ &&
+      wal_->Append(WalOpType::Delete, key.data(), key.size())) {
+    LOG(ERROR) << "append delete to wal error, key=" << key;
+    return -2;
+  }
   ++delete_num_;
-  bitmap::set(docids_bitmap_, docid);
+  docids_bitmap_.Set(docid);
   table_->Delete(key);
 
   vec_manager_->Delete(docid);
   is_dirty_ = true;
-
   return ret;
 }
 
@@ -857,15 +1386,29 @@ int GammaEngine::DelDocByQuery(Request &request) {
   }
 
   std::vector<int> doc_ids = range_query_result.ToDocs();
-  for (size_t i = 0; i < doc_ids.size(); ++i) {
-    int docid = doc_ids[i];
-    if (bitmap::test(docids_bitmap_, docid)) {
+  ReadThreadLock wal_lock(wal_apply_lock_);
+  if (wal_ && !b_loading_ && doc_ids.size() > 0 &&
+      wal_->Append(WalOpType::DeleteDocids, (const char *)doc_ids.data(),
+                   doc_ids.size() * sizeof(int))) {
+    LOG(ERROR) << "append delete by query to wal error";
+    return 1;
+  }
+  DeleteDocids(doc_ids.data(), doc_ids.size());
+#endif  // BUILD_GPU
+  is_dirty_ = true;
+  return 0;
+}
+
+int GammaEngine::DeleteDocids(const int *docids, int n) {
+  for (int i = 0; i < n; ++i) {
+    int docid = docids[i];
+    if (docid < 0 || docid >= max_docid_ ||
+        docids_bitmap_.Test(docid)) {
       continue;
     }
     ++delete_num_;
-    bitmap::set(docids_bitmap_, docid);
+    docids_bitmap_.Set(docid);
   }
-#endif  // BUILD_GPU
   is_dirty_ = true;
   return 0;
 }
@@ -883,7 +1426,7 @@ int GammaEngine::GetDoc(std::string &key, Doc &doc) {
 
 int GammaEngine::GetDoc(int docid, Doc &doc) {
   int ret = 0;
-  if (bitmap::test(docids_bitmap_, docid)) {
+  if (docids_bitmap_.Test(docid)) {
     LOG(INFO) << "docid [" << docid << "] is deleted!";
     return -1;
   }
@@ -915,7 +1458,12 @@ int GammaEngine::GetDoc(int docid, Doc &doc) {
 int GammaEngine::BuildIndex() {
   int running = __sync_fetch_and_add(&b_running_, 1);
   if (running) {
-    if (vec_manager_->Indexing() != 0) {
+    int ret = 0;
+    {
+      ScopeIndexingSlot slot;
+      ret = vec_manager_->Indexing();
+    }
+    if (ret != 0) {
       LOG(ERROR) << "Create index failed!";
       return -1;
     }
@@ -929,7 +1477,14 @@ int GammaEngine::BuildIndex() {
 }
 
 int GammaEngine::Indexing() {
-  if (vec_manager_->Indexing() != 0) {
+  large_alloc::PinThread();
+  large_alloc::PinOmpThreads();
+  int train_ret = 0;
+  {
+    ScopeIndexingSlot slot;
+    train_ret = vec_manager_->Indexing();
+  }
+  if (train_ret != 0) {
     LOG(ERROR) << "Create index failed!";
     b_running_ = 0;
     return -1;
@@ -944,21 +1499,59 @@ int GammaEngine::Indexing() {
       continue;
     }
     index_status_ = IndexStatus::INDEXED;
-    int add_ret = vec_manager_->AddRTVecsToIndex();
+    indexing_since_ms_ = unindexed_since_ms_.exchange(0);
+    int add_ret = 0;
+    {
+      ScopeIndexingSlot slot;
+      add_ret = vec_manager_->AddRTVecsToIndex(indexing_freshness_ms_);
+    }
+    long since = indexing_since_ms_.exchange(0);
     if (add_ret < 0) {
       has_error = true;
       LOG(ERROR) << "Add real time vectors to index error!";
       continue;
     } else if (add_ret > 0) {
       is_dirty_ = true;
+      long lag = (long)utils::getmillisecs() - since;
+      if (since > 0 && lag > indexing_freshness_ms_) {
+        LOG(WARNING) << "indexing lag [" << lag << "]ms exceeds freshness ["
+                     << indexing_freshness_ms_ << "]ms, indexed num ["
+                     << add_ret << "]";
+      }
     }
-    usleep(1000 * 1000);  // sleep 5000ms
+    // sleep until writers add vectors, the timeout is only a safeguard
+    std::unique_lock<std::mutex> lk(indexing_mutex_);
+    indexing_cv_.wait_for(lk, std::chrono::seconds(kIndexingIdleWaitS), [this] {
+      return indexing_pending_ || not b_running_;
+    });
+    indexing_pending_ = false;
   }
   running_cv_.notify_one();
   LOG(INFO) << "Build index exited!";
   return ret;
 }
 
+void GammaEngine::NotifyIndexing() {
+  long expected = 0;
+  unindexed_since_ms_.compare_exchange_strong(expected,
+                                              (long)utils::getmillisecs());
+  // only the first writer after a round takes the lock
+  if (indexing_pending_) return;
+  {
+    std::lock_guard<std::mutex> lk(indexing_mutex_);
+    indexing_pending_ = true;
+  }
+  indexing_cv_.notify_one();
+}
+
+long GammaEngine::IndexingLagMs() {
+  long oldest = indexing_since_ms_;
+  long pending = unindexed_since_ms_;
+  if (oldest == 0 || (pending > 0 && pending < oldest)) oldest = pending;
+  if (oldest == 0) return 0;
+  return (long)utils::getmillisecs() - oldest;
+}
+
 int GammaEngine::BuildFieldIndex() {
   b_field_running_ = true;
 
@@ -1012,13 +1605,70 @@ void GammaEngine::GetIndexStatus(EngineStatus &engine_status) {
   engine_status.SetIndexMem(index_mem_bytes);
   engine_status.SetVectorMem(vec_mem_bytes);
   engine_status.SetFieldRangeMem(total_mem_b);
-  engine_status.SetBitmapMem(bitmap_bytes_size_);
+  engine_status.SetBitmapMem(docids_bitmap_.MemBytes());
   engine_status.SetDocNum(GetDocsNum());
   engine_status.SetMaxDocID(max_docid_ - 1);
   engine_status.SetMinIndexedNum(vec_manager_->MinIndexedNum());
+  engine_status.SetUnsearchedNum(vec_manager_->UnsearchedNum());
+  engine_status.SetIndexingLagMs(IndexingLagMs());
+
+  float hot_hit_ratio = 0, cold_hit_ratio = 0;
+  vec_manager_->GetTierHitRatios(hot_hit_ratio, cold_hit_ratio);
+  engine_status.SetVectorHotHitRatio(hot_hit_ratio);
+  engine_status.SetVectorColdHitRatio(cold_hit_ratio);
+
+  std::map<std::string, std::vector<float>> tombstone_ratios;
+  vec_manager_->GetTombstoneRatios(tombstone_ratios);
+  for (auto &iter : tombstone_ratios) {
+    struct TombstoneRatios tombstone;
+    tombstone.index_name = iter.first;
+    tombstone.bucket_ratios.swap(iter.second);
+    tombstone.max_ratio = 0;
+    for (float ratio : tombstone.bucket_ratios) {
+      if (ratio > tombstone.max_ratio) tombstone.max_ratio = ratio;
+    }
+    engine_status.Tombstones().push_back(std::move(tombstone));
+  }
+
+  long admitted = 0, queued = 0, timed_out = 0, rejected = 0;
+  RequestConcurrentController::GetInstance().GetStats(
+      table_id_, admitted, queued, timed_out, rejected);
+  engine_status.SetSearchAdmission(admitted, queued, timed_out, rejected);
+
+  std::vector<struct StageLatency> &latencies = engine_status.StageLatencies();
+  for (int i = 0; i < search_stats::kStageNum; ++i) {
+    search_stats::Stage stage = (search_stats::Stage)i;
+    const search_stats::Histogram &histogram =
+        search_stats_.GetHistogram(stage);
+    struct StageLatency latency;
+    latency.stage = search_stats::StageName(stage);
+    latency.count = histogram.Count();
+    latency.p50_us = histogram.Percentile(0.5);
+    latency.p99_us = histogram.Percentile(0.99);
+    latency.p999_us = histogram.Percentile(0.999);
+    latency.max_us = histogram.Max();
+    latencies.push_back(latency);
+  }
+  engine_status.SetSearchCounters(
+      search_stats_.GetCounter(search_stats::Counter::ListsProbed),
+      search_stats_.GetCounter(search_stats::Counter::CodesScanned),
+      search_stats_.GetCounter(search_stats::Counter::Reranked));
+
+  large_alloc::MemStats mem_stats;
+  large_alloc::GetMemStats(mem_stats);
+  engine_status.SetMemStats(mem_stats.heap_bytes, mem_stats.heap_free_bytes,
+                            mem_stats.arena_bytes, mem_stats.arena_free_bytes,
+                            mem_stats.returned_bytes, mem_stats.reclaims);
 }
 
 int GammaEngine::Dump() {
+  // operations logged before it are in the dump, the later ones are
+  // replayed. No writer is between logging and applying while it is read.
+  long wal_lsn = 0;
+  if (wal_) {
+    WriteThreadLock wal_lock(wal_apply_lock_);
+    wal_lsn = wal_->LastLsn();
+  }
   int ret = table_->Sync();
   if (ret != 0) {
     LOG(ERROR) << "dump table error, ret=" << ret;
@@ -1044,22 +1694,11 @@ int GammaEngine::Dump() {
     }
 
     const string bm_name = path + "/" + "bitmap";
-    FILE *fp_output = fopen(bm_name.c_str(), "wb");
-    if (fp_output == nullptr) {
-      LOG(ERROR) << "Cannot write file " << bm_name;
-      return -1;
-    }
-
-    size_t bitmap_write_size = fwrite((void *)(docids_bitmap_), sizeof(char),
-                                      bitmap_bytes_size_, fp_output);
-    if ((size_t)bitmap_bytes_size_ != bitmap_write_size) {
-      LOG(ERROR) << "write bitmap error";
-      fclose(fp_output);
+    if (docids_bitmap_.Dump(bm_name, max_docid_)) {
+      LOG(ERROR) << "write bitmap error, path=" << bm_name;
       return -2;
     }
 
-    fclose(fp_output);
-
     const string dump_done_file = path + "/dump.done";
     std::ofstream f_done;
     f_done.open(dump_done_file);
@@ -1069,8 +1708,13 @@ int GammaEngine::Dump() {
     }
     f_done << "start_docid " << 0 << std::endl;
     f_done << "end_docid " << max_docid << std::endl;
+    f_done << "wal_lsn " << wal_lsn << std::endl;
     f_done.close();
 
+    if (wal_ && wal_->Purge(wal_lsn)) {
+      LOG(ERROR) << "purge wal error, lsn=" << wal_lsn;
+    }
+
     if (last_dump_dir_ != "" && utils::remove_dir(last_dump_dir_.c_str())) {
       LOG(ERROR) << "remove last dump directory error, path=" << last_dump_dir_;
     }
@@ -1082,6 +1726,16 @@ int GammaEngine::Dump() {
   return 0;
 }
 
+int GammaEngine::Compact(int io_mb_per_sec) {
+  long io_bytes_per_sec = (long)io_mb_per_sec * 1024 * 1024;
+  int ret = table_->CompactStrings(docids_bitmap_.Data(), io_bytes_per_sec);
+  if (ret != 0) {
+    LOG(ERROR) << "compact table error, ret=" << ret;
+    return ret;
+  }
+  return 0;
+}
+
 int GammaEngine::CreateTableFromLocal(std::string &table_name) {
   std::vector<string> file_paths = utils::ls(index_root_path_);
   for (string &file_path : file_paths) {
@@ -1143,6 +1797,7 @@ int GammaEngine::Load() {
                const std::pair<std::time_t, string> &b) {
               return a.first < b.first;
             });
+  long wal_lsn = 0;  // dumps without it are older than the log
   if (folders_tm.size() > 0) {
     string dump_done_file =
         folders_tm[folders_tm.size() - 1].second + "/dump.done";
@@ -1156,11 +1811,18 @@ int GammaEngine::Load() {
     fio.Read(buf, 1, fsize);
     string buf_str(buf, fsize);
     std::vector<string> lines = utils::split(buf_str, "\n");
-    assert(lines.size() == 2);
-    std::vector<string> items = utils::split(lines[1], " ");
-    assert(items.size() == 2);
-    max_docid_ = (int)std::strtol(items[1].c_str(), nullptr, 10) + 1;
-    LOG(INFO) << "read doc num=" << max_docid_ << " from " << dump_done_file;
+    assert(lines.size() >= 2);
+    for (const string &line : lines) {
+      std::vector<string> items = utils::split(line, " ");
+      if (items.size() != 2) continue;
+      if (items[0] == "end_docid") {
+        max_docid_ = (int)std::strtol(items[1].c_str(), nullptr, 10) + 1;
+      } else if (items[0] == "wal_lsn") {
+        wal_lsn = std::strtol(items[1].c_str(), nullptr, 10);
+      }
+    }
+    LOG(INFO) << "read doc num=" << max_docid_ << ", wal lsn=" << wal_lsn
+              << " from " << dump_done_file;
     delete[] buf;
   }
 
@@ -1187,30 +1849,24 @@ int GammaEngine::Load() {
     LOG(INFO) << "Loading from " << last_dir;
     dirs.push_back(last_dir);
     // load bitmap
+    // the full size bitmap of the old dumps is loaded too
     string bitmap_file_name = last_dir + "/bitmap";
-    FILE *fp_bm = fopen(bitmap_file_name.c_str(), "rb");
-    if (fp_bm == nullptr) {
-      LOG(ERROR) << "Cannot open file " << bitmap_file_name;
+    if (docids_bitmap_.Load(bitmap_file_name)) {
+      LOG(ERROR) << "Cannot load file " << bitmap_file_name;
       return IO_ERR;
     }
-    long bm_file_size = utils::get_file_size(bitmap_file_name.c_str());
-    fread((void *)(docids_bitmap_), sizeof(char), bm_file_size, fp_bm);
-    fclose(fp_bm);
-    // compatiable with v3.1.0
-    assert(bm_file_size <= bitmap_bytes_size_);
-
-    delete_num_ = 0;
-    for (int i = 0; i < max_docid_; ++i) {
-      if (bitmap::test(docids_bitmap_, i)) {
-        ++delete_num_;
-      }
-    }
+    delete_num_ = docids_bitmap_.Count(max_docid_);
   }
   ret = vec_manager_->Load(dirs, max_docid_);
   if (ret != 0) {
     LOG(ERROR) << "load vector error, ret=" << ret << ", path=" << last_dir;
     return ret;
   }
+  ret = ReplayWal(wal_lsn);
+  if (ret != 0) {
+    LOG(ERROR) << "replay wal error, ret=" << ret << ", lsn=" << wal_lsn;
+    return ret;
+  }
   if (not b_running_ and index_status_ == UNINDEXED) {
     if (max_docid_ >= indexing_size_) {
       LOG(INFO) << "Begin indexing.";
@@ -1234,6 +1890,43 @@ int GammaEngine::Load() {
   return 0;
 }
 
+int GammaEngine::ReplayWal(long lsn) {
+  if (wal_ == nullptr) return 0;
+  double start = utils::getmillisecs();
+  int docid_before = max_docid_;
+  long failed = 0;
+  long num = wal_->Replay(lsn, [this](WalOpType type, const char *data,
+                                      int len) -> int {
+    switch (type) {
+      case WalOpType::AddOrUpdate: {
+        Doc doc;
+        doc.SetEngine(this);
+        doc.Deserialize(data, len);
+        return AddOrUpdate(doc);
+      }
+      case WalOpType::Delete: {
+        std::string key(data, len);
+        return Delete(key);
+      }
+      case WalOpType::DeleteDocids:
+        return DeleteDocids((const int *)data, len / sizeof(int));
+      default:
+        LOG(ERROR) << "unknown wal record type=" << (int)type;
+        return -1;
+    }
+  }, &failed);
+  if (num < 0) return (int)num;
+  // the failed records were applied before the crash, the state diverged
+  if (failed > 0) {
+    LOG(ERROR) << "replay wal failed records=" << failed << " of " << num;
+    return INTERNAL_ERR;
+  }
+  LOG(INFO) << "replay wal records=" << num << ", docs " << docid_before
+            << " -> " << max_docid_ << ", cost "
+            << utils::getmillisecs() - start << "ms";
+  return 0;
+}
+
 int GammaEngine::AddNumIndexFields() {
   int retvals = 0;
   std::map<std::string, enum DataType> attr_type;
@@ -1259,94 +1952,133 @@ int GammaEngine::AddNumIndexFields() {
   return retvals;
 }
 
-int GammaEngine::PackResults(const GammaResult *gamma_results,
-                             Response &response_results, Request &request) {
-  for (int i = 0; i < request.ReqNum(); ++i) {
-    struct SearchResult result;
-    result.total = gamma_results[i].total;
-    result.result_items.resize(gamma_results[i].results_count);
+void GammaEngine::GetResultFields(Request &request,
+                                  ResultFields &result_fields) {
+  std::map<std::string, int> &field_map = table_->FieldMap();
+  std::vector<std::string> &fields = request.Fields();
+  if (fields.size() == 0) {
+    for (const auto &it : field_map) {
+      result_fields.table_names.push_back(it.first);
+      result_fields.table_ids.push_back(it.second);
+    }
+    return;
+  }
 
+  for (std::string &name : fields) {
+    if (vec_manager_->Contains(name)) {
+      result_fields.vec_names.push_back(name);
+      continue;
+    }
+    const auto &it = field_map.find(name);
+    if (it == field_map.end()) {
+      LOG(ERROR) << "Cannot find field [" << name << "]";
+      continue;
+    }
+    result_fields.table_names.push_back(name);
+    result_fields.table_ids.push_back(it->second);
+  }
+}
+
+int GammaEngine::PackResults(const GammaResult *gamma_results, int req_num,
+                             const ResultFields &result_fields,
+                             Response &response_results, int threads) {
+  std::vector<int64_t> docids;
+  for (int i = 0; i < req_num; ++i) {
     for (int j = 0; j < gamma_results[i].results_count; ++j) {
-      int docid = gamma_results[i].docs[j]->docid;
-      VectorDoc *vec_doc = gamma_results[i].docs[j];
-      struct ResultItem result_item;
-      PackResultItem(vec_doc, request, result_item);
-      result.result_items[j] = std::move(result_item);
+      docids.push_back(gamma_results[i].docs[j]->docid);
     }
-    result.msg = "Success";
-    result.result_code = SearchResultCode::SUCCESS;
-    response_results.AddResults(std::move(result));
+  }
+  if (docids.size() > 1) table_->Prefetch(docids);
+
+  if (docids.size() > 1 && result_fields.vec_names.size() > 0) {
+    vec_manager_->Prefetch(result_fields.vec_names, docids);
+  }
+
+  // the hits of all sub requests are packed in one parallel loop
+  std::vector<struct SearchResult> results(req_num);
+  std::vector<std::pair<int, int>> hits;
+  hits.reserve(docids.size());
+  for (int i = 0; i < req_num; ++i) {
+    results[i].total = gamma_results[i].total;
+    results[i].result_items.resize(gamma_results[i].results_count);
+    for (int j = 0; j < gamma_results[i].results_count; ++j) {
+      hits.emplace_back(i, j);
+    }
+  }
+
+  int n = hits.size();
+#pragma omp parallel for schedule(dynamic) if (n > 1) num_threads(threads)
+  for (int k = 0; k < n; ++k) {
+    int i = hits[k].first, j = hits[k].second;
+    PackResultItem(gamma_results[i].docs[j], result_fields,
+                   results[i].result_items[j]);
+  }
+
+  for (int i = 0; i < req_num; ++i) {
+    results[i].msg = "Success";
+    results[i].result_code = SearchResultCode::SUCCESS;
+    response_results.AddResults(std::move(results[i]));
   }
   return 0;
 }
 
-int GammaEngine::PackResultItem(const VectorDoc *vec_doc, Request &request,
+int GammaEngine::PackResultItem(const VectorDoc *vec_doc,
+                                const ResultFields &result_fields,
                                 struct ResultItem &result_item) {
   result_item.score = vec_doc->score;
-
-  Doc doc;
   int docid = vec_doc->docid;
 
-  std::vector<std::string> &vec_fields = request.Fields();
-
   // add vector into result
-  size_t fields_size = vec_fields.size();
-  if (fields_size != 0) {
+  if (result_fields.vec_names.size() > 0) {
     std::vector<std::pair<string, int>> vec_fields_ids;
-    std::vector<string> table_fields;
-
-    for (size_t i = 0; i < fields_size; ++i) {
-      std::string &name = vec_fields[i];
-      if (!vec_manager_->Contains(name)) {
-        table_fields.push_back(name);
-      } else {
-        vec_fields_ids.emplace_back(std::make_pair(name, docid));
-      }
+    for (const std::string &name : result_fields.vec_names) {
+      vec_fields_ids.emplace_back(std::make_pair(name, docid));
     }
 
     std::vector<string> vec;
     int ret = vec_manager_->GetVector(vec_fields_ids, vec, true);
-
-    table_->GetDocInfo(docid, doc, table_fields);
-
     if (ret == 0 && vec.size() == vec_fields_ids.size()) {
       for (size_t i = 0; i < vec_fields_ids.size(); ++i) {
-        const string &field_name = vec_fields_ids[i].first;
-        result_item.names.emplace_back(std::move(field_name));
-        result_item.values.emplace_back(vec[i]);
+        result_item.names.emplace_back(vec_fields_ids[i].first);
+        result_item.values.emplace_back(std::move(vec[i]));
       }
-    } else {
-      // get vector error
-      // TODO : release extra field
-      ;
     }
-  } else {
-    std::vector<string> table_fields;
-    table_->GetDocInfo(docid, doc, table_fields);
   }
 
-  std::vector<struct Field> &fields = doc.TableFields();
-
-  for (struct Field &field : fields) {
-    result_item.names.emplace_back(std::move(field.name));
-    result_item.values.emplace_back(std::move(field.value));
+  // strings are serialized from the pinned cache blocks, not copied here
+  result_item.names.insert(result_item.names.end(),
+                           result_fields.table_names.begin(),
+                           result_fields.table_names.end());
+  table_->GetDocFields(docid, result_fields.table_ids, result_item.values,
+                       result_item.refs);
+  if (result_item.values.size() != result_item.names.size()) {
+    result_item.values.resize(result_item.names.size());
+    result_item.refs.resize(result_item.names.size());
   }
 
+  // extra is deprecated, it is filled with the json of vector_results until
+  // the clients read vector_results
   cJSON *extra_json = cJSON_CreateObject();
   cJSON *vec_result_json = cJSON_CreateArray();
   cJSON_AddItemToObject(extra_json, EXTRA_VECTOR_RESULT.c_str(),
                         vec_result_json);
+  result_item.vector_results.resize(vec_doc->fields_len);
   for (int i = 0; i < vec_doc->fields_len; ++i) {
     VectorDocField *vec_field = vec_doc->fields + i;
-    cJSON *vec_field_json = cJSON_CreateObject();
+    struct VectorFieldResult &vec_result = result_item.vector_results[i];
+    vec_result.field = vec_field->name;
+    if (vec_field->source != nullptr) {
+      vec_result.source.assign(vec_field->source, vec_field->source_len);
+    }
+    vec_result.score = vec_field->score;
 
+    cJSON *vec_field_json = cJSON_CreateObject();
     cJSON_AddStringToObject(vec_field_json, EXTRA_VECTOR_FIELD_NAME.c_str(),
-                            vec_field->name.c_str());
-    string source = string(vec_field->source, vec_field->source_len);
+                            vec_result.field.c_str());
     cJSON_AddStringToObject(vec_field_json, EXTRA_VECTOR_FIELD_SOURCE.c_str(),
-                            source.c_str());
+                            vec_result.source.c_str());
     cJSON_AddNumberToObject(vec_field_json, EXTRA_VECTOR_FIELD_SCORE.c_str(),
-                            vec_field->score);
+                            vec_result.score);
     cJSON_AddItemToArray(vec_result_json, vec_field_json);
   }
 
@@ -1370,6 +2102,17 @@ int GammaEngine::GetConfig(Config &conf) {
   if (str_cache_size > 0) {
     conf.AddCacheInfo("string", (int)str_cache_size);
   }
+  conf.SetIndexingFreshnessMs(indexing_freshness_ms_);
+  conf.SetWalSyncPolicy((int)wal_sync_policy_ + 1);
+  long capacity = 0;
+  int queue_size = 0, timeout_ms = 0;
+  RequestConcurrentController::GetInstance().GetLimits(capacity, queue_size,
+                                                       timeout_ms);
+  conf.SetSearchAdmission((int)capacity, queue_size, timeout_ms);
+  conf.SetSearchTraceSample(search_trace_sample_);
+  conf.SetUnindexedSearchLimit(vec_manager_->UnindexedSearchLimit());
+  long budget_mb = CacheQuota::GetInstance().Budget();
+  conf.SetCacheBudgetMb(budget_mb > 0 ? (int)budget_mb : -1);
   return 0;
 }
 
@@ -1386,6 +2129,25 @@ int GammaEngine::SetConfig(Config &conf) {
     }
   }
   table_->AlterCacheSize(table_cache_size, str_cache_size);
+  if (conf.IndexingFreshnessMs() > 0) {
+    indexing_freshness_ms_ = conf.IndexingFreshnessMs();
+  }
+  int sync_policy = conf.WalSyncPolicy();
+  if (sync_policy >= 1 && sync_policy <= 3) {
+    wal_sync_policy_ = (disk_io::SyncPolicy)(sync_policy - 1);
+    if (wal_) wal_->SetSyncPolicy(wal_sync_policy_);
+  }
+  RequestConcurrentController::GetInstance().SetLimits(
+      conf.SearchCapacity(), conf.SearchQueueSize(), conf.SearchTimeoutMs());
+  if (conf.SearchTraceSample() != 0) {
+    search_trace_sample_ = conf.SearchTraceSample();
+  }
+  if (conf.UnindexedSearchLimit() != 0) {
+    vec_manager_->SetUnindexedSearchLimit(conf.UnindexedSearchLimit());
+  }
+  if (conf.CacheBudgetMb() != 0) {
+    CacheQuota::GetInstance().SetBudget(conf.CacheBudgetMb());
+  }
   GetConfig(conf);
   return 0;
 }
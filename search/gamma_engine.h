@@ -7,8 +7,16 @@
 
 #pragma once
 
+#include <pthread.h>
+
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "api_data/gamma_batch_result.h"
 #include "api_data/gamma_doc.h"
@@ -18,7 +26,10 @@
 #include "api_data/gamma_response.h"
 #include "api_data/gamma_table.h"
 #include "async_flush.h"
+#include "bitmap.h"
 #include "field_range_index.h"
+#include "gamma_wal.h"
+#include "search_stats.h"
 #include "table.h"
 #include "vector_manager.h"
 
@@ -26,6 +37,15 @@ namespace tig_gamma {
 
 enum IndexStatus { UNINDEXED = 0, INDEXING, INDEXED };
 
+// a vector is expected to be searchable within it after added
+const static int kDefaultIndexingFreshnessMs = 1000;
+// the indexing thread waits for writers at most so long
+const static int kIndexingIdleWaitS = 60;
+// a cursor not read for so long is closed by the next OpenCursor
+const static int kCursorIdleMs = 10 * 60 * 1000;
+const static int kMaxCursors = 1024;
+const static int kMaxCursorPageSize = 10000;
+
 class GammaEngine {
  public:
   static GammaEngine *GetInstance(const std::string &index_root_path);
@@ -36,6 +56,27 @@ class GammaEngine {
 
   int Search(Request &request, Response &response_results);
 
+  /** open a cursor over the docs matching the range and term filters of
+   * request in docid order, all docs if there is no filter. The fields of
+   * request are returned, its vector queries are not supported. The filter
+   * and each page are admitted like searches, with the priority and the
+   * timeout of request.
+   *
+   * @param cursor_id  (output) id for CursorNext and CloseCursor
+   * @return 0 if successed
+   */
+  int OpenCursor(Request &request, long &cursor_id);
+
+  /** get the next page of a cursor as one search result, the docs added
+   * after it is opened are not returned
+   *
+   * @return number of docs in the page, 0 at the end, < 0 if error or the
+   *         page isn't admitted
+   */
+  int CursorNext(long cursor_id, int page_size, Response &response_results);
+
+  int CloseCursor(long cursor_id);
+
   int CreateTable(TableInfo &table);
 
   int AddOrUpdate(Doc &doc);
@@ -73,8 +114,16 @@ class GammaEngine {
 
   void GetIndexStatus(EngineStatus &engine_status);
 
+  // stage latencies and counters of the searches of this engine
+  search_stats::SearchStats &GetSearchStats() { return search_stats_; }
+
   int Dump();
 
+  /** reclaim the string space of deleted docs and of updated strings, it
+   * runs online and reads and writes at most io_mb_per_sec (<= 0 unlimited)
+   */
+  int Compact(int io_mb_per_sec);
+
   int Load();
 
   int GetDocsNum();
@@ -111,13 +160,33 @@ class GammaEngine {
 
   int Indexing();
 
+  // called by writers after vectors are stored, wakes up the indexing thread
+  void NotifyIndexing();
+
+  // age of the oldest stored vector which is not indexed yet
+  long IndexingLagMs();
+
+  // apply a doc which is already logged
+  int ApplyDoc(Doc &doc);
+
+  // log the docs before they are applied, it is skipped while loading
+  int LogDocs(std::vector<Doc *> &docs, long &first_lsn);
+
+  // abort the logged docs which failed to apply
+  int AbortDocs(const std::vector<long> &lsns);
+
+  // apply the logged operations after the lsn of the loaded dump
+  int ReplayWal(long lsn);
+
+  int DeleteDocids(const int *docids, int n);
+
  private:
   std::string index_root_path_;
   std::string dump_path_;
 
   MultiFieldsRangeIndex *field_range_index_;
 
-  char *docids_bitmap_;
+  bitmap::LazyBitmap docids_bitmap_;
   table::Table *table_;
   VectorManager *vec_manager_;
 
@@ -134,19 +203,62 @@ class GammaEngine {
   std::condition_variable running_cv_;
   std::condition_variable running_field_cv_;
 
-  int PackResults(const GammaResult *gamma_results, Response &response_results,
-                  Request &request);
-
-  int PackResultItem(const VectorDoc *vec_doc, Request &request,
+  std::mutex indexing_mutex_;
+  std::condition_variable indexing_cv_;
+  std::atomic<bool> indexing_pending_;
+  std::atomic<long> unindexed_since_ms_;  // 0 if all is indexed
+  std::atomic<long> indexing_since_ms_;   // oldest write of current round
+  // a vector should be searchable in indexing_freshness_ms_ after added
+  int indexing_freshness_ms_;
+  // 1 in search_trace_sample_ searches logs its stages, <= 0 is off
+  std::atomic<int> search_trace_sample_;
+  std::atomic<long> search_seq_;
+  search_stats::SearchStats search_stats_;
+
+  // the fields of the results, resolved once per request
+  struct ResultFields {
+    std::vector<std::string> vec_names;
+    std::vector<std::string> table_names;
+    std::vector<int> table_ids;
+  };
+
+  void GetResultFields(Request &request, ResultFields &result_fields);
+
+  // threads: max threads packing the hits
+  int PackResults(const GammaResult *gamma_results, int req_num,
+                  const ResultFields &result_fields,
+                  Response &response_results, int threads);
+
+  int PackResultItem(const VectorDoc *vec_doc,
+                     const ResultFields &result_fields,
                      struct ResultItem &result_item);
 
   int MultiRangeQuery(Request &request, GammaSearchCondition *condition,
                       Response &response_results,
                       MultiRangeQueryResults *range_query_result);
 
+  // @return number of matched docs, 0 if none, < 0 if error
+  int RangeQuery(Request &request, MultiRangeQueryResults *range_query_result);
+
+  // the filters and the scan position stay in the engine between pages
+  struct SearchCursor {
+    std::mutex mutex;
+    MultiRangeQueryResults range_result;
+    bool has_filter;
+    int next_docid;
+    int end_docid;  // exclusive
+    ResultFields result_fields;
+    double last_ms;
+    int priority;
+    int timeout_ms;
+  };
+
+  std::mutex cursors_mutex_;
+  std::map<long, std::shared_ptr<SearchCursor>> cursors_;
+  long next_cursor_id_;
+
   enum IndexStatus index_status_;
 
-  int bitmap_bytes_size_;
   const std::string date_time_format_;
   std::string last_dump_dir_;  // it should be delete after next dump
 
@@ -163,9 +275,36 @@ class GammaEngine {
 #endif
 
   AsyncFlushExecutor *af_exector_;
+
+  WriteAheadLog *wal_;
+  disk_io::SyncPolicy wal_sync_policy_;
+  // writers hold it shared from logging to applying an operation, the dump
+  // takes it to read an lsn whose records are all applied
+  pthread_rwlock_t wal_apply_lock_;
+
+  // id in the schedulers shared by the tables of the process
+  int table_id_;
 };
 
 
+enum class SearchPriority : uint8_t { Normal = 0, High, Low };
+
+const static int kSearchPriorityNum = 3;
+const static int kDefaultSearchQueueSize = 1024;
+const static int kDefaultSearchTimeoutMs = 500;
+// work of a query in one cost unit, it is topn 100 with the default nprobe
+const static long kSearchUnitWork = 100 * 80;
+
+/** admits searches while the sum of their costs is within the capacity, the
+ * others wait in a bounded queue of their priority until the capacity is
+ * released or their deadline passes. Waiters are admitted in priority order,
+ * within a priority the one of the table using the least capacity goes
+ * first (FIFO among equals) so that a hot table doesn't starve the others
+ * of the process. The picked waiter which doesn't fit blocks the later ones
+ * so that costly searches are not starved. Low priority searches are shed
+ * when the queue is more than half full, the searches of a table when it
+ * holds half of the queue and other tables are open.
+ */
 class RequestConcurrentController {
  public:
   static RequestConcurrentController &GetInstance() {
@@ -175,9 +314,38 @@ class RequestConcurrentController {
 
   ~RequestConcurrentController() = default;
 
-  bool Acquire(int req_num);
+  /** @param cost  it is clamped to the capacity, the clamped one should be
+   *               released
+   *  @param timeout_ms  max wait in the queue, 0 uses the default one, < 0
+   *                     doesn't wait
+   */
+  bool Acquire(long &cost, SearchPriority priority, int timeout_ms,
+               int table_id);
+
+  void Release(long cost, int table_id);
+
+  // id of a table sharing the capacity, it is unregistered when closed
+  int RegisterTable();
+
+  void UnregisterTable(int table_id);
+
+  // values <= 0 are unchanged
+  void SetLimits(long capacity, int queue_size, int timeout_ms);
+
+  void GetLimits(long &capacity, int &queue_size, int &timeout_ms);
 
-  void Release(int req_num);
+  // searches of the table, admitted: total admitted, queued: admitted or not
+  // after waiting, timed_out: waited until the deadline, rejected: queue full
+  // or shed
+  void GetStats(int table_id, long &admitted, long &queued, long &timed_out,
+                long &rejected);
+
+  // threads of a search admitted now, the omp threads are shared evenly by
+  // the running searches so that they don't oversubscribe the cpus
+  int SearchThreads();
+
+  // searches admitted or waiting
+  int Running();
 
  private:
   RequestConcurrentController();
@@ -187,14 +355,117 @@ class RequestConcurrentController {
   RequestConcurrentController &operator=(const RequestConcurrentController &) =
       delete;
 
+  struct Waiter {
+    long cost;
+    int table_id;
+    bool admitted;
+    std::condition_variable cv;
+  };
+
+  struct TableUsage {
+    long used;
+    int waiting;
+    long admitted;
+    long queued;
+    long timed_out;
+    long rejected;
+
+    TableUsage()
+        : used(0),
+          waiting(0),
+          admitted(0),
+          queued(0),
+          timed_out(0),
+          rejected(0) {}
+  };
+
+  // admit the picked waiters which fit, by mutex_
+  void Dispatch();
+
+  void Admit(long cost, int table_id);
+
   int GetMaxThread();
 
-  int GetSystemInfo(const char *cmd);
+  int GetSystemInfo(const char *path);
 
  private:
-  int cur_concurrent_num_;
+  std::mutex mutex_;
+  std::deque<Waiter *> queues_[kSearchPriorityNum];
+  int waiting_num_;
+  int running_;  // admitted and not released
+  long used_;
+  long capacity_;
+  int queue_size_;
+  int timeout_ms_;
+
+  std::unordered_map<int, TableUsage> tables_;
+  int next_table_id_;
+
   int concurrent_threshold_;
   int max_threads_;
+  int search_threads_;  // shared by the running searches
+};
+
+// releases an admitted search when it leaves the scope
+class ScopeAdmission {
+ public:
+  ScopeAdmission(long cost, int table_id) : cost_(cost), table_id_(table_id) {}
+
+  ~ScopeAdmission() {
+    RequestConcurrentController::GetInstance().Release(cost_, table_id_);
+  }
+
+ private:
+  long cost_;
+  int table_id_;
+};
+
+// omp threads of the process per concurrent indexing round
+const static int kIndexingThreadsPerSlot = 8;
+
+/** bounds the indexing rounds which run at the same time in the process, the
+ * tables take turns in FIFO order so that a table with many writes doesn't
+ * keep the others from indexing
+ */
+class IndexingScheduler {
+ public:
+  static IndexingScheduler &GetInstance() {
+    static IndexingScheduler instance;
+    return instance;
+  }
+
+ private:
+  // a slot is only taken by ScopeIndexingSlot, so it is always given back
+  friend class ScopeIndexingSlot;
+
+  IndexingScheduler();
+
+  void Acquire();
+
+  void Release();
+
+  IndexingScheduler(const IndexingScheduler &) = delete;
+
+  IndexingScheduler &operator=(const IndexingScheduler &) = delete;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<long> tickets_;  // waiting
+  long next_ticket_;
+  int running_;
+  int slots_;
+};
+
+// holds a slot of the indexing scheduler until it leaves the scope
+class ScopeIndexingSlot {
+ public:
+  ScopeIndexingSlot() { IndexingScheduler::GetInstance().Acquire(); }
+
+  ~ScopeIndexingSlot() { IndexingScheduler::GetInstance().Release(); }
+
+  ScopeIndexingSlot(const ScopeIndexingSlot &) = delete;
+
+  ScopeIndexingSlot &operator=(const ScopeIndexingSlot &) = delete;
 };
 
 }  // namespace tig_gamma
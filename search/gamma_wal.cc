@@ -0,0 +1,387 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "gamma_wal.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "background_pool.h"
+#include "error_code.h"
+#include "log.h"
+#include "utils.h"
+
+namespace tig_gamma {
+
+namespace {
+
+const size_t kHeaderBytes = sizeof(uint32_t) * 2 + sizeof(long) + 1;
+const char *kWalSuffix = ".wal";
+
+uint32_t Crc32c(uint32_t crc, const char *data, size_t len) {
+  static uint32_t table[256];
+  static bool inited = [] {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+      table[i] = c;
+    }
+    return true;
+  }();
+  (void)inited;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void EncodeRecord(long lsn, const WalRecord &record, std::string &buf) {
+  uint32_t len = record.len;
+  size_t pos = buf.size();
+  buf.resize(pos + kHeaderBytes + len);
+  char *p = &buf[pos];
+  memcpy(p, &len, sizeof(len));
+  memcpy(p + 8, &lsn, sizeof(lsn));
+  p[16] = (char)record.type;
+  if (len > 0) memcpy(p + kHeaderBytes, record.data, len);
+  uint32_t crc = Crc32c(0, p + 8, kHeaderBytes - 8 + len);
+  memcpy(p + 4, &crc, sizeof(crc));
+}
+
+// decode the record at pos, return false if it is torn or corrupted
+bool DecodeRecord(const std::string &buf, size_t pos, long &lsn,
+                  WalOpType &type, const char *&data, uint32_t &len) {
+  if (pos + kHeaderBytes > buf.size()) return false;
+  const char *p = buf.data() + pos;
+  uint32_t crc;
+  memcpy(&len, p, sizeof(len));
+  memcpy(&crc, p + 4, sizeof(crc));
+  if (pos + kHeaderBytes + len > buf.size()) return false;
+  if (crc != Crc32c(0, p + 8, kHeaderBytes - 8 + len)) return false;
+  memcpy(&lsn, p + 8, sizeof(lsn));
+  type = (WalOpType)p[16];
+  data = p + kHeaderBytes;
+  return true;
+}
+
+int ReadFile(const std::string &path, std::string &buf) {
+  long size = utils::get_file_size(path);
+  if (size < 0) return IO_ERR;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) return IO_ERR;
+  buf.resize(size);
+  long n = 0;
+  while (n < size) {
+    ssize_t ret = read(fd, &buf[n], size - n);
+    if (ret <= 0) break;
+    n += ret;
+  }
+  close(fd);
+  buf.resize(n);
+  return 0;
+}
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string &dir) : dir_(dir) {
+  last_lsn_ = 0;
+  written_lsn_ = 0;
+  writing_ = false;
+  broken_ = false;
+  fd_ = -1;
+  file_bytes_ = 0;
+  dirty_ = false;
+  sync_policy_ = disk_io::SyncPolicy::Interval;
+  sync_interval_ms_ = kWalSyncIntervalMs;
+  sync_task_id_ = 0;
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (sync_task_id_ != 0) {
+    BackgroundPool::GetInstance()->Remove(sync_task_id_);
+  }
+  if (fd_ != -1) {
+    if (dirty_) fdatasync(fd_);
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+std::string WriteAheadLog::FilePath(long first_lsn) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%020ld", first_lsn);
+  return dir_ + "/" + buf + kWalSuffix;
+}
+
+std::vector<std::pair<long, std::string>> WriteAheadLog::ListFiles() {
+  std::vector<std::pair<long, std::string>> files;
+  for (const std::string &path : utils::ls(dir_)) {
+    std::string::size_type begin = path.rfind('/') + 1;
+    std::string::size_type pos = path.rfind(kWalSuffix);
+    if (pos == std::string::npos || pos + strlen(kWalSuffix) != path.size())
+      continue;
+    long first_lsn = std::strtol(path.substr(begin, pos - begin).c_str(),
+                                 nullptr, 10);
+    files.push_back(std::make_pair(first_lsn, path));
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+int WriteAheadLog::Open(disk_io::SyncPolicy sync_policy,
+                        int sync_interval_ms) {
+  if (!utils::isFolderExist(dir_.c_str()) && utils::make_dir(dir_.c_str())) {
+    LOG(ERROR) << "mkdir error, path=" << dir_;
+    return IO_ERR;
+  }
+  sync_policy_ = sync_policy;
+  if (sync_interval_ms > 0) sync_interval_ms_ = sync_interval_ms;
+
+  std::vector<std::pair<long, std::string>> files = ListFiles();
+  int ret = 0;
+  if (files.size() == 0) {
+    last_lsn_ = 0;
+    ret = NewFile(1);
+  } else {
+    ret = OpenLastFile(files.back().first, files.back().second);
+  }
+  if (ret) return ret;
+  written_lsn_ = last_lsn_;
+
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  if (pool == nullptr) {
+    LOG(ERROR) << "start wal sync error, dir=" << dir_;
+    return INTERNAL_ERR;
+  }
+  sync_task_id_ =
+      pool->Add([this]() { return SyncOnce(); }, sync_interval_ms_);
+  LOG(INFO) << "open wal success, dir=" << dir_ << ", files=" << files.size()
+            << ", last lsn=" << last_lsn_
+            << ", sync policy=" << (int)sync_policy;
+  return 0;
+}
+
+int WriteAheadLog::OpenLastFile(long first_lsn, const std::string &path) {
+  std::string buf;
+  if (ReadFile(path, buf)) {
+    LOG(ERROR) << "read wal file error, path=" << path;
+    return IO_ERR;
+  }
+  last_lsn_ = first_lsn - 1;
+  size_t pos = 0;
+  long lsn;
+  WalOpType type;
+  const char *data;
+  uint32_t len;
+  while (DecodeRecord(buf, pos, lsn, type, data, len)) {
+    last_lsn_ = lsn;
+    pos += kHeaderBytes + len;
+  }
+
+  fd_ = open(path.c_str(), O_WRONLY | O_APPEND);
+  if (fd_ == -1) {
+    LOG(ERROR) << "open wal file error, path=" << path;
+    return IO_ERR;
+  }
+  if (pos < buf.size()) {
+    LOG(WARNING) << "cut off torn wal tail, path=" << path << ", valid bytes="
+                 << pos << ", file bytes=" << buf.size();
+    if (ftruncate(fd_, pos)) {
+      LOG(ERROR) << "truncate wal file error, path=" << path;
+      return IO_ERR;
+    }
+  }
+  file_bytes_ = pos;
+  return 0;
+}
+
+int WriteAheadLog::NewFile(long first_lsn) {
+  std::string path = FilePath(first_lsn);
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1) {
+    LOG(ERROR) << "create wal file error, path=" << path;
+    return IO_ERR;
+  }
+  if (fd_ != -1) {
+    fdatasync(fd_);
+    close(fd_);
+  }
+  fd_ = fd;
+  file_bytes_ = 0;
+  dirty_ = false;
+  return 0;
+}
+
+int WriteAheadLog::WriteToFile(const std::string &buf, long first_lsn,
+                               bool sync) {
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  if (file_bytes_ >= kWalFileBytes && NewFile(first_lsn)) return IO_ERR;
+
+  if (utils::write_n(fd_, buf.data(), buf.size(), 3) != (ssize_t)buf.size()) {
+    LOG(ERROR) << "write wal error, dir=" << dir_ << ", lsn=" << first_lsn
+               << ", err=" << strerror(errno);
+    return IO_ERR;
+  }
+  file_bytes_ += buf.size();
+  if (sync) {
+    if (fdatasync(fd_)) {
+      LOG(ERROR) << "sync wal error, dir=" << dir_
+                 << ", err=" << strerror(errno);
+      return IO_ERR;
+    }
+  } else {
+    dirty_ = true;
+  }
+  return 0;
+}
+
+int WriteAheadLog::Append(const std::vector<WalRecord> &records,
+                          long *first_lsn) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (broken_) return IO_ERR;
+  if (first_lsn) *first_lsn = last_lsn_ + 1;
+  for (const WalRecord &record : records) {
+    EncodeRecord(++last_lsn_, record, pending_);
+  }
+  long lsn = last_lsn_;
+
+  // the first waiting writer flushes the pending records of all writers
+  while (written_lsn_ < lsn) {
+    if (broken_) return IO_ERR;
+    if (writing_) {
+      commit_cv_.wait(lock);
+      continue;
+    }
+    writing_ = true;
+    std::string buf;
+    buf.swap(pending_);
+    long first_lsn = written_lsn_ + 1;
+    long end_lsn = last_lsn_;
+    bool sync = sync_policy_ == disk_io::SyncPolicy::Batch;
+    lock.unlock();
+
+    int ret = WriteToFile(buf, first_lsn, sync);
+
+    lock.lock();
+    writing_ = false;
+    if (ret) {
+      // the log has a gap now, the following appends can't be replayed
+      broken_ = true;
+    } else {
+      written_lsn_ = end_lsn;
+    }
+    commit_cv_.notify_all();
+  }
+  return 0;
+}
+
+long WriteAheadLog::Replay(long lsn, ReplayFunc func, long *failed) {
+  std::vector<std::pair<long, std::string>> files = ListFiles();
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (i + 1 < files.size() && files[i + 1].first <= lsn + 1) continue;
+    paths.push_back(files[i].second);
+  }
+
+  std::unordered_set<long> aborted;
+  // the abort records follow the records they abort, collect them first
+  for (const std::string &path : paths) {
+    std::string buf;
+    if (ReadFile(path, buf)) {
+      LOG(ERROR) << "read wal file error, path=" << path;
+      return -IO_ERR;
+    }
+    size_t pos = 0;
+    long record_lsn;
+    WalOpType type;
+    const char *data;
+    uint32_t len;
+    while (DecodeRecord(buf, pos, record_lsn, type, data, len)) {
+      pos += kHeaderBytes + len;
+      if (type != WalOpType::Abort) continue;
+      for (size_t k = 0; k + sizeof(long) <= len; k += sizeof(long)) {
+        long aborted_lsn;
+        memcpy(&aborted_lsn, data + k, sizeof(aborted_lsn));
+        aborted.insert(aborted_lsn);
+      }
+    }
+    // the torn tail of the last file is cut off when it is opened
+    if (pos < buf.size()) {
+      LOG(ERROR) << "corrupted wal record, path=" << path
+                 << ", offset=" << pos;
+      return -FORMAT_ERR;
+    }
+  }
+
+  long num = 0, failed_num = 0;
+  for (const std::string &path : paths) {
+    std::string buf;
+    if (ReadFile(path, buf)) {
+      LOG(ERROR) << "read wal file error, path=" << path;
+      return -IO_ERR;
+    }
+    size_t pos = 0;
+    long record_lsn;
+    WalOpType type;
+    const char *data;
+    uint32_t len;
+    while (DecodeRecord(buf, pos, record_lsn, type, data, len)) {
+      pos += kHeaderBytes + len;
+      if (record_lsn <= lsn || type == WalOpType::Abort ||
+          aborted.count(record_lsn))
+        continue;
+      if (func(type, data, len)) {
+        LOG(ERROR) << "replay wal record error, lsn=" << record_lsn
+                   << ", type=" << (int)type;
+        ++failed_num;
+      }
+      ++num;
+    }
+  }
+  LOG(INFO) << "replay wal after lsn " << lsn << ", records=" << num
+            << ", aborted=" << aborted.size() << ", failed=" << failed_num;
+  if (failed) *failed = failed_num;
+  return num;
+}
+
+int WriteAheadLog::Purge(long lsn) {
+  std::vector<std::pair<long, std::string>> files = ListFiles();
+  // the last file is kept, its name holds the next lsn when it is empty
+  for (size_t i = 0; i + 1 < files.size(); i++) {
+    if (files[i + 1].first - 1 > lsn) break;
+    if (remove(files[i].second.c_str())) {
+      LOG(ERROR) << "remove wal file error, path=" << files[i].second;
+      return IO_ERR;
+    }
+  }
+  return 0;
+}
+
+long WriteAheadLog::LastLsn() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_lsn_;
+}
+
+void WriteAheadLog::SetSyncPolicy(disk_io::SyncPolicy sync_policy) {
+  sync_policy_ = sync_policy;
+}
+
+long WriteAheadLog::SyncOnce() {
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  if (dirty_ && sync_policy_ == disk_io::SyncPolicy::Interval) {
+    fdatasync(fd_);
+    dirty_ = false;
+  }
+  return sync_interval_ms_;
+}
+
+}  // namespace tig_gamma
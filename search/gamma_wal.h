@@ -0,0 +1,130 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+
+namespace tig_gamma {
+
+enum class WalOpType : uint8_t {
+  AddOrUpdate = 1,  // payload is a serialized doc
+  Delete,           // payload is the key
+  DeleteDocids,     // payload is an array of int docids
+  Abort             // payload is an array of long lsns which failed to apply
+};
+
+// a new log file is started when the current one is larger
+const static long kWalFileBytes = 64 * 1024 * 1024;
+const static int kWalSyncIntervalMs = 1000;
+
+struct WalRecord {
+  WalOpType type;
+  const char *data;
+  int len;
+};
+
+/** append-only log of the write operations after the last dump, it is
+ * replayed on load. A record is [len:4][crc32c:4][lsn:8][type:1][payload],
+ * the crc covers lsn, type and payload. Files are named by the lsn of their
+ * first record and a torn record at the tail is cut off when opened.
+ */
+class WriteAheadLog {
+ public:
+  WriteAheadLog(const std::string &dir);
+
+  ~WriteAheadLog();
+
+  int Open(disk_io::SyncPolicy sync_policy = disk_io::SyncPolicy::Interval,
+           int sync_interval_ms = kWalSyncIntervalMs);
+
+  /** append records as one group, they are durable by the sync policy when
+   * it returns: written to the page cache (none and interval) or synced to
+   * disk (batch, concurrent appends share one fdatasync)
+   *
+   * @param first_lsn  lsn of the first record, the records are numbered
+   *                   in order
+   * @return 0 if successed
+   */
+  int Append(const std::vector<WalRecord> &records, long *first_lsn = nullptr);
+
+  int Append(WalOpType type, const char *data, int len,
+             long *lsn = nullptr) {
+    return Append(std::vector<WalRecord>{{type, data, len}}, lsn);
+  }
+
+  // records are appended before they are applied, the ones which fail to
+  // apply are aborted and skipped by the replay
+  int Abort(const std::vector<long> &lsns) {
+    if (lsns.size() == 0) return 0;
+    return Append(WalOpType::Abort, (const char *)lsns.data(),
+                  lsns.size() * sizeof(long));
+  }
+
+  using ReplayFunc = std::function<int(WalOpType, const char *, int)>;
+
+  /** call func with the records after lsn in order, aborted records are
+   * skipped
+   *
+   * @param failed  number of records which func failed to apply
+   * @return number of replayed records, < 0 if error
+   */
+  long Replay(long lsn, ReplayFunc func, long *failed = nullptr);
+
+  // remove the files whose records are all before or at lsn
+  int Purge(long lsn);
+
+  long LastLsn();
+
+  void SetSyncPolicy(disk_io::SyncPolicy sync_policy);
+
+ private:
+  std::string FilePath(long first_lsn);
+
+  // files sorted by their first lsn
+  std::vector<std::pair<long, std::string>> ListFiles();
+
+  // open the last file and cut off its torn tail
+  int OpenLastFile(long first_lsn, const std::string &path);
+
+  int NewFile(long first_lsn);
+
+  int WriteToFile(const std::string &buf, long first_lsn, bool sync);
+
+  // run by the background pool, returns the ms to the next run
+  long SyncOnce();
+
+  std::string dir_;
+
+  std::mutex mutex_;  // lsn and pending records
+  std::condition_variable commit_cv_;
+  long last_lsn_;
+  long written_lsn_;  // records before or at it are written
+  bool writing_;      // a writer is flushing the pending records
+  bool broken_;       // a write failed, the log can't be appended
+  std::string pending_;
+
+  std::mutex file_mutex_;  // fd and its size
+  int fd_;
+  long file_bytes_;
+  bool dirty_;
+
+  std::atomic<disk_io::SyncPolicy> sync_policy_;
+  int sync_interval_ms_;
+  long sync_task_id_;
+};
+
+}  // namespace tig_gamma
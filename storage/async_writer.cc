@@ -7,151 +7,386 @@
 
 #include "async_writer.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "log.h"
+#include "utils.h"
 
 namespace tig_gamma {
 namespace disk_io {
 
-AsyncWriter::AsyncWriter() {
-  running_ = true;
-  writer_q_ = nullptr;
-  header_size_ = 0;
-  item_length_ = 0;
+const static int kMaxIov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+static int UpdateSize(int fd, std::atomic<uint32_t> *cur_size, int num) {
+  uint32_t size = *cur_size + num;
+  if (pwrite(fd, &size, sizeof(size), sizeof(uint8_t) + sizeof(uint32_t)) !=
+      sizeof(size)) {
+    LOG(ERROR) << "update size error, fd=" << fd << ", err=" << strerror(errno);
+    return -1;
+  }
+  *cur_size = size;
+  return 0;
 }
 
-AsyncWriter::~AsyncWriter() {
-  Sync();
-  running_ = false;
-  handler_thread_.join();
-  if (writer_q_) {
-    delete writer_q_;
-    writer_q_ = nullptr;
+static int PWriteFully(int fd, const uint8_t *data, uint32_t len,
+                       off_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      LOG(ERROR) << "pwrite error, fd=" << fd << ", offset=" << offset
+                 << ", err=" << strerror(errno);
+      return -1;
+    }
+    data += n;
+    len -= n;
+    offset += n;
   }
+  return 0;
 }
 
-int AsyncWriter::Init() {
-  writer_q_ = new WriterQueue;
-  if (writer_q_ == nullptr) {
-    LOG(ERROR) << "AsyncWriter init failed.";
+static int PWritevFully(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  while (iovcnt > 0) {
+    ssize_t n = pwritev(fd, iov, iovcnt, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      LOG(ERROR) << "pwritev error, fd=" << fd << ", offset=" << offset
+                 << ", err=" << strerror(errno);
+      return -1;
+    }
+    offset += n;
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+WriteQueue *WriteQueue::GetInstance() {
+  // never deleted, the writers of the engines left at exit may still use it
+  static std::mutex mutex;
+  static WriteQueue *instance = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (instance == nullptr) {
+    WriteQueue *queue = new (std::nothrow) WriteQueue();
+    if (queue != nullptr && queue->Init() == 0) {
+      instance = queue;
+    } else {
+      CHECK_DELETE(queue);
+    }
+  }
+  return instance;
+}
+
+WriteQueue::WriteQueue() {
+  ring_ = nullptr;
+  entries_ = nullptr;
+  entry_head_ = entry_tail_ = 0;
+  byte_head_ = byte_tail_ = 0;
+  sync_wait_ms_ = 0;
+}
+
+WriteQueue::~WriteQueue() {
+  CHECK_DELETE_ARRAY(ring_);
+  CHECK_DELETE_ARRAY(entries_);
+}
+
+int WriteQueue::Init() {
+  ring_ = new (std::nothrow) uint8_t[kRingBytes];
+  entries_ = new (std::nothrow) WriteEntry[kRingEntries];
+  if (ring_ == nullptr || entries_ == nullptr) {
+    LOG(ERROR) << "WriteQueue init failed.";
     return -1;
   }
-  auto func_operate = std::bind(&AsyncWriter::WriterHandler, this);
-  handler_thread_ = std::thread(func_operate);
+  handler_thread_ = std::thread(&WriteQueue::WriterHandler, this);
+  return 0;
 }
 
-static uint32_t WritenSize(int fd) {
-  uint32_t size;
-  pread(fd, &size, sizeof(size), sizeof(uint8_t) + sizeof(uint32_t));
-  return size;
+void WriteQueue::Register(AsyncWriter *writer) {
+  std::lock_guard<std::mutex> writers_lock(writers_mutex_);
+  writers_.push_back(writer);
+  int wait_ms = 0;
+  for (AsyncWriter *w : writers_) {
+    if (w->sync_policy_ != SyncPolicy::Interval) continue;
+    if (wait_ms == 0 || w->sync_interval_ms_ < wait_ms) {
+      wait_ms = w->sync_interval_ms_;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sync_wait_ms_ = wait_ms;
+  }
+  not_empty_cv_.notify_one();
 }
 
-static void UpdateSize(int fd, std::atomic<uint32_t> *cur_size, int num) {
-  uint32_t size = *cur_size + num;
-  pwrite(fd, &size, sizeof(size), sizeof(uint8_t) + sizeof(uint32_t));
-  *cur_size = size;
+void WriteQueue::Unregister(AsyncWriter *writer) {
+  std::lock_guard<std::mutex> writers_lock(writers_mutex_);
+  writers_.erase(std::remove(writers_.begin(), writers_.end(), writer),
+                 writers_.end());
+  int wait_ms = 0;
+  for (AsyncWriter *w : writers_) {
+    if (w->sync_policy_ != SyncPolicy::Interval) continue;
+    if (wait_ms == 0 || w->sync_interval_ms_ < wait_ms) {
+      wait_ms = w->sync_interval_ms_;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  sync_wait_ms_ = wait_ms;
 }
 
-int AsyncWriter::WriterHandler() {
-  int bulk_size = 1000;
-  int bulk_bytes = 1 * 1024 * 1024;  // TODO check overflow
-  uint8_t *buffer = new uint8_t[bulk_bytes];
-
-  while (running_) {
-    struct WriterStruct *writer_structs[bulk_size];
-
-    int size = 0;
-    while(not writer_q_->empty() && size < bulk_size) {
-      struct WriterStruct *pop_val = nullptr;
-      bool ret = writer_q_->try_pop(pop_val);
-      if (ret) writer_structs[size++] = pop_val;
-    }
-
-    if (size == 1) {
-      pwrite(writer_structs[0]->fd, writer_structs[0]->data,
-             writer_structs[0]->len, writer_structs[0]->start);
-      UpdateSize(writer_structs[0]->fd, writer_structs[0]->cur_size,
-                 writer_structs[0]->len / item_length_);
-      delete[] writer_structs[0]->data;
-      delete writer_structs[0];
-    } else if (size > 1) {
-      int prev_fd = writer_structs[0]->fd;
-      uint32_t buffered_size = writer_structs[0]->len;
-      uint32_t buffered_start = writer_structs[0]->start;
-      std::atomic<uint32_t> *prev_cur_size = writer_structs[0]->cur_size;
-      memcpy(buffer + 0, writer_structs[0]->data, buffered_size);
-      delete[] writer_structs[0]->data;
-      delete writer_structs[0];
-
-      for (size_t i = 1; i < size; ++i) {
-        int fd = writer_structs[i]->fd;
-        uint8_t *data = writer_structs[i]->data;
-        uint32_t len = writer_structs[i]->len;
-        uint32_t start = writer_structs[i]->start;
-        std::atomic<uint32_t> *cur_size = writer_structs[i]->cur_size;
-
-        if (prev_fd != fd || buffered_size + len >= bulk_bytes) {
-          // flush prev data
-          pwrite(prev_fd, buffer, buffered_size, buffered_start);
-          UpdateSize(prev_fd, prev_cur_size, buffered_size / item_length_);
-          prev_fd = fd;
-          buffered_start = start;
-          prev_cur_size = cur_size;
-          // TODO check buffered_size + len < bulk_bytes
-          memcpy(buffer + 0, data, len);
-          buffered_size = len;
-        } else {
-          memcpy(buffer + buffered_size, data, len);
-          buffered_size += len;
-        }
-        
-        delete[] data;
-        delete writer_structs[i];
+void WriteQueue::Flush(uint64_t begin, uint64_t end) {
+  struct iovec iov[kMaxIov];
+  flushed_.clear();
+
+  uint64_t i = begin;
+  while (i < end) {
+    const WriteEntry &first = entries_[i % kRingEntries];
+    int iovcnt = 0;
+    uint32_t bytes = 0, num = 0;
+    uint64_t j = i;
+    // coalesce the following writes which continue the same file range
+    for (; j < end; ++j) {
+      const WriteEntry &e = entries_[j % kRingEntries];
+      if (e.writer != first.writer || e.fd != first.fd ||
+          e.cur_size != first.cur_size || e.start != first.start + bytes)
+        break;
+      uint8_t *data = ring_ + (e.end - e.len) % kRingBytes;
+      if (iovcnt > 0 && (uint8_t *)iov[iovcnt - 1].iov_base +
+                                iov[iovcnt - 1].iov_len == data) {
+        iov[iovcnt - 1].iov_len += e.len;
+      } else {
+        if (iovcnt == kMaxIov) break;
+        iov[iovcnt].iov_base = data;
+        iov[iovcnt].iov_len = e.len;
+        ++iovcnt;
       }
-      pwrite(prev_fd, buffer, buffered_size, buffered_start);
-      UpdateSize(prev_fd, prev_cur_size, buffered_size / item_length_);
+      bytes += e.len;
+      num += e.num;
     }
-    else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    AsyncWriter *writer = first.writer;
+    // nothing more of a writer is written after its error, they are dropped
+    if (writer->error_) {
+      i = j;
+      continue;
+    }
+
+    auto it = std::find_if(flushed_.begin(), flushed_.end(),
+                           [&](const FlushedFile &f) {
+                             return f.cur_size == first.cur_size;
+                           });
+    if (it == flushed_.end()) {
+      flushed_.push_back({writer, first.fd, first.cur_size, 0, false});
+      it = flushed_.end() - 1;
+    }
+    // the size only covers the ranges written before the first failure
+    if (not it->failed) {
+      if (PWritevFully(first.fd, iov, iovcnt, first.start)) {
+        it->failed = true;
+        writer->SetError();
+        LOG(ERROR) << "AsyncWriter flush failed, later writes are refused";
+      } else {
+        it->num += num;
+      }
+    }
+    i = j;
+  }
+
+  // data is durable before the readers see the new size
+  for (FlushedFile &f : flushed_) {
+    if (f.num == 0) continue;
+    if (f.writer->sync_policy_ == SyncPolicy::Batch && fdatasync(f.fd)) {
+      LOG(ERROR) << "fdatasync error, fd=" << f.fd
+                 << ", err=" << strerror(errno);
+      f.writer->SetError();
+      continue;
+    }
+    if (UpdateSize(f.fd, f.cur_size, f.num)) {
+      f.writer->SetError();
+      continue;
+    }
+    if (f.writer->sync_policy_ != SyncPolicy::None) {
+      f.writer->AddDirtyFd(f.fd);
+    }
+  }
+}
+
+void WriteQueue::SyncIntervalWriters() {
+  std::lock_guard<std::mutex> writers_lock(writers_mutex_);
+  double now = utils::getmillisecs();
+  for (AsyncWriter *writer : writers_) {
+    if (writer->sync_policy_ != SyncPolicy::Interval ||
+        now - writer->last_sync_ms_ < writer->sync_interval_ms_)
+      continue;
+    writer->SyncFiles();
+    writer->last_sync_ms_ = now;
+  }
+}
+
+void WriteQueue::WriterHandler() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (entry_head_ == entry_tail_) {
+      if (sync_wait_ms_ > 0) {
+        not_empty_cv_.wait_for(lock, std::chrono::milliseconds(sync_wait_ms_));
+      } else {
+        not_empty_cv_.wait(lock);
+      }
+    }
+    uint64_t begin = entry_head_, end = entry_tail_;
+    bool interval = sync_wait_ms_ > 0;
+    lock.unlock();
+
+    if (begin < end) Flush(begin, end);
+    if (interval) SyncIntervalWriters();
+
+    lock.lock();
+    if (begin < end) {
+      entry_head_ = end;
+      byte_head_ = entries_[(end - 1) % kRingEntries].end;
+      not_full_cv_.notify_all();
+      drained_cv_.notify_all();
     }
   }
-  delete[] buffer;
-  return 0;
 }
 
-int AsyncWriter::AsyncWrite(struct WriterStruct *writer_struct) {
-  auto qu_size = writer_q_->size();
-  while (qu_size > 10000) {
-    LOG(INFO) << "AsyncWriter queue size[" << qu_size << "] > 10000, sleep 10ms";
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    qu_size = writer_q_->size();
+int WriteQueue::Enqueue(AsyncWriter *writer, int fd, const uint8_t *data,
+                        uint32_t len, uint32_t start,
+                        std::atomic<uint32_t> *cur_size, uint32_t num) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t pad = 0;
+  while (true) {
+    // data of an entry is contiguous, skip the ring tail if it doesn't fit
+    uint64_t pos = byte_tail_ % kRingBytes;
+    pad = pos + len > kRingBytes ? kRingBytes - pos : 0;
+    if (entry_tail_ - entry_head_ < kRingEntries &&
+        byte_tail_ + pad + len - byte_head_ <= kRingBytes)
+      break;
+    not_full_cv_.wait(lock);
   }
-  writer_q_->push(writer_struct);
+  byte_tail_ += pad;
+  memcpy(ring_ + byte_tail_ % kRingBytes, data, len);
+  byte_tail_ += len;
+
+  WriteEntry &entry = entries_[entry_tail_ % kRingEntries];
+  entry.writer = writer;
+  entry.fd = fd;
+  entry.start = start;
+  entry.len = len;
+  entry.num = num;
+  entry.end = byte_tail_;
+  entry.cur_size = cur_size;
+  ++entry_tail_;
+  lock.unlock();
+  not_empty_cv_.notify_one();
   return 0;
 }
 
-int AsyncWriter::SyncWrite(struct WriterStruct *writer_struct) {
-  int fd = writer_struct->fd;
-  uint8_t *data = writer_struct->data;
-  uint32_t start = writer_struct->start;
-  uint32_t len = writer_struct->len;
-  std::atomic<uint32_t> *cur_size = writer_struct->cur_size;
+void WriteQueue::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t tail = entry_tail_;
+  drained_cv_.wait(lock, [this, tail] { return entry_head_ >= tail; });
+}
+
+AsyncWriter::AsyncWriter() {
+  queue_ = nullptr;
+  sync_policy_ = SyncPolicy::None;
+  sync_interval_ms_ = kSyncIntervalMs;
+  last_sync_ms_ = 0;
+  error_ = 0;
+  header_size_ = 0;
+  item_length_ = 0;
+}
 
-  pwrite(fd, data, len, start);
-  UpdateSize(fd, cur_size, len / item_length_);
+AsyncWriter::~AsyncWriter() {
+  if (queue_ == nullptr) return;
+  Sync();
+  queue_->Unregister(this);
+}
 
-  delete[] data;
-  delete writer_struct;
+int AsyncWriter::Init(SyncPolicy sync_policy, int sync_interval_ms) {
+  queue_ = WriteQueue::GetInstance();
+  if (queue_ == nullptr) {
+    LOG(ERROR) << "AsyncWriter init failed.";
+    return -1;
+  }
+  sync_policy_ = sync_policy;
+  if (sync_interval_ms > 0) sync_interval_ms_ = sync_interval_ms;
+  last_sync_ms_ = utils::getmillisecs();
+  queue_->Register(this);
   return 0;
 }
 
-int AsyncWriter::Sync() {
-  while (writer_q_->size()) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+void AsyncWriter::AddDirtyFd(int fd) {
+  std::lock_guard<std::mutex> lock(dirty_mutex_);
+  if (std::find(dirty_fds_.begin(), dirty_fds_.end(), fd) == dirty_fds_.end())
+    dirty_fds_.push_back(fd);
+}
+
+int AsyncWriter::SyncFiles() {
+  std::vector<int> fds;
+  {
+    std::lock_guard<std::mutex> lock(dirty_mutex_);
+    fds.swap(dirty_fds_);
+  }
+  int ret = 0;
+  for (int fd : fds) {
+    if (fdatasync(fd)) {
+      LOG(ERROR) << "fdatasync error, fd=" << fd << ", err=" << strerror(errno);
+      ret = -1;
+    }
+  }
+  if (ret) SetError();
+  return ret;
+}
+
+int AsyncWriter::AsyncWrite(int fd, const uint8_t *data, uint32_t len,
+                            uint32_t start, std::atomic<uint32_t> *cur_size) {
+  if (len > kRingBytes / 2) {
+    return SyncWrite(fd, data, len, start, cur_size);
+  }
+  if (error_) return error_;
+  return queue_->Enqueue(this, fd, data, len, start, cur_size,
+                         len / item_length_);
+}
+
+int AsyncWriter::SyncWrite(int fd, const uint8_t *data, uint32_t len,
+                           uint32_t start, std::atomic<uint32_t> *cur_size) {
+  // keep the order with the queued writes of the file
+  if (Sync()) return error_;
+  if (PWriteFully(fd, data, len, start)) {
+    SetError();
+    return error_;
+  }
+  if (sync_policy_ != SyncPolicy::None && fdatasync(fd)) {
+    LOG(ERROR) << "fdatasync error, fd=" << fd << ", err=" << strerror(errno);
+    SetError();
+    return error_;
+  }
+  if (UpdateSize(fd, cur_size, len / item_length_)) {
+    SetError();
+    return error_;
   }
   return 0;
 }
 
+int AsyncWriter::Sync() {
+  if (queue_ == nullptr) return error_;
+  queue_->Drain();
+  if (sync_policy_ != SyncPolicy::None) SyncFiles();
+  return error_;
+}
+
 }  // namespace disk_io
-}  // namespace tig_gamma
\ No newline at end of file
+}  // namespace tig_gamma
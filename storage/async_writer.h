@@ -8,53 +8,160 @@
 #pragma once
 
 #include <stdint.h>
+
 #include <atomic>
-#include <tbb/concurrent_queue.h>
-#include "concurrentqueue/blockingconcurrentqueue.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace tig_gamma {
 namespace disk_io {
 
-struct WriterStruct {
-  int fd;
-  uint8_t *data;
-  uint32_t start;
-  uint32_t len;
-  std::atomic<uint32_t> *cur_size;
+// durability of the asynchronous writes
+enum class SyncPolicy : uint8_t {
+  None = 0,  // left to the page cache
+  Interval,  // fdatasync the written files every sync interval
+  Batch      // fdatasync the written files after each batch (group commit)
 };
 
-//typedef moodycamel::BlockingConcurrentQueue<struct WriterStruct *> WriterQueue;
-typedef tbb::concurrent_bounded_queue<struct WriterStruct *> WriterQueue;
+const static uint32_t kRingBytes = 8 * 1024 * 1024;  // bytes of queued data
+const static uint32_t kRingEntries = 16384;          // max queued writes
+const static int kSyncIntervalMs = 1000;
+
+class AsyncWriter;
+
+/** the ring buffer and the handler thread shared by all the AsyncWriters of
+ * the process. Writes are copied into the ring and flushed by the handler,
+ * contiguous writes of a file are coalesced into one pwritev and the size in
+ * the file header is updated once per batch. Producers block while the ring
+ * is full.
+ */
+class WriteQueue {
+ public:
+  // nullptr if the ring can't be allocated
+  static WriteQueue *GetInstance();
+
+  int Enqueue(AsyncWriter *writer, int fd, const uint8_t *data, uint32_t len,
+              uint32_t start, std::atomic<uint32_t> *cur_size, uint32_t num);
+
+  // wait until the writes queued before the call are flushed
+  void Drain();
+
+  void Register(AsyncWriter *writer);
+
+  // the writes of the writer must be drained
+  void Unregister(AsyncWriter *writer);
+
+ private:
+  struct WriteEntry {
+    AsyncWriter *writer;
+    int fd;
+    uint32_t start;
+    uint32_t len;
+    uint32_t num;  // items of the write
+    uint64_t end;  // ring position after the data
+    std::atomic<uint32_t> *cur_size;
+  };
+
+  struct FlushedFile {
+    AsyncWriter *writer;
+    int fd;
+    std::atomic<uint32_t> *cur_size;
+    uint32_t num;
+    bool failed;  // later ranges of the file are not counted
+  };
+
+  WriteQueue();
+
+  ~WriteQueue();
+
+  int Init();
+
+  void WriterHandler();
+
+  // write the entries [begin, end)
+  void Flush(uint64_t begin, uint64_t end);
 
+  // fdatasync the files of the writers whose sync interval is over
+  void SyncIntervalWriters();
+
+  uint8_t *ring_;
+  WriteEntry *entries_;
+  // entries [entry_head_, entry_tail_) are queued, positions are monotonic
+  uint64_t entry_head_;
+  uint64_t entry_tail_;
+  uint64_t byte_head_;
+  uint64_t byte_tail_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_cv_;
+  std::condition_variable not_full_cv_;
+  std::condition_variable drained_cv_;
+  int sync_wait_ms_;  // min interval of the writers, 0 if none, by mutex_
+
+  // the handler syncs the writers under writers_mutex_, so they are not
+  // unregistered meanwhile
+  std::mutex writers_mutex_;
+  std::vector<AsyncWriter *> writers_;
+
+  std::vector<FlushedFile> flushed_;  // only used by the handler
+  std::thread handler_thread_;
+};
+
+/** writes of a storage through the shared WriteQueue, each writer has its
+ * own durability policy and its own latched error, so a failed file of one
+ * table doesn't refuse the writes of the others
+ */
 class AsyncWriter {
  public:
   AsyncWriter();
   ~AsyncWriter();
 
-  int Init();
+  int Init(SyncPolicy sync_policy = SyncPolicy::None,
+           int sync_interval_ms = kSyncIntervalMs);
 
-  int AsyncWrite(struct WriterStruct *writer_struct);
+  int AsyncWrite(int fd, const uint8_t *data, uint32_t len, uint32_t start,
+                 std::atomic<uint32_t> *cur_size);
 
-  int SyncWrite(struct WriterStruct *writer_struct);
+  int SyncWrite(int fd, const uint8_t *data, uint32_t len, uint32_t start,
+                std::atomic<uint32_t> *cur_size);
 
+  // wait until the queued writes are flushed (and synced by the policy),
+  // returns the latched write error
   int Sync();
 
+  // 0, or -1 once a write, a size update or a sync failed. The error is
+  // latched: later writes are refused and no size advances over lost data.
+  int Error() { return error_; }
+
   void Set(uint32_t header_size, int item_length) {
     header_size_ = header_size;
     item_length_ = item_length;
   }
 
  private:
-  int WriterHandler();
+  friend class WriteQueue;
 
-  WriterQueue *writer_q_;
+  int SyncFiles();
 
-  bool running_;
-  std::thread handler_thread_;
+  void AddDirtyFd(int fd);
+
+  void SetError() { error_ = -1; }
+
+  WriteQueue *queue_;
+  SyncPolicy sync_policy_;
+  int sync_interval_ms_;
+  double last_sync_ms_;  // only used by the handler
+
+  std::mutex dirty_mutex_;
+  std::vector<int> dirty_fds_;  // written since the last sync
+
+  std::atomic<int> error_;
 
   uint32_t header_size_;
   int item_length_;
 };
 
 }  // namespace disk_io
-}
\ No newline at end of file
+}  // namespace tig_gamma
@@ -143,6 +143,39 @@ int Block::Update(const uint8_t *value, int n_bytes, uint32_t start) {
   return 0;
 }
 
+void Block::MissingBlocks(uint32_t start, uint32_t n_bytes,
+                          std::vector<uint32_t> &block_ids) {
+  if (lru_cache_ == nullptr || n_bytes == 0) return;
+  StoredRange(start, n_bytes);
+
+  uint32_t first_bid = start / per_block_size_;
+  uint32_t last_bid = (start + n_bytes - 1) / per_block_size_;
+  if (last_bid_in_disk_ <= last_bid) {
+    last_bid_in_disk_ = (*cur_size_) * item_length_ / per_block_size_;
+    if ((int)(*cur_size_) == max_size_) SegmentIsFull();
+  }
+  for (uint32_t block_id = first_bid; block_id <= last_bid; ++block_id) {
+    // the blocks not brushed to disk are read directly
+    if (block_id >= last_bid_in_disk_) break;
+    if (not lru_cache_->Contains(GetCacheBlockId(block_id))) {
+      block_ids.push_back(block_id);
+    }
+  }
+}
+
+bool Block::LoadBlock(uint32_t block_id) {
+  char *block = nullptr;
+  ReadFunParameter parameter;
+  GetReadFunParameter(parameter, per_block_size_, block_id * per_block_size_);
+  bool res = lru_cache_->SetOrGet(GetCacheBlockId(block_id), block, &parameter);
+  if (not res || block == nullptr) {
+    LOG(ERROR) << "Load block fails from disk_file, block_id[" << block_id
+               << "]";
+    return false;
+  }
+  return true;
+}
+
 void Block::SegmentIsFull() {
   last_bid_in_disk_ = (*cur_size_) * item_length_ / per_block_size_;
   ++last_bid_in_disk_;
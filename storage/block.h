@@ -49,6 +49,14 @@ class Block {
 
   virtual int Update(const uint8_t *value, int n_bytes, uint32_t start);
 
+  // ids of the blocks covering [start, start + n_bytes) which are on disk
+  // but not in the cache
+  void MissingBlocks(uint32_t start, uint32_t n_bytes,
+                     std::vector<uint32_t> &block_ids);
+
+  // read a block from disk into the cache
+  bool LoadBlock(uint32_t block_id);
+
   void SegmentIsFull(); // Segment is full and all data is brushed to disk.
   
   int32_t GetCacheBlockId(uint32_t block_id);
@@ -60,6 +68,9 @@ class Block {
 
   virtual void InitSubclass() = 0;
 
+  // map a range of raw values to the range stored in the blocks
+  virtual void StoredRange(uint32_t &start, uint32_t &n_bytes) {}
+
   virtual int WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
                            disk_io::AsyncWriter *disk_io,
                            std::atomic<uint32_t> *cur_size) = 0;
@@ -0,0 +1,116 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "cache_quota.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace tig_gamma {
+
+void CacheQuota::SetBudget(long budget_mb) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_mb_ = budget_mb > 0 ? budget_mb : 0;
+  LOG(INFO) << "cache budget [" << budget_mb_ << "]M";
+  Rebalance();
+}
+
+long CacheQuota::Budget() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return budget_mb_;
+}
+
+void CacheQuota::Register(int table_id, BlockCache *cache, size_t cache_mb) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // the cache is created with its configured size
+  caches_[cache] = {table_id, cache_mb, cache_mb};
+  Rebalance();
+}
+
+void CacheQuota::Resize(BlockCache *cache, size_t cache_mb) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = caches_.find(cache);
+  if (it == caches_.end()) return;
+  it->second.cache_mb = cache_mb;
+  Rebalance();
+}
+
+void CacheQuota::Unregister(BlockCache *cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (caches_.erase(cache) > 0) Rebalance();
+}
+
+size_t CacheQuota::TableQuota(int table_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t quota = 0;
+  for (auto &it : caches_) {
+    if (it.second.table_id == table_id) quota += it.second.quota_mb;
+  }
+  return quota;
+}
+
+void CacheQuota::Rebalance() {
+  std::map<int, size_t> demands;  // table id -> configured M
+  size_t total = 0;
+  for (auto &it : caches_) {
+    demands[it.second.table_id] += it.second.cache_mb;
+    total += it.second.cache_mb;
+  }
+
+  std::map<int, size_t> quotas = demands;
+  if (budget_mb_ > 0 && total > (size_t)budget_mb_) {
+    // the smaller demands are served first, the rest is split evenly
+    std::vector<std::pair<size_t, int>> tables;
+    for (auto &it : demands) tables.push_back({it.second, it.first});
+    std::sort(tables.begin(), tables.end());
+    size_t left = budget_mb_;
+    size_t n = tables.size();
+    for (auto &table : tables) {
+      size_t share = left / n--;
+      size_t quota = std::min(table.first, share);
+      quotas[table.second] = quota;
+      left -= quota;
+    }
+  }
+
+  // the caches of a table are scaled by their configured sizes, the largest
+  // one takes what the rounding leaves
+  std::map<BlockCache *, size_t> cache_quotas;
+  std::map<int, BlockCache *> largest;
+  std::map<int, size_t> assigned;
+  for (auto &it : caches_) {
+    Entry &entry = it.second;
+    size_t demand = demands[entry.table_id];
+    size_t quota = entry.cache_mb;
+    if (quotas[entry.table_id] < demand) {
+      quota = quotas[entry.table_id] * entry.cache_mb / demand;
+    }
+    cache_quotas[it.first] = quota;
+    assigned[entry.table_id] += quota;
+    BlockCache *&cache = largest[entry.table_id];
+    if (cache == nullptr || caches_[cache].cache_mb < entry.cache_mb) {
+      cache = it.first;
+    }
+  }
+  for (auto &it : largest) {
+    cache_quotas[it.second] += quotas[it.first] - assigned[it.first];
+  }
+
+  for (auto &it : caches_) {
+    Entry &entry = it.second;
+    size_t quota = cache_quotas[it.first];
+    if (quota == 0) quota = 1;
+    if (quota == entry.quota_mb) continue;
+    entry.quota_mb = quota;
+    it.first->AlterCacheSize(quota);
+    LOG(INFO) << "cache [" << it.first->GetName() << "] of table ["
+              << entry.table_id << "] quota [" << quota << "]M, configured ["
+              << entry.cache_mb << "]M";
+  }
+}
+
+}  // namespace tig_gamma
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+
+#include "lru_cache.h"
+
+namespace tig_gamma {
+
+typedef LRUCache<uint32_t, ReadFunParameter *> BlockCache;
+
+/** shares one memory budget among the block caches of all the tables of the
+ * process. Each table is given an equal share, what a table doesn't ask for
+ * goes to the others, and the caches of a table are scaled in proportion to
+ * their configured sizes. Without a budget the caches keep their configured
+ * sizes.
+ */
+class CacheQuota {
+ public:
+  static CacheQuota &GetInstance() {
+    static CacheQuota instance;
+    return instance;
+  }
+
+  // budget_mb <= 0 means unlimited
+  void SetBudget(long budget_mb);
+
+  long Budget();
+
+  void Register(int table_id, BlockCache *cache, size_t cache_mb);
+
+  // the configured size of the cache is changed
+  void Resize(BlockCache *cache, size_t cache_mb);
+
+  void Unregister(BlockCache *cache);
+
+  // memory given to the caches of the table in M
+  size_t TableQuota(int table_id);
+
+ private:
+  struct Entry {
+    int table_id;
+    size_t cache_mb;  // configured
+    size_t quota_mb;  // applied
+  };
+
+  CacheQuota() : budget_mb_(0) {}
+
+  CacheQuota(const CacheQuota &) = delete;
+
+  CacheQuota &operator=(const CacheQuota &) = delete;
+
+  // called with mutex_ held
+  void Rebalance();
+
+  std::mutex mutex_;
+  long budget_mb_;
+  std::map<BlockCache *, Entry> caches_;
+};
+
+}  // namespace tig_gamma
@@ -0,0 +1,167 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "compressor.h"
+#include "log.h"
+
+namespace tig_gamma {
+
+namespace float16 {
+
+inline uint32_t AsUint(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline float AsFloat(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// round to nearest even, overflow becomes inf
+inline uint16_t FloatToHalf(float f) {
+  const uint32_t f16_max = (127 + 16) << 23;
+  const uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+  uint32_t u = AsUint(f);
+  uint32_t sign = u & 0x80000000u;
+  u ^= sign;
+
+  uint16_t h;
+  if (u >= f16_max) {
+    h = u > 0x7f800000u ? 0x7e00 : 0x7c00;
+  } else if (u < (113u << 23)) {
+    // subnormal or zero, the float add does the rounding
+    h = (uint16_t)(AsUint(AsFloat(u) + AsFloat(denorm_magic)) - denorm_magic);
+  } else {
+    uint32_t mant_odd = (u >> 13) & 1;
+    u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    u += mant_odd;
+    h = (uint16_t)(u >> 13);
+  }
+  return h | (uint16_t)(sign >> 16);
+}
+
+inline float HalfToFloat(uint16_t h) {
+  const uint32_t shifted_exp = 0x7c00u << 13;
+  uint32_t u = (uint32_t)(h & 0x7fff) << 13;
+  uint32_t exp = shifted_exp & u;
+  u += (127 - 15) << 23;
+  if (exp == shifted_exp) {
+    u += (128 - 16) << 23;  // inf or nan
+  } else if (exp == 0) {
+    u += 1 << 23;  // subnormal, renormalize
+    u = AsUint(AsFloat(u) - AsFloat(113u << 23));
+  }
+  return AsFloat(u | ((uint32_t)(h & 0x8000) << 16));
+}
+
+inline uint16_t FloatToBfloat(float f) {
+  uint32_t u = AsUint(f);
+  if ((u & 0x7fffffffu) > 0x7f800000u) return (uint16_t)((u >> 16) | 0x40);
+  u += 0x7fff + ((u >> 16) & 1);
+  return (uint16_t)(u >> 16);
+}
+
+inline float BfloatToFloat(uint16_t b) { return AsFloat((uint32_t)b << 16); }
+
+inline void EncodeHalf(const float *x, uint16_t *y, size_t n) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    __m128i h =
+        _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i *)(y + i), h);
+  }
+#endif
+  for (; i < n; i++) y[i] = FloatToHalf(x[i]);
+}
+
+inline void DecodeHalf(const uint16_t *x, float *y, size_t n) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128((const __m128i *)(x + i));
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; i < n; i++) y[i] = HalfToFloat(x[i]);
+}
+
+// the plain loops are vectorized by the compiler
+inline void EncodeBfloat(const float *x, uint16_t *y, size_t n) {
+  for (size_t i = 0; i < n; i++) y[i] = FloatToBfloat(x[i]);
+}
+
+inline void DecodeBfloat(const uint16_t *x, float *y, size_t n) {
+  for (size_t i = 0; i < n; i++) y[i] = BfloatToFloat(x[i]);
+}
+
+}  // namespace float16
+
+/** stores each float in 16 bits, Fp16 is IEEE half precision and Bf16 keeps
+ * the float exponent with a 7 bits mantissa. It has no state, vectors are
+ * decoded straight into the output buffer.
+ */
+class CompressorFloat16 : public Compressor {
+ public:
+  CompressorFloat16(CompressType type) : Compressor(type) {
+    dims_ = 0;
+    LOG(INFO) << "CompressorFloat16 construction!";
+  }
+
+  ~CompressorFloat16() {}
+
+  void Init(int d, double r = DEFAULT_RATE, int t = 0) { dims_ = d; }
+
+  size_t GetCompressLen(int data_len = 0) { return dims_ * sizeof(uint16_t); }
+
+  int GetRawLen() { return dims_ * sizeof(float); }
+
+  size_t Compress(char *data, char *output, int data_len) {
+    return CompressBatch(data, output, 1, data_len);
+  }
+
+  size_t Decompress(char *data, char *output, int data_len) {
+    return DecompressBatch(data, output, 1, data_len);
+  }
+
+  size_t CompressBatch(char *datum, char *output, int n, int data_len) {
+    size_t num = (size_t)n * dims_;
+    if (GetCompressType() == CompressType::Bf16) {
+      float16::EncodeBfloat((const float *)datum, (uint16_t *)output, num);
+    } else {
+      float16::EncodeHalf((const float *)datum, (uint16_t *)output, num);
+    }
+    return num * sizeof(uint16_t);
+  }
+
+  size_t DecompressBatch(char *datum, char *output, int n, int data_len) {
+    size_t num = (size_t)n * dims_;
+    if (GetCompressType() == CompressType::Bf16) {
+      float16::DecodeBfloat((const uint16_t *)datum, (float *)output, num);
+    } else {
+      float16::DecodeHalf((const uint16_t *)datum, (float *)output, num);
+    }
+    return num * sizeof(float);
+  }
+
+ private:
+  int dims_;
+};
+
+}  // namespace tig_gamma
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "compressor.h"
+#include "log.h"
+
+namespace tig_gamma {
+
+/** 8 bits scalar quantization, a vector is stored as [min:4][scale:4][codes:d]
+ * and decoded as min + code * scale. The range is kept per vector so that a
+ * vector can be updated in place and decoded without its neighbours.
+ */
+class CompressorSQ8 : public Compressor {
+ public:
+  CompressorSQ8(CompressType type) : Compressor(type) {
+    dims_ = 0;
+    LOG(INFO) << "CompressorSQ8 construction!";
+  }
+
+  ~CompressorSQ8() {}
+
+  void Init(int d, double r = DEFAULT_RATE, int t = 0) { dims_ = d; }
+
+  size_t GetCompressLen(int data_len = 0) { return kHeaderLen + dims_; }
+
+  int GetRawLen() { return dims_ * sizeof(float); }
+
+  size_t Compress(char *data, char *output, int data_len) {
+    const float *x = (const float *)data;
+    float min = x[0], max = x[0];
+    for (int i = 1; i < dims_; i++) {
+      min = x[i] < min ? x[i] : min;
+      max = x[i] > max ? x[i] : max;
+    }
+    float scale = (max - min) / 255;
+    float inv = scale > 0 ? 1 / scale : 0;
+    memcpy(output, &min, sizeof(min));
+    memcpy(output + sizeof(min), &scale, sizeof(scale));
+
+    uint8_t *codes = (uint8_t *)output + kHeaderLen;
+    for (int i = 0; i < dims_; i++) {
+      int code = (int)lrintf((x[i] - min) * inv);
+      codes[i] = (uint8_t)(code < 0 ? 0 : (code > 255 ? 255 : code));
+    }
+    return GetCompressLen();
+  }
+
+  size_t Decompress(char *data, char *output, int data_len) {
+    float min, scale;
+    memcpy(&min, data, sizeof(min));
+    memcpy(&scale, data + sizeof(min), sizeof(scale));
+    const uint8_t *codes = (const uint8_t *)data + kHeaderLen;
+    float *y = (float *)output;
+
+    int i = 0;
+#ifdef __AVX2__
+    __m256 vmin = _mm256_set1_ps(min);
+    __m256 vscale = _mm256_set1_ps(scale);
+    for (; i + 8 <= dims_; i += 8) {
+      __m128i c = _mm_loadl_epi64((const __m128i *)(codes + i));
+      __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c));
+      _mm256_storeu_ps(y + i, _mm256_add_ps(vmin, _mm256_mul_ps(v, vscale)));
+    }
+#endif
+    for (; i < dims_; i++) y[i] = min + codes[i] * scale;
+    return GetRawLen();
+  }
+
+  size_t CompressBatch(char *datum, char *output, int n, int data_len) {
+    for (int i = 0; i < n; i++) {
+      Compress(datum + (size_t)i * GetRawLen(),
+               output + (size_t)i * GetCompressLen(), 0);
+    }
+    return (size_t)n * GetCompressLen();
+  }
+
+  size_t DecompressBatch(char *datum, char *output, int n, int data_len) {
+    for (int i = 0; i < n; i++) {
+      Decompress(datum + (size_t)i * GetCompressLen(),
+                 output + (size_t)i * GetRawLen(), 0);
+    }
+    return (size_t)n * GetRawLen();
+  }
+
+ private:
+  const static int kHeaderLen = 2 * sizeof(float);
+  int dims_;
+};
+
+}  // namespace tig_gamma
@@ -19,6 +19,9 @@
 
 namespace tig_gamma {
 
+// smaller batches are decoded by the calling thread
+const static int kZfpParallelBatch = 1024;
+
 class CompressorZFP : public Compressor {
  public:
   CompressorZFP(CompressType type) : Compressor(type) { 
@@ -48,81 +51,84 @@ class CompressorZFP : public Compressor {
   int GetRawLen() { return raw_len; }
 
   size_t Compress(char* data, char* output, int data_len) {
-    zfp_field *field = zfp_field_1d(data, type, dims);
-    zfp_stream *zfp = zfp_stream_open(NULL);
-    zfp_stream_set_rate(zfp, rate, type, 1, 0);
-
-    bitstream *b_stream;
-    b_stream = stream_open(output, zfpsize);
-    zfp_stream_set_bit_stream(zfp, b_stream);
-    // zfp_stream_rewind(zfp);
-    size_t size = (size_t)zfp_compress(zfp, field);
-    zfp_field_free(field);
-    zfp_stream_close(zfp);
+    ZfpContext &ctx = Context();
+    zfp_field_set_pointer(ctx.field, data);
+    bitstream *b_stream = stream_open(output, zfpsize);
+    zfp_stream_set_bit_stream(ctx.zfp, b_stream);
+    zfp_stream_rewind(ctx.zfp);
+    size_t size = (size_t)zfp_compress(ctx.zfp, ctx.field);
     stream_close(b_stream);
     return size;
   }
 
   size_t CompressBatch(char* datum, char* output, int n, int data_len) {
     size_t flag = n * zfpsize;
-    int size;
-
     if (!threads) threads = omp_get_max_threads();
-    int chunks = (n + threads - 1) / threads;
-
-#pragma omp parallel for num_threads(threads)
-    for (int i = 0; i < threads; i++) {
-      for (int j = 0; j < chunks; j++) {
-        if (j + i * chunks > n - 1) break;
-        size = Compress(datum + sizeof(float) * dims * (j + i * chunks),
-                        output + zfpsize * (j + i * chunks), 0);
-        if (size == 0) {
-          flag = 0;
-        }
+
+#pragma omp parallel for num_threads(threads) if (n >= kZfpParallelBatch)
+    for (int i = 0; i < n; i++) {
+      size_t size = Compress(datum + sizeof(float) * dims * i,
+                             output + zfpsize * i, 0);
+      if (size == 0) {
+        flag = 0;
       }
     }
     return flag;
   }
 
   size_t Decompress(char* data, char* output, int data_len) {
-    zfp_field *field = zfp_field_1d(output, type, dims);
-    zfp_stream *zfp = zfp_stream_open(NULL);
-    zfp_stream_set_rate(zfp, rate, type, 1, 0);
-    /* zfp_stream_set_execution(zfp, zfp_exec_omp); */
-    /* zfp_stream_set_reversible(zfp); */
-    bitstream *b_stream;
-    zfp_field_set_pointer(field, output);
-    b_stream = stream_open(data, zfpsize);
-    zfp_stream_set_bit_stream(zfp, b_stream);
-    // zfp_stream_rewind(zfp);
-    size_t size = (size_t)zfp_decompress(zfp, field);
-    zfp_field_free(field);
-    zfp_stream_close(zfp);
+    ZfpContext &ctx = Context();
+    zfp_field_set_pointer(ctx.field, output);
+    bitstream *b_stream = stream_open(data, zfpsize);
+    zfp_stream_set_bit_stream(ctx.zfp, b_stream);
+    zfp_stream_rewind(ctx.zfp);
+    size_t size = (size_t)zfp_decompress(ctx.zfp, ctx.field);
     stream_close(b_stream);
     return size;
   }
 
   size_t DecompressBatch(char* datum, char* output, int n, int data_len) {
     size_t flag = n * zfpsize;
-    int size;
     if (!threads) threads = omp_get_max_threads();
-    int chunks = (n + threads - 1) / threads;
-
-#pragma omp parallel for num_threads(threads)
-    for (int i = 0; i < threads; i++) {
-      for (int j = 0; j < chunks; j++) {
-        if (j + i * chunks > n - 1) break;
-        size = Decompress(datum + zfpsize * (j + i * chunks),
-                          output + sizeof(float) * dims * (j + i * chunks), 0);
-        if (size == 0) {
-          flag = 0;
-        }
+
+#pragma omp parallel for num_threads(threads) if (n >= kZfpParallelBatch)
+    for (int i = 0; i < n; i++) {
+      size_t size = Decompress(datum + zfpsize * i,
+                               output + sizeof(float) * dims * i, 0);
+      if (size == 0) {
+        flag = 0;
       }
     }
     return flag;
   }
 
  private:
+  // zfp stream and field of a thread, they are reused by the calls
+  struct ZfpContext {
+    zfp_stream *zfp = nullptr;
+    zfp_field *field = nullptr;
+    int dims = 0;
+    double rate = 0;
+
+    ~ZfpContext() {
+      if (field) zfp_field_free(field);
+      if (zfp) zfp_stream_close(zfp);
+    }
+  };
+
+  ZfpContext &Context() {
+    static thread_local ZfpContext ctx;
+    if (ctx.zfp == nullptr || ctx.dims != dims || ctx.rate != rate) {
+      if (ctx.zfp == nullptr) ctx.zfp = zfp_stream_open(NULL);
+      if (ctx.field) zfp_field_free(ctx.field);
+      ctx.field = zfp_field_1d(NULL, type, dims);
+      zfp_stream_set_rate(ctx.zfp, rate, type, 1, 0);
+      ctx.dims = dims;
+      ctx.rate = rate;
+    }
+    return ctx;
+  }
+
   int dims;     // the dims of 1D_array
   double rate;  // the rate of compress, default is 16
   int threads;
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <time.h>
 #include <unistd.h>
 // #include <malloc.h>
@@ -20,6 +21,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "log.h"
 
@@ -29,10 +31,6 @@ struct ReadFunParameter {
   uint32_t offset;
 };
 
-#define THRESHOLD_OF_SWAP 250
-#define THRESHOLD_TYPE uint8_t
-#define MAP_GROUP_NUM 100
-
 
 
 template <typename Value>
@@ -280,330 +278,549 @@ class MemoryPool {
   std::queue<char *> que_;
 };
 
+const static int kCacheShardNum = 16;
+
+/** a sharded CLOCK cache, keys are hash-partitioned into shards which have
+ * their own lock, cells and memory pool. Hits don't lock: the cell is found
+ * in the hit table of the shard and pinned by a CAS on its state. Misses,
+ * inserts and evictions take the shard lock, the clock hand gives
+ * referenced cells a second chance when a shard is full.
+ */
 template <typename Key, typename FuncToken,
           typename HashFunction = std::hash<Key>>
 class LRUCache {
  public:
   using LoadFunc = bool (*)(Key, char *, FuncToken);
-  using QueueIterator = typename std::list<Key>::iterator;
-  struct Cell {
-    char *value = nullptr;
-    QueueIterator que_ite;
-    THRESHOLD_TYPE hits;
-    // ~Cell() {
-    //   if (value) {
-    //     delete[] value;
-    //     value = nullptr;
-    //   }
-    // }
-  };
-
 
   struct InsertInfo {
     std::mutex mtx_;
     bool is_clean_ = false;
     bool is_product_ = false;
-    Cell cell_;
+    char *value_ = nullptr;
   };
 
  private:
+  struct Shard;
+
+  // state of a cell is generation << 33 | dead << 32 | refs, the cache
+  // holds one ref of a live cell and each pin holds one
+  const static uint64_t kCellRefMask = 0xffffffffULL;
+  const static uint64_t kCellDead = 1ULL << 32;
+  const static int kCellGenShift = 33;
+
+  /* cells are recycled but only freed with the cache, a reader which loaded
+   * a stale cell still reads valid memory, its CAS fails on a dead cell and
+   * the key check catches a recycled one */
+  struct Cell {
+    Key key;
+    char *value = nullptr;
+    Shard *shard = nullptr;
+    size_t slot = 0;                     // position in the clock ring
+    std::atomic<uint8_t> referenced{0};  // set by hits, cleared by the hand
+    std::atomic<uint64_t> state{kCellDead};
+  };
+
+  // direct-mapped, a key whose slot holds another cell is found by the
+  // locked path
+  struct HitTable {
+    explicit HitTable(size_t capacity) : mask(capacity - 1) {
+      slots = new std::atomic<Cell *>[capacity];
+      for (size_t i = 0; i < capacity; ++i) slots[i] = nullptr;
+    }
+    ~HitTable() { delete[] slots; }
+
+    size_t mask;
+    std::atomic<Cell *> *slots;
+  };
+
+  struct Shard {
+    pthread_rwlock_t rw_lock;
+    std::unordered_map<Key, Cell *, HashFunction> cells;
+    std::unordered_map<Key, std::shared_ptr<InsertInfo>, HashFunction>
+        insert_infos;
+    std::vector<Cell *> clock;  // cells scanned by the clock hand
+    size_t hand = 0;
+    size_t max_size = 0;
+    MemoryPool mem_pool;
+    std::atomic<HitTable *> hit_table{nullptr};
+    // replaced by a resize, readers may still probe them
+    std::vector<HitTable *> retired_tables;
+    std::vector<Cell *> free_cells;
+    std::vector<Cell *> all_cells;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> set_hits{0};
+    std::atomic<size_t> evictions{0};
+  };
+
   std::string name_;
-  size_t max_size_;
+  std::atomic<size_t> max_size_;
   size_t cell_size_;
-  MemoryPool mem_pool_;
-  std::unordered_map<Key, std::shared_ptr<InsertInfo>, HashFunction>
-      insert_infos_;
-  size_t max_overflow_ = 0;
-  size_t last_show_log_ = 1;
+  int shard_num_;
+  int shard_bits_;
+  Shard *shards_;
   std::atomic<size_t> cur_size_{0};
-  std::atomic<size_t> hits_{0};
-  std::atomic<size_t> misses_{0};
-  std::atomic<size_t> set_hits_{0};
-  size_t evict_num_ = 0;
-  std::unordered_map<Key, Cell, HashFunction> cells_;
-
-  // CacheList<Key> queue_;
-  std::list<Key> queue_;
   LoadFunc load_func_;
-  std::mutex mtx_;
-  // pthread_rwlock_t rw_lock_;
+  std::mutex alter_mutex_;  // serializes AlterCacheSize
 
  public:
-  LRUCache(std::string name, size_t cache_size, size_t cell_size, LoadFunc func) {
+  LRUCache(std::string name, size_t cache_size, size_t cell_size,
+           LoadFunc func) {
     name_ = name;
     cell_size_ = cell_size;
-    max_size_ = (cache_size * 1024 * 1024) / cell_size;
-    max_overflow_ = max_size_ / 20;
-    if (max_overflow_ > 1000) {
-      max_overflow_ = 1000;
+    size_t max_size = (cache_size * 1024 * 1024) / cell_size;
+    if (max_size == 0) max_size = 1;
+    max_size_ = max_size;
+    // small caches use fewer shards to keep the CLOCK policy meaningful
+    shard_num_ = kCacheShardNum;
+    while (shard_num_ > 1 && max_size / shard_num_ < 32) shard_num_ /= 2;
+    shard_bits_ = 0;
+    while ((1 << shard_bits_) < shard_num_) ++shard_bits_;
+    shards_ = new Shard[shard_num_];
+    for (int i = 0; i < shard_num_; ++i) {
+      Shard &shard = shards_[i];
+      pthread_rwlock_init(&shard.rw_lock, nullptr);
+      shard.max_size = ShardMaxSize(i, max_size);
+      shard.hit_table = new HitTable(HitTableSize(shard.max_size));
     }
-    max_size_ -= max_overflow_;
     load_func_ = func;
-    LOG(INFO) << "LruCache[" << name_ << "] open! Max_size[" << max_size_
-              << "], max_overflow[" << max_overflow_ << "]";
+    LOG(INFO) << "LruCache[" << name_ << "] open! Max_size[" << max_size
+              << "], shard_num[" << shard_num_ << "]";
   }
 
   virtual ~LRUCache() {
-    // pthread_rwlock_destroy(&rw_lock_);
+    LOG(INFO) << "LruCache[" << name_ << "] cur_size[" << cur_size_
+              << "] hits[" << GetHits() << "] set_hits[" << GetSetHits()
+              << "] misses[" << GetMisses() << "] evictions["
+              << GetEvictions() << "]";
+    for (int i = 0; i < shard_num_; ++i) {
+      Shard &shard = shards_[i];
+      for (Cell *cell : shard.all_cells) {
+        if (cell->value) shard.mem_pool.ReclaimBuffer(cell->value);
+        delete cell;
+      }
+      delete shard.hit_table.load();
+      for (HitTable *table : shard.retired_tables) delete table;
+      pthread_rwlock_destroy(&shard.rw_lock);
+    }
+    delete[] shards_;
     LOG(INFO) << "LruCache[" << name_ << "] destroyed successfully!";
   }
 
   int Init() {
-    // queue_.Init();
-    mem_pool_.Init((uint32_t)max_size_ + max_overflow_ + 500,
-                   (uint32_t)cell_size_);
-    // int ret = pthread_rwlock_init(&rw_lock_, nullptr);
-    // if (ret != 0) {
-    //   LOG(ERROR) << "LruCache[" << name_
-    //              << "] init read-write lock error, ret=" << ret;
-    //   return 2;
-    // }
+    for (int i = 0; i < shard_num_; ++i) {
+      Shard &shard = shards_[i];
+      shard.mem_pool.Init(PoolSize(shard.max_size), (uint32_t)cell_size_);
+    }
     return 0;
   }
 
   bool Get(Key key, char *&value) {
-    bool res;
-    {
-      std::lock_guard<std::mutex> lock(mtx_);
-      // pthread_rwlock_rdlock(&rw_lock_);
-      res = GetImpl(key, value);
-      // pthread_rwlock_unlock(&rw_lock_);
+    uint64_t h = Hash(key);
+    Shard &shard = GetShard(h);
+    bool res = false;
+    Cell *cell = FastPin(shard, key, h);
+    if (cell != nullptr) {
+      value = cell->value;
+      Touch(cell);
+      Release(cell);
+      res = true;
+    } else {
+      pthread_rwlock_rdlock(&shard.rw_lock);
+      res = GetImpl(shard, key, value);
+      pthread_rwlock_unlock(&shard.rw_lock);
     }
 
     if (res)
-      ++hits_;
+      shard.hits.fetch_add(1, std::memory_order_relaxed);
     else
-      ++misses_;
-    if (hits_ % 100000 == 0 && hits_ != last_show_log_) {
-      LOG(INFO) << "LruCache[" << name_ << "] cur_size[" << cur_size_
-                << "] cells_size[" << cells_.size() << "] hits[" << hits_
-                << "] set_hits[" << set_hits_ << "] misses[" << misses_
-                << "] evict_num_[" << evict_num_ << "]";
-      last_show_log_ = hits_;
+      shard.misses.fetch_add(1, std::memory_order_relaxed);
+    return res;
+  }
+
+  // neither counted as a hit nor marks the cell referenced
+  bool Contains(Key key) {
+    uint64_t h = Hash(key);
+    Shard &shard = GetShard(h);
+    Cell *cell = FastPin(shard, key, h);
+    if (cell != nullptr) {
+      Release(cell);
+      return true;
     }
+    pthread_rwlock_rdlock(&shard.rw_lock);
+    bool res = shard.cells.find(key) != shard.cells.end();
+    pthread_rwlock_unlock(&shard.rw_lock);
     return res;
   }
 
+  /* like Get, but value stays valid until Unpin(handle) even if the cell is
+   * evicted or replaced in the meantime */
+  bool Pin(Key key, char *&value, void *&handle) {
+    uint64_t h = Hash(key);
+    Shard &shard = GetShard(h);
+    Cell *cell = FastPin(shard, key, h);
+    if (cell == nullptr) {
+      // cells in the map are live, they are only killed by the write lock
+      pthread_rwlock_rdlock(&shard.rw_lock);
+      auto ite = shard.cells.find(key);
+      if (ite != shard.cells.end()) {
+        cell = ite->second;
+        cell->state.fetch_add(1, std::memory_order_acq_rel);
+      }
+      pthread_rwlock_unlock(&shard.rw_lock);
+    }
+
+    if (cell == nullptr) {
+      shard.misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    value = cell->value;
+    handle = cell;
+    Touch(cell);
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void Unpin(void *handle) { Release((Cell *)handle); }
+
   void Set(Key key, char *value) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    // pthread_rwlock_wrlock(&rw_lock_);
-    SetImpl(key, value);
-    // pthread_rwlock_unlock(&rw_lock_);
+    Shard &shard = GetShard(Hash(key));
+    pthread_rwlock_wrlock(&shard.rw_lock);
+    SetImpl(shard, key, value);
+    pthread_rwlock_unlock(&shard.rw_lock);
   }
 
   bool SetOrGet(Key key, char *&value, FuncToken token) {
+    uint64_t h = Hash(key);
+    Shard &shard = GetShard(h);
+    Cell *cell = FastPin(shard, key, h);
+    if (cell != nullptr) {
+      value = cell->value;
+      Touch(cell);
+      Release(cell);
+      shard.set_hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
     std::shared_ptr<InsertInfo> ptr_insert;
     {
-      std::lock_guard<std::mutex> cache_lck(mtx_);
-      // pthread_rwlock_wrlock(&rw_lock_);
-      bool res = GetImpl(key, value);
+      pthread_rwlock_wrlock(&shard.rw_lock);
+      bool res = GetImpl(shard, key, value);
       if (res) {
-        // pthread_rwlock_unlock(&rw_lock_);
-        ++set_hits_;
+        pthread_rwlock_unlock(&shard.rw_lock);
+        shard.set_hits.fetch_add(1, std::memory_order_relaxed);
         return true;
       }
 
-      auto &insert_info = insert_infos_[key];
+      auto &insert_info = shard.insert_infos[key];
       if (!insert_info) {
         insert_info = std::make_shared<InsertInfo>();
-        insert_info->cell_.value = mem_pool_.GetBuffer();
+        insert_info->value_ = shard.mem_pool.GetBuffer();
       }
       ptr_insert = insert_info;
-      // pthread_rwlock_unlock(&rw_lock_);
+      pthread_rwlock_unlock(&shard.rw_lock);
     }
 
     InsertInfo *insert = ptr_insert.get();
     std::lock_guard<std::mutex> insert_lck(insert->mtx_);
 
     if (insert->is_product_) {
-      ++set_hits_;
-      value = insert->cell_.value;
+      shard.set_hits.fetch_add(1, std::memory_order_relaxed);
+      value = insert->value_;
       return true;
     }
-    bool res = load_func_(key, insert->cell_.value, token);
+    bool res = load_func_(key, insert->value_, token);
     if (res) {
-      value = insert->cell_.value;
+      value = insert->value_;
       insert->is_product_ = true;
     }
 
-    std::lock_guard<std::mutex> cache_lck(mtx_);
-    // pthread_rwlock_wrlock(&rw_lock_);
-    auto ite = insert_infos_.find(key);
-    if (res && ite != insert_infos_.end() && ite->second.get() == insert) {
-      SetImpl(key, insert->cell_.value);
+    pthread_rwlock_wrlock(&shard.rw_lock);
+    auto ite = shard.insert_infos.find(key);
+    if (res && ite != shard.insert_infos.end() &&
+        ite->second.get() == insert) {
+      SetImpl(shard, key, insert->value_);
     } else {
-      mem_pool_.ReclaimBuffer(insert->cell_.value);
+      shard.mem_pool.ReclaimBuffer(insert->value_);
       value = nullptr;
     }
 
     if (!ptr_insert->is_clean_) {
       insert->is_clean_ = true;
-      insert_infos_.erase(key);
+      shard.insert_infos.erase(key);
     }
-    // pthread_rwlock_unlock(&rw_lock_);
+    pthread_rwlock_unlock(&shard.rw_lock);
     return res;
   }
 
   bool Get2(Key key, char *&value) {
-    bool res;
-    {
-      std::lock_guard<std::mutex> lock(mtx_);
-      res = GetImpl(key, value);
-      if (res == false) {
-        value = mem_pool_.GetBuffer();
-        if (value == nullptr) {
-          LOG(ERROR) << "lrucache[" << name_ << "] mem_pool GetBuffer error, buffer is nullptr:";
-        }
+    Shard &shard = GetShard(Hash(key));
+    pthread_rwlock_wrlock(&shard.rw_lock);
+    bool res = GetImpl(shard, key, value);
+    if (res == false) {
+      value = shard.mem_pool.GetBuffer();
+      if (value == nullptr) {
+        LOG(ERROR) << "lrucache[" << name_
+                   << "] mem_pool GetBuffer error, buffer is nullptr:";
       }
     }
+    pthread_rwlock_unlock(&shard.rw_lock);
 
     if (res)
-      ++hits_;
+      shard.hits.fetch_add(1, std::memory_order_relaxed);
     else
-      ++misses_;
-    if (hits_ % 100000 == 0 && hits_ != last_show_log_) {
-      LOG(INFO) << "LruCache[" << name_ << "] cur_size[" << cur_size_
-                << "] cells_size[" << cells_.size() << "] hits[" << hits_
-                << "] set_hits[" << set_hits_ << "] misses[" << misses_
-                << "] evict_num_[" << evict_num_ << "]";
-      last_show_log_ = hits_;
-    }
+      shard.misses.fetch_add(1, std::memory_order_relaxed);
     return res;
   }
 
   void Set2(Key key, char *buffer) {
-    std::lock_guard<std::mutex> lock(mtx_);
     if (buffer == nullptr) {
-      LOG(ERROR) << "lrucache[" << name_ << "] Set2 buffer is nullptr"; 
+      LOG(ERROR) << "lrucache[" << name_ << "] Set2 buffer is nullptr";
     }
-    SetImpl(key, buffer);
+    Set(key, buffer);
   }
 
   void Evict(Key key) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    // pthread_rwlock_wrlock(&rw_lock_);
-    auto ite = cells_.find(key);
-    if (ite == cells_.end()) {
-      // pthread_rwlock_unlock(&rw_lock_);
-      return;
+    Shard &shard = GetShard(Hash(key));
+    pthread_rwlock_wrlock(&shard.rw_lock);
+    auto ite = shard.cells.find(key);
+    if (ite != shard.cells.end()) {
+      EraseCell(shard, ite);
     }
-    Cell &del = ite->second;
-    char *buffer = del.value;
-    auto que_ite = del.que_ite;
-    mem_pool_.ReclaimBuffer(buffer);
-    queue_.erase(que_ite);
-    cells_.erase(ite);
-    --cur_size_;
-    ++evict_num_;
-    // pthread_rwlock_unlock(&rw_lock_);
+    pthread_rwlock_unlock(&shard.rw_lock);
   }
 
+  // the size of each shard is changed under its lock, so the clock hand
+  // never sees a half-applied size
   void AlterCacheSize(size_t cache_size) {
-    max_size_ = (cache_size * 1024 * 1024) / cell_size_;
-    max_overflow_ = max_size_ / 20;
-    if (max_overflow_ > 1000) {
-      max_overflow_ = 1000;
+    std::lock_guard<std::mutex> lock(alter_mutex_);
+    size_t max_size = (cache_size * 1024 * 1024) / cell_size_;
+    if (max_size == 0) max_size = 1;
+    max_size_ = max_size;
+    for (int i = 0; i < shard_num_; ++i) {
+      Shard &shard = shards_[i];
+      pthread_rwlock_wrlock(&shard.rw_lock);
+      shard.max_size = ShardMaxSize(i, max_size);
+      EvictOverflow(shard, nullptr);
+      ResizeHitTable(shard);
+      shard.mem_pool.SetMaxBufferNum(PoolSize(shard.max_size));
+      pthread_rwlock_unlock(&shard.rw_lock);
     }
-    max_size_ = max_size_ - max_overflow_;
-    // pthread_rwlock_wrlock(&rw_lock_);
-    std::lock_guard<std::mutex> lock(mtx_);
-    EvictOverflow();
-    mem_pool_.SetMaxBufferNum((uint32_t)max_size_ + 500);
-    // pthread_rwlock_unlock(&rw_lock_);
-    LOG(INFO) << "LruCache[" << name_ << "] Max_size[" << max_size_
-              << "], max_overflow[" << max_overflow_ << "]";
+    LOG(INFO) << "LruCache[" << name_ << "] Max_size[" << max_size << "]";
   }
 
-  size_t GetMaxSize() { return max_size_ + max_overflow_; }
+  size_t GetMaxSize() { return max_size_; }
 
   size_t Count() const { return cur_size_; }
 
-  size_t GetHits() { return hits_; }
+  size_t GetHits() { return SumCounter(&Shard::hits); }
+
+  size_t GetSetHits() { return SumCounter(&Shard::set_hits); }
 
-  size_t GetSetHits() { return set_hits_; }
+  size_t GetMisses() { return SumCounter(&Shard::misses); }
 
-  size_t GetMisses() { return misses_; }
+  size_t GetEvictions() { return SumCounter(&Shard::evictions); }
 
   std::string GetName() { return name_; }
 
  private:
-  bool GetImpl(const Key &key, char *&value) {
-    auto ite = cells_.find(key);
-    if (ite == cells_.end()) {
-      return false;
+  uint64_t Hash(const Key &key) {
+    return (uint64_t)HashFunction()(key) * 0x9E3779B97F4A7C15ULL;
+  }
+
+  Shard &GetShard(uint64_t h) {
+    if (shard_num_ == 1) return shards_[0];
+    return shards_[h >> (64 - shard_bits_)];
+  }
+
+  size_t ShardMaxSize(int i, size_t max_size) {
+    size_t shard_max_size = max_size / shard_num_;
+    if (i < (int)(max_size % shard_num_)) ++shard_max_size;
+    return shard_max_size > 0 ? shard_max_size : 1;
+  }
+
+  // twice the cells at least, to keep collisions of the direct mapping low
+  size_t HitTableSize(size_t max_size) {
+    size_t size = 16;
+    while (size < max_size * 2) size <<= 1;
+    return size;
+  }
+
+  // buffers of loading cells are taken from the pool as well
+  uint32_t PoolSize(size_t max_size) {
+    return (uint32_t)(max_size + max_size / 20 + 32);
+  }
+
+  size_t SumCounter(std::atomic<size_t> Shard::*counter) {
+    size_t sum = 0;
+    for (int i = 0; i < shard_num_; ++i) sum += shards_[i].*counter;
+    return sum;
+  }
+
+  // avoid writing the shared cache line when it is already set
+  void Touch(Cell *cell) {
+    if (cell->referenced.load(std::memory_order_relaxed) == 0) {
+      cell->referenced.store(1, std::memory_order_relaxed);
     }
-    Cell &cell = ite->second;
-    value = cell.value;
+  }
+
+  // pins a live cell of key without the lock, nullptr sends the caller to
+  // the locked path
+  Cell *FastPin(Shard &shard, const Key &key, uint64_t h) {
+    HitTable *table = shard.hit_table.load(std::memory_order_acquire);
+    Cell *cell = table->slots[h & table->mask].load(std::memory_order_acquire);
+    if (cell == nullptr) return nullptr;
+    uint64_t state = cell->state.load(std::memory_order_acquire);
+    do {
+      if (state & kCellDead) return nullptr;
+    } while (!cell->state.compare_exchange_weak(state, state + 1,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire));
+    // the key is stable while the cell is pinned
+    if (cell->key == key) return cell;
+    Release(cell);
+    return nullptr;
+  }
+
+  // the last ref of a dead cell gives its value back to the pool
+  void Release(Cell *cell) {
+    uint64_t prev = cell->state.fetch_sub(1, std::memory_order_acq_rel);
+    if ((prev & kCellDead) && (prev & kCellRefMask) == 1) {
+      Shard &shard = *cell->shard;
+      pthread_rwlock_wrlock(&shard.rw_lock);
+      Reclaim(shard, cell);
+      pthread_rwlock_unlock(&shard.rw_lock);
+    }
+  }
+
+  // the following are called with the write lock of the shard
+
+  void Reclaim(Shard &shard, Cell *cell) {
+    shard.mem_pool.ReclaimBuffer(cell->value);
+    cell->value = nullptr;
+    shard.free_cells.push_back(cell);
+  }
 
-    if (cell.hits >= THRESHOLD_OF_SWAP) {
-      // pthread_rwlock_unlock(&rw_lock_);
-      // pthread_rwlock_wrlock(&rw_lock_);
-      // queue_.MoveToTail(cell->queue_ite);
-      queue_.splice(queue_.end(), queue_, cell.que_ite);
-      cell.hits = 0;
+  Cell *NewCell(Shard &shard, const Key &key, char *value) {
+    Cell *cell = nullptr;
+    if (shard.free_cells.size() > 0) {
+      cell = shard.free_cells.back();
+      shard.free_cells.pop_back();
     } else {
-      ++cell.hits;
+      cell = new Cell;
+      cell->shard = &shard;
+      shard.all_cells.push_back(cell);
     }
+    uint64_t gen = (cell->state.load(std::memory_order_relaxed) >>
+                    kCellGenShift) + 1;
+    cell->key = key;
+    cell->value = value;
+    // new cells get a second chance as well
+    cell->referenced = 1;
+    cell->state.store(gen << kCellGenShift | 1, std::memory_order_release);
+
+    HitTable *table = shard.hit_table.load(std::memory_order_relaxed);
+    table->slots[Hash(key) & table->mask].store(cell,
+                                                 std::memory_order_release);
+    return cell;
+  }
+
+  // readers which pinned the cell before keep its value until they unpin
+  void KillCell(Shard &shard, Cell *cell) {
+    HitTable *table = shard.hit_table.load(std::memory_order_relaxed);
+    Cell *expected = cell;
+    table->slots[Hash(cell->key) & table->mask].compare_exchange_strong(
+        expected, nullptr);
+    // sets the dead bit and drops the ref of the cache at once
+    uint64_t prev =
+        cell->state.fetch_add(kCellDead - 1, std::memory_order_acq_rel);
+    if ((prev & kCellRefMask) == 1) Reclaim(shard, cell);
+  }
+
+  void ResizeHitTable(Shard &shard) {
+    HitTable *table = shard.hit_table.load(std::memory_order_relaxed);
+    size_t size = HitTableSize(shard.max_size);
+    if (size <= table->mask + 1) return;
+    HitTable *resized = new HitTable(size);
+    for (auto &it : shard.cells) {
+      resized->slots[Hash(it.first) & resized->mask] = it.second;
+    }
+    shard.hit_table.store(resized, std::memory_order_release);
+    shard.retired_tables.push_back(table);
+  }
+
+  bool GetImpl(Shard &shard, const Key &key, char *&value) {
+    auto ite = shard.cells.find(key);
+    if (ite == shard.cells.end()) {
+      return false;
+    }
+    value = ite->second->value;
+    Touch(ite->second);
     return true;
   }
 
-  void SetImpl(const Key &key, char *value) {
-    auto res =
-        cells_.emplace(std::piecewise_construct, std::forward_as_tuple(key),
-                       std::forward_as_tuple());
-    Cell &cell = res.first->second;
-    bool inserted = res.second;
+  void SetImpl(Shard &shard, const Key &key, char *value) {
+    auto ite = shard.cells.find(key);
+    bool inserted = ite == shard.cells.end();
+    if (not inserted) RemoveCell(shard, ite);
 
+    Cell *cell = NewCell(shard, key, value);
+    cell->slot = shard.clock.size();
+    shard.clock.push_back(cell);
+    shard.cells[key] = cell;
     if (inserted) {
-      cell.value = value;
-      // cell->queue_ite = queue_.Insert(key);
-      cell.que_ite = queue_.insert(queue_.end(), key);
-      cell.hits = 0;
       ++cur_size_;
-      EvictOverflow();
-    } else {
-      if (cell.hits >= THRESHOLD_OF_SWAP) {
-        // queue_.MoveToTail(cell->queue_ite);
-        queue_.splice(queue_.end(), queue_, cell.que_ite);
-        cell.hits = 0;
-      } else {
-        ++cell.hits;
+      EvictOverflow(shard, cell);
+    }
+  }
+
+  void RemoveCell(
+      Shard &shard,
+      typename std::unordered_map<Key, Cell *, HashFunction>::iterator ite) {
+    Cell *cell = ite->second;
+    shard.cells.erase(ite);
+    RemoveSlot(shard, cell->slot);
+    KillCell(shard, cell);
+  }
+
+  void EraseCell(
+      Shard &shard,
+      typename std::unordered_map<Key, Cell *, HashFunction>::iterator ite) {
+    RemoveCell(shard, ite);
+    --cur_size_;
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // the last cell of the ring fills the slot
+  void RemoveSlot(Shard &shard, size_t slot) {
+    Cell *last = shard.clock.back();
+    shard.clock.pop_back();
+    if (slot < shard.clock.size()) {
+      shard.clock[slot] = last;
+      last->slot = slot;
+    }
+  }
+
+  void EvictOverflow(Shard &shard, const Cell *protect) {
+    while (shard.cells.size() > shard.max_size) {
+      if (shard.hand >= shard.clock.size()) shard.hand = 0;
+      Cell *cell = shard.clock[shard.hand];
+      if (cell == protect || cell->referenced) {
+        cell->referenced = 0;
+        ++shard.hand;
+        continue;
       }
-      mem_pool_.ReclaimBuffer(cell.value);
-      cell.value = value;
-    }
-  }
-
-  void EvictOverflow() {
-    if (cur_size_ >= max_size_ + max_overflow_) {
-      int evict_num = cur_size_ - max_size_;
-      cur_size_ -= evict_num;
-
-      int fail_pop_num = 0;
-      Key key;
-      for (int i = 0; i < evict_num; ++i) {
-        // if (!queue_.Pop(key)) {
-        if (queue_.empty()) {
-          ++fail_pop_num;
-          LOG(ERROR) << "Lrucache[" << name_ << "] queue_.Pop(" << key
-                     << ") failed.";
-          continue;
-        }
-        key = queue_.front();
-        auto ite = cells_.find(key);
-        if (ite == cells_.end()) {
-          LOG(ERROR) << "LruCache[" << name_ << "], cur_size[" << cur_size_
-                     << "], cells_.size()[" << cells_.size() << "]."
-                     << "Queue and map is inconsistent.";
-          continue;
-          // abort();
-        }
-        mem_pool_.ReclaimBuffer((ite->second).value);
-        cells_.erase(ite);
-        queue_.pop_front();
+      auto ite = shard.cells.find(cell->key);
+      if (ite == shard.cells.end()) {
+        LOG(ERROR) << "LruCache[" << name_ << "], cells_size["
+                   << shard.cells.size() << "], clock_size["
+                   << shard.clock.size() << "]. Clock and map is inconsistent.";
+        RemoveSlot(shard, shard.hand);
+        continue;
       }
-      cur_size_ += fail_pop_num;
-      // malloc_trim(0);
+      // the hand stays, it points to the cell moved into the slot now
+      EraseCell(shard, ite);
     }
   }
 };
@@ -57,6 +57,27 @@ inline size_t BCompressedOff() {
   return StrCompressedOff() + sizeof(str_compressed_size);
 }
 
+const char *kCompactSuffix = ".compact";
+const char *kCompactRowsSuffix = "_str.rows";
+
+// header of the rows file of a committed string compaction
+struct CompactRowsHeader {
+  uint32_t n;
+  uint64_t str_capacity;
+  str_offset_t str_offset;
+};
+
+// a rename is durable once the directory is synced
+int SyncDir(const std::string &file_path) {
+  std::string::size_type pos = file_path.rfind('/');
+  std::string dir = pos == std::string::npos ? "." : file_path.substr(0, pos);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd == -1) return -1;
+  int ret = fsync(fd);
+  close(fd);
+  return ret;
+}
+
 }  // namespace
 
 Segment::Segment(const std::string &file_path, uint32_t seg_id, int max_size,
@@ -92,9 +113,13 @@ Segment::Segment(const std::string &file_path, uint32_t seg_id, int max_size,
   buffered_size_ = 0;
   str_blocks_ = nullptr;
   blocks_ = nullptr;
+  compact_fd_ = -1;
+  compact_blocks_ = nullptr;
+  compact_offset_ = 0;
 }
 
 Segment::~Segment() {
+  AbortStrCompaction();
   if (base_fd_ != -1) {
     close(base_fd_);
     base_fd_ = -1;
@@ -261,6 +286,11 @@ int Segment::InitBlock(BlockType block_type, Compressor *compressor) {
                       seg_id_, seg_block_capacity_);
     break;
   case BlockType::VectorBlockType:
+    if (compressor) {
+      // a block holds whole compressed vectors
+      int stored_len = compressor->GetCompressLen();
+      per_block_size_ = ((64 * 1024) / stored_len) * stored_len;
+    }
     blocks_ =
       new VectorBlock(base_fd_, per_block_size_, item_length_, seg_header_size_,
                       seg_id_, seg_block_capacity_, &cur_size_, max_size_);
@@ -284,6 +314,12 @@ int Segment::InitBlock(BlockType block_type, Compressor *compressor) {
 
 // TODO: Load compressor
 int Segment::Load(BlockType block_type, Compressor *compressor) {
+  if (block_type == BlockType::TableBlockType && RedoStrCompaction()) {
+    return -IO_ERR;
+  }
+  // left by a compaction which was interrupted before its commit
+  remove((file_path_ + "_str" + kCompactSuffix).c_str());
+  remove((file_path_ + "_str.idx" + kCompactSuffix).c_str());
   OpenFile(block_type);
   InitBlock(block_type, compressor);
   str_capacity_ = StrCapacity();
@@ -300,6 +336,18 @@ int Segment::Add(const uint8_t *data, int len) {
   return 0;
 }
 
+int Segment::BatchAdd(const uint8_t *data, int n) {
+  if (buffered_size_ + n > (uint32_t)max_size_) {
+    LOG(ERROR) << "segment overflow, buffered_size=" << buffered_size_
+               << ", n=" << n << ", max_size=" << max_size_;
+    return PARAM_ERR;
+  }
+  size_t offset = (size_t)buffered_size_ * item_length_;
+  blocks_->Write(data, n * item_length_, offset, disk_io_, &cur_size_);
+  buffered_size_ += n;
+  return 0;
+}
+
 str_offset_t Segment::AddString(const char *str, int len, uint32_t &block_id,
                                 uint32_t &in_block_pos) {
   if (str_offset_ + len >= str_capacity_) {
@@ -325,6 +373,179 @@ str_offset_t Segment::AddString(const char *str, int len, uint32_t &block_id,
   return str_offset_;
 }
 
+int Segment::BeginStrCompaction() {
+  if (str_blocks_ == nullptr) return -1;
+  AbortStrCompaction();
+
+  std::string path = file_path_ + "_str" + kCompactSuffix;
+  compact_fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (compact_fd_ == -1) {
+    LOG(ERROR) << "open compact string file error, path=" << path;
+    return IO_ERR;
+  }
+  std::string idx_path = file_path_ + "_str.idx" + kCompactSuffix;
+  remove(idx_path.c_str());
+  compact_blocks_ =
+      new (std::nothrow) StringBlock(compact_fd_, per_block_size_, item_length_,
+                                     seg_header_size_, seg_id_,
+                                     seg_block_capacity_);
+  if (compact_blocks_ == nullptr) {
+    AbortStrCompaction();
+    return INTERNAL_ERR;
+  }
+  compact_blocks_->InitStrBlock(str_cache_);
+  if (compact_blocks_->LoadIndex(idx_path)) {
+    AbortStrCompaction();
+    return IO_ERR;
+  }
+  compact_offset_ = 0;
+  return 0;
+}
+
+str_offset_t Segment::AddCompactString(const char *str, int len,
+                                       uint32_t &block_id,
+                                       uint32_t &in_block_pos) {
+  compact_blocks_->WriteString(str, len, compact_offset_, block_id,
+                               in_block_pos);
+  compact_offset_ += len;
+  return compact_offset_;
+}
+
+int Segment::CommitStrCompaction(const uint8_t *rows, int n) {
+  if (compact_blocks_ == nullptr) return -1;
+  uint64_t str_capacity = seg_header_size_ + max_size_ * 4;
+  while (compact_offset_ >= str_capacity) str_capacity <<= 1;
+  if (ftruncate(compact_fd_, str_capacity) || fsync(compact_fd_) ||
+      compact_blocks_->SyncIndex()) {
+    LOG(ERROR) << "sync compact string file error:" << strerror(errno);
+    AbortStrCompaction();
+    return IO_ERR;
+  }
+
+  // the rows with the new refs are the commit point, a load after a crash
+  // finishes the swap from them
+  std::string rows_path = file_path_ + kCompactRowsSuffix;
+  std::string tmp_path = rows_path + kCompactSuffix;
+  CompactRowsHeader header{(uint32_t)n, str_capacity, compact_offset_};
+  size_t rows_bytes = (size_t)n * item_length_;
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  bool written =
+      fd != -1 &&
+      utils::write_n(fd, (const char *)&header, sizeof(header), 3) ==
+          (ssize_t)sizeof(header) &&
+      utils::write_n(fd, (const char *)rows, rows_bytes, 3) ==
+          (ssize_t)rows_bytes &&
+      fsync(fd) == 0;
+  if (fd != -1) close(fd);
+  if (!written || rename(tmp_path.c_str(), rows_path.c_str()) ||
+      SyncDir(rows_path)) {
+    LOG(ERROR) << "write compact rows error, path=" << rows_path
+               << ", err=" << strerror(errno);
+    remove(tmp_path.c_str());
+    remove(rows_path.c_str());
+    AbortStrCompaction();
+    return IO_ERR;
+  }
+
+  // each rename is atomic, the index goes first as it is the smaller one
+  std::string str_path = file_path_ + "_str";
+  if (compact_blocks_->MoveIndex(str_path + ".idx") ||
+      rename((str_path + kCompactSuffix).c_str(), str_path.c_str())) {
+    // committed, the files are kept for the load to finish the swap
+    LOG(ERROR) << "replace string file error, path=" << str_path;
+    CHECK_DELETE(compact_blocks_);
+    close(compact_fd_);
+    compact_fd_ = -1;
+    return IO_ERR;
+  }
+  if (IsFull()) compact_blocks_->CloseBlockPosFile();
+
+  str_blocks_->EvictCache();
+  delete str_blocks_;
+  close(str_fd_);
+  str_blocks_ = compact_blocks_;
+  str_fd_ = compact_fd_;
+  compact_blocks_ = nullptr;
+  compact_fd_ = -1;
+
+  str_capacity_ = str_capacity;
+  str_offset_ = compact_offset_;
+  blocks_->Update(rows, rows_bytes, 0);
+  SetStrCapacity(str_capacity_);
+  SetStrOffset(str_offset_);
+  if (fsync(base_fd_)) {
+    LOG(ERROR) << "sync segment file error, path=" << file_path_;
+    return IO_ERR;
+  }
+  remove(rows_path.c_str());
+  return 0;
+}
+
+int Segment::RedoStrCompaction() {
+  std::string rows_path = file_path_ + kCompactRowsSuffix;
+  remove((rows_path + kCompactSuffix).c_str());
+  if (!utils::file_exist(rows_path)) return 0;
+
+  std::string str_path = file_path_ + "_str";
+  std::string idx_path = str_path + ".idx";
+  // a file which is already renamed has no compact file left
+  if (utils::file_exist(idx_path + kCompactSuffix) &&
+      rename((idx_path + kCompactSuffix).c_str(), idx_path.c_str())) {
+    LOG(ERROR) << "rename compact index error, path=" << idx_path;
+    return IO_ERR;
+  }
+  if (utils::file_exist(str_path + kCompactSuffix) &&
+      rename((str_path + kCompactSuffix).c_str(), str_path.c_str())) {
+    LOG(ERROR) << "rename compact string file error, path=" << str_path;
+    return IO_ERR;
+  }
+
+  utils::FileIO rows_file(rows_path);
+  CompactRowsHeader header;
+  long file_size = utils::get_file_size(rows_path);
+  if (rows_file.Open("rb") ||
+      rows_file.Read(&header, sizeof(header), 1) != 1 ||
+      file_size != (long)(sizeof(header) + (size_t)header.n * item_length_)) {
+    LOG(ERROR) << "read compact rows error, path=" << rows_path;
+    return IO_ERR;
+  }
+  std::vector<uint8_t> rows((size_t)header.n * item_length_);
+  if (header.n > 0 && rows_file.Read(rows.data(), rows.size(), 1) != 1) {
+    LOG(ERROR) << "read compact rows error, path=" << rows_path;
+    return IO_ERR;
+  }
+
+  int fd = open(file_path_.c_str(), O_RDWR);
+  if (fd == -1) return IO_ERR;
+  int ret = 0;
+  if (pwrite(fd, rows.data(), rows.size(), seg_header_size_) !=
+          (ssize_t)rows.size() ||
+      pwrite(fd, &header.str_capacity, sizeof(header.str_capacity),
+             StrCapacityOff()) != sizeof(header.str_capacity) ||
+      pwrite(fd, &header.str_offset, sizeof(header.str_offset),
+             StrOffsetOff()) != sizeof(header.str_offset) ||
+      fsync(fd)) {
+    LOG(ERROR) << "write compact rows error, path=" << file_path_;
+    ret = IO_ERR;
+  }
+  close(fd);
+  if (ret) return ret;
+  remove(rows_path.c_str());
+  LOG(INFO) << "finish the string compaction of " << file_path_
+            << ", rows=" << header.n;
+  return 0;
+}
+
+void Segment::AbortStrCompaction() {
+  CHECK_DELETE(compact_blocks_);
+  if (compact_fd_ != -1) {
+    close(compact_fd_);
+    compact_fd_ = -1;
+    remove((file_path_ + "_str" + kCompactSuffix).c_str());
+    remove((file_path_ + "_str.idx" + kCompactSuffix).c_str());
+  }
+}
+
 int Segment::GetValues(uint8_t *value, int id, int n) {
   int start = id * item_length_;
   int n_bytes = n * item_length_;
@@ -352,6 +573,16 @@ int Segment::GetValues(uint8_t *value, int id, int n) {
   return 0;
 }
 
+void Segment::MissingBlocks(int id, int n, std::vector<uint32_t> &block_ids) {
+  if (id + n > (int)cur_size_) n = (int)cur_size_ - id;
+  if (n <= 0) return;
+  blocks_->MissingBlocks(id * item_length_, n * item_length_, block_ids);
+}
+
+bool Segment::LoadBlock(uint32_t block_id) {
+  return blocks_->LoadBlock(block_id);
+}
+
 std::string Segment::GetString(uint32_t block_id, uint32_t in_block_pos,
                                str_len_t len) {
   std::string str;
@@ -359,6 +590,11 @@ std::string Segment::GetString(uint32_t block_id, uint32_t in_block_pos,
   return str;
 }
 
+int Segment::GetStringRef(uint32_t block_id, uint32_t in_block_pos,
+                          str_len_t len, StringRef &ref) {
+  return str_blocks_->ReadRef(block_id, in_block_pos, len, ref);
+}
+
 bool Segment::IsFull() {
   if (BufferedSize() == max_size_) {
     if (str_blocks_) str_blocks_->CloseBlockPosFile();
@@ -33,14 +33,25 @@ class Segment {
 
   int Add(const uint8_t *vec, int len);
 
+  // n items in one write, they must fit in the segment
+  int BatchAdd(const uint8_t *data, int n);
+
   str_offset_t AddString(const char *vec, int len, uint32_t &block_id,
                          uint32_t &in_block_pos);
 
   int GetValues(uint8_t *value, int id, int size);
 
+  // blocks of values [id, id + n) that a read would load from disk
+  void MissingBlocks(int id, int n, std::vector<uint32_t> &block_ids);
+
+  bool LoadBlock(uint32_t block_id);
+
   std::string GetString(uint32_t block_id, uint32_t in_block_pos,
                         str_len_t len);
 
+  int GetStringRef(uint32_t block_id, uint32_t in_block_pos, str_len_t len,
+                   StringRef &ref);
+
   bool IsFull();
 
   int Update(int id, uint8_t *data, int len);
@@ -51,7 +62,25 @@ class Segment {
 
   str_offset_t StrOffset();
 
+  /** strings are rewritten into a new file by AddCompactString, it replaces
+   * the string file on CommitStrCompaction. The refs returned by
+   * AddCompactString are only valid after the commit, the rows holding them
+   * are written with the commit so a crash can't split files and refs.
+   */
+  int BeginStrCompaction();
+
+  str_offset_t AddCompactString(const char *str, int len, uint32_t &block_id,
+                                uint32_t &in_block_pos);
+
+  // rows are the n rows of the segment with the new refs
+  int CommitStrCompaction(const uint8_t *rows, int n);
+
+  void AbortStrCompaction();
+
  private:
+  // finish a compaction which was committed before a crash
+  int RedoStrCompaction();
+
   uint8_t Version();
 
   void SetVersion(uint8_t version);
@@ -110,6 +139,10 @@ class Segment {
 
   StringBlock *str_blocks_;
 
+  int compact_fd_;
+  StringBlock *compact_blocks_;
+  str_offset_t compact_offset_;
+
   uint32_t per_block_size_;
   disk_io::AsyncWriter *disk_io_;
 
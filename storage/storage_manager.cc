@@ -7,6 +7,9 @@
 
 #include "storage_manager.h"
 
+#include <algorithm>
+
+#include "background_pool.h"
 #include "error_code.h"
 #include "log.h"
 #include "table_block.h"
@@ -22,16 +25,26 @@ StorageManager::StorageManager(const std::string &root_path,
   size_ = 0;
   cache_ = nullptr;
   str_cache_ = nullptr;
+  cache_size_ = 0;
+  str_cache_size_ = 0;
   compressor_ = nullptr;
   disk_io_ = nullptr;
+  prefetch_running_ = true;
+  prefetch_task_id_ = 0;
 }
 
 StorageManager::~StorageManager() {
+  StopPrefetch();
+  // flush the queued writes before the segment files are closed
+  CHECK_DELETE(disk_io_);
   for (size_t i = 0; i < segments_.Size(); i++) {
     Segment *seg = segments_.GetData(i);
     CHECK_DELETE(seg);
   }
-  CHECK_DELETE(disk_io_);
+  if (options_.table_id >= 0) {
+    if (cache_) CacheQuota::GetInstance().Unregister(cache_);
+    if (str_cache_) CacheQuota::GetInstance().Unregister(str_cache_);
+  }
   CHECK_DELETE(str_cache_);
   CHECK_DELETE(cache_);
   CHECK_DELETE(compressor_);
@@ -45,29 +58,56 @@ std::string StorageManager::NextSegmentFilePath() {
 }
 
 int StorageManager::UseCompress(CompressType type, int d, double rate) {
-  if (type == CompressType::Zfp) {
+  if (d <= 0) return -1;
+  switch (type) {
+    case CompressType::Zfp:
 #ifdef WITH_ZFP
-    if (d > 0) {
-      compressor_ = new CompressorZFP(type);
+      compressor_ = new (std::nothrow) CompressorZFP(type);
+#endif
+      break;
+    case CompressType::Fp16:
+    case CompressType::Bf16:
+      compressor_ = new (std::nothrow) CompressorFloat16(type);
+      break;
+    case CompressType::Sq8:
+      compressor_ = new (std::nothrow) CompressorSQ8(type);
+      break;
+    default:
+      break;
+  }
+  if (compressor_) {
+    if (rate > 0) {
+      compressor_->Init(d, rate);
+    } else {
       compressor_->Init(d);
     }
-#endif
   }
   return (compressor_ ? 0 : -1);
 }
 
 bool StorageManager::AlterCacheSize(uint32_t cache_size,
                                     uint32_t str_cache_size) {
+  CacheQuota &quota = CacheQuota::GetInstance();
   if (cache_size > 0) {  // cache_size unit: M
     if (cache_ != nullptr) {
-      cache_->AlterCacheSize((size_t)cache_size);
+      cache_size_ = cache_size;
+      if (options_.table_id >= 0) {
+        quota.Resize(cache_, (size_t)cache_size);
+      } else {
+        cache_->AlterCacheSize((size_t)cache_size);
+      }
     } else {
       LOG(WARNING) << "Alter cache_ failure, cache_ is nullptr.";
     }
   }
   if (str_cache_size > 0) {
     if (str_cache_ != nullptr) {
-      str_cache_->AlterCacheSize((size_t)str_cache_size);
+      str_cache_size_ = str_cache_size;
+      if (options_.table_id >= 0) {
+        quota.Resize(str_cache_, (size_t)str_cache_size);
+      } else {
+        str_cache_->AlterCacheSize((size_t)str_cache_size);
+      }
     } else {
       LOG(WARNING) << "Alter str_cache_ failure, str_cache_ is nullptr.";
     }
@@ -77,17 +117,15 @@ bool StorageManager::AlterCacheSize(uint32_t cache_size,
 
 void StorageManager::GetCacheSize(uint32_t &cache_size,
                                   uint32_t &str_cache_size) {
+  cache_size = cache_ != nullptr ? cache_size_ : 0;
+  str_cache_size = str_cache_ != nullptr ? str_cache_size_ : 0;
+}
+
+void StorageManager::GetCacheHits(size_t &hits, size_t &misses) {
+  hits = misses = 0;
   if (cache_ != nullptr) {
-    size_t max_size = cache_->GetMaxSize();
-    cache_size = (uint32_t)(max_size * 64 / 1024);
-  } else {
-    cache_size = 0;
-  }
-  if (str_cache_ != nullptr) {
-    size_t max_size = str_cache_->GetMaxSize();
-    str_cache_size = (uint32_t)(max_size * 64 / 1024);
-  } else {
-    str_cache_size = 0;
+    hits = cache_->GetHits();
+    misses = cache_->GetMisses();
   }
 }
 
@@ -106,8 +144,11 @@ int StorageManager::Init(int cache_size, std::string cache_name,
     LOG(ERROR) << "fixed_value_bytes[" << options_.fixed_value_bytes
                << "] > 64K. it exceeds the length of the block.";
   }
-  uint32_t per_block_size = ((64 * 1024) / options_.fixed_value_bytes) *
-                            options_.fixed_value_bytes;  // block~=64k
+  // cached blocks hold the compressed vectors
+  int stored_bytes = options_.fixed_value_bytes;
+  if (compressor_) stored_bytes = compressor_->GetCompressLen();
+  uint32_t per_block_size =
+      ((64 * 1024) / stored_bytes) * stored_bytes;  // block~=64k
   if (cache_size > 0) {
     cache_ = new LRUCache<uint32_t, ReadFunParameter *>(cache_name, cache_size,
                                                         per_block_size, fun);
@@ -119,13 +160,25 @@ int StorageManager::Init(int cache_size, std::string cache_name,
         &StringBlock::ReadString);
     str_cache_->Init();
   }
+  cache_size_ = cache_size > 0 ? cache_size : 0;
+  str_cache_size_ = str_cache_size > 0 ? str_cache_size : 0;
+  if (options_.table_id >= 0) {
+    CacheQuota &quota = CacheQuota::GetInstance();
+    if (cache_) quota.Register(options_.table_id, cache_, cache_size_);
+    if (str_cache_) {
+      quota.Register(options_.table_id, str_cache_, str_cache_size_);
+    }
+  }
 
   disk_io_ = new disk_io::AsyncWriter();
   if (disk_io_ == nullptr) {
     LOG(ERROR) << "new AsyncWriter failed.";
     return SYSTEM_ERR;
   }
-  disk_io_->Init();
+  if (disk_io_->Init(options_.sync_policy, options_.sync_interval_ms)) {
+    LOG(ERROR) << "init AsyncWriter failed.";
+    return SYSTEM_ERR;
+  }
   if (!options_.IsValid()) {
     LOG(ERROR) << "invalid options=" << options_.ToStr();
     return PARAM_ERR;
@@ -135,7 +188,7 @@ int StorageManager::Init(int cache_size, std::string cache_name,
     return IO_ERR;
   }
 
-  Load();
+  if (Load() < 0) return IO_ERR;
   // init the first segment
   if (segments_.Size() == 0 && Extend()) {
     return INTERNAL_ERR;
@@ -203,6 +256,28 @@ int StorageManager::Add(const uint8_t *value, int len) {
   return 0;
 }
 
+int StorageManager::BatchAdd(const uint8_t *values, int n) {
+  while (n > 0) {
+    Segment *segment = segments_.GetLastData();
+    int num = options_.segment_size - size_ % options_.segment_size;
+    if (num > n) num = n;
+    int ret = segment->BatchAdd(values, num);
+    if (ret) {
+      LOG(ERROR) << "segment batch add error [" << ret << "]";
+      return ret;
+    }
+
+    if (segment->IsFull() && Extend()) {
+      LOG(ERROR) << "extend error";
+      return INTERNAL_ERR;
+    }
+    size_ += num;
+    values += (size_t)num * options_.fixed_value_bytes;
+    n -= num;
+  }
+  return 0;
+}
+
 str_offset_t StorageManager::AddString(const char *value, int len,
                                        uint32_t &block_id,
                                        uint32_t &in_block_pos) {
@@ -303,6 +378,104 @@ int StorageManager::Get(long id, const uint8_t *&value) {
   return ret;
 }
 
+void StorageManager::MissingBlocks(const std::vector<int64_t> &ids,
+                                   std::vector<uint64_t> &blocks) {
+  std::vector<uint32_t> block_ids;
+  for (int64_t id : ids) {
+    if (id < 0 || (size_t)id >= size_) continue;
+    int seg_id = id / options_.segment_size;
+    Segment *segment = segments_.GetData(seg_id);
+    if (segment == nullptr) continue;
+    block_ids.clear();
+    segment->MissingBlocks(id % options_.segment_size, 1, block_ids);
+    for (uint32_t block_id : block_ids) {
+      blocks.push_back((uint64_t)seg_id << 32 | block_id);
+    }
+  }
+  std::sort(blocks.begin(), blocks.end());
+  blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+}
+
+int StorageManager::Prefetch(const std::vector<int64_t> &ids) {
+  if (cache_ == nullptr || ids.size() == 0) return 0;
+
+  std::vector<uint64_t> blocks;
+  MissingBlocks(ids, blocks);
+  if (blocks.size() == 0) return 0;
+
+  int n = blocks.size();
+  int num_threads = std::min(n, kPrefetchThreads);
+  std::atomic<int> failed(0);
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for (int i = 0; i < n; ++i) {
+    Segment *segment = segments_.GetData(blocks[i] >> 32);
+    if (not segment->LoadBlock((uint32_t)blocks[i])) failed++;
+  }
+  if (failed > 0) {
+    LOG(ERROR) << "Storage[" << cache_->GetName() << "] prefetch " << n
+               << " blocks, failed " << failed;
+    return -1;
+  }
+  return n;
+}
+
+int StorageManager::PrefetchAsync(const std::vector<int64_t> &ids) {
+  if (cache_ == nullptr || ids.size() == 0) return 0;
+
+  std::vector<uint64_t> blocks;
+  MissingBlocks(ids, blocks);
+  if (blocks.size() == 0) return 0;
+
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  if (pool == nullptr) return 0;
+
+  int queued = 0;
+  std::lock_guard<std::mutex> lock(prefetch_mutex_);
+  if (not prefetch_running_) return 0;
+  for (uint64_t block : blocks) {
+    if (prefetch_queue_.size() >= kPrefetchQueueSize) break;
+    if (not prefetch_pending_.insert(block).second) continue;
+    prefetch_queue_.push_back(block);
+    ++queued;
+  }
+  if (queued > 0 && prefetch_task_id_ == 0) {
+    prefetch_task_id_ =
+        pool->Add([this]() { return PrefetchOnce(); }, 0);
+  }
+  return queued;
+}
+
+long StorageManager::PrefetchOnce() {
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  for (int i = 0; i < kPrefetchBlocksPerRun; ++i) {
+    if (not prefetch_running_ || prefetch_queue_.size() == 0) break;
+    uint64_t block = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    lock.unlock();
+
+    Segment *segment = segments_.GetData(block >> 32);
+    if (segment) segment->LoadBlock((uint32_t)block);
+
+    lock.lock();
+    prefetch_pending_.erase(block);
+  }
+  if (prefetch_running_ && prefetch_queue_.size() > 0) return 0;
+  // the next hint starts a new task
+  prefetch_task_id_ = 0;
+  return -1;
+}
+
+void StorageManager::StopPrefetch() {
+  long task_id = 0;
+  {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    prefetch_running_ = false;
+    task_id = prefetch_task_id_;
+  }
+  // it does nothing if the task has ended
+  if (task_id != 0) BackgroundPool::GetInstance()->Remove(task_id);
+}
+
 int StorageManager::GetString(long id, std::string &value, uint32_t block_id,
                               uint32_t in_block_pos, str_len_t len) {
   if ((size_t)id >= size_ || id < 0) {
@@ -322,6 +495,52 @@ int StorageManager::GetString(long id, std::string &value, uint32_t block_id,
   return 0;
 }
 
+int StorageManager::GetStringRef(long id, StringRef &ref, uint32_t block_id,
+                                 uint32_t in_block_pos, str_len_t len) {
+  if ((size_t)id >= size_ || id < 0) {
+    LOG(ERROR) << "id [" << id << "] >= size_ [" << size_ << "]";
+    return PARAM_ERR;
+  }
+  Segment *segment = segments_.GetData(id / options_.segment_size);
+  if (segment == nullptr) {
+    LOG(ERROR) << "Storage[" << cache_->GetName() << "], segments_size["
+               << segments_.Size() << "], GetStringRef(" << id
+               << ") failed.";
+    return -1;
+  }
+  return segment->GetStringRef(block_id, in_block_pos, len, ref);
+}
+
+int StorageManager::FullSegmentNum() {
+  int n = segments_.Size();
+  while (n > 0 && !segments_.GetData(n - 1)->IsFull()) --n;
+  return n;
+}
+
+int StorageManager::BeginStrCompaction(int seg_id) {
+  if (block_type_ != BlockType::TableBlockType || seg_id < 0 ||
+      seg_id >= FullSegmentNum()) {
+    return PARAM_ERR;
+  }
+  return segments_.GetData(seg_id)->BeginStrCompaction();
+}
+
+str_offset_t StorageManager::AddCompactString(int seg_id, const char *value,
+                                              int len, uint32_t &block_id,
+                                              uint32_t &in_block_pos) {
+  return segments_.GetData(seg_id)->AddCompactString(value, len, block_id,
+                                                     in_block_pos);
+}
+
+int StorageManager::CommitStrCompaction(int seg_id, const uint8_t *rows,
+                                        int n) {
+  return segments_.GetData(seg_id)->CommitStrCompaction(rows, n);
+}
+
+void StorageManager::AbortStrCompaction(int seg_id) {
+  segments_.GetData(seg_id)->AbortStrCompaction();
+}
+
 int StorageManager::Truncate(size_t size) {
   if (size > size_) {
     LOG(ERROR) << "Storage_mgr size[" << size_ << "] < truncate size[" << size
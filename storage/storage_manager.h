@@ -7,10 +7,16 @@
 
 #pragma once
 
+#include <deque>
+#include <mutex>
 #include <sstream>
+#include <unordered_set>
 #include <vector>
 
 #include "async_writer.h"
+#include "cache_quota.h"
+#include "compress/compressor_float16.h"
+#include "compress/compressor_sq8.h"
 #include "compress/compressor_zfp.h"
 #include "compress/compressor_zstd.h"
 #include "lru_cache.h"
@@ -22,21 +28,38 @@
 
 namespace tig_gamma {
 
+// max threads reading the missing blocks of a prefetch
+const static int kPrefetchThreads = 8;
+// blocks of prefetch hints loaded by a run of the background task, then the
+// tasks of the other tables get their turn
+const static int kPrefetchBlocksPerRun = 64;
+// max queued blocks of prefetch hints, the later hints are dropped
+const static size_t kPrefetchQueueSize = 4096;
+
 struct StorageManagerOptions {
   int segment_size;
   int fixed_value_bytes;
   uint32_t seg_block_capacity;
+  disk_io::SyncPolicy sync_policy;
+  int sync_interval_ms;
+  int table_id;  // the caches share the quota of the table, -1 if they don't
 
   StorageManagerOptions() {
     segment_size = -1;
     fixed_value_bytes = -1;
     seg_block_capacity = 0;
+    sync_policy = disk_io::SyncPolicy::None;
+    sync_interval_ms = disk_io::kSyncIntervalMs;
+    table_id = -1;
   }
 
   StorageManagerOptions(const StorageManagerOptions &options) {
     segment_size = options.segment_size;
     fixed_value_bytes = options.fixed_value_bytes;
     seg_block_capacity = options.seg_block_capacity;
+    sync_policy = options.sync_policy;
+    sync_interval_ms = options.sync_interval_ms;
+    table_id = options.table_id;
   }
 
   bool IsValid() {
@@ -50,7 +73,10 @@ struct StorageManagerOptions {
     std::stringstream ss;
     ss << "{segment_size=" << segment_size
        << ", fixed_value_bytes=" << fixed_value_bytes
-       << ", seg_block_capacity=" << seg_block_capacity << "}";
+       << ", seg_block_capacity=" << seg_block_capacity
+       << ", sync_policy=" << (int)sync_policy
+       << ", sync_interval_ms=" << sync_interval_ms
+       << ", table_id=" << table_id << "}";
     return ss.str();
   }
 };
@@ -65,6 +91,9 @@ class StorageManager {
 
   int Add(const uint8_t *value, int len);
 
+  // append n values of fixed_value_bytes, one write per segment
+  int BatchAdd(const uint8_t *values, int n);
+
   str_offset_t AddString(const char *value, int len, uint32_t &block_id,
                          uint32_t &in_block_pos);
 
@@ -79,6 +108,25 @@ class StorageManager {
   int GetString(long id, std::string &value, uint32_t blocck_id,
                 uint32_t in_block_pos, str_len_t len);
 
+  // ref pins the cached block of the string until it is released
+  int GetStringRef(long id, StringRef &ref, uint32_t block_id,
+                   uint32_t in_block_pos, str_len_t len);
+
+  /** load the blocks of ids which are not cached, each block is read once
+   * and the reads are issued concurrently, so the following Get of ids are
+   * served from the cache. Invalid ids are ignored.
+   *
+   * @return number of loaded blocks, < 0 if error
+   */
+  int Prefetch(const std::vector<int64_t> &ids);
+
+  /** queue the missing blocks of ids to be loaded by a task of the background
+   * pool and return at once, it is a hint so blocks are dropped if the queue is full
+   *
+   * @return number of queued blocks
+   */
+  int PrefetchAsync(const std::vector<int64_t> &ids);
+
   int GetHeaders(int start, int n, std::vector<const uint8_t *> &values,
                  std::vector<int> &lens);
 
@@ -87,12 +135,31 @@ class StorageManager {
 
   int Size() { return size_; }
 
+  int SegmentSize() { return options_.segment_size; }
+
+  // segments before it are full, docs are only added to the later ones
+  int FullSegmentNum();
+
+  // compact the string file of a segment, see Segment::BeginStrCompaction
+  int BeginStrCompaction(int seg_id);
+
+  str_offset_t AddCompactString(int seg_id, const char *value, int len,
+                                uint32_t &block_id, uint32_t &in_block_pos);
+
+  int CommitStrCompaction(int seg_id, const uint8_t *rows, int n);
+
+  void AbortStrCompaction(int seg_id);
+
   int UseCompress(CompressType type, int d = -1, double rate = -1);
 
+  // the configured sizes, the caches of a table with a quota may be smaller
   bool AlterCacheSize(uint32_t cache_size, uint32_t str_cache_size);
 
   void GetCacheSize(uint32_t &cache_size, uint32_t &str_cache_size);
 
+  // hits and misses of the block cache
+  void GetCacheHits(size_t &hits, size_t &misses);
+
   void CountByteSize(uint64_t &base_size, uint64_t &str_size);
 
   int Sync();
@@ -100,6 +167,15 @@ class StorageManager {
  private:
   int Load();
 
+  // (segment id << 32 | block id) of the uncached blocks of ids, deduped
+  void MissingBlocks(const std::vector<int64_t> &ids,
+                     std::vector<uint64_t> &blocks);
+
+  // returns the ms to wait before the next run, < 0 if the queue is empty
+  long PrefetchOnce();
+
+  void StopPrefetch();
+
   int Extend();
 
   std::string NextSegmentFilePath();
@@ -114,7 +190,15 @@ class StorageManager {
   BlockType block_type_;
   LRUCache<uint32_t, ReadFunParameter *> *cache_;
   LRUCache<uint32_t, ReadFunParameter *> *str_cache_;
+  uint32_t cache_size_;  // configured, M
+  uint32_t str_cache_size_;
   Compressor *compressor_;
+
+  std::mutex prefetch_mutex_;
+  std::deque<uint64_t> prefetch_queue_;
+  std::unordered_set<uint64_t> prefetch_pending_;  // queued or loading
+  long prefetch_task_id_;  // 0 if no task, started by the hints
+  bool prefetch_running_;
 };
 
 }  // namespace tig_gamma
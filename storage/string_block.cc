@@ -7,17 +7,63 @@
 
 #include "string_block.h"
 
+#include <stdio.h>
 #include <unistd.h>
 
 namespace tig_gamma {
 
 const static int MAX_STR_BLOCK_SIZE = 102400;
 
+void StringRef::Pin(StrLRUCache *cache, void *handle, const char *data,
+                    size_t len) {
+  Release();
+  cache_ = cache;
+  handle_ = handle;
+  data_ = data;
+  len_ = len;
+}
+
+void StringRef::Assign(std::string &&str) {
+  Release();
+  copy_ = std::move(str);
+  data_ = copy_.data();
+  len_ = copy_.size();
+}
+
+void StringRef::Release() {
+  if (cache_ != nullptr) cache_->Unpin(handle_);
+  cache_ = nullptr;
+  handle_ = nullptr;
+  data_ = nullptr;
+  len_ = 0;
+  copy_.clear();
+}
+
+void StringRef::MoveFrom(StringRef &other) {
+  cache_ = other.cache_;
+  handle_ = other.handle_;
+  len_ = other.len_;
+  if (cache_ == nullptr && other.data_ != nullptr) {
+    // the bytes of a short string live in the object itself
+    copy_ = std::move(other.copy_);
+    data_ = copy_.data();
+  } else {
+    data_ = other.data_;
+  }
+  other.cache_ = nullptr;
+  other.handle_ = nullptr;
+  other.data_ = nullptr;
+  other.len_ = 0;
+  other.copy_.clear();
+}
+
 StringBlock::StringBlock(int fd, int per_block_size, int length,
                          uint32_t header_size, uint32_t seg_id,
                          uint32_t seg_block_capacity)
     : Block(fd, per_block_size, length, header_size, seg_id, seg_block_capacity,
             nullptr, -1){
+  str_lru_cache_ = nullptr;
+  block_pos_fp_ = nullptr;
 }
 
 StringBlock::~StringBlock() {
@@ -70,6 +116,33 @@ int StringBlock::CloseBlockPosFile() {
   return -1;
 }
 
+int StringBlock::SyncIndex() {
+  if (block_pos_fp_ == nullptr) return 0;
+  if (fflush(block_pos_fp_) || fsync(fileno(block_pos_fp_))) {
+    LOG(ERROR) << "sync block pos file error, path=" << block_pos_file_path_;
+    return -1;
+  }
+  return 0;
+}
+
+int StringBlock::MoveIndex(const std::string &file_path) {
+  if (SyncIndex()) return -1;
+  if (rename(block_pos_file_path_.c_str(), file_path.c_str())) {
+    LOG(ERROR) << "rename block pos file error, from=" << block_pos_file_path_
+               << ", to=" << file_path;
+    return -1;
+  }
+  block_pos_file_path_ = file_path;
+  return 0;
+}
+
+void StringBlock::EvictCache() {
+  if (str_lru_cache_ == nullptr) return;
+  for (uint32_t i = 0; i < block_pos_.Size(); i++) {
+    str_lru_cache_->Evict(GetCacheBlockId(i));
+  }
+}
+
 int StringBlock::WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
                               disk_io::AsyncWriter *disk_io,
                               std::atomic<uint32_t> *cur_size) {
@@ -100,66 +173,48 @@ int StringBlock::WriteString(const char *value, str_len_t n_bytes,
 
 int StringBlock::Read(uint32_t block_id, uint32_t in_block_pos, str_len_t n_bytes,
                       std::string &str_out) {
-  if (str_lru_cache_ == nullptr) {
-    uint32_t off = block_pos_.GetData(block_id) + in_block_pos;
-    char *tmp_buf = new char[n_bytes];
-    pread(fd_, tmp_buf, n_bytes, off);
-    str_out = std::string(tmp_buf, n_bytes);
-    delete[] tmp_buf;
+  // The last block of each segment does not enter the cache.
+  if (str_lru_cache_ == nullptr || block_id + 1 >= block_pos_.Size()) {
+    str_out.resize(n_bytes);
+    pread(fd_, &str_out[0], n_bytes, block_pos_.GetData(block_id) + in_block_pos);
     return 0;
   }
+  StringRef ref;
+  int ret = ReadRef(block_id, in_block_pos, n_bytes, ref);
+  if (ret == 0) str_out.assign(ref.Data(), ref.Size());
+  return ret;
+}
 
-  uint32_t block_pos = block_pos_.GetData(block_id);
-  uint32_t block_num = block_pos_.Size();
-
-  // The last block of each segment does not enter the cache.
-  if (block_id + 1 >= block_num) {
-    char *str = new char[n_bytes];
-    pread(fd_, str, n_bytes, block_pos + in_block_pos);
-    str_out = std::string(str, n_bytes);
-    delete[] str;
-  }
-  else {
-    char *block = nullptr;
+int StringBlock::ReadRef(uint32_t block_id, uint32_t in_block_pos,
+                         str_len_t n_bytes, StringRef &ref) {
+  uint32_t off = block_pos_.GetData(block_id) + in_block_pos;
+  if (str_lru_cache_ != nullptr && block_id + 1 < block_pos_.Size()) {
     uint32_t cache_bid = GetCacheBlockId(block_id);
-    bool res = str_lru_cache_->Get(cache_bid, block);
-    if (not res) {
+    // the loaded block may be evicted again before it is pinned
+    for (int i = 0; i < 3; i++) {
+      char *block = nullptr;
+      void *handle = nullptr;
+      if (str_lru_cache_->Pin(cache_bid, block, handle)) {
+        ref.Pin(str_lru_cache_, handle, block + in_block_pos, n_bytes);
+        return 0;
+      }
       ReadFunParameter parameter;
-      parameter.fd = fd_;      
-      parameter.len = block_pos_.GetData(block_id + 1) - block_pos_.GetData(block_id);
+      parameter.fd = fd_;
+      parameter.len =
+          block_pos_.GetData(block_id + 1) - block_pos_.GetData(block_id);
       parameter.offset = block_pos_.GetData(block_id);
-      res = str_lru_cache_->SetOrGet(cache_bid, block, &parameter);
+      bool res = str_lru_cache_->SetOrGet(cache_bid, block, &parameter);
+      if (not res || block == nullptr) {
+        LOG(ERROR) << "Read block fails from disk_file, block_id[" << block_id
+                   << "]";
+        return -1;
+      }
     }
+  }
 
-    if (not res || block == nullptr) {
-      LOG(ERROR) << "Read block fails from disk_file, block_id[" << block_id
-                 << "]";
-      return -1;
-    }
-    str_out = std::string(block + in_block_pos, n_bytes);
-  }
-  // else {
-  //   char *block = nullptr;
-  //   uint32_t cache_bid = GetCacheBlockId(block_id);
-  //   bool res = str_lru_cache_->Get2(cache_bid, block);
-  //   if (block == nullptr) {
-  //     LOG(ERROR) << "StringBlock Get block=nullptr:";
-  //   }
-  //   if (not res) {
-  //     ReadFunParameter parameter;
-  //     parameter.fd = fd_;              // TODO remove
-  //     parameter.len = block_pos_.GetData(block_id + 1) - block_pos_.GetData(block_id);
-  //     parameter.offset = block_pos_.GetData(block_id);
-
-  //     ReadString(cache_bid, block, &parameter);
-  //     str_lru_cache_->Set2(cache_bid, block);
-  //     if (block == nullptr) {
-  //       LOG(ERROR) << "stringblock cell = nullptr";
-  //     }
-  //   }
-
-  //   str_out = std::string(block + in_block_pos, n_bytes);
-  // }
+  std::string str(n_bytes, 0);
+  pread(fd_, &str[0], n_bytes, off);
+  ref.Assign(std::move(str));
   return 0;
 }
 
@@ -17,6 +17,58 @@
 
 namespace tig_gamma {
 
+typedef LRUCache<uint32_t, ReadFunParameter *> StrLRUCache;
+
+/** a string read in place, the cached block holding it is pinned until the
+ * ref is released so that the bytes stay valid if the block is evicted.
+ * Strings which are not in the cache are copied into the ref.
+ */
+class StringRef {
+ public:
+  StringRef() : data_(nullptr), len_(0), cache_(nullptr), handle_(nullptr) {}
+
+  StringRef(StringRef &&other) noexcept : StringRef() { MoveFrom(other); }
+
+  StringRef &operator=(StringRef &&other) noexcept {
+    if (this != &other) {
+      Release();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  StringRef(const StringRef &) = delete;
+  StringRef &operator=(const StringRef &) = delete;
+
+  ~StringRef() { Release(); }
+
+  const char *Data() const { return data_; }
+
+  size_t Size() const { return len_; }
+
+  bool Valid() const { return data_ != nullptr; }
+
+  std::string Str() const {
+    return data_ ? std::string(data_, len_) : std::string();
+  }
+
+  // handle is the pin of the block returned by StrLRUCache::Pin
+  void Pin(StrLRUCache *cache, void *handle, const char *data, size_t len);
+
+  void Assign(std::string &&str);
+
+  void Release();
+
+ private:
+  void MoveFrom(StringRef &other);
+
+  const char *data_;
+  size_t len_;
+  StrLRUCache *cache_;  // nullptr if data_ points to copy_
+  void *handle_;
+  std::string copy_;
+};
+
 class StringBlock : public Block {
  public:
   StringBlock(int fd, int per_block_size, int length, uint32_t header_size,
@@ -33,6 +85,14 @@ class StringBlock : public Block {
 
   int CloseBlockPosFile();
 
+  int SyncIndex();
+
+  // sync the block pos file and rename it to file_path
+  int MoveIndex(const std::string &file_path);
+
+  // drop the cached blocks, they are stale once the string file is replaced
+  void EvictCache();
+
   int WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
                    disk_io::AsyncWriter *disk_io,
                    std::atomic<uint32_t> *cur_size) override;
@@ -47,6 +107,9 @@ class StringBlock : public Block {
   int Read(uint32_t block_id, uint32_t in_block_pos, str_len_t n_bytes,
            std::string &str_out);
 
+  int ReadRef(uint32_t block_id, uint32_t in_block_pos, str_len_t n_bytes,
+              StringRef &ref);
+
   static bool ReadString(uint32_t key, char *block, ReadFunParameter *param);
 
  private:
@@ -54,7 +117,7 @@ class StringBlock : public Block {
 
   int AddBlockPos(uint32_t block_pos);
 
-  LRUCache<uint32_t, ReadFunParameter *> *str_lru_cache_;
+  StrLRUCache *str_lru_cache_;
 
   std::string block_pos_file_path_;
 
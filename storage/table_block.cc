@@ -31,16 +31,8 @@ int TableBlock::WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
                              disk_io::AsyncWriter *disk_io,
                              std::atomic<uint32_t> *cur_size) {
   disk_io->Set(header_size_, item_length_);
-  struct disk_io::WriterStruct *write_struct = new struct disk_io::WriterStruct;
-  write_struct->fd = fd_;
-  write_struct->data = new uint8_t[n_bytes];
-  memcpy(write_struct->data, value, n_bytes);
-  write_struct->start = header_size_ + start;
-  write_struct->len = n_bytes;
-  write_struct->cur_size = cur_size;
-  disk_io->AsyncWrite(write_struct);
-  // disk_io->SyncWrite(write_struct);
-  return 0;
+  return disk_io->AsyncWrite(fd_, value, n_bytes, header_size_ + start,
+                             cur_size);
 }
 
 bool TableBlock::ReadBlock(uint32_t key, char *block,
@@ -24,11 +24,19 @@ VectorBlock::VectorBlock(int fd, int per_block_size, int length,
 void VectorBlock::InitSubclass() {
   if(compressor_) {
     vec_item_len_ = compressor_->GetCompressLen();
-    LOG(INFO) << "Vector block use compress. vec_item_len_[" 
+    // blocks hold the stored items
+    item_length_ = vec_item_len_;
+    LOG(INFO) << "Vector block use compress. type["
+              << (int)compressor_->GetCompressType() << "] vec_item_len_["
               << vec_item_len_ << "]";
-    if (compressor_->GetCompressType() != CompressType::Zfp) {
-      LOG(ERROR) << "The compression method used by vec_block is not ZFP.";
-    }
+  }
+}
+
+void VectorBlock::StoredRange(uint32_t &start, uint32_t &n_bytes) {
+  if (compressor_) {
+    uint32_t raw_len = (uint32_t)(compressor_->GetRawLen());
+    n_bytes = (n_bytes / raw_len) * vec_item_len_;
+    start = (start / raw_len) * vec_item_len_;
   }
 }
 
@@ -59,7 +67,6 @@ bool VectorBlock::ReadBlock(uint32_t key, char *block,
 int VectorBlock::WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
                               disk_io::AsyncWriter *disk_io, 
                               std::atomic<uint32_t> *cur_size) {
-#ifdef WITH_ZFP
   std::vector<char> output;
   if (compressor_) {
     int raw_len = compressor_->GetRawLen();
@@ -68,28 +75,20 @@ int VectorBlock::WriteContent(const uint8_t *value, int n_bytes, uint32_t start,
     start = (start / raw_len) * vec_item_len_;
     value = (const uint8_t *)output.data();
   }
-#endif
 
   disk_io->Set(header_size_, vec_item_len_);
-  struct disk_io::WriterStruct *write_struct = new struct disk_io::WriterStruct;
-  write_struct->fd = fd_;
-  write_struct->data = new uint8_t[vec_item_len_];
-  memcpy(write_struct->data, value, vec_item_len_);
-  write_struct->start = header_size_ + start;
-  write_struct->len = vec_item_len_;
-  write_struct->cur_size = cur_size;
-  disk_io->AsyncWrite(write_struct);
-  // disk_io->SyncWrite(write_struct);
-  return 0;
+  return disk_io->AsyncWrite(fd_, value, vec_item_len_, header_size_ + start,
+                             cur_size);
 }
 
 int VectorBlock::ReadContent(uint8_t *value, uint32_t n_bytes, uint32_t start) {
-#ifdef WITH_ZFP
   if (compressor_) {
     uint32_t raw_len = (uint32_t)(compressor_->GetRawLen());
     uint32_t batch_num = n_bytes / raw_len;
     uint32_t cmprs_data_len = batch_num * vec_item_len_;
-    char *cmprs_data = new char[cmprs_data_len];
+    static thread_local std::vector<char> buffer;
+    if (buffer.size() < cmprs_data_len) buffer.resize(cmprs_data_len);
+    char *cmprs_data = buffer.data();
     start = (start / raw_len) * vec_item_len_;
     pread(fd_, cmprs_data, cmprs_data_len, header_size_ + start);
 
@@ -99,9 +98,7 @@ int VectorBlock::ReadContent(uint8_t *value, uint32_t n_bytes, uint32_t start) {
       compressor_->DecompressBatch((char *)cmprs_data, (char *)value, batch_num,
                                    n_bytes);
     }
-    delete[] cmprs_data;
   } else
-#endif
   {
     pread(fd_, value, n_bytes, header_size_ + start);
   }
@@ -113,14 +110,12 @@ int VectorBlock::Read(uint8_t *value, uint32_t n_bytes, uint32_t start) {
     return ReadContent(value, n_bytes, start);
   }
 
-#ifdef WITH_ZFP
   uint32_t raw_len = 0;
   if (compressor_) {
     raw_len = (uint32_t)(compressor_->GetRawLen());
     n_bytes = (n_bytes / raw_len) * vec_item_len_;
     start = (start / raw_len) * vec_item_len_;
   }
-#endif
 
   int read_num = 0;
   while (n_bytes) {
@@ -140,14 +135,12 @@ int VectorBlock::Read(uint8_t *value, uint32_t n_bytes, uint32_t start) {
       if ((int)(*cur_size_) == max_size_) SegmentIsFull();
     }
     if (last_bid_in_disk_ <= block_id) {
-#ifdef WITH_ZFP
       if (compressor_) {
         uint8_t *output = value + (read_num / vec_item_len_) * raw_len;
         uint32_t read_len = (len / vec_item_len_) * raw_len;
         uint32_t offset = ((block_pos + block_offset) / vec_item_len_) * raw_len;
         ReadContent(output, read_len, offset);
       } else
-#endif
       {
         ReadContent(value + read_num, len, block_pos + block_offset);
       }
@@ -186,7 +179,6 @@ int VectorBlock::Read(uint8_t *value, uint32_t n_bytes, uint32_t start) {
       // }
 
 
-#ifdef WITH_ZFP
       if (compressor_) {
         int batch_num = len / vec_item_len_;
         char *output = (char*)value + (read_num / vec_item_len_) * raw_len;
@@ -196,7 +188,6 @@ int VectorBlock::Read(uint8_t *value, uint32_t n_bytes, uint32_t start) {
           compressor_->DecompressBatch(block + block_offset, output, batch_num, 0);
         }
       } else
-#endif
       {
         memcpy(value + read_num, block + block_offset, len);
       }
@@ -210,7 +201,6 @@ int VectorBlock::Read(uint8_t *value, uint32_t n_bytes, uint32_t start) {
 }
 
 int VectorBlock::Compress(const uint8_t *data, int len, std::vector<char> &output) {
-#ifdef WITH_ZFP
   if (compressor_) {
     int raw_len = compressor_->GetRawLen();
     int batch_num = len / raw_len;
@@ -226,12 +216,10 @@ int VectorBlock::Compress(const uint8_t *data, int len, std::vector<char> &outpu
     }
     return 0;
   }
-#endif
   return -1;
 }
 
 int VectorBlock::Update(const uint8_t *value, int n_bytes, uint32_t start) {
-#ifdef WITH_ZFP
   std::vector<char> output;
   if (compressor_) {
     int raw_len = compressor_->GetRawLen();
@@ -240,7 +228,6 @@ int VectorBlock::Update(const uint8_t *value, int n_bytes, uint32_t start) {
     value = (uint8_t *)output.data();
     n_bytes = output.size();
   }
-#endif
 
   pwrite(fd_, value, n_bytes, header_size_ + start);
   
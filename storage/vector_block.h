@@ -44,6 +44,8 @@ class VectorBlock : public Block {
  private:
   void InitSubclass() override;
 
+  void StoredRange(uint32_t &start, uint32_t &n_bytes) override;
+
   int GetReadFunParameter(ReadFunParameter &parameter, uint32_t len,
                           uint32_t off) override;
 
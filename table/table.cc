@@ -11,9 +11,12 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <string>
 
+#include "bitmap.h"
+#include "thread_util.h"
 #include "utils.h"
 
 using std::move;
@@ -23,7 +26,7 @@ using std::vector;
 namespace tig_gamma {
 namespace table {
 
-Table::Table(const string &root_path, bool b_compress) {
+Table::Table(const string &root_path, bool b_compress, int table_id) {
   item_length_ = 0;
   field_num_ = 0;
   string_field_num_ = 0;
@@ -31,11 +34,13 @@ Table::Table(const string &root_path, bool b_compress) {
   root_path_ = root_path + "/table";
   seg_num_ = 0;
   b_compress_ = b_compress;
+  table_id_ = table_id;
 
   table_created_ = false;
   last_docid_ = -1;
   table_params_ = nullptr;
   storage_mgr_ = nullptr;
+  pthread_rwlock_init(&str_rwlock_, nullptr);
   LOG(INFO) << "Table created success!";
 }
 
@@ -45,6 +50,7 @@ Table::~Table() {
     delete storage_mgr_;
     storage_mgr_ = nullptr;
   }
+  pthread_rwlock_destroy(&str_rwlock_);
   LOG(INFO) << "Table deleted.";
 }
 
@@ -133,6 +139,7 @@ int Table::CreateTable(TableInfo &table, TableParams &table_params) {
   options.segment_size = 500000;
   options.fixed_value_bytes = item_length_;
   options.seg_block_capacity = 400000;
+  options.table_id = table_id_;
   storage_mgr_ =
       new StorageManager(root_path_, BlockType::TableBlockType, options);
   int cache_size = 512;  // unit : M
@@ -272,58 +279,69 @@ int Table::Add(const std::string &key, const std::vector<struct Field> &fields,
   return 0;
 }
 
-int Table::BatchAdd(int start_id, int batch_size, int docid,
+int Table::BatchAdd(const std::vector<int> &doc_idxs, int docid,
                     std::vector<Doc> &doc_vec, BatchResult &result) {
 #ifdef PERFORMANCE_TESTING
   double start = utils::getmillisecs();
 #endif
-
-#pragma omp parallel for
-  for (size_t i = 0; i < batch_size; ++i) {
-    int id = docid + i;
-    Doc &doc = doc_vec[start_id + i];
-
-    std::string &key = doc.Key();
-    if (key.size() == 0) {
-      std::string msg = "Add item error : _id is null!";
-      result.SetResult(i, -1, msg);
+  int n = doc_idxs.size();
+  if (n == 0) return 0;
+
+  // docids are taken in order, a doc without a row for every field fails
+  // the batch before anything is stored
+  int bad_num = 0;
+  for (int i = 0; i < n; ++i) {
+    size_t field_num = doc_vec[doc_idxs[i]].TableFields().size();
+    if (field_num != attr_idx_map_.size()) {
+      std::string msg = "Field num [" + std::to_string(field_num) +
+                        "] not equal to [" +
+                        std::to_string(attr_idx_map_.size()) + "]";
+      result.SetResult(doc_idxs[i], -1, msg);
       LOG(ERROR) << msg;
-      continue;
-    }
-
-    if (id_type_ == 0) {
-      int64_t k = utils::StringToInt64(key);
-      item_to_docid_.insert(k, id);
-    } else {
-      long key_long = -1;
-      memcpy(&key_long, key.data(), sizeof(key_long));
-
-      item_to_docid_.insert(key_long, id);
+      ++bad_num;
     }
   }
+  if (bad_num > 0) return -2;
 
-  for (size_t i = 0; i < batch_size; ++i) {
-    int id = docid + i;
-    Doc &doc = doc_vec[start_id + i];
-    std::vector<Field> &fields = doc.TableFields();
-    uint8_t doc_value[item_length_];
-
-    for (size_t j = 0; j < fields.size(); ++j) {
-      const auto &field_value = fields[j];
-      const string &name = field_value.name;
-      size_t offset = idx_attr_offset_[j];
+  std::vector<int> str_fields;
+  for (int j = 0; j < field_num_; ++j) {
+    if (attrs_[j] == DataType::STRING) str_fields.push_back(j);
+  }
+  uint8_t *values = new (std::nothrow) uint8_t[(size_t)n * item_length_];
+  if (values == nullptr) {
+    LOG(ERROR) << "new batch values error, n=" << n;
+    return -1;
+  }
 
+  // fixed size fields are encoded in parallel, strings are appended below
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    std::vector<Field> &fields = doc_vec[doc_idxs[i]].TableFields();
+    uint8_t *doc_value = values + (size_t)i * item_length_;
+    for (int j = 0; j < field_num_; ++j) {
       DataType attr = attrs_[j];
-
       if (attr != DataType::STRING) {
-        int type_size = FTypeSize(attr);
-        memcpy(doc_value + offset, field_value.value.c_str(), type_size);
-      } else {
-        size_t ofst = sizeof(str_offset_t);
-        str_len_t len = field_value.value.size();
+        memcpy(doc_value + idx_attr_offset_[j], fields[j].value.c_str(),
+               FTypeSize(attr));
+      }
+    }
+  }
+
+  int ret = 0;
+  int segment_size = storage_mgr_->SegmentSize();
+  for (int begin = 0; begin < n && ret == 0;) {
+    // strings are stored in the segment of their rows
+    int end = begin + segment_size - storage_mgr_->Size() % segment_size;
+    if (end > n) end = n;
+    for (int i = begin; i < end; ++i) {
+      std::vector<Field> &fields = doc_vec[doc_idxs[i]].TableFields();
+      uint8_t *doc_value = values + (size_t)i * item_length_;
+      for (int j : str_fields) {
+        size_t offset = idx_attr_offset_[j];
+        str_len_t len = fields[j].value.size();
         uint32_t block_id, in_block_pos;
-        str_offset_t str_offset = storage_mgr_->AddString(
-            field_value.value.c_str(), len, block_id, in_block_pos);
+        storage_mgr_->AddString(fields[j].value.c_str(), len, block_id,
+                                in_block_pos);
 
         memcpy(doc_value + offset, &block_id, sizeof(block_id));
         memcpy(doc_value + offset + sizeof(block_id), &in_block_pos,
@@ -332,33 +350,54 @@ int Table::BatchAdd(int start_id, int batch_size, int docid,
                &len, sizeof(len));
       }
     }
+    ret = storage_mgr_->BatchAdd(values + (size_t)begin * item_length_,
+                                 end - begin);
+    begin = end;
+  }
+  delete[] values;
+  if (ret) {
+    LOG(ERROR) << "batch add to storage error, ret=" << ret;
+    return ret;
+  }
 
-    storage_mgr_->Add((const uint8_t *)doc_value, item_length_);
-    if (id % 10000 == 0) {
-      std::string &key = doc_vec[i].Key();
-      if (id_type_ == 0) {
-        LOG(INFO) << "Add item _id [" << key << "], num [" << id << "]";
-      } else {
-        long key_long = -1;
-        memcpy(&key_long, key.data(), sizeof(key_long));
-        LOG(INFO) << "Add item _id [" << key_long << "], num [" << id << "]";
-      }
+  // keys are inserted once their rows are stored
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    std::string &key = doc_vec[doc_idxs[i]].Key();
+    if (key.size() == 0) {
+      std::string msg = "Add item error : _id is null!";
+      result.SetResult(doc_idxs[i], -1, msg);
+      LOG(ERROR) << msg;
+      continue;
+    }
+
+    if (id_type_ == 0) {
+      int64_t k = utils::StringToInt64(key);
+      item_to_docid_.insert(k, docid + i);
+    } else {
+      long key_long = -1;
+      memcpy(&key_long, key.data(), sizeof(key_long));
+
+      item_to_docid_.insert(key_long, docid + i);
     }
   }
+  if ((docid + n) / 10000 != docid / 10000) {
+    LOG(INFO) << "Add item num [" << docid + n << "]";
+  }
 
-  // Compress();
 #ifdef PERFORMANCE_TESTING
   double end = utils::getmillisecs();
   if (docid % 10000 == 0) {
     LOG(INFO) << "table cost [" << end - start << "]ms";
   }
 #endif
-  last_docid_ = docid + batch_size;
+  last_docid_ = docid + n;
   return 0;
 }
 
 int Table::Update(const std::vector<Field> &fields, int docid) {
   if (fields.size() == 0) return 0;
+  ReadThreadLock lock(str_rwlock_);
 
   const uint8_t *ori_doc_value;
   storage_mgr_->Get(docid, ori_doc_value);
@@ -433,12 +472,18 @@ int Table::GetDocInfo(std::string &id, Doc &doc,
   return GetDocInfo(doc_id, doc, fields);
 }
 
+int Table::Prefetch(const std::vector<int64_t> &docids) {
+  return storage_mgr_->Prefetch(docids);
+}
+
 int Table::GetDocInfo(const int docid, Doc &doc,
-                      std::vector<std::string> &fields) {
+                      std::vector<std::string> &fields,
+                      std::vector<StringRef> *str_refs) {
   if (docid > last_docid_) {
     LOG(ERROR) << "doc [" << docid << "] in front of [" << last_docid_ << "]";
     return -1;
   }
+  ReadThreadLock lock(str_rwlock_);
   const uint8_t *doc_value;
   storage_mgr_->Get(docid, doc_value);
   std::vector<struct Field> &table_fields = doc.TableFields();
@@ -446,6 +491,7 @@ int Table::GetDocInfo(const int docid, Doc &doc,
   if (fields.size() == 0) {
     int i = 0;
     table_fields.resize(attr_type_map_.size());
+    if (str_refs) str_refs->resize(table_fields.size());
 
     for (const auto &it : attr_idx_map_) {
       DataType type = attr_type_map_[it.first];
@@ -453,11 +499,16 @@ int Table::GetDocInfo(const int docid, Doc &doc,
       table_fields[i].name = it.first;
       table_fields[i].source = source;
       table_fields[i].datatype = type;
-      GetFieldRawValue(docid, it.second, table_fields[i].value, doc_value);
+      if (str_refs && type == DataType::STRING) {
+        GetFieldStringRef(docid, it.second, (*str_refs)[i], doc_value);
+      } else {
+        GetFieldRawValue(docid, it.second, table_fields[i].value, doc_value);
+      }
       ++i;
     }
   } else {
     table_fields.resize(fields.size());
+    if (str_refs) str_refs->resize(table_fields.size());
     int i = 0;
     for (std::string &f : fields) {
       const auto &iter = attr_idx_map_.find(f);
@@ -470,7 +521,11 @@ int Table::GetDocInfo(const int docid, Doc &doc,
       table_fields[i].name = f;
       table_fields[i].source = source;
       table_fields[i].datatype = type;
-      GetFieldRawValue(docid, field_idx, table_fields[i].value, doc_value);
+      if (str_refs && type == DataType::STRING) {
+        GetFieldStringRef(docid, field_idx, (*str_refs)[i], doc_value);
+      } else {
+        GetFieldRawValue(docid, field_idx, table_fields[i].value, doc_value);
+      }
       ++i;
     }
   }
@@ -478,6 +533,33 @@ int Table::GetDocInfo(const int docid, Doc &doc,
   return 0;
 }
 
+int Table::GetDocFields(int docid, const std::vector<int> &field_ids,
+                        std::vector<std::string> &values,
+                        std::vector<StringRef> &refs) {
+  if (docid > last_docid_) {
+    LOG(ERROR) << "doc [" << docid << "] in front of [" << last_docid_ << "]";
+    return -1;
+  }
+  size_t begin = values.size();
+  values.resize(begin + field_ids.size());
+  refs.resize(values.size());
+  if (field_ids.size() == 0) return 0;
+
+  ReadThreadLock lock(str_rwlock_);
+  const uint8_t *doc_value;
+  storage_mgr_->Get(docid, doc_value);
+  for (size_t i = 0; i < field_ids.size(); ++i) {
+    int field_id = field_ids[i];
+    if (attrs_[field_id] == DataType::STRING) {
+      GetFieldStringRef(docid, field_id, refs[begin + i], doc_value);
+    } else {
+      GetFieldRawValue(docid, field_id, values[begin + i], doc_value);
+    }
+  }
+  delete[] doc_value;
+  return 0;
+}
+
 int Table::GetFieldRawValue(int docid, const std::string &field_name,
                             std::string &value, const uint8_t *doc_v) {
   const auto iter = attr_idx_map_.find(field_name);
@@ -492,16 +574,21 @@ int Table::GetFieldRawValue(int docid, int field_id, std::string &value,
                             const uint8_t *doc_v) {
   if ((docid < 0) or (field_id < 0 || field_id >= field_num_)) return -1;
 
+  DataType data_type = attrs_[field_id];
+  size_t offset = idx_attr_offset_[field_id];
+
   const uint8_t *doc_value = doc_v;
   bool free = false;
+  bool locked = false;
   if (doc_value == nullptr) {
     free = true;
+    if (data_type == DataType::STRING) {
+      pthread_rwlock_rdlock(&str_rwlock_);
+      locked = true;
+    }
     storage_mgr_->Get(docid, doc_value);
   }
 
-  DataType data_type = attrs_[field_id];
-  size_t offset = idx_attr_offset_[field_id];
-
   if (data_type == DataType::STRING) {
     uint32_t block_id = 0;
     memcpy(&block_id, doc_value + offset, sizeof(block_id));
@@ -521,6 +608,9 @@ int Table::GetFieldRawValue(int docid, int field_id, std::string &value,
     value = std::string((const char *)(doc_value + offset), value_len);
   }
 
+  if (locked) {
+    pthread_rwlock_unlock(&str_rwlock_);
+  }
   if (free) {
     delete[] doc_value;
   }
@@ -528,6 +618,39 @@ int Table::GetFieldRawValue(int docid, int field_id, std::string &value,
   return 0;
 }
 
+int Table::GetFieldStringRef(int docid, int field_id, StringRef &ref,
+                             const uint8_t *doc_v) {
+  if ((docid < 0) or (field_id < 0 || field_id >= field_num_) or
+      attrs_[field_id] != DataType::STRING) {
+    return -1;
+  }
+  size_t offset = idx_attr_offset_[field_id];
+
+  const uint8_t *doc_value = doc_v;
+  if (doc_value == nullptr) {
+    pthread_rwlock_rdlock(&str_rwlock_);
+    storage_mgr_->Get(docid, doc_value);
+  }
+
+  uint32_t block_id = 0;
+  memcpy(&block_id, doc_value + offset, sizeof(block_id));
+
+  uint32_t in_block_pos = 0;
+  memcpy(&in_block_pos, doc_value + offset + sizeof(block_id),
+         sizeof(in_block_pos));
+
+  str_len_t len;
+  memcpy(&len, doc_value + offset + sizeof(block_id) + sizeof(in_block_pos),
+         sizeof(len));
+  int ret = storage_mgr_->GetStringRef(docid, ref, block_id, in_block_pos, len);
+
+  if (doc_v == nullptr) {
+    pthread_rwlock_unlock(&str_rwlock_);
+    delete[] doc_value;
+  }
+  return ret;
+}
+
 int Table::GetFieldType(const std::string &field_name, DataType &type) {
   const auto &it = attr_type_map_.find(field_name);
   if (it == attr_type_map_.end()) {
@@ -565,5 +688,150 @@ void Table::GetCacheSize(uint32_t &cache_size, uint32_t &str_cache_size) {
   storage_mgr_->GetCacheSize(cache_size, str_cache_size);
 }
 
+int Table::CompactStrings(const char *docids_bitmap, long io_bytes_per_sec) {
+  if (string_field_num_ == 0) return 0;
+  std::unique_lock<std::mutex> compact_lock(compact_mutex_, std::try_to_lock);
+  if (!compact_lock.owns_lock()) {
+    LOG(WARNING) << "string compaction is running";
+    return -1;
+  }
+
+  uint64_t base_size = 0, str_size = 0, compacted_str_size = 0;
+  storage_mgr_->CountByteSize(base_size, str_size);
+  utils::IoThrottle throttle(io_bytes_per_sec);
+  int seg_num = storage_mgr_->FullSegmentNum();
+  for (int i = 0; i < seg_num; i++) {
+    int ret = CompactSegmentStrings(i, docids_bitmap, throttle);
+    if (ret) {
+      LOG(ERROR) << "compact strings of segment " << i << " error, ret=" << ret;
+      return ret;
+    }
+  }
+  storage_mgr_->CountByteSize(base_size, compacted_str_size);
+  LOG(INFO) << "compact strings of " << seg_num << " segments, string bytes "
+            << str_size << " -> " << compacted_str_size;
+  return 0;
+}
+
+int Table::CompactSegmentStrings(int seg_id, const char *docids_bitmap,
+                                 utils::IoThrottle &throttle) {
+  std::vector<int> str_offsets;
+  for (const auto &it : str_field_id_) {
+    str_offsets.push_back(idx_attr_offset_[it.first]);
+  }
+  const size_t ref_len = FTypeSize(DataType::STRING);
+  const size_t ref_num = str_offsets.size();
+  int begin = seg_id * storage_mgr_->SegmentSize();
+  int end = begin + storage_mgr_->SegmentSize();
+
+  int ret = storage_mgr_->BeginStrCompaction(seg_id);
+  if (ret) return ret;
+
+  // [ref when it is copied, ref in the compacted file] of each string
+  std::vector<uint8_t> refs((size_t)(end - begin) * ref_num * ref_len * 2);
+  auto copy_string = [&](int docid, const uint8_t *ref, uint8_t *new_ref) {
+    uint32_t block_id, in_block_pos;
+    str_len_t len;
+    memcpy(&block_id, ref, sizeof(block_id));
+    memcpy(&in_block_pos, ref + sizeof(block_id), sizeof(in_block_pos));
+    memcpy(&len, ref + sizeof(block_id) + sizeof(in_block_pos), sizeof(len));
+    std::string str;
+    storage_mgr_->GetString(docid, str, block_id, in_block_pos, len);
+    len = (str_len_t)str.size();
+    storage_mgr_->AddCompactString(seg_id, str.c_str(), len, block_id,
+                                   in_block_pos);
+    memcpy(new_ref, &block_id, sizeof(block_id));
+    memcpy(new_ref + sizeof(block_id), &in_block_pos, sizeof(in_block_pos));
+    memcpy(new_ref + sizeof(block_id) + sizeof(in_block_pos), &len,
+           sizeof(len));
+    return (long)len;
+  };
+
+  // rows are read kCompactBatch at a time, one read per block
+  const int kCompactBatch = 1024;
+  auto read_rows = [&](int start, int n) -> const uint8_t * {
+    std::vector<const uint8_t *> values;
+    std::vector<int> lens;
+    if (storage_mgr_->GetHeaders(start, n, values, lens) || values.size() != 1)
+      return nullptr;
+    return values[0];
+  };
+
+  // copy online, the old string file is append only until the commit
+  for (int start = begin; start < end; start += kCompactBatch) {
+    int n = std::min(kCompactBatch, end - start);
+    const uint8_t *rows = read_rows(start, n);
+    if (rows == nullptr) {
+      storage_mgr_->AbortStrCompaction(seg_id);
+      return -1;
+    }
+    long bytes = (long)n * item_length_;
+    for (int docid = start; docid < start + n; docid++) {
+      if (bitmap::test(docids_bitmap, docid)) continue;
+      const uint8_t *doc_value = rows + (size_t)(docid - start) * item_length_;
+      uint8_t *doc_refs = refs.data() + (docid - begin) * ref_num * ref_len * 2;
+      for (size_t i = 0; i < ref_num; i++) {
+        uint8_t *ref = doc_refs + i * ref_len * 2;
+        memcpy(ref, doc_value + str_offsets[i], ref_len);
+        bytes += copy_string(docid, ref, ref + ref_len) * 2;
+      }
+    }
+    delete[] rows;
+    throttle.Consume(bytes);
+  }
+
+  WriteThreadLock lock(str_rwlock_);
+  // the strings updated during the copy are copied again
+  std::vector<const uint8_t *> seg_rows;
+  for (int start = begin; start < end; start += kCompactBatch) {
+    int n = std::min(kCompactBatch, end - start);
+    const uint8_t *rows = read_rows(start, n);
+    if (rows == nullptr) break;
+    seg_rows.push_back(rows);
+    for (int docid = start; docid < start + n; docid++) {
+      if (bitmap::test(docids_bitmap, docid)) continue;
+      const uint8_t *doc_value = rows + (size_t)(docid - start) * item_length_;
+      uint8_t *doc_refs = refs.data() + (docid - begin) * ref_num * ref_len * 2;
+      for (size_t i = 0; i < ref_num; i++) {
+        uint8_t *ref = doc_refs + i * ref_len * 2;
+        if (memcmp(ref, doc_value + str_offsets[i], ref_len) != 0) {
+          copy_string(docid, doc_value + str_offsets[i], ref + ref_len);
+        }
+      }
+    }
+  }
+
+  if ((int)seg_rows.size() * kCompactBatch < end - begin) {
+    storage_mgr_->AbortStrCompaction(seg_id);
+    for (const uint8_t *rows : seg_rows) delete[] rows;
+    return -1;
+  }
+
+  // the refs of deleted docs are cleared, their strings are dropped. The
+  // rows are committed with the string file.
+  std::vector<uint8_t> new_rows((size_t)(end - begin) * item_length_);
+  for (int docid = begin; docid < end; docid++) {
+    int batch = (docid - begin) / kCompactBatch;
+    size_t pos = (docid - begin) % kCompactBatch;
+    const uint8_t *doc_value = seg_rows[batch] + pos * item_length_;
+    uint8_t *new_value =
+        new_rows.data() + (size_t)(docid - begin) * item_length_;
+    memcpy(new_value, doc_value, item_length_);
+    bool deleted = bitmap::test(docids_bitmap, docid);
+    uint8_t *doc_refs = refs.data() + (docid - begin) * ref_num * ref_len * 2;
+    for (size_t i = 0; i < ref_num; i++) {
+      uint8_t *new_ref = doc_refs + i * ref_len * 2 + ref_len;
+      if (deleted) {
+        memset(new_value + str_offsets[i], 0, ref_len);
+      } else {
+        memcpy(new_value + str_offsets[i], new_ref, ref_len);
+      }
+    }
+  }
+  for (const uint8_t *rows : seg_rows) delete[] rows;
+  return storage_mgr_->CommitStrCompaction(seg_id, new_rows.data(),
+                                           end - begin);
+}
+
 }  // namespace table
 }  // namespace tig_gamma
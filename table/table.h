@@ -7,8 +7,11 @@
 
 #pragma once
 
+#include <pthread.h>
+
 #include <cuckoohash_map.hh>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,6 +22,7 @@
 #include "log.h"
 #include "storage_manager.h"
 #include "table_define.h"
+#include "utils.h"
 
 using namespace tig_gamma::table;
 
@@ -38,7 +42,9 @@ struct TableParams : DumpConfig {
  */
 class Table {
  public:
-  explicit Table(const std::string &root_path, bool b_compress = false);
+  // the caches share the cache quota of table_id, -1 if they don't
+  explicit Table(const std::string &root_path, bool b_compress = false,
+                 int table_id = -1);
 
   ~Table();
 
@@ -60,7 +66,10 @@ class Table {
   int Add(const std::string &key, const std::vector<struct Field> &fields,
           int docid);
 
-  int BatchAdd(int start_id, int batch_size, int docid,
+  /** add doc_vec[doc_idxs[i]] as docid + i, the rows are encoded in
+   * parallel and appended with one write per segment
+   */
+  int BatchAdd(const std::vector<int> &doc_idxs, int docid,
                std::vector<Doc> &doc_vec, BatchResult &result);
 
   /** update a doc
@@ -90,7 +99,22 @@ class Table {
   long GetMemoryBytes();
 
   int GetDocInfo(std::string &id, Doc &doc, std::vector<std::string> &fields);
-  int GetDocInfo(const int docid, Doc &doc, std::vector<std::string> &fields);
+  /** if str_refs is not nullptr, it gets a ref per table field and the
+   * values of string fields are left empty, they are read in place into the
+   * refs instead, see GetFieldStringRef
+   */
+  int GetDocInfo(const int docid, Doc &doc, std::vector<std::string> &fields,
+                 std::vector<StringRef> *str_refs = nullptr);
+
+  /** the values of field_ids are appended to values in one read of the doc,
+   * refs is kept parallel to values and string fields are read into it
+   */
+  int GetDocFields(int docid, const std::vector<int> &field_ids,
+                   std::vector<std::string> &values,
+                   std::vector<StringRef> &refs);
+
+  // load the docs of a page of results into the cache in one batch
+  int Prefetch(const std::vector<int64_t> &docids);
 
   int GetFieldRawValue(int docid, const std::string &field_name, std::string &value,
                        const uint8_t *doc_v = nullptr);
@@ -98,6 +122,10 @@ class Table {
   int GetFieldRawValue(int docid, int field_id, std::string &value,
                        const uint8_t *doc_v = nullptr);
 
+  // ref pins the cached block of the string, it should be released soon
+  int GetFieldStringRef(int docid, int field_id, StringRef &ref,
+                        const uint8_t *doc_v = nullptr);
+
   int GetFieldType(const std::string &field, DataType &type);
 
   int GetAttrType(std::map<std::string, DataType> &attr_type_map);
@@ -124,6 +152,16 @@ class Table {
 
   void GetCacheSize(uint32_t &cache_size, uint32_t &str_cache_size);
 
+  /** rewrite the string files of the full segments with only the strings of
+   * the live docs, the strings of deleted docs and the old versions of
+   * updated strings are dropped. Docids are not changed. The strings are
+   * copied online within io_bytes_per_sec (<= 0 is unlimited), readers and
+   * updaters are only blocked while the refs of a segment are switched.
+   *
+   * @return 0 if successed
+   */
+  int CompactStrings(const char *docids_bitmap, long io_bytes_per_sec);
+
   std::string root_path_;
   int last_docid_;
 
@@ -132,6 +170,9 @@ class Table {
 
   int AddField(const std::string &name, DataType ftype, bool is_index);
 
+  int CompactSegmentStrings(int seg_id, const char *docids_bitmap,
+                            utils::IoThrottle &throttle);
+
   std::string name_;   // table name
   int item_length_;    // every doc item length
   uint8_t field_num_;  // field number
@@ -148,6 +189,7 @@ class Table {
 
   uint8_t id_type_;  // 0 string, 1 long, default 1
   bool b_compress_;
+  int table_id_;
   cuckoohash_map<long, int> item_to_docid_;
 
   int seg_num_;  // cur segment num
@@ -156,6 +198,11 @@ class Table {
 
   TableParams *table_params_;
   StorageManager *storage_mgr_;
+
+  // a row and the strings it refers to are read under the read lock, the
+  // refs are switched to the compacted string file under the write lock
+  pthread_rwlock_t str_rwlock_;
+  std::mutex compact_mutex_;
 };
 
 }  // namespace table
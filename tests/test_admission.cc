@@ -0,0 +1,225 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <omp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gamma_engine.h"
+#include "utils.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static long kCapacity = 4;
+const static int kQueueSize = 4;
+
+class AdmissionTest : public ::testing::Test {
+ protected:
+  AdmissionTest() : controller_(RequestConcurrentController::GetInstance()) {}
+
+  void SetUp() override {
+    controller_.GetLimits(capacity_, queue_size_, timeout_ms_);
+    controller_.SetLimits(kCapacity, kQueueSize, 2000);
+    table_a_ = controller_.RegisterTable();
+    table_b_ = controller_.RegisterTable();
+  }
+
+  void TearDown() override {
+    for (std::thread &t : threads_) t.join();
+    controller_.SetLimits(capacity_, queue_size_, timeout_ms_);
+    controller_.UnregisterTable(table_a_);
+    controller_.UnregisterTable(table_b_);
+  }
+
+  // acquires in a thread, result is 1 if admitted, 0 if not, -1 while waiting
+  void AcquireAsync(long cost, SearchPriority priority, int table_id,
+                    std::atomic<int> &result) {
+    result = -1;
+    threads_.emplace_back([=, &result]() {
+      long c = cost;
+      result = controller_.Acquire(c, priority, 0, table_id) ? 1 : 0;
+    });
+    // queued before the next one
+    while (controller_.Running() < (int)threads_.size() + held_) {
+      usleep(1000);
+    }
+  }
+
+  bool Acquire(long cost, int table_id, int timeout_ms = -1) {
+    if (not controller_.Acquire(cost, SearchPriority::Normal, timeout_ms,
+                                table_id)) {
+      return false;
+    }
+    ++held_;
+    return true;
+  }
+
+  void Release(long cost, int table_id) {
+    controller_.Release(cost, table_id);
+    --held_;
+  }
+
+  void WaitFor(std::atomic<int> &result) {
+    for (int i = 0; i < 2000 && result < 0; ++i) usleep(1000);
+  }
+
+  RequestConcurrentController &controller_;
+  long capacity_;
+  int queue_size_;
+  int timeout_ms_;
+  int table_a_;
+  int table_b_;
+  int held_ = 0;  // admitted by the test thread
+  vector<std::thread> threads_;
+};
+
+TEST_F(AdmissionTest, AdmitsWithinCapacity) {
+  ASSERT_TRUE(Acquire(3, table_a_));
+  // it doesn't fit and never waits
+  ASSERT_FALSE(Acquire(2, table_a_));
+  ASSERT_TRUE(Acquire(1, table_a_));
+  Release(3, table_a_);
+  Release(1, table_a_);
+
+  // a search costlier than the capacity runs alone
+  long cost = 100;
+  ASSERT_TRUE(controller_.Acquire(cost, SearchPriority::Normal, -1, table_a_));
+  ASSERT_EQ(kCapacity, cost);
+  controller_.Release(cost, table_a_);
+
+  long admitted, queued, timed_out, rejected;
+  controller_.GetStats(table_a_, admitted, queued, timed_out, rejected);
+  ASSERT_EQ(3, admitted);
+  ASSERT_EQ(0, queued);
+  ASSERT_EQ(1, rejected);
+}
+
+TEST_F(AdmissionTest, QueuedUntilReleased) {
+  ASSERT_TRUE(Acquire(kCapacity, table_a_));
+  std::atomic<int> result;
+  AcquireAsync(2, SearchPriority::Normal, table_a_, result);
+  usleep(50 * 1000);
+  ASSERT_EQ(-1, result);
+
+  Release(kCapacity, table_a_);
+  WaitFor(result);
+  ASSERT_EQ(1, result);
+  controller_.Release(2, table_a_);
+
+  long admitted, queued, timed_out, rejected;
+  controller_.GetStats(table_a_, admitted, queued, timed_out, rejected);
+  ASSERT_EQ(2, admitted);
+  ASSERT_EQ(1, queued);
+  ASSERT_EQ(0, timed_out);
+}
+
+TEST_F(AdmissionTest, TimesOutAtDeadline) {
+  ASSERT_TRUE(Acquire(kCapacity, table_a_));
+  double begin = utils::getmillisecs();
+  ASSERT_FALSE(Acquire(1, table_a_, 100));
+  ASSERT_GE(utils::getmillisecs() - begin, 100);
+  Release(kCapacity, table_a_);
+
+  long admitted, queued, timed_out, rejected;
+  controller_.GetStats(table_a_, admitted, queued, timed_out, rejected);
+  ASSERT_EQ(1, queued);
+  ASSERT_EQ(1, timed_out);
+  ASSERT_EQ(0, controller_.Running());
+}
+
+TEST_F(AdmissionTest, HigherPriorityFirst) {
+  ASSERT_TRUE(Acquire(kCapacity, table_a_));
+  std::atomic<int> low, high;
+  AcquireAsync(kCapacity, SearchPriority::Low, table_a_, low);
+  AcquireAsync(kCapacity, SearchPriority::High, table_b_, high);
+
+  Release(kCapacity, table_a_);
+  WaitFor(high);
+  ASSERT_EQ(1, high);
+  ASSERT_EQ(-1, low);
+
+  controller_.Release(kCapacity, table_b_);
+  WaitFor(low);
+  ASSERT_EQ(1, low);
+  controller_.Release(kCapacity, table_a_);
+}
+
+TEST_F(AdmissionTest, LeastUsedTableFirst) {
+  ASSERT_TRUE(Acquire(2, table_a_));
+  ASSERT_TRUE(Acquire(2, table_a_));
+  std::atomic<int> a, b;
+  AcquireAsync(2, SearchPriority::Normal, table_a_, a);
+  AcquireAsync(2, SearchPriority::Normal, table_b_, b);
+
+  // table a still holds 2, the waiter of table b is admitted first
+  Release(2, table_a_);
+  WaitFor(b);
+  ASSERT_EQ(1, b);
+  ASSERT_EQ(-1, a);
+
+  Release(2, table_a_);
+  WaitFor(a);
+  ASSERT_EQ(1, a);
+  controller_.Release(2, table_a_);
+  controller_.Release(2, table_b_);
+}
+
+TEST_F(AdmissionTest, LowPriorityShedWhenHalfFull) {
+  ASSERT_TRUE(Acquire(kCapacity, table_a_));
+  std::atomic<int> first, second;
+  AcquireAsync(1, SearchPriority::Normal, table_a_, first);
+  AcquireAsync(1, SearchPriority::Normal, table_b_, second);
+
+  long cost = 1;
+  ASSERT_FALSE(controller_.Acquire(cost, SearchPriority::Low, 1000, table_b_));
+  long admitted, queued, timed_out, rejected;
+  controller_.GetStats(table_b_, admitted, queued, timed_out, rejected);
+  ASSERT_EQ(1, rejected);
+
+  Release(kCapacity, table_a_);
+  WaitFor(first);
+  WaitFor(second);
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(1, second);
+  controller_.Release(1, table_a_);
+  controller_.Release(1, table_b_);
+}
+
+TEST_F(AdmissionTest, SearchThreadsSharedByRunning) {
+  int max_threads = omp_get_max_threads();
+  ASSERT_EQ(max_threads, controller_.SearchThreads());
+  ASSERT_TRUE(Acquire(1, table_a_));
+  ASSERT_EQ(max_threads, controller_.SearchThreads());
+  ASSERT_TRUE(Acquire(1, table_b_));
+  ASSERT_EQ(std::max(1, max_threads / 2), controller_.SearchThreads());
+
+  // more searches than threads get one each
+  int running = max_threads + 1;
+  controller_.SetLimits(running, kQueueSize, 2000);
+  for (int i = 2; i < running; ++i) ASSERT_TRUE(Acquire(1, table_a_));
+  ASSERT_EQ(1, controller_.SearchThreads());
+
+  // the budget is carried by the condition, 0 means omp's default
+  RetrievalContext context;
+  ASSERT_EQ(max_threads, context.SearchThreads());
+  context.SetSearchThreads(controller_.SearchThreads());
+  ASSERT_EQ(1, context.SearchThreads());
+
+  for (int i = 1; i < running; ++i) Release(1, table_a_);
+  Release(1, table_b_);
+  ASSERT_EQ(max_threads, controller_.SearchThreads());
+}
+
+}  // namespace Test
@@ -0,0 +1,198 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_writer.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma::disk_io;
+
+const static uint32_t kHeaderSize = 64;
+const static int kItemLen = 16;
+
+class AsyncWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char path[] = "/tmp/test_async_writer_XXXXXX";
+    fd_ = mkstemp(path);
+    ASSERT_GE(fd_, 0);
+    path_ = path;
+    vector<uint8_t> header(kHeaderSize, 0);
+    ASSERT_EQ((ssize_t)kHeaderSize, pwrite(fd_, header.data(), kHeaderSize, 0));
+  }
+
+  void TearDown() override {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  vector<uint8_t> Item(int i) { return vector<uint8_t>(kItemLen, i); }
+
+  uint32_t HeaderSize() {
+    uint32_t size = 0;
+    pread(fd_, &size, sizeof(size), sizeof(uint8_t) + sizeof(uint32_t));
+    return size;
+  }
+
+  int fd_;
+  string path_;
+};
+
+TEST_F(AsyncWriterTest, CoalescedWritesLand) {
+  AsyncWriter writer;
+  ASSERT_EQ(0, writer.Init(SyncPolicy::Batch));
+  writer.Set(kHeaderSize, kItemLen);
+  std::atomic<uint32_t> cur_size(0);
+  for (int i = 0; i < 1000; ++i) {
+    vector<uint8_t> item = Item(i);
+    ASSERT_EQ(0, writer.AsyncWrite(fd_, item.data(), kItemLen,
+                                   kHeaderSize + i * kItemLen, &cur_size));
+  }
+  ASSERT_EQ(0, writer.Sync());
+  ASSERT_EQ(1000U, cur_size);
+  ASSERT_EQ(1000U, HeaderSize());
+
+  for (int i = 0; i < 1000; ++i) {
+    uint8_t data[kItemLen];
+    ASSERT_EQ(kItemLen, pread(fd_, data, kItemLen, kHeaderSize + i * kItemLen));
+    ASSERT_EQ(0, memcmp(data, Item(i).data(), kItemLen));
+  }
+
+  // large writes bypass the ring and keep the order
+  vector<uint8_t> large(kRingBytes / 2 + kItemLen, 7);
+  ASSERT_EQ(0, writer.AsyncWrite(fd_, large.data(), large.size(),
+                                 kHeaderSize + 1000 * kItemLen, &cur_size));
+  ASSERT_EQ(1000U + large.size() / kItemLen, cur_size);
+  ASSERT_EQ(0, writer.Error());
+}
+
+TEST_F(AsyncWriterTest, ErrorLatched) {
+  AsyncWriter writer;
+  ASSERT_EQ(0, writer.Init(SyncPolicy::Interval, 10));
+  writer.Set(kHeaderSize, kItemLen);
+  int rdonly = open(path_.c_str(), O_RDONLY);
+  ASSERT_GE(rdonly, 0);
+  std::atomic<uint32_t> cur_size(0);
+  vector<uint8_t> item = Item(1);
+  ASSERT_EQ(0, writer.AsyncWrite(rdonly, item.data(), kItemLen, kHeaderSize,
+                                 &cur_size));
+  // the failed batch is not counted and Sync reports it
+  ASSERT_EQ(-1, writer.Sync());
+  ASSERT_EQ(0U, cur_size);
+  ASSERT_EQ(-1, writer.Error());
+
+  // producers see the error, nothing more is written
+  std::atomic<uint32_t> other_size(0);
+  ASSERT_EQ(-1, writer.AsyncWrite(fd_, item.data(), kItemLen, kHeaderSize,
+                                  &other_size));
+  ASSERT_EQ(-1, writer.Sync());
+  ASSERT_EQ(0U, other_size);
+  ASSERT_EQ(0U, HeaderSize());
+  close(rdonly);
+}
+
+TEST_F(AsyncWriterTest, SyncWriteError) {
+  AsyncWriter writer;
+  ASSERT_EQ(0, writer.Init());
+  writer.Set(kHeaderSize, kItemLen);
+  int rdonly = open(path_.c_str(), O_RDONLY);
+  ASSERT_GE(rdonly, 0);
+  std::atomic<uint32_t> cur_size(0);
+  vector<uint8_t> item = Item(1);
+  ASSERT_EQ(-1, writer.SyncWrite(rdonly, item.data(), kItemLen, kHeaderSize,
+                                 &cur_size));
+  ASSERT_EQ(0U, cur_size);
+  ASSERT_EQ(-1, writer.Sync());
+  close(rdonly);
+}
+
+TEST_F(AsyncWriterTest, WritersShareQueueNotErrors) {
+  AsyncWriter failed, healthy;
+  ASSERT_EQ(0, failed.Init(SyncPolicy::Batch));
+  ASSERT_EQ(0, healthy.Init(SyncPolicy::Interval, 10));
+  failed.Set(kHeaderSize, kItemLen);
+  healthy.Set(kHeaderSize, kItemLen);
+  int rdonly = open(path_.c_str(), O_RDONLY);
+  ASSERT_GE(rdonly, 0);
+
+  std::atomic<uint32_t> failed_size(0), cur_size(0);
+  for (int i = 0; i < 100; ++i) {
+    vector<uint8_t> item = Item(i);
+    failed.AsyncWrite(rdonly, item.data(), kItemLen, kHeaderSize + i * kItemLen,
+                      &failed_size);
+    ASSERT_EQ(0, healthy.AsyncWrite(fd_, item.data(), kItemLen,
+                                    kHeaderSize + i * kItemLen, &cur_size));
+  }
+  ASSERT_EQ(-1, failed.Sync());
+  ASSERT_EQ(0U, failed_size);
+
+  // the error of a writer doesn't refuse the writes of the others
+  ASSERT_EQ(0, healthy.Sync());
+  ASSERT_EQ(0, healthy.Error());
+  ASSERT_EQ(100U, cur_size);
+  ASSERT_EQ(100U, HeaderSize());
+  close(rdonly);
+}
+
+TEST_F(AsyncWriterTest, ConcurrentWriters) {
+  const int kWriters = 4;
+  const int kItems = 2000;
+  vector<string> paths;
+  vector<int> fds;
+  for (int w = 0; w < kWriters; ++w) {
+    char path[] = "/tmp/test_async_writer_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    vector<uint8_t> header(kHeaderSize, 0);
+    ASSERT_EQ((ssize_t)kHeaderSize, pwrite(fd, header.data(), kHeaderSize, 0));
+    paths.push_back(path);
+    fds.push_back(fd);
+  }
+
+  vector<std::thread> threads;
+  vector<std::atomic<uint32_t>> sizes(kWriters);
+  for (int w = 0; w < kWriters; ++w) {
+    sizes[w] = 0;
+    threads.emplace_back([&, w]() {
+      AsyncWriter writer;
+      ASSERT_EQ(0, writer.Init(w % 2 ? SyncPolicy::None : SyncPolicy::Batch));
+      writer.Set(kHeaderSize, kItemLen);
+      for (int i = 0; i < kItems; ++i) {
+        vector<uint8_t> item = Item(i + w);
+        ASSERT_EQ(0, writer.AsyncWrite(fds[w], item.data(), kItemLen,
+                                       kHeaderSize + i * kItemLen, &sizes[w]));
+      }
+      ASSERT_EQ(0, writer.Sync());
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  for (int w = 0; w < kWriters; ++w) {
+    ASSERT_EQ((uint32_t)kItems, sizes[w]);
+    uint8_t data[kItemLen];
+    int i = kItems - 1;
+    ASSERT_EQ(kItemLen,
+              pread(fds[w], data, kItemLen, kHeaderSize + i * kItemLen));
+    ASSERT_EQ(0, memcmp(data, Item(i + w).data(), kItemLen));
+    close(fds[w]);
+    unlink(paths[w].c_str());
+  }
+}
+
+}  // namespace Test
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "background_pool.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+TEST(BackgroundPool, PeriodicTaskRunsUntilRemoved) {
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  ASSERT_NE(nullptr, pool);
+  std::atomic<int> runs(0);
+  long id = pool->Add([&runs]() -> long {
+    runs++;
+    return 10;
+  }, 0);
+  ASSERT_GT(id, 0);
+  usleep(200 * 1000);
+  pool->Remove(id);
+  int removed_runs = runs;
+  ASSERT_GT(removed_runs, 3);
+  usleep(50 * 1000);
+  ASSERT_EQ(removed_runs, runs);
+}
+
+TEST(BackgroundPool, NegativeWaitEndsTask) {
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  std::atomic<int> runs(0);
+  size_t task_num = pool->TaskNum();
+  pool->Add([&runs]() -> long {
+    runs++;
+    return -1;
+  }, 0);
+  usleep(100 * 1000);
+  ASSERT_EQ(1, runs);
+  ASSERT_EQ(task_num, pool->TaskNum());
+}
+
+TEST(BackgroundPool, WakeRunsAtOnce) {
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  std::atomic<int> runs(0);
+  long id = pool->Add([&runs]() -> long {
+    runs++;
+    return 60 * 1000;
+  }, 60 * 1000);
+  usleep(50 * 1000);
+  ASSERT_EQ(0, runs);
+  pool->Wake(id);
+  usleep(50 * 1000);
+  ASSERT_EQ(1, runs);
+  pool->Remove(id);
+}
+
+TEST(BackgroundPool, RemoveWaitsForRunningTask) {
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  std::atomic<bool> started(false);
+  std::atomic<bool> finished(false);
+  long id = pool->Add([&]() -> long {
+    started = true;
+    usleep(100 * 1000);
+    finished = true;
+    return 0;
+  }, 0);
+  while (not started) usleep(1000);
+  pool->Remove(id);
+  ASSERT_TRUE(finished);
+}
+
+// tasks of many tables share the threads and never run twice at once
+TEST(BackgroundPool, ManyTasksShareThreads) {
+  BackgroundPool *pool = BackgroundPool::GetInstance();
+  const int task_num = 32;
+  std::atomic<int> running[task_num];
+  std::atomic<int> runs(0);
+  std::atomic<int> overlaps(0);
+  vector<long> ids;
+  for (int i = 0; i < task_num; ++i) {
+    running[i] = 0;
+    std::atomic<int> *flag = &running[i];
+    ids.push_back(pool->Add([&, flag]() -> long {
+      if (flag->fetch_add(1) != 0) overlaps++;
+      usleep(1000);
+      flag->fetch_sub(1);
+      runs++;
+      return 0;
+    }, 0));
+  }
+  usleep(200 * 1000);
+  for (long id : ids) pool->Remove(id);
+  ASSERT_EQ(0, overlaps);
+  ASSERT_GT(runs, task_num);
+}
+
+}  // namespace Test
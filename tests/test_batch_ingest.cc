@@ -0,0 +1,187 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "c_api/api_data/gamma_batch_result.h"
+#include "c_api/api_data/gamma_docs.h"
+#include "test_engine.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+class BatchIngestTest : public EngineTest {
+ protected:
+  BatchIngestTest() : EngineTest("batch_ingest") {
+    has_cid_ = true;
+    has_name_ = true;
+    store_type_ = "Mmap";
+  }
+
+  // the name of a doc is "doc_<value>", its vector is value
+  Doc MakeDoc(long id, int value, int dimension = kDimension) {
+    return EngineTest::MakeDoc(id, value, value, dimension);
+  }
+
+  // codes of the docs in the batch order
+  int AddBatch(vector<Doc> &batch, vector<int> &codes) {
+    Docs docs;
+    for (Doc &doc : batch) docs.AddDoc(doc);
+    char **doc_strs = nullptr;
+    int n = 0;
+    docs.Serialize(&doc_strs, &n);
+    char *result_str = nullptr;
+    int result_len = 0;
+    int ret = AddOrUpdateDocs(engine_, doc_strs, n, &result_str, &result_len);
+    for (int i = 0; i < n; ++i) free(doc_strs[i]);
+    free(doc_strs);
+
+    BatchResult result;
+    result.Deserialize(result_str, result_len);
+    free(result_str);
+    codes.clear();
+    for (int i = 0; i < n; ++i) codes.push_back(result.Code(i));
+    return ret;
+  }
+
+  struct Stored {
+    long id;
+    int cid;
+    string name;
+    float vec;  // the first dimension
+  };
+
+  // the stored fields of a docid
+  bool Get(int docid, Stored &stored) {
+    Doc doc;
+    if (Engine()->GetDoc(docid, doc) != 0) return false;
+    for (Field &field : doc.TableFields()) {
+      if (field.name == "_id") {
+        memcpy(&stored.id, field.value.data(), sizeof(stored.id));
+      } else if (field.name == "cid") {
+        memcpy(&stored.cid, field.value.data(), sizeof(stored.cid));
+      } else if (field.name == "name") {
+        stored.name = field.value;
+      }
+    }
+    if (doc.VectorFields().size() != 1) return false;
+    // [bytes of the vector][vector][source]
+    memcpy(&stored.vec, doc.VectorFields()[0].value.data() + sizeof(int),
+           sizeof(float));
+    return true;
+  }
+
+  int DocsNum() { return Engine()->GetDocsNum(); }
+};
+
+TEST_F(BatchIngestTest, AddsInBatchOrder) {
+  const int n = 1000;
+  vector<Doc> batch;
+  for (long id = 0; id < n; ++id) batch.push_back(MakeDoc(id, id));
+  vector<int> codes;
+  ASSERT_EQ(0, AddBatch(batch, codes));
+  ASSERT_EQ(vector<int>(n, 0), codes);
+  ASSERT_EQ(n, DocsNum());
+
+  // the docids follow the batch, the strings of each doc are its own
+  for (int docid = 0; docid < n; docid += 37) {
+    Stored stored;
+    ASSERT_TRUE(Get(docid, stored));
+    ASSERT_EQ(docid, stored.id);
+    ASSERT_EQ(docid, stored.cid);
+    ASSERT_EQ("doc_" + to_string(docid), stored.name);
+    ASSERT_FLOAT_EQ(docid, stored.vec);
+  }
+}
+
+TEST_F(BatchIngestTest, RepeatedKeyUpdatesFirstAdd) {
+  vector<Doc> batch = {MakeDoc(0, 0), MakeDoc(1, 1), MakeDoc(0, 100)};
+  vector<int> codes;
+  ASSERT_EQ(0, AddBatch(batch, codes));
+  ASSERT_EQ((vector<int>{0, 0, 0}), codes);
+  ASSERT_EQ(2, DocsNum());
+
+  Stored stored;
+  ASSERT_TRUE(Get(0, stored));
+  ASSERT_EQ(0, stored.id);
+  ASSERT_EQ(100, stored.cid);
+  ASSERT_EQ("doc_100", stored.name);
+  ASSERT_FLOAT_EQ(100, stored.vec);
+  ASSERT_TRUE(Get(1, stored));
+  ASSERT_EQ(1, stored.id);
+}
+
+TEST_F(BatchIngestTest, ExistingKeysUpdated) {
+  vector<Doc> batch;
+  for (long id = 0; id < 10; ++id) batch.push_back(MakeDoc(id, id));
+  vector<int> codes;
+  ASSERT_EQ(0, AddBatch(batch, codes));
+
+  batch = {MakeDoc(10, 10), MakeDoc(5, 50), MakeDoc(11, 11)};
+  ASSERT_EQ(0, AddBatch(batch, codes));
+  ASSERT_EQ((vector<int>{0, 0, 0}), codes);
+  ASSERT_EQ(12, DocsNum());
+
+  Stored stored;
+  ASSERT_TRUE(Get(5, stored));
+  ASSERT_EQ(5, stored.id);
+  ASSERT_EQ(50, stored.cid);
+  ASSERT_FLOAT_EQ(50, stored.vec);
+  // the new keys take the next docids in the batch order
+  ASSERT_TRUE(Get(10, stored));
+  ASSERT_EQ(10, stored.id);
+  ASSERT_TRUE(Get(11, stored));
+  ASSERT_EQ(11, stored.id);
+}
+
+TEST_F(BatchIngestTest, InvalidDocReportedAtItsPosition) {
+  vector<Doc> batch = {MakeDoc(0, 0), MakeDoc(1, 1, kDimension - 1),
+                       MakeDoc(2, 2)};
+  vector<int> codes;
+  AddBatch(batch, codes);
+  ASSERT_EQ(3U, codes.size());
+  ASSERT_EQ(0, codes[0]);
+  ASSERT_NE(0, codes[1]);
+  ASSERT_EQ(0, codes[2]);
+  ASSERT_EQ(2, DocsNum());
+
+  Stored stored;
+  ASSERT_TRUE(Get(1, stored));
+  ASSERT_EQ(2, stored.id);
+}
+
+TEST_F(BatchIngestTest, DocWithMissingFieldRejected) {
+  // the engine is called directly, deserialized docs always carry every
+  // field of the schema
+  Docs docs;
+  for (long id = 0; id < 3; ++id) docs.AddDoc(MakeDoc(id, id));
+  vector<Field> &fields = docs.GetDocs()[1].TableFields();
+  for (auto it = fields.begin(); it != fields.end(); ++it) {
+    if (it->name == "name") {
+      fields.erase(it);
+      break;
+    }
+  }
+  BatchResult result(3);
+  Engine()->AddOrUpdateDocs(docs, result);
+  ASSERT_EQ(0, result.Code(0));
+  ASSERT_NE(0, result.Code(1));
+  ASSERT_EQ(0, result.Code(2));
+  ASSERT_EQ(2, DocsNum());
+
+  Stored stored;
+  ASSERT_TRUE(Get(1, stored));
+  ASSERT_EQ(2, stored.id);
+  ASSERT_EQ("doc_2", stored.name);
+}
+
+}  // namespace Test
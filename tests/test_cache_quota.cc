@@ -0,0 +1,119 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "cache_quota.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static size_t kCellSize = 1024 * 1024 / 16;  // 16 cells per M
+
+static bool LoadCell(uint32_t key, char *value, ReadFunParameter *param) {
+  return true;
+}
+
+static size_t CacheMb(BlockCache &cache) {
+  return cache.GetMaxSize() * kCellSize / (1024 * 1024);
+}
+
+class CacheQuotaTest : public ::testing::Test {
+ protected:
+  // the caches are left before they are destroyed, even if an assertion fails
+  void TearDown() override {
+    CacheQuota &quota = CacheQuota::GetInstance();
+    for (auto &cache : caches_) quota.Unregister(cache.get());
+    caches_.clear();
+    quota.SetBudget(0);
+  }
+
+  BlockCache &NewCache(int table_id, const char *name, size_t cache_mb) {
+    BlockCache *cache = new BlockCache(name, cache_mb, kCellSize, &LoadCell);
+    caches_.emplace_back(cache);
+    cache->Init();
+    CacheQuota::GetInstance().Register(table_id, cache, cache_mb);
+    return *cache;
+  }
+
+  vector<std::unique_ptr<BlockCache>> caches_;
+};
+
+TEST_F(CacheQuotaTest, UnlimitedKeepsConfiguredSizes) {
+  CacheQuota &quota = CacheQuota::GetInstance();
+  quota.SetBudget(0);
+  BlockCache &a = NewCache(1, "a", 100);
+  BlockCache &b = NewCache(2, "b", 300);
+  ASSERT_EQ(100U, CacheMb(a));
+  ASSERT_EQ(300U, CacheMb(b));
+  ASSERT_EQ(300U, quota.TableQuota(2));
+}
+
+TEST_F(CacheQuotaTest, BudgetSharedByTables) {
+  CacheQuota &quota = CacheQuota::GetInstance();
+  quota.SetBudget(400);
+  BlockCache &small = NewCache(1, "small", 100);
+  BlockCache &large = NewCache(2, "large", 600);
+  BlockCache &large_str = NewCache(2, "large_str", 200);
+
+  // the small table gets all it asks for, the large one the rest
+  ASSERT_EQ(100U, quota.TableQuota(1));
+  ASSERT_EQ(100U, CacheMb(small));
+  ASSERT_EQ(300U, quota.TableQuota(2));
+  // the caches of a table are scaled by their configured sizes
+  ASSERT_EQ(225U, CacheMb(large));
+  ASSERT_EQ(75U, CacheMb(large_str));
+
+  // a third table takes its share from the large one
+  BlockCache &third = NewCache(3, "third", 400);
+  ASSERT_EQ(100U, quota.TableQuota(1));
+  ASSERT_EQ(150U, quota.TableQuota(2));
+  ASSERT_EQ(150U, CacheMb(third));
+
+  // and gives it back when it is closed
+  quota.Unregister(&third);
+  ASSERT_EQ(300U, quota.TableQuota(2));
+  ASSERT_EQ(225U, CacheMb(large));
+}
+
+TEST_F(CacheQuotaTest, ResizeAndBudgetChanges) {
+  CacheQuota &quota = CacheQuota::GetInstance();
+  quota.SetBudget(200);
+  BlockCache &a = NewCache(1, "a", 200);
+  BlockCache &b = NewCache(2, "b", 200);
+  ASSERT_EQ(100U, CacheMb(a));
+  ASSERT_EQ(100U, CacheMb(b));
+
+  // a smaller configured size frees quota for the other table
+  quota.Resize(&a, 50);
+  ASSERT_EQ(50U, CacheMb(a));
+  ASSERT_EQ(150U, CacheMb(b));
+
+  // without a budget the configured sizes come back
+  quota.SetBudget(-1);
+  ASSERT_EQ(50U, CacheMb(a));
+  ASSERT_EQ(200U, CacheMb(b));
+}
+
+TEST_F(CacheQuotaTest, CachedBlocksFollowTheQuota) {
+  CacheQuota &quota = CacheQuota::GetInstance();
+  BlockCache &cache = NewCache(1, "cache", 4);
+  char *value = nullptr;
+  for (uint32_t key = 0; key < 64; ++key) {
+    ASSERT_TRUE(cache.SetOrGet(key, value, nullptr));
+  }
+  ASSERT_GT(cache.Count(), 48U);
+
+  quota.SetBudget(1);
+  ASSERT_LE(cache.Count(), 16U);
+}
+
+}  // namespace Test
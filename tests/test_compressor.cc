@@ -0,0 +1,149 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "compress/compressor_float16.h"
+#include "compress/compressor_sq8.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+// 21 dims cover the simd loops and their scalar tails
+const static int kDims = 21;
+const static int kNum = 50;
+
+static vector<float> RandomVectors(int n, float low, float high) {
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> dist(low, high);
+  vector<float> x((size_t)n * kDims);
+  for (float &v : x) v = dist(gen);
+  return x;
+}
+
+// encodes and decodes n vectors, it checks the lengths of the codec
+static vector<float> RoundTrip(Compressor &c, vector<float> &x) {
+  int n = x.size() / kDims;
+  vector<char> codes((size_t)n * c.GetCompressLen());
+  vector<float> y(x.size());
+  EXPECT_EQ(codes.size(), c.CompressBatch((char *)x.data(), codes.data(), n,
+                                          c.GetRawLen()));
+  EXPECT_EQ(y.size() * sizeof(float),
+            c.DecompressBatch(codes.data(), (char *)y.data(), n,
+                              c.GetCompressLen()));
+  return y;
+}
+
+TEST(Compressor, Fp16RoundTrip) {
+  CompressorFloat16 c(CompressType::Fp16);
+  c.Init(kDims);
+  ASSERT_EQ(kDims * 2U, c.GetCompressLen());
+  vector<float> x = RandomVectors(kNum, -100, 100);
+  vector<float> y = RoundTrip(c, x);
+  for (size_t i = 0; i < x.size(); i++) {
+    // 10 bits of mantissa
+    ASSERT_NEAR(x[i], y[i], fabs(x[i]) / 2048 + 1e-6) << i;
+  }
+}
+
+TEST(Compressor, Bf16RoundTrip) {
+  CompressorFloat16 c(CompressType::Bf16);
+  c.Init(kDims);
+  ASSERT_EQ(kDims * 2U, c.GetCompressLen());
+  // the float exponent is kept, the range is beyond fp16
+  vector<float> x = RandomVectors(kNum, -1e20, 1e20);
+  vector<float> y = RoundTrip(c, x);
+  for (size_t i = 0; i < x.size(); i++) {
+    // 7 bits of mantissa
+    ASSERT_NEAR(x[i], y[i], fabs(x[i]) / 256) << i;
+  }
+}
+
+TEST(Compressor, HalfSpecialValues) {
+  const float inf = numeric_limits<float>::infinity();
+  ASSERT_EQ(0x0000, float16::FloatToHalf(0.0f));
+  ASSERT_EQ(0x8000, float16::FloatToHalf(-0.0f));
+  ASSERT_EQ(0x3c00, float16::FloatToHalf(1.0f));
+  ASSERT_EQ(0x7bff, float16::FloatToHalf(65504.0f));
+  // overflow and infinity
+  ASSERT_EQ(0x7c00, float16::FloatToHalf(1e6f));
+  ASSERT_EQ(0xfc00, float16::FloatToHalf(-inf));
+  ASSERT_TRUE(isnan(float16::HalfToFloat(
+      float16::FloatToHalf(numeric_limits<float>::quiet_NaN()))));
+  // the smallest subnormal
+  ASSERT_EQ(0x0001, float16::FloatToHalf(ldexpf(1, -24)));
+  ASSERT_FLOAT_EQ(ldexpf(1, -24), float16::HalfToFloat(0x0001));
+  // rounded to nearest even
+  ASSERT_EQ(0x3c00, float16::FloatToHalf(1.0f + ldexpf(1, -11)));
+  ASSERT_EQ(0x3c02, float16::FloatToHalf(1.0f + 3 * ldexpf(1, -11)));
+
+  ASSERT_EQ(0x3f80, float16::FloatToBfloat(1.0f));
+  ASSERT_EQ(0x7f80, float16::FloatToBfloat(inf));
+  ASSERT_TRUE(isnan(float16::BfloatToFloat(
+      float16::FloatToBfloat(numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST(Compressor, HalfBatchMatchesScalar) {
+  vector<float> x = RandomVectors(kNum, -10, 10);
+  vector<uint16_t> h(x.size());
+  vector<float> y(x.size());
+  float16::EncodeHalf(x.data(), h.data(), x.size());
+  float16::DecodeHalf(h.data(), y.data(), h.size());
+  for (size_t i = 0; i < x.size(); i++) {
+    ASSERT_EQ(float16::FloatToHalf(x[i]), h[i]) << i;
+    ASSERT_EQ(float16::HalfToFloat(h[i]), y[i]) << i;
+  }
+}
+
+TEST(Compressor, Sq8RoundTrip) {
+  CompressorSQ8 c(CompressType::Sq8);
+  c.Init(kDims);
+  ASSERT_EQ(8U + kDims, c.GetCompressLen());
+  vector<float> x = RandomVectors(kNum, -3, 5);
+  vector<float> y = RoundTrip(c, x);
+  for (int v = 0; v < kNum; v++) {
+    const float *xv = x.data() + v * kDims;
+    float min = *std::min_element(xv, xv + kDims);
+    float max = *std::max_element(xv, xv + kDims);
+    // half a step of the range of the vector
+    float step = (max - min) / 255;
+    for (int i = 0; i < kDims; i++) {
+      ASSERT_NEAR(xv[i], y[v * kDims + i], step / 2 + 1e-5) << v << " " << i;
+    }
+  }
+}
+
+TEST(Compressor, Sq8SingleVector) {
+  CompressorSQ8 c(CompressType::Sq8);
+  c.Init(kDims);
+  // a constant vector has no range
+  vector<float> x(kDims, 1.5f);
+  vector<char> code(c.GetCompressLen());
+  vector<float> y(kDims);
+  c.Compress((char *)x.data(), code.data(), 0);
+  c.Decompress(code.data(), (char *)y.data(), 0);
+  for (int i = 0; i < kDims; i++) ASSERT_FLOAT_EQ(1.5f, y[i]);
+
+  // a vector is decoded on its own whatever its neighbours
+  vector<float> batch = RandomVectors(3, -1, 1);
+  vector<char> codes(3 * c.GetCompressLen());
+  c.CompressBatch((char *)batch.data(), codes.data(), 3, 0);
+  c.Decompress(codes.data() + c.GetCompressLen(), (char *)y.data(), 0);
+  vector<float> all(batch.size());
+  c.DecompressBatch(codes.data(), (char *)all.data(), 3, 0);
+  for (int i = 0; i < kDims; i++) ASSERT_EQ(all[kDims + i], y[i]);
+}
+
+}  // namespace Test
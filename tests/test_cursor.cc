@@ -0,0 +1,151 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "c_api/api_data/gamma_request.h"
+#include "c_api/api_data/gamma_response.h"
+#include "test_engine.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDocNum = 100;
+
+class CursorTest : public EngineTest {
+ protected:
+  CursorTest() : EngineTest("cursor") {
+    has_cid_ = true;
+    indexing_size_ = kDocNum * 10;
+  }
+
+  void SetUp() override {
+    EngineTest::SetUp();
+    if (HasFatalFailure()) return;
+    for (long id = 0; id < kDocNum; ++id) ASSERT_EQ(0, AddDoc(id));
+  }
+
+  // the cid of a doc is its id % 10
+  int AddDoc(long id) {
+    Doc doc = MakeDoc(id, id % 10, id);
+    return EngineTest::AddDoc(doc);
+  }
+
+  int Open(Request &request, long &cursor_id) {
+    string field = "_id";
+    request.AddField(field);
+    char *request_str = nullptr;
+    int len = 0;
+    request.Serialize(&request_str, &len);
+    int ret = OpenCursor(engine_, request_str, len, &cursor_id);
+    free(request_str);
+    return ret;
+  }
+
+  // ids of the next page, the return of CursorNext
+  int Next(long cursor_id, int page_size, vector<long> &ids) {
+    char *response_str = nullptr;
+    int len = 0;
+    int ret = CursorNext(engine_, cursor_id, page_size, &response_str, &len);
+    if (ret <= 0) {
+      free(response_str);
+      return ret;
+    }
+    Response response;
+    response.Deserialize(response_str, len);
+    free(response_str);
+    for (SearchResult &result : response.Results()) {
+      for (ResultItem &item : result.result_items) {
+        for (size_t i = 0; i < item.names.size(); ++i) {
+          if (item.names[i] != "_id") continue;
+          long id;
+          memcpy(&id, item.values[i].data(), sizeof(id));
+          ids.push_back(id);
+        }
+      }
+    }
+    return ret;
+  }
+};
+
+TEST_F(CursorTest, PagesInDocidOrder) {
+  Request request;
+  long cursor_id = -1;
+  ASSERT_EQ(0, Open(request, cursor_id));
+  vector<long> ids;
+  vector<int> pages;
+  int n = 0;
+  while ((n = Next(cursor_id, 30, ids)) > 0) pages.push_back(n);
+  ASSERT_EQ(0, n);
+  ASSERT_EQ((vector<int>{30, 30, 30, 10}), pages);
+  ASSERT_EQ((size_t)kDocNum, ids.size());
+  for (long id = 0; id < kDocNum; ++id) ASSERT_EQ(id, ids[id]);
+
+  ASSERT_EQ(0, CloseCursor(engine_, cursor_id));
+  ASSERT_LT(Next(cursor_id, 30, ids), 0);
+}
+
+TEST_F(CursorTest, FilteredAndDeletedDocsSkipped) {
+  Request request;
+  RangeFilter filter;
+  filter.field = "cid";
+  int cid = 3;
+  filter.lower_value = string((char *)&cid, sizeof(cid));
+  filter.upper_value = string((char *)&cid, sizeof(cid));
+  filter.include_lower = true;
+  filter.include_upper = true;
+  request.AddRangeFilter(filter);
+  long cursor_id = -1;
+  ASSERT_EQ(0, Open(request, cursor_id));
+
+  long deleted = 13;
+  ASSERT_EQ(0, DeleteDoc(engine_, (const char *)&deleted, sizeof(deleted)));
+  // docs added after the cursor is opened are not returned
+  ASSERT_EQ(0, AddDoc(kDocNum + 3));
+
+  vector<long> ids;
+  ASSERT_EQ(4, Next(cursor_id, 4, ids));
+  ASSERT_EQ(5, Next(cursor_id, 100, ids));
+  ASSERT_EQ(0, Next(cursor_id, 100, ids));
+  ASSERT_EQ((vector<long>{3, 23, 33, 43, 53, 63, 73, 83, 93}), ids);
+  ASSERT_EQ(0, CloseCursor(engine_, cursor_id));
+}
+
+TEST_F(CursorTest, PagesAreAdmitted) {
+  Request request;
+  request.SetTimeoutMs(-1);  // rejected at once if there is no room
+  long cursor_id = -1;
+  ASSERT_EQ(0, Open(request, cursor_id));
+
+  // another table takes the whole capacity
+  RequestConcurrentController &controller =
+      RequestConcurrentController::GetInstance();
+  long capacity = 0;
+  int queue_size = 0, timeout_ms = 0;
+  controller.GetLimits(capacity, queue_size, timeout_ms);
+  int table_id = controller.RegisterTable();
+  long cost = capacity;
+  ASSERT_TRUE(controller.Acquire(cost, SearchPriority::Normal, -1, table_id));
+
+  vector<long> ids;
+  ASSERT_LT(Next(cursor_id, 10, ids), 0);
+  long cursor_id2 = -1;
+  ASSERT_NE(0, Open(request, cursor_id2));
+
+  controller.Release(cost, table_id);
+  controller.UnregisterTable(table_id);
+  ASSERT_EQ(10, Next(cursor_id, 10, ids));
+  ASSERT_EQ(0, ids[0]);
+  ASSERT_EQ(0, CloseCursor(engine_, cursor_id));
+}
+
+}  // namespace Test
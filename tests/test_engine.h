@@ -0,0 +1,239 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "c_api/api_data/gamma_config.h"
+#include "c_api/api_data/gamma_doc.h"
+#include "c_api/api_data/gamma_engine_status.h"
+#include "c_api/api_data/gamma_request.h"
+#include "c_api/api_data/gamma_response.h"
+#include "c_api/api_data/gamma_table.h"
+#include "gamma_api.h"
+#include "gamma_engine.h"
+#include "utils.h"
+
+namespace Test {
+
+const static int kDimension = 8;
+
+/** engine in a fresh directory with one table: _id, the optional int cid
+ * (range indexed) and string name, and the float vector vec, FLAT unless the
+ * test sets another retrieval type. The constructor of a test sets the
+ * schema, SetUp creates the table.
+ */
+class EngineTest : public ::testing::Test {
+ protected:
+  explicit EngineTest(const std::string &name)
+      : name_(name),
+        has_cid_(false),
+        has_name_(false),
+        store_type_("MemoryOnly"),
+        store_param_("{\"cache_size\": 16}"),
+        retrieval_type_("FLAT"),
+        retrieval_param_("{\"metric_type\" : \"InnerProduct\"}"),
+        indexing_size_(100000),
+        engine_(nullptr) {}
+
+  void SetUp() override {
+    path_ = "./test_" + name_ + "_files";
+    utils::remove_dir(path_.c_str());
+    engine_ = OpenEngine();
+    ASSERT_NE(nullptr, engine_);
+    ASSERT_EQ(0, CreateTable());
+  }
+
+  void TearDown() override {
+    Close(engine_);
+    utils::remove_dir(path_.c_str());
+    utils::remove_dir((path_ + "_logs").c_str());
+  }
+
+  // an engine on path_, the files of a closed one are loaded by Load
+  void *OpenEngine() {
+    tig_gamma::Config config;
+    std::string log_dir = path_ + "_logs";
+    config.SetPath(path_);
+    config.SetLogDir(log_dir);
+    char *config_str = nullptr;
+    int len = 0;
+    config.Serialize(&config_str, &len);
+    void *engine = Init(config_str, len);
+    free(config_str);
+    return engine;
+  }
+
+  int CreateTable() {
+    tig_gamma::TableInfo table;
+    table.SetName(name_);
+    table.SetIndexingSize(indexing_size_);
+    table.SetRetrievalType(retrieval_type_);
+    table.SetRetrievalParam(retrieval_param_);
+    AddFieldInfo(table, "_id", tig_gamma::DataType::LONG, false);
+    if (has_cid_) AddFieldInfo(table, "cid", tig_gamma::DataType::INT, true);
+    if (has_name_) {
+      AddFieldInfo(table, "name", tig_gamma::DataType::STRING, false);
+    }
+
+    tig_gamma::VectorInfo vector_info;
+    vector_info.name = "vec";
+    vector_info.data_type = tig_gamma::DataType::FLOAT;
+    vector_info.is_index = true;
+    vector_info.dimension = kDimension;
+    vector_info.store_type = store_type_;
+    vector_info.store_param = store_param_;
+    vector_info.has_source = false;
+    table.AddVectorInfo(vector_info);
+
+    char *table_str = nullptr;
+    int len = 0;
+    table.Serialize(&table_str, &len);
+    int ret = ::CreateTable(engine_, table_str, len);
+    free(table_str);
+    return ret;
+  }
+
+  /** a doc with the fields of the schema, its name is "doc_<cid>" and every
+   * dimension of its vector is value. The key is set for the docs passed to
+   * the engine without serializing them.
+   */
+  tig_gamma::Doc MakeDoc(long id, int cid, float value,
+                         int dimension = kDimension) {
+    tig_gamma::Doc doc;
+    std::string key((char *)&id, sizeof(id));
+    doc.Key() = key;
+    AddDocField(doc, "_id", tig_gamma::DataType::LONG, key);
+    if (has_cid_) {
+      AddDocField(doc, "cid", tig_gamma::DataType::INT,
+                  std::string((char *)&cid, sizeof(cid)));
+    }
+    if (has_name_) {
+      AddDocField(doc, "name", tig_gamma::DataType::STRING,
+                  "doc_" + std::to_string(cid));
+    }
+    std::vector<float> vec(dimension, value);
+    AddDocField(doc, "vec", tig_gamma::DataType::VECTOR,
+                std::string((char *)vec.data(), vec.size() * sizeof(float)));
+    return doc;
+  }
+
+  int AddDoc(tig_gamma::Doc &doc) {
+    char *doc_str = nullptr;
+    int len = 0;
+    doc.Serialize(&doc_str, &len);
+    int ret = AddOrUpdateDoc(engine_, doc_str, len);
+    free(doc_str);
+    return ret;
+  }
+
+  /** a request for the topn docs nearest to a vector of value in every
+   * dimension, the _id of the docs is returned
+   */
+  void MakeRequest(float value, int topn, tig_gamma::Request &request) {
+    std::vector<float> vec(kDimension, value);
+    tig_gamma::VectorQuery vector_query;
+    vector_query.name = "vec";
+    vector_query.value =
+        std::string((char *)vec.data(), vec.size() * sizeof(float));
+    vector_query.min_score = -10000;
+    vector_query.max_score = 10000;
+    vector_query.boost = 1;
+    vector_query.has_boost = 0;
+    request.AddVectorQuery(vector_query);
+    request.SetReqNum(1);
+    request.SetTopN(topn);
+    request.SetBruteForceSearch(0);
+    request.SetHasRank(true);
+    request.SetMultiVectorRank(0);
+    request.SetL2Sqrt(false);
+    std::string retrieval_params = "{\"metric_type\" : \"InnerProduct\"}";
+    request.SetRetrievalParams(retrieval_params);
+    std::string field = "_id";
+    request.AddField(field);
+  }
+
+  int Search(tig_gamma::Request &request, tig_gamma::Response &response) {
+    char *request_str = nullptr, *response_str = nullptr;
+    int request_len = 0, response_len = 0;
+    request.Serialize(&request_str, &request_len);
+    int ret = ::Search(engine_, request_str, request_len, &response_str,
+                       &response_len);
+    free(request_str);
+    if (ret == 0) response.Deserialize(response_str, response_len);
+    free(response_str);
+    return ret;
+  }
+
+  // the _id of the docs of a result in their order
+  static std::vector<long> Ids(tig_gamma::SearchResult &result) {
+    std::vector<long> ids;
+    for (tig_gamma::ResultItem &item : result.result_items) {
+      for (size_t i = 0; i < item.names.size(); ++i) {
+        if (item.names[i] != "_id") continue;
+        long id;
+        memcpy(&id, item.values[i].data(), sizeof(id));
+        ids.push_back(id);
+      }
+    }
+    return ids;
+  }
+
+  int MinIndexedNum() {
+    char *status_str = nullptr;
+    int len = 0;
+    GetEngineStatus(engine_, &status_str, &len);
+    tig_gamma::EngineStatus status;
+    status.Deserialize(status_str, len);
+    free(status_str);
+    return status.MinIndexedNum();
+  }
+
+  tig_gamma::GammaEngine *Engine() {
+    return static_cast<tig_gamma::GammaEngine *>(engine_);
+  }
+
+  std::string name_;  // of the table and the test directory
+  bool has_cid_;
+  bool has_name_;
+  std::string store_type_;
+  std::string store_param_;
+  std::string retrieval_type_;
+  std::string retrieval_param_;
+  int indexing_size_;
+
+  std::string path_;
+  void *engine_;
+
+ private:
+  static void AddFieldInfo(tig_gamma::TableInfo &table,
+                           const std::string &name,
+                           tig_gamma::DataType data_type, bool is_index) {
+    tig_gamma::FieldInfo info;
+    info.name = name;
+    info.data_type = data_type;
+    info.is_index = is_index;
+    table.AddField(info);
+  }
+
+  static void AddDocField(tig_gamma::Doc &doc, const std::string &name,
+                          tig_gamma::DataType data_type,
+                          const std::string &value) {
+    tig_gamma::Field field;
+    field.name = name;
+    field.datatype = data_type;
+    field.value = value;
+    doc.AddField(std::move(field));
+  }
+};
+
+}  // namespace Test
@@ -0,0 +1,64 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "test_engine.h"
+#include "utils.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDocNum = 100;
+
+class IndexingTest : public EngineTest {
+ protected:
+  IndexingTest() : EngineTest("indexing") {
+    retrieval_type_ = "HNSW";
+    retrieval_param_ =
+        "{\"nlinks\" : 16, \"metric_type\" : \"InnerProduct\", "
+        "\"efConstruction\" : 40}";
+    indexing_size_ = kDocNum;
+  }
+
+  int AddDoc(long id) {
+    Doc doc = MakeDoc(id, 0, id * 0.01f);
+    return EngineTest::AddDoc(doc);
+  }
+
+  // the ms it takes the index to cover num docs, -1 if it doesn't in 10s
+  double WaitIndexed(int num) {
+    double start = utils::getmillisecs();
+    for (int i = 0; i < 1000; ++i) {
+      if (MinIndexedNum() >= num) return utils::getmillisecs() - start;
+      usleep(10 * 1000);
+    }
+    return -1;
+  }
+};
+
+TEST_F(IndexingTest, WritersWakeTheIdleIndexer) {
+  for (long id = 0; id < kDocNum; ++id) ASSERT_EQ(0, AddDoc(id));
+  ASSERT_GE(WaitIndexed(kDocNum), 0);
+
+  // the indexing thread waits kIndexingIdleWaitS for writes, each round of
+  // writes wakes it well before that
+  for (int round = 1; round <= 3; ++round) {
+    usleep(200 * 1000);
+    for (long id = kDocNum * round; id < kDocNum * (round + 1); ++id) {
+      ASSERT_EQ(0, AddDoc(id));
+    }
+    double ms = WaitIndexed(kDocNum * (round + 1));
+    ASSERT_GE(ms, 0);
+    ASSERT_LT(ms, kIndexingIdleWaitS * 1000 / 10);
+  }
+}
+
+}  // namespace Test
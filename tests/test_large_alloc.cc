@@ -0,0 +1,192 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <omp.h>
+#include <string.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "large_alloc.h"
+
+namespace Test {
+
+using namespace std;
+
+TEST(LargeAlloc, SmallAndHugeSizes) {
+  char *small = (char *)large_alloc::Alloc(100);
+  ASSERT_NE(nullptr, small);
+  memset(small, 1, 100);
+  small = (char *)large_alloc::Realloc(small, 100, 200);
+  ASSERT_EQ(1, small[99]);
+  large_alloc::Free(small, 200);
+
+  size_t size = large_alloc::kLargeAllocBytes * 2;
+  char *large = (char *)large_alloc::Alloc(size);
+  ASSERT_NE(nullptr, large);
+  memset(large, 2, size);
+  large_alloc::Free(large, size);
+}
+
+TEST(LargeAlloc, ArenaBlocksAreReused) {
+  size_t size = 5000;  // the 6K class
+  void *p = large_alloc::Alloc(size);
+  ASSERT_NE(nullptr, p);
+  memset(p, 3, size);
+  large_alloc::Free(p, size);
+  void *q = large_alloc::Alloc(size + 1000);
+  ASSERT_EQ(p, q);
+  large_alloc::Free(q, size + 1000);
+
+  large_alloc::MemStats stats;
+  large_alloc::GetMemStats(stats);
+  // the untouched blocks of the slabs are not counted
+  ASSERT_GE(stats.arena_bytes, 6UL << 10);
+  ASSERT_GE(stats.arena_free_bytes, 6UL << 10);
+}
+
+TEST(LargeAlloc, ReallocInClassKeepsBlock) {
+  void *p = large_alloc::Alloc(8 * 1024);
+  memset(p, 4, 8 * 1024);
+  // 8K and 7K are in the 8K class
+  ASSERT_EQ(p, large_alloc::Realloc(p, 8 * 1024, 7 * 1024));
+  char *q = (char *)large_alloc::Realloc(p, 7 * 1024, 64 * 1024);
+  ASSERT_NE(p, (void *)q);
+  ASSERT_EQ(4, q[7 * 1024 - 1]);
+  // from the arenas back to malloc
+  char *r = (char *)large_alloc::Realloc(q, 64 * 1024, 1024);
+  ASSERT_EQ(4, r[1023]);
+  large_alloc::Free(r, 1024);
+}
+
+TEST(LargeAlloc, BlocksDontOverlap) {
+  vector<char *> blocks;
+  set<char *> seen;
+  size_t size = 48 * 1024;
+  for (int i = 0; i < 200; i++) {  // more than one slab
+    char *p = (char *)large_alloc::Alloc(size);
+    ASSERT_NE(nullptr, p);
+    ASSERT_TRUE(seen.insert(p).second);
+    memset(p, i, size);
+    blocks.push_back(p);
+  }
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ((char)i, blocks[i][0]);
+    ASSERT_EQ((char)i, blocks[i][size - 1]);
+    large_alloc::Free(blocks[i], size);
+  }
+}
+
+TEST(LargeAlloc, ReclaimReturnsFreeBlocks) {
+  vector<void *> blocks;
+  size_t size = 512 * 1024;
+  for (int i = 0; i < 16; i++) {
+    void *p = large_alloc::Alloc(size);
+    memset(p, 5, size);
+    blocks.push_back(p);
+  }
+  for (void *p : blocks) large_alloc::Free(p, size);
+
+  large_alloc::MemStats before;
+  large_alloc::GetMemStats(before);
+  ASSERT_GT(large_alloc::Reclaim(0), 0UL);
+  large_alloc::MemStats after;
+  large_alloc::GetMemStats(after);
+  ASSERT_LT(after.arena_bytes, before.arena_bytes);
+  ASSERT_EQ(before.reclaims + 1, after.reclaims);
+
+  // the returned blocks are handed out again
+  void *p = large_alloc::Alloc(size);
+  ASSERT_NE(nullptr, p);
+  memset(p, 6, size);
+  large_alloc::Free(p, size);
+}
+
+TEST(LargeAlloc, ConcurrentAllocFree) {
+  vector<thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 2000; i++) {
+        size_t size = 4096 + ((i * 7919 + t) % 256) * 1024;
+        char *p = (char *)large_alloc::Alloc(size);
+        p[0] = (char)t;
+        p[size - 1] = (char)t;
+        large_alloc::Free(p, size);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+}
+
+#ifndef NDEBUG
+TEST(LargeAllocDeathTest, FreeChecksSizeClass) {
+  void *p = large_alloc::Alloc(8 * 1024);
+  ASSERT_DEATH(large_alloc::Free(p, 100 * 1024), "");
+  ASSERT_DEATH(large_alloc::Free(p, 100), "");
+  large_alloc::Free(p, 8 * 1024);
+
+  void *small = large_alloc::Alloc(100);
+  ASSERT_DEATH(large_alloc::Free(small, 8 * 1024), "");
+  large_alloc::Free(small, 100);
+}
+#endif
+
+TEST(LargeAlloc, MallocThresholdsOnce) {
+  large_alloc::SetMallocThresholds();
+  large_alloc::SetMallocThresholds();
+  void *p = large_alloc::Alloc(1 << 20);
+  ASSERT_NE(nullptr, p);
+  large_alloc::Free(p, 1 << 20);
+}
+
+TEST(LargeAlloc, ScopePinRestoresAffinity) {
+  large_alloc::SetPolicy(large_alloc::HugePage::None,
+                         large_alloc::NumaPolicy::Bind, 0);
+  std::thread t([]() {
+    cpu_set_t before, after;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(before), &before));
+    { large_alloc::ScopePin pin; }
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(after), &after));
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+  });
+  t.join();
+  large_alloc::SetPolicy(large_alloc::HugePage::None,
+                         large_alloc::NumaPolicy::Default, 0);
+}
+
+TEST(LargeAlloc, PinOmpThreadsPinsWorkersOnly) {
+  large_alloc::SetPolicy(large_alloc::HugePage::None,
+                         large_alloc::NumaPolicy::Bind, 0);
+  std::thread t([]() {
+    cpu_set_t before, bound;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(before), &before));
+    {
+      large_alloc::ScopePin pin;
+      ASSERT_EQ(0, sched_getaffinity(0, sizeof(bound), &bound));
+    }
+    large_alloc::PinOmpThreads();
+    std::atomic<int> unpinned(0);
+#pragma omp parallel
+    {
+      cpu_set_t set;
+      sched_getaffinity(0, sizeof(set), &set);
+      if (omp_get_thread_num() != 0 && !CPU_EQUAL(&set, &bound)) unpinned++;
+    }
+    ASSERT_EQ(0, unpinned);
+    cpu_set_t after;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(after), &after));
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+  });
+  t.join();
+  large_alloc::SetPolicy(large_alloc::HugePage::None,
+                         large_alloc::NumaPolicy::Default, 0);
+}
+
+}  // namespace Test
@@ -0,0 +1,179 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitmap.h"
+
+namespace Test {
+
+using namespace std;
+
+const static int kPageBits = 4096 * 8;
+const static int kMaxDocs = 64 * kPageBits;  // 256K of address space
+
+class LazyBitmapTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "./test_lazy_bitmap.dump";
+    unlink(path_.c_str());
+  }
+
+  void TearDown() override { unlink(path_.c_str()); }
+
+  string path_;
+};
+
+TEST_F(LazyBitmapTest, CommitsTheSetPages) {
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  ASSERT_EQ(0, bm.MemBytes());
+  ASSERT_FALSE(bm.Test(kMaxDocs - 1));
+
+  bm.Set(1);
+  bm.Set(2);
+  bm.Set(10 * kPageBits + 3);
+  ASSERT_EQ(2 * 4096, bm.MemBytes());
+  ASSERT_TRUE(bm.Test(10 * kPageBits + 3));
+  ASSERT_TRUE(bitmap::test(bm.Data(), 2));
+
+  // unsetting a bit of an untouched page commits nothing
+  bm.Unset(20 * kPageBits);
+  ASSERT_EQ(2 * 4096, bm.MemBytes());
+  bm.Unset(2);
+  ASSERT_FALSE(bm.Test(2));
+}
+
+TEST_F(LazyBitmapTest, CountBelowSize) {
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  vector<int> ids = {0, 7, 8, 13, kPageBits - 1, kPageBits, 5 * kPageBits + 9};
+  for (int id : ids) bm.Set(id);
+
+  ASSERT_EQ(0, bm.Count(0));
+  ASSERT_EQ(1, bm.Count(1));
+  ASSERT_EQ(1, bm.Count(7));
+  ASSERT_EQ(2, bm.Count(8));
+  ASSERT_EQ(3, bm.Count(9));
+  ASSERT_EQ(4, bm.Count(14));
+  ASSERT_EQ(5, bm.Count(kPageBits));
+  ASSERT_EQ(6, bm.Count(kPageBits + 1));
+  ASSERT_EQ(6, bm.Count(5 * kPageBits + 9));
+  ASSERT_EQ(7, bm.Count(kMaxDocs));
+}
+
+TEST_F(LazyBitmapTest, DumpAndLoad) {
+  int max_docid = 40 * kPageBits + 5;
+  {
+    bitmap::LazyBitmap bm;
+    ASSERT_EQ(0, bm.Init(kMaxDocs));
+    bm.Set(3);
+    bm.Set(30 * kPageBits + 1);
+    bm.Set(max_docid - 1);
+    // above the dumped size
+    bm.Set(50 * kPageBits);
+    ASSERT_EQ(0, bm.Dump(path_, max_docid));
+  }
+
+  // the untouched pages are holes of the file
+  struct stat st;
+  ASSERT_EQ(0, stat(path_.c_str(), &st));
+  ASSERT_EQ((max_docid >> 3) + 1, st.st_size);
+  ASSERT_LT(st.st_blocks * 512, st.st_size / 4);
+
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  ASSERT_EQ(0, bm.Load(path_));
+  ASSERT_TRUE(bm.Test(3));
+  ASSERT_TRUE(bm.Test(30 * kPageBits + 1));
+  ASSERT_TRUE(bm.Test(max_docid - 1));
+  ASSERT_FALSE(bm.Test(50 * kPageBits));
+  ASSERT_EQ(3, bm.Count(max_docid));
+  ASSERT_EQ(3 * 4096, bm.MemBytes());
+}
+
+TEST_F(LazyBitmapTest, LoadSkipsZeroPagesOfFullDumps) {
+  // a dump of the former bitmap writes every byte
+  vector<char> bytes((kMaxDocs >> 3) + 1, 0);
+  bitmap::set(bytes.data(), 12 * kPageBits + 6);
+  int fd = open(path_.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ((ssize_t)bytes.size(), write(fd, bytes.data(), bytes.size()));
+  close(fd);
+
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  ASSERT_EQ(0, bm.Load(path_));
+  ASSERT_EQ(4096, bm.MemBytes());
+  ASSERT_TRUE(bm.Test(12 * kPageBits + 6));
+  ASSERT_EQ(1, bm.Count(kMaxDocs));
+}
+
+TEST_F(LazyBitmapTest, DumpWritesDirtyPages) {
+  int max_docid = 40 * kPageBits;
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  bm.Set(3);
+  bm.Set(10 * kPageBits + 1);
+  ASSERT_EQ(0, bm.Dump(path_, max_docid));
+
+  // a clean page of the file is left as it is by the next dump
+  char zero = 0;
+  int fd = open(path_.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(1, pwrite(fd, &zero, 1, 10 * 4096));
+  close(fd);
+  bm.Set(20 * kPageBits + 2);
+  bm.Unset(3);
+  ASSERT_EQ(0, bm.Dump(path_, max_docid));
+
+  bitmap::LazyBitmap loaded;
+  ASSERT_EQ(0, loaded.Init(kMaxDocs));
+  ASSERT_EQ(0, loaded.Load(path_));
+  ASSERT_FALSE(loaded.Test(3));
+  ASSERT_FALSE(loaded.Test(10 * kPageBits + 1));
+  ASSERT_TRUE(loaded.Test(20 * kPageBits + 2));
+}
+
+TEST_F(LazyBitmapTest, SetWhileDumping) {
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (int id = 0; id < kMaxDocs; id += 997) bm.Set(id);
+    done = true;
+  });
+  while (not done) {
+    ASSERT_EQ(0, bm.Dump(path_, kMaxDocs));
+    long count = bm.Count(kMaxDocs);
+    ASSERT_LE(count, bm.MemBytes() * 8);
+  }
+  writer.join();
+  ASSERT_EQ(0, bm.Dump(path_, kMaxDocs));
+
+  bitmap::LazyBitmap loaded;
+  ASSERT_EQ(0, loaded.Init(kMaxDocs));
+  ASSERT_EQ(0, loaded.Load(path_));
+  ASSERT_EQ(bm.Count(kMaxDocs), loaded.Count(kMaxDocs));
+  ASSERT_EQ((kMaxDocs + 996) / 997, loaded.Count(kMaxDocs));
+}
+
+TEST_F(LazyBitmapTest, LoadMissingFile) {
+  bitmap::LazyBitmap bm;
+  ASSERT_EQ(0, bm.Init(kMaxDocs));
+  ASSERT_NE(0, bm.Load(path_));
+}
+
+}  // namespace Test
@@ -0,0 +1,187 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "lru_cache.h"
+
+namespace Test {
+
+using namespace std;
+
+const static size_t kCellSize = 1024 * 1024 / 64;  // 64 cells of 1MB cache
+
+typedef LRUCache<uint32_t, std::atomic<int> *> TestCache;
+
+// fills the cell with the key, counts the loads
+static bool LoadCell(uint32_t key, char *value, std::atomic<int> *loads) {
+  memset(value, 0, kCellSize);
+  memcpy(value, &key, sizeof(key));
+  if (loads) loads->fetch_add(1);
+  return true;
+}
+
+static uint32_t CellKey(const char *value) {
+  uint32_t key;
+  memcpy(&key, value, sizeof(key));
+  return key;
+}
+
+TEST(LRUCache, SetOrGetLoadsOnce) {
+  TestCache cache("test", 1, kCellSize, &LoadCell);
+  cache.Init();
+  std::atomic<int> loads(0);
+  char *value = nullptr;
+  ASSERT_TRUE(cache.SetOrGet(7, value, &loads));
+  ASSERT_EQ(7U, CellKey(value));
+  ASSERT_TRUE(cache.SetOrGet(7, value, &loads));
+  ASSERT_EQ(1, loads);
+  ASSERT_EQ(1U, cache.GetSetHits());
+
+  ASSERT_TRUE(cache.Get(7, value));
+  ASSERT_EQ(7U, CellKey(value));
+  ASSERT_FALSE(cache.Get(8, value));
+  ASSERT_EQ(1U, cache.GetHits());
+  ASSERT_EQ(1U, cache.GetMisses());
+  ASSERT_TRUE(cache.Contains(7));
+  ASSERT_FALSE(cache.Contains(8));
+}
+
+TEST(LRUCache, EvictsAtCapacity) {
+  TestCache cache("test", 1, kCellSize, &LoadCell);
+  cache.Init();
+  size_t max_size = cache.GetMaxSize();
+  char *value = nullptr;
+  for (uint32_t key = 0; key < max_size * 4; ++key) {
+    ASSERT_TRUE(cache.SetOrGet(key, value, nullptr));
+    ASSERT_EQ(key, CellKey(value));
+    ASSERT_LE(cache.Count(), max_size);
+  }
+  ASSERT_EQ(max_size, cache.Count());
+  ASSERT_GE(cache.GetEvictions(), max_size * 3);
+
+  cache.Evict(max_size * 4 - 1);
+  ASSERT_FALSE(cache.Contains(max_size * 4 - 1));
+  ASSERT_EQ(max_size - 1, cache.Count());
+}
+
+TEST(LRUCache, ReferencedCellsSurvive) {
+  // 32 cells make a single shard
+  TestCache cache("test", 1, kCellSize * 2, &LoadCell);
+  cache.Init();
+  size_t max_size = cache.GetMaxSize();
+  char *value = nullptr;
+  for (uint32_t key = 0; key < max_size; ++key) {
+    cache.SetOrGet(key, value, nullptr);
+  }
+  // one pass of the hand clears the bits of the loaded cells
+  cache.SetOrGet(max_size, value, nullptr);
+  for (uint32_t key = 0; key <= max_size; ++key) {
+    if (key % 2 == 0) cache.Get(key, value);
+  }
+  for (uint32_t key = max_size + 1; key < max_size + max_size / 4; ++key) {
+    cache.SetOrGet(key, value, nullptr);
+  }
+  size_t hot = 0;
+  for (uint32_t key = 0; key < max_size; key += 2) {
+    if (cache.Contains(key)) ++hot;
+  }
+  // the second chance keeps most of the referenced cells
+  ASSERT_GT(hot, max_size / 4);
+}
+
+TEST(LRUCache, PinnedValueOutlivesEviction) {
+  TestCache cache("test", 1, kCellSize, &LoadCell);
+  cache.Init();
+  char *value = nullptr;
+  void *handle = nullptr;
+  ASSERT_TRUE(cache.SetOrGet(1, value, nullptr));
+  ASSERT_TRUE(cache.Pin(1, value, handle));
+  cache.Evict(1);
+  ASSERT_FALSE(cache.Contains(1));
+  // the buffer is not given back to the pool until it is unpinned
+  char *other = nullptr;
+  ASSERT_TRUE(cache.SetOrGet(2, other, nullptr));
+  ASSERT_NE(value, other);
+  ASSERT_EQ(1U, CellKey(value));
+  cache.Unpin(handle);
+
+  // a replaced value stays pinned as well
+  ASSERT_TRUE(cache.Pin(2, value, handle));
+  char *buffer = new char[kCellSize];
+  LoadCell(3, buffer, nullptr);
+  cache.Set(2, buffer);
+  ASSERT_EQ(2U, CellKey(value));
+  ASSERT_TRUE(cache.Get(2, other));
+  ASSERT_EQ(3U, CellKey(other));
+  cache.Unpin(handle);
+}
+
+TEST(LRUCache, AlterCacheSize) {
+  TestCache cache("test", 2, kCellSize, &LoadCell);
+  cache.Init();
+  char *value = nullptr;
+  for (uint32_t key = 0; key < 128; ++key) {
+    cache.SetOrGet(key, value, nullptr);
+  }
+  // keys are not spread evenly over the shards
+  size_t count = cache.Count();
+  ASSERT_GT(count, 96U);
+  cache.AlterCacheSize(1);
+  ASSERT_EQ(64U, cache.GetMaxSize());
+  ASSERT_LE(cache.Count(), 64U);
+  cache.AlterCacheSize(4);
+  for (uint32_t key = 0; key < 256; ++key) {
+    cache.SetOrGet(key, value, nullptr);
+  }
+  ASSERT_GT(cache.Count(), count);
+}
+
+// readers pin and check cells while writers load, evict and resize
+TEST(LRUCache, ConcurrentPinAndEvict) {
+  TestCache cache("test", 1, kCellSize, &LoadCell);
+  cache.Init();
+  const uint32_t key_num = 256;
+  std::atomic<bool> stop(false);
+  std::atomic<long> errors(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      uint32_t key = t;
+      for (int i = 0; i < 200000; ++i) {
+        key = (key * 7 + 13) % key_num;
+        char *value = nullptr;
+        void *handle = nullptr;
+        if (cache.Pin(key, value, handle)) {
+          if (CellKey(value) != key) errors.fetch_add(1);
+          cache.Unpin(handle);
+        } else {
+          // the value is not pinned, it may be evicted at once
+          cache.SetOrGet(key, value, nullptr);
+        }
+      }
+    });
+  }
+  std::thread writer([&]() {
+    for (int i = 0; not stop; ++i) {
+      cache.Evict(i % key_num);
+      if (i % 500 == 0) cache.AlterCacheSize(i % 1000 == 0 ? 1 : 2);
+    }
+  });
+  for (auto &thread : threads) thread.join();
+  stop = true;
+  writer.join();
+  ASSERT_EQ(0, errors);
+}
+
+}  // namespace Test
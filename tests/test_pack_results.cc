@@ -0,0 +1,118 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <omp.h>
+
+#include <string>
+#include <vector>
+
+#include "test_engine.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDocNum = 200;
+const static int kReqNum = 8;
+const static int kTopN = 20;
+
+class PackResultsTest : public EngineTest {
+ protected:
+  PackResultsTest()
+      : EngineTest("pack_results"),
+        controller_(RequestConcurrentController::GetInstance()) {
+    has_cid_ = true;
+    has_name_ = true;
+  }
+
+  void SetUp() override {
+    EngineTest::SetUp();
+    if (HasFatalFailure()) return;
+    for (long id = 0; id < kDocNum; ++id) {
+      Doc doc = MakeDoc(id, id % 10, id * 0.01f);
+      ASSERT_EQ(0, AddDoc(doc));
+    }
+  }
+
+  // kReqNum queries returning every field of the schema
+  int SearchAll(Response &response) {
+    Request request;
+    MakeRequest(0, kTopN, request);
+    string value;
+    for (int i = 0; i < kReqNum; ++i) {
+      // no query is zero, the scores of its hits would tie
+      vector<float> vec(kDimension, i - kReqNum / 2 + 0.5f);
+      value.append((char *)vec.data(), vec.size() * sizeof(float));
+    }
+    request.VecFields()[0].value = value;
+    request.SetReqNum(kReqNum);
+    request.SetBruteForceSearch(1);
+    for (string field : {"cid", "name", "vec"}) request.AddField(field);
+    return Search(request, response);
+  }
+
+  static void ExpectSame(ResultItem &a, ResultItem &b) {
+    ASSERT_EQ(a.score, b.score);
+    ASSERT_EQ(a.names, b.names);
+    ASSERT_EQ(a.names.size(), a.values.size());
+    for (size_t i = 0; i < a.names.size(); ++i) {
+      ASSERT_EQ(string(a.ValueData(i), a.ValueSize(i)),
+                string(b.ValueData(i), b.ValueSize(i)))
+          << "field=" << a.names[i];
+    }
+    // the deprecated extra still holds the vector results
+    ASSERT_NE(string::npos, a.extra.find("\"vector_result\""));
+    ASSERT_EQ(a.extra, b.extra);
+    ASSERT_EQ(a.vector_results.size(), b.vector_results.size());
+  }
+
+  RequestConcurrentController &controller_;
+};
+
+TEST_F(PackResultsTest, ParallelSameAsSerial) {
+  Response parallel;
+  ASSERT_EQ(0, SearchAll(parallel));
+
+  // while the searches of another table hold the threads the budget of the
+  // search is one thread, its results are packed serially. The capacity
+  // leaves room for the search whatever its cost
+  long capacity;
+  int queue_size, timeout_ms;
+  controller_.GetLimits(capacity, queue_size, timeout_ms);
+  int held = omp_get_max_threads();
+  controller_.SetLimits(1L << 40, queue_size, timeout_ms);
+  int table_id = controller_.RegisterTable();
+  for (int i = 0; i < held; ++i) {
+    long cost = 1;
+    ASSERT_TRUE(
+        controller_.Acquire(cost, SearchPriority::Normal, -1, table_id));
+  }
+  ASSERT_EQ(1, controller_.SearchThreads());
+  Response serial;
+  int ret = SearchAll(serial);
+  for (int i = 0; i < held; ++i) controller_.Release(1, table_id);
+  controller_.UnregisterTable(table_id);
+  controller_.SetLimits(capacity, queue_size, timeout_ms);
+  ASSERT_EQ(0, ret);
+
+  ASSERT_EQ((size_t)kReqNum, parallel.Results().size());
+  ASSERT_EQ(parallel.Results().size(), serial.Results().size());
+  for (int i = 0; i < kReqNum; ++i) {
+    SearchResult &a = parallel.Results()[i];
+    SearchResult &b = serial.Results()[i];
+    ASSERT_EQ((size_t)kTopN, a.result_items.size());
+    ASSERT_EQ(a.result_items.size(), b.result_items.size());
+    for (int j = 0; j < kTopN; ++j) {
+      ExpectSame(a.result_items[j], b.result_items[j]);
+      if (HasFatalFailure()) return;
+    }
+  }
+}
+
+}  // namespace Test
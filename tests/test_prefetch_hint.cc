@@ -0,0 +1,106 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "storage_manager.h"
+#include "utils.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDimension = 64;
+const static int kVectorBytes = kDimension * sizeof(float);
+// a block holds 64K of vectors, the full segment is on disk in 4 blocks
+const static int kSegmentSize = 1024;
+const static int kBlockVectors = 64 * 1024 / kVectorBytes;
+
+class PrefetchHintTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_path_ = "./test_prefetch_hint";
+    utils::remove_dir(root_path_.c_str());
+    utils::make_dir(root_path_.c_str());
+    storage_ = Open();
+    ASSERT_NE(nullptr, storage_);
+    vector<float> vec(kDimension);
+    for (int i = 0; i < kSegmentSize; ++i) {
+      vec[0] = i;
+      ASSERT_EQ(0, storage_->Add((const uint8_t *)vec.data(), kVectorBytes));
+    }
+    ASSERT_EQ(0, storage_->Sync());
+    // the blocks are read from disk after a reopen
+    delete storage_;
+    storage_ = Open();
+    ASSERT_NE(nullptr, storage_);
+  }
+
+  void TearDown() override {
+    delete storage_;
+    utils::remove_dir(root_path_.c_str());
+  }
+
+  StorageManager *Open() {
+    StorageManagerOptions options;
+    options.segment_size = kSegmentSize;
+    options.fixed_value_bytes = kVectorBytes;
+    options.seg_block_capacity = 2000000;
+    StorageManager *storage = new StorageManager(
+        root_path_, BlockType::VectorBlockType, options);
+    if (storage->Init(16, "vector")) {
+      delete storage;
+      return nullptr;
+    }
+    return storage;
+  }
+
+  // the first dimension of the vector of id
+  float Get(int id) {
+    const uint8_t *value = nullptr;
+    if (storage_->Get(id, value)) return -1;
+    float first;
+    memcpy(&first, value, sizeof(first));
+    delete[] value;
+    return first;
+  }
+
+  string root_path_;
+  StorageManager *storage_;
+};
+
+TEST_F(PrefetchHintTest, HintedBlocksReadFromCache) {
+  // two ids of the first block, one of the third and ids out of range
+  vector<int64_t> ids = {0, 5, 2 * kBlockVectors + 1, -1, kSegmentSize * 2};
+  ASSERT_EQ(2, storage_->PrefetchAsync(ids));
+  // the queued blocks are not queued twice
+  ASSERT_EQ(0, storage_->PrefetchAsync(ids));
+  usleep(1000 * 1000);
+
+  size_t hits = 0, misses = 0;
+  storage_->GetCacheHits(hits, misses);
+  ASSERT_EQ(0, Get(0));
+  ASSERT_EQ(5, Get(5));
+  ASSERT_EQ(2 * kBlockVectors + 1, Get(2 * kBlockVectors + 1));
+  size_t hinted_misses = misses;
+  storage_->GetCacheHits(hits, misses);
+  ASSERT_EQ(hinted_misses, misses);
+  ASSERT_EQ(0, storage_->PrefetchAsync(ids));
+
+  // a block not hinted is read from disk
+  ASSERT_EQ(kBlockVectors, Get(kBlockVectors));
+  storage_->GetCacheHits(hits, misses);
+  ASSERT_EQ(hinted_misses + 1, misses);
+}
+
+}  // namespace Test
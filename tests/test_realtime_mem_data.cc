@@ -0,0 +1,247 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bitmap.h"
+#include "raw_vector_common.h"
+#include "realtime_mem_data.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+using namespace tig_gamma::realtime;
+
+const static int kCodeBytes = 8;
+const static int kBucketKeys = 4;  // small chunks to cross chunk borders
+const static int kMaxDocs = 1024;
+
+class RealTimeMemDataTest : public ::testing::Test {
+ protected:
+  RealTimeMemDataTest() : vid_mgr_(false), bitmap_(nullptr) {}
+
+  void SetUp() override {
+    int bytes = 0;
+    ASSERT_EQ(0, bitmap::create(bitmap_, bytes, kMaxDocs));
+    data_ = new RealTimeMemData(2, &vid_mgr_, bitmap_, kBucketKeys, kCodeBytes);
+    ASSERT_TRUE(data_->Init());
+  }
+
+  void TearDown() override {
+    // the replaced chunk directories are freed one second later
+    sleep(2);
+    delete data_;
+    free(bitmap_);
+  }
+
+  void Add(int bucket_no, int begin, int n) {
+    vector<long> keys;
+    vector<uint8_t> codes;
+    for (int i = begin; i < begin + n; i++) {
+      keys.push_back(i);
+      vector<uint8_t> code = Code(i);
+      codes.insert(codes.end(), code.begin(), code.end());
+    }
+    ASSERT_TRUE(data_->AddKeys(bucket_no, n, keys, codes));
+  }
+
+  vector<uint8_t> Code(int vid) { return vector<uint8_t>(kCodeBytes, vid); }
+
+  size_t Size(int bucket_no) {
+    RTBucketChunks *chunks = nullptr;
+    size_t size = 0;
+    data_->GetIvtList(bucket_no, chunks, size);
+    return size;
+  }
+
+  long Id(int bucket_no, int pos) {
+    long id = 0;
+    data_->RetrieveCodes(bucket_no, pos, 1, nullptr, &id);
+    return id;
+  }
+
+  VIDMgr vid_mgr_;
+  char *bitmap_;
+  RealTimeMemData *data_;
+};
+
+TEST_F(RealTimeMemDataTest, AddAcrossChunks) {
+  Add(0, 0, 10);
+  Add(0, 10, 30);  // extends the chunk directory
+  ASSERT_EQ(40U, Size(0));
+
+  vector<long> ids(40);
+  vector<uint8_t> codes(40 * kCodeBytes);
+  data_->RetrieveCodes(0, 0, 40, codes.data(), ids.data());
+  for (int i = 0; i < 40; i++) {
+    ASSERT_EQ(i, ids[i]);
+    ASSERT_EQ(0, memcmp(codes.data() + i * kCodeBytes, Code(i).data(),
+                        kCodeBytes));
+  }
+}
+
+TEST_F(RealTimeMemDataTest, CompactDropsTombstones) {
+  Add(0, 0, 10);
+  int deleted[] = {1, 3, 5, 7};
+  for (int vid : deleted) bitmap::set(bitmap_, vid);
+  data_->Delete(deleted, 4);
+
+  vector<float> ratios;
+  data_->GetTombstoneRatios(ratios);
+  ASSERT_EQ(2U, ratios.size());
+  ASSERT_FLOAT_EQ(0.4f, ratios[0]);
+  ASSERT_FLOAT_EQ(0, ratios[1]);
+
+  ASSERT_EQ(1, data_->CompactIfNeed());
+  ASSERT_EQ(6U, Size(0));
+  int expect[] = {0, 2, 4, 6, 8, 9};
+  for (int i = 0; i < 6; i++) ASSERT_EQ(expect[i], Id(0, i));
+  data_->GetTombstoneRatios(ratios);
+  ASSERT_FLOAT_EQ(0, ratios[0]);
+
+  // nothing left to compact
+  ASSERT_EQ(0, data_->CompactIfNeed());
+}
+
+TEST_F(RealTimeMemDataTest, CompactKeysBudget) {
+  Add(0, 0, 8);
+  Add(1, 8, 8);
+  int deleted[] = {0, 1, 2, 3, 8, 9, 10, 11};
+  for (int vid : deleted) bitmap::set(bitmap_, vid);
+  data_->Delete(deleted, 8);
+
+  // the budget only covers one bucket, at least one is compacted each round
+  ASSERT_EQ(1, data_->CompactIfNeed(8));
+  ASSERT_EQ(1, data_->CompactIfNeed(8));
+  ASSERT_EQ(4U, Size(0));
+  ASSERT_EQ(4U, Size(1));
+}
+
+TEST_F(RealTimeMemDataTest, UpdateMovesBucket) {
+  Add(0, 0, 4);
+  vector<uint8_t> code = Code(100);
+  ASSERT_EQ(0, data_->Update(1, 2, code));
+
+  ASSERT_EQ(2 | kDelIdxMask, Id(0, 2));
+  ASSERT_EQ(1U, Size(1));
+  ASSERT_EQ(2, Id(1, 0));
+  uint8_t out[kCodeBytes];
+  data_->RetrieveCodes(1, 0, 1, out, nullptr);
+  ASSERT_EQ(0, memcmp(out, code.data(), kCodeBytes));
+
+  // staying in the bucket rewrites the codes in place
+  code = Code(101);
+  ASSERT_EQ(0, data_->Update(1, 2, code));
+  ASSERT_EQ(1U, Size(1));
+  data_->RetrieveCodes(1, 0, 1, out, nullptr);
+  ASSERT_EQ(0, memcmp(out, code.data(), kCodeBytes));
+}
+
+TEST_F(RealTimeMemDataTest, SlotReusedWithoutReaders) {
+  Add(0, 0, 4);
+  Add(1, 4, 4);
+  vector<uint8_t> code = Code(100);
+  // vid 1 leaves bucket 0, its slot is pending
+  ASSERT_EQ(0, data_->Update(1, 1, code));
+  ASSERT_EQ(5U, Size(1));
+
+  // the next update of bucket 0 releases the slot and reuses it
+  ASSERT_EQ(0, data_->Update(0, 5, code));
+  ASSERT_EQ(4U, Size(0));
+  ASSERT_EQ(5, Id(0, 1));
+  ASSERT_EQ(5 | kDelIdxMask, Id(1, 1));
+}
+
+TEST_F(RealTimeMemDataTest, SlotNotReusedWhileScanned) {
+  Add(0, 0, 4);
+  Add(1, 4, 4);
+  vector<uint8_t> code = Code(100);
+  ASSERT_EQ(0, data_->Update(1, 1, code));
+
+  // a search holds bucket 0, the tombstoned slot must not be rewritten
+  int parity = data_->EnterBucket(0);
+  ASSERT_EQ(0, data_->Update(0, 5, code));
+  ASSERT_EQ(5U, Size(0));
+  ASSERT_EQ(1 | kDelIdxMask, Id(0, 1));
+  ASSERT_EQ(5, Id(0, 4));
+  data_->LeaveBucket(0, parity);
+
+  // released once the search is gone
+  ASSERT_EQ(0, data_->Update(0, 6, code));
+  ASSERT_EQ(5U, Size(0));
+  ASSERT_EQ(6, Id(0, 1));
+}
+
+TEST_F(RealTimeMemDataTest, CompactClearsPendingSlots) {
+  Add(0, 0, 4);
+  vector<uint8_t> code = Code(100);
+  int parity = data_->EnterBucket(0);
+  ASSERT_EQ(0, data_->Update(1, 1, code));
+  ASSERT_TRUE(data_->CompactBucket(0));
+  data_->LeaveBucket(0, parity);
+
+  ASSERT_EQ(3U, Size(0));
+  // nothing pending is left to point into the compacted bucket
+  ASSERT_EQ(0, data_->Update(0, 1, code));
+  ASSERT_EQ(4U, Size(0));
+  ASSERT_EQ(1, Id(0, 3));
+}
+
+TEST_F(RealTimeMemDataTest, CompactedChunksKeptWhileScanned) {
+  Add(0, 0, 10);
+  int deleted[] = {1, 3, 5, 7};
+  for (int vid : deleted) bitmap::set(bitmap_, vid);
+  data_->Delete(deleted, 4);
+
+  // a search holds bucket 0 and scans the chunks it took before compaction
+  int parity = data_->EnterBucket(0);
+  RTBucketChunks *chunks = nullptr;
+  size_t size = 0;
+  data_->GetIvtList(0, chunks, size);
+  long mem_bytes = data_->GetTotalMemBytes();
+  ASSERT_EQ(1, data_->CompactIfNeed());
+  long compacted_bytes = data_->GetTotalMemBytes();
+  ASSERT_GT(compacted_bytes, mem_bytes);
+
+  // longer than the delay given to the reads which skip the gate
+  sleep(2);
+  ASSERT_EQ(compacted_bytes, data_->GetTotalMemBytes());
+  for (size_t i = 0; i < size; i++) ASSERT_EQ((long)i, *chunks->Ids(i));
+  data_->LeaveBucket(0, parity);
+
+  // the next round frees them
+  ASSERT_EQ(0, data_->CompactIfNeed());
+  sleep(2);
+  ASSERT_LT(data_->GetTotalMemBytes(), mem_bytes);
+}
+
+TEST_F(RealTimeMemDataTest, SlotsReusedUnderOverlappingReaders) {
+  Add(0, 0, 4);
+  Add(1, 4, 4);
+  vector<uint8_t> code = Code(100);
+  // bucket 0 is never free of searches, each one leaves after the next one
+  // entered while vid 1 moves out of it and back
+  int parity = data_->EnterBucket(0);
+  for (int i = 0; i < 100; i++) {
+    int next_parity = data_->EnterBucket(0);
+    data_->LeaveBucket(0, parity);
+    parity = next_parity;
+    ASSERT_EQ(0, data_->Update(1, 1, code));
+    ASSERT_EQ(0, data_->Update(0, 1, code));
+  }
+  data_->LeaveBucket(0, parity);
+  // the slots tombstoned before the older searches left are reused
+  ASSERT_LE(Size(0), 6U);
+}
+
+}  // namespace Test
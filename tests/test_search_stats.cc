@@ -0,0 +1,94 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "search_stats.h"
+
+namespace Test {
+
+using namespace std;
+using namespace search_stats;
+
+TEST(SearchStats, EmptyHistogram) {
+  Histogram histogram;
+  ASSERT_EQ(0, histogram.Count());
+  ASSERT_EQ(0, histogram.Max());
+  ASSERT_EQ(0, histogram.Percentile(0.99));
+}
+
+TEST(SearchStats, SmallValuesAreExact) {
+  Histogram histogram;
+  for (long us = 0; us < 8; us++) histogram.Record(us);
+  ASSERT_EQ(8, histogram.Count());
+  ASSERT_EQ(7, histogram.Max());
+  ASSERT_EQ(3, histogram.Percentile(0.5));
+  ASSERT_EQ(7, histogram.Percentile(1));
+  // negative latencies are counted as 0
+  histogram.Record(-5);
+  ASSERT_EQ(9, histogram.Count());
+  ASSERT_EQ(0, histogram.Percentile(0.1));
+}
+
+TEST(SearchStats, PercentilesWithinBucketError) {
+  Histogram histogram;
+  for (long us = 1; us <= 100000; us++) histogram.Record(us);
+  ASSERT_EQ(100000, histogram.Count());
+  ASSERT_EQ(100000, histogram.Max());
+
+  double ps[] = {0.5, 0.9, 0.99, 0.999};
+  for (double p : ps) {
+    long expect = (long)(p * 100000);
+    long percentile = histogram.Percentile(p);
+    // the upper bound of the bucket, 8 sub buckets per power of two
+    ASSERT_GE(percentile, expect);
+    ASSERT_LE(percentile, expect + expect / 8);
+  }
+  // never above the max
+  ASSERT_EQ(100000, histogram.Percentile(1));
+}
+
+TEST(SearchStats, ConcurrentRecord) {
+  Histogram histogram;
+  vector<thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&histogram, t]() {
+      for (long us = 0; us < 10000; us++) histogram.Record(us + t);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  ASSERT_EQ(40000, histogram.Count());
+  ASSERT_EQ(10002, histogram.Max());
+}
+
+TEST(SearchStats, InstancesAreIndependent) {
+  SearchStats first, second;
+  first.Record(Stage::Search, 100);
+  first.Record(Stage::Rerank, 20);
+  first.Add(Counter::CodesScanned, 1000);
+  second.Add(Counter::CodesScanned, 1);
+
+  ASSERT_EQ(1, first.GetHistogram(Stage::Search).Count());
+  ASSERT_EQ(1, first.GetHistogram(Stage::Rerank).Count());
+  ASSERT_EQ(0, second.GetHistogram(Stage::Search).Count());
+  ASSERT_EQ(0, second.GetHistogram(Stage::Rerank).Count());
+  ASSERT_EQ(1000, first.GetCounter(Counter::CodesScanned));
+  ASSERT_EQ(1, second.GetCounter(Counter::CodesScanned));
+  ASSERT_EQ(0, first.GetCounter(Counter::Reranked));
+}
+
+TEST(SearchStats, StageNames) {
+  ASSERT_EQ(string("filter"), StageName(Stage::Filter));
+  ASSERT_EQ(string("total"), StageName(Stage::Total));
+  ASSERT_EQ(string("rerank"), StageName(Stage::Rerank));
+}
+
+}  // namespace Test
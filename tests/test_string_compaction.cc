@@ -0,0 +1,165 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "storage_manager.h"
+#include "utils.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kSegmentSize = 100;
+// a row only holds the ref of one string
+const static int kRowLen =
+    sizeof(uint32_t) + sizeof(uint32_t) + sizeof(str_len_t);
+
+class StringCompactionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_path_ = "./test_string_compaction";
+    utils::remove_dir(root_path_.c_str());
+    storage_ = Open();
+    ASSERT_NE(nullptr, storage_);
+    // the first segment is full, the second one is extended
+    for (int i = 0; i < kSegmentSize + 1; ++i) {
+      string str = Str(i, 0);
+      uint8_t row[kRowLen];
+      uint32_t block_id, in_block_pos;
+      storage_->AddString(str.c_str(), str.size(), block_id, in_block_pos);
+      Ref(row, block_id, in_block_pos, str.size());
+      ASSERT_EQ(0, storage_->Add(row, kRowLen));
+    }
+    ASSERT_EQ(0, storage_->Sync());
+    ASSERT_EQ(1, storage_->FullSegmentNum());
+  }
+
+  void TearDown() override {
+    delete storage_;
+    utils::remove_dir(root_path_.c_str());
+  }
+
+  StorageManager *Open() {
+    StorageManagerOptions options;
+    options.segment_size = kSegmentSize;
+    options.fixed_value_bytes = kRowLen;
+    options.seg_block_capacity = 1000;
+    StorageManager *storage = new StorageManager(
+        root_path_, BlockType::TableBlockType, options);
+    if (storage->Init(100, "table", 100, "string")) {
+      delete storage;
+      return nullptr;
+    }
+    return storage;
+  }
+
+  string Str(int i, int version) {
+    return "string " + to_string(i) + " of version " + to_string(version);
+  }
+
+  void Ref(uint8_t *row, uint32_t block_id, uint32_t in_block_pos,
+           str_len_t len) {
+    memcpy(row, &block_id, sizeof(block_id));
+    memcpy(row + sizeof(block_id), &in_block_pos, sizeof(in_block_pos));
+    memcpy(row + sizeof(block_id) + sizeof(in_block_pos), &len, sizeof(len));
+  }
+
+  string Get(int id) {
+    const uint8_t *row = nullptr;
+    storage_->Get(id, row);
+    uint32_t block_id, in_block_pos;
+    str_len_t len;
+    memcpy(&block_id, row, sizeof(block_id));
+    memcpy(&in_block_pos, row + sizeof(block_id), sizeof(in_block_pos));
+    memcpy(&len, row + sizeof(block_id) + sizeof(in_block_pos), sizeof(len));
+    delete[] row;
+    string str;
+    if (len > 0) storage_->GetString(id, str, block_id, in_block_pos, len);
+    return str;
+  }
+
+  // copy the strings of the odd rows, the even ones are dropped
+  vector<uint8_t> Compact() {
+    vector<uint8_t> rows((size_t)kSegmentSize * kRowLen, 0);
+    EXPECT_EQ(0, storage_->BeginStrCompaction(0));
+    for (int i = 1; i < kSegmentSize; i += 2) {
+      string str = Str(i, 0);
+      uint32_t block_id, in_block_pos;
+      storage_->AddCompactString(0, str.c_str(), str.size(), block_id,
+                                 in_block_pos);
+      Ref(rows.data() + (size_t)i * kRowLen, block_id, in_block_pos,
+          str.size());
+    }
+    return rows;
+  }
+
+  void CheckCompacted() {
+    for (int i = 0; i < kSegmentSize; ++i) {
+      ASSERT_EQ(i % 2 ? Str(i, 0) : "", Get(i)) << "id=" << i;
+    }
+    ASSERT_EQ(Str(kSegmentSize, 0), Get(kSegmentSize));
+  }
+
+  string root_path_;
+  StorageManager *storage_;
+};
+
+TEST_F(StringCompactionTest, CommitReplacesStringsAndRows) {
+  vector<uint8_t> rows = Compact();
+  ASSERT_EQ(0, storage_->CommitStrCompaction(0, rows.data(), kSegmentSize));
+  CheckCompacted();
+  ASSERT_FALSE(utils::file_exist(root_path_ + "/000000_str.compact"));
+  ASSERT_FALSE(utils::file_exist(root_path_ + "/000000_str.rows"));
+
+  // the compacted segment is loaded as it is
+  delete storage_;
+  storage_ = Open();
+  ASSERT_NE(nullptr, storage_);
+  CheckCompacted();
+}
+
+TEST_F(StringCompactionTest, AbortKeepsOldStrings) {
+  Compact();
+  storage_->AbortStrCompaction(0);
+  for (int i = 0; i < kSegmentSize; ++i) ASSERT_EQ(Str(i, 0), Get(i));
+
+  // an interrupted compaction is dropped by the load
+  Compact();
+  delete storage_;
+  storage_ = Open();
+  ASSERT_NE(nullptr, storage_);
+  for (int i = 0; i < kSegmentSize; ++i) ASSERT_EQ(Str(i, 0), Get(i));
+}
+
+TEST_F(StringCompactionTest, LoadFinishesCommittedSwap) {
+  // the string file can't be replaced by a directory, the commit fails
+  // after its commit point like a crash would
+  string str_path = root_path_ + "/000000_str";
+  ASSERT_EQ(0, rename(str_path.c_str(), (str_path + ".old").c_str()));
+  ASSERT_EQ(0, mkdir(str_path.c_str(), 0777));
+  vector<uint8_t> rows = Compact();
+  ASSERT_NE(0, storage_->CommitStrCompaction(0, rows.data(), kSegmentSize));
+  ASSERT_TRUE(utils::file_exist(root_path_ + "/000000_str.rows"));
+  delete storage_;
+  ASSERT_EQ(0, rmdir(str_path.c_str()));
+  remove((str_path + ".old").c_str());
+
+  storage_ = Open();
+  ASSERT_NE(nullptr, storage_);
+  ASSERT_FALSE(utils::file_exist(root_path_ + "/000000_str.rows"));
+  CheckCompacted();
+}
+
+}  // namespace Test
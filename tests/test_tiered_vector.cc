@@ -0,0 +1,138 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "c_api/api_data/gamma_config.h"
+#include "c_api/api_data/gamma_engine_status.h"
+#include "test_engine.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDocNum = 100;
+
+class TieredVectorTest : public EngineTest {
+ protected:
+  TieredVectorTest() : EngineTest("tiered_vector") {
+    store_type_ = "Tiered";
+    store_param_ = "{\"cache_size\": 16, \"hot_cache_size\": 1}";
+    indexing_size_ = kDocNum * 10;
+  }
+
+  void SetUp() override {
+    EngineTest::SetUp();
+    if (HasFatalFailure()) return;
+    for (long id = 0; id < kDocNum; ++id) ASSERT_EQ(0, AddDoc(id, id));
+  }
+
+  // every dimension of the vector is value
+  int AddDoc(long id, float value) {
+    Doc doc = MakeDoc(id, 0, value);
+    return EngineTest::AddDoc(doc);
+  }
+
+  // the vector of the doc, empty if it is not found
+  vector<float> GetVector(long id) {
+    string key((char *)&id, sizeof(id));
+    Doc doc;
+    if (Engine()->GetDoc(key, doc) != 0 || doc.VectorFields().size() != 1) {
+      return vector<float>();
+    }
+    // [bytes of the vector][vector][source]
+    const string &value = doc.VectorFields()[0].value;
+    vector<float> vec(kDimension);
+    memcpy(vec.data(), value.data() + sizeof(int), kDimension * sizeof(float));
+    return vec;
+  }
+
+  float HotHitRatio() {
+    EngineStatus status;
+    Engine()->GetIndexStatus(status);
+    return status.VectorHotHitRatio();
+  }
+
+  int HotCacheSize() {
+    Config config;
+    Engine()->GetConfig(config);
+    for (CacheInfo &cache : config.CacheInfos()) {
+      if (cache.field_name == "vec_hot") return cache.cache_size;
+    }
+    return -1;
+  }
+};
+
+TEST_F(TieredVectorTest, ColdReads) {
+  for (long id = 0; id < kDocNum; ++id) {
+    ASSERT_EQ(vector<float>(kDimension, id), GetVector(id));
+  }
+  // each vector is read once, none is promoted
+  ASSERT_FLOAT_EQ(0, HotHitRatio());
+}
+
+TEST_F(TieredVectorTest, FrequentReadsPromoted) {
+  // promoted after kPromoteCount cold reads
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(vector<float>(kDimension, 5), GetVector(5));
+  }
+  float ratio = HotHitRatio();
+  ASSERT_GT(ratio, 0.5f);
+  ASSERT_LT(ratio, 1.0f);
+}
+
+TEST_F(TieredVectorTest, UpdateRefreshesHotCopy) {
+  for (int i = 0; i < 10; ++i) GetVector(5);
+  ASSERT_EQ(0, AddDoc(5, 500));
+  ASSERT_EQ(vector<float>(kDimension, 500), GetVector(5));
+  ASSERT_EQ(vector<float>(kDimension, 6), GetVector(6));
+}
+
+TEST_F(TieredVectorTest, AlterHotCacheSize) {
+  ASSERT_EQ(1, HotCacheSize());
+  for (int i = 0; i < 10; ++i) GetVector(5);
+
+  Config config;
+  config.AddCacheInfo("vec_hot", 2);
+  ASSERT_EQ(0, Engine()->SetConfig(config));
+  ASSERT_EQ(2, HotCacheSize());
+  // the hot vectors are dropped, they are read from the cold tier
+  ASSERT_EQ(vector<float>(kDimension, 5), GetVector(5));
+}
+
+TEST_F(TieredVectorTest, ReadRacingUpdateNotPromoted) {
+  // readers promote vid 5 while it is updated, a cold read taken before an
+  // update must not be promoted over it
+  std::atomic<bool> stop(false);
+  vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&]() {
+      while (!stop) GetVector(5);
+    });
+  }
+  int failed = 0, stale = 0;
+  for (int value = 1000; value < 1200; ++value) {
+    if (AddDoc(5, value)) ++failed;
+    // longer than the reads in flight when the update returned
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    if (GetVector(5) != vector<float>(kDimension, value)) ++stale;
+  }
+  stop = true;
+  for (std::thread &t : readers) t.join();
+  ASSERT_EQ(0, failed);
+  ASSERT_EQ(0, stale);
+  ASSERT_GT(HotHitRatio(), 0);
+}
+
+}  // namespace Test
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+#include "test_engine.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+const static int kDocNum = 200;
+
+class UnindexedSearchTest : public EngineTest {
+ protected:
+  UnindexedSearchTest() : EngineTest("unindexed_search") {
+    retrieval_type_ = "HNSW";
+    retrieval_param_ =
+        "{\"nlinks\" : 16, \"metric_type\" : \"InnerProduct\", "
+        "\"efConstruction\" : 40}";
+    indexing_size_ = kDocNum / 2;
+  }
+
+  // the later a doc is added the nearer it is to the query of ones
+  int AddDoc(long id) {
+    Doc doc = MakeDoc(id, 0, id * 0.01f);
+    return EngineTest::AddDoc(doc);
+  }
+};
+
+TEST_F(UnindexedSearchTest, FreshDocFoundOnce) {
+  for (long id = 0; id < kDocNum; ++id) ASSERT_EQ(0, AddDoc(id));
+  for (int i = 0; i < 1000 && MinIndexedNum() < kDocNum; ++i) {
+    usleep(10 * 1000);
+  }
+  ASSERT_EQ(kDocNum, MinIndexedNum());
+
+  // each search races the indexing thread adding the doc just written, the
+  // doc is found whether it is indexed yet or not, and only once
+  for (long id = kDocNum; id < kDocNum * 2; ++id) {
+    ASSERT_EQ(0, AddDoc(id));
+    Request request;
+    MakeRequest(1, 10, request);
+    Response response;
+    ASSERT_EQ(0, Search(request, response));
+    ASSERT_EQ(1U, response.Results().size());
+    vector<long> ids = Ids(response.Results()[0]);
+    ASSERT_FALSE(ids.empty());
+    ASSERT_EQ(id, ids[0]);
+    ASSERT_EQ(ids.size(), set<long>(ids.begin(), ids.end()).size());
+  }
+}
+
+}  // namespace Test
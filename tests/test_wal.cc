@@ -0,0 +1,217 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gamma_wal.h"
+#include "test_engine.h"
+#include "utils.h"
+
+namespace Test {
+
+using namespace std;
+using namespace tig_gamma;
+
+class WalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = "./test_wal_dir";
+    utils::remove_dir(dir_.c_str());
+  }
+
+  void TearDown() override { utils::remove_dir(dir_.c_str()); }
+
+  // replay after lsn, the payloads are collected in order
+  long Replay(long lsn, vector<string> &payloads, long *failed = nullptr,
+              const string &fail_on = "") {
+    WriteAheadLog wal(dir_);
+    return wal.Replay(
+        lsn,
+        [&](WalOpType type, const char *data, int len) -> int {
+          payloads.push_back(string(data, len));
+          return payloads.back() == fail_on ? -1 : 0;
+        },
+        failed);
+  }
+
+  string LastFile() {
+    vector<string> files = utils::ls(dir_);
+    sort(files.begin(), files.end());
+    return files.back();
+  }
+
+  string dir_;
+};
+
+TEST_F(WalTest, AppendAndReplay) {
+  {
+    WriteAheadLog wal(dir_);
+    ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+    long lsn = 0;
+    ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "a", 1, &lsn));
+    ASSERT_EQ(1, lsn);
+    vector<WalRecord> records{{WalOpType::AddOrUpdate, "b", 1},
+                              {WalOpType::Delete, "c", 1}};
+    ASSERT_EQ(0, wal.Append(records, &lsn));
+    ASSERT_EQ(2, lsn);
+    ASSERT_EQ(3, wal.LastLsn());
+  }
+  vector<string> payloads;
+  ASSERT_EQ(3, Replay(0, payloads));
+  ASSERT_EQ((vector<string>{"a", "b", "c"}), payloads);
+
+  payloads.clear();
+  ASSERT_EQ(1, Replay(2, payloads));
+  ASSERT_EQ("c", payloads[0]);
+
+  // the lsn goes on after reopen
+  WriteAheadLog wal(dir_);
+  ASSERT_EQ(0, wal.Open());
+  ASSERT_EQ(3, wal.LastLsn());
+}
+
+TEST_F(WalTest, TornTailCutOff) {
+  {
+    WriteAheadLog wal(dir_);
+    ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+    ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "a", 1));
+    ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "bbbb", 4));
+  }
+  string path = LastFile();
+  long size = utils::get_file_size(path);
+  ASSERT_EQ(0, truncate(path.c_str(), size - 2));
+
+  WriteAheadLog wal(dir_);
+  ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+  ASSERT_EQ(1, wal.LastLsn());
+  ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "c", 1));
+  vector<string> payloads;
+  ASSERT_EQ(2, Replay(0, payloads));
+  ASSERT_EQ((vector<string>{"a", "c"}), payloads);
+}
+
+TEST_F(WalTest, CorruptedRecordFailsReplay) {
+  {
+    WriteAheadLog wal(dir_);
+    ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+    ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "a", 1));
+    ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "b", 1));
+  }
+  // flip the payload of the first record
+  int fd = open(LastFile().c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(1, pwrite(fd, "x", 1, 17));
+  close(fd);
+  vector<string> payloads;
+  ASSERT_LT(Replay(0, payloads), 0);
+  ASSERT_EQ(0U, payloads.size());
+}
+
+TEST_F(WalTest, AbortedRecordsSkipped) {
+  {
+    WriteAheadLog wal(dir_);
+    ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+    long lsn = 0;
+    vector<WalRecord> records{{WalOpType::AddOrUpdate, "a", 1},
+                              {WalOpType::AddOrUpdate, "b", 1},
+                              {WalOpType::AddOrUpdate, "c", 1}};
+    ASSERT_EQ(0, wal.Append(records, &lsn));
+    ASSERT_EQ(0, wal.Abort(vector<long>{lsn + 1}));
+    ASSERT_EQ(0, wal.Abort(vector<long>()));
+    ASSERT_EQ(4, wal.LastLsn());
+  }
+  vector<string> payloads;
+  long failed = -1;
+  ASSERT_EQ(2, Replay(0, payloads, &failed));
+  ASSERT_EQ((vector<string>{"a", "c"}), payloads);
+  ASSERT_EQ(0, failed);
+
+  // failures of the replay are reported
+  payloads.clear();
+  ASSERT_EQ(2, Replay(0, payloads, &failed, "c"));
+  ASSERT_EQ(1, failed);
+}
+
+TEST_F(WalTest, PurgeKeepsLastFile) {
+  WriteAheadLog wal(dir_);
+  ASSERT_EQ(0, wal.Open(disk_io::SyncPolicy::Batch));
+  ASSERT_EQ(0, wal.Append(WalOpType::AddOrUpdate, "a", 1));
+  ASSERT_EQ(0, wal.Purge(wal.LastLsn()));
+  ASSERT_EQ(1U, utils::ls(dir_).size());
+  vector<string> payloads;
+  ASSERT_EQ(0, Replay(1, payloads));
+}
+
+class WalReplayTest : public EngineTest {
+ protected:
+  WalReplayTest() : EngineTest("wal_replay") { has_cid_ = true; }
+
+  int AddDoc(long id, float value) {
+    Doc doc = MakeDoc(id, id % 10, value);
+    return EngineTest::AddDoc(doc);
+  }
+
+  int Delete(long id) { return DeleteDoc(engine_, (char *)&id, sizeof(id)); }
+
+  // the ids of all the docs by their vector values, the largest first
+  vector<long> AllIds() {
+    Request request;
+    MakeRequest(1, 100, request);
+    request.SetBruteForceSearch(1);
+    Response response;
+    if (Search(request, response) || response.Results().size() != 1) {
+      return vector<long>();
+    }
+    return Ids(response.Results()[0]);
+  }
+};
+
+TEST_F(WalReplayTest, ReplayAfterDump) {
+  for (long id = 0; id < 10; ++id) ASSERT_EQ(0, AddDoc(id, id + 1));
+  ASSERT_EQ(0, AddDoc(1, 0.5));
+  ASSERT_EQ(0, Delete(2));
+  ASSERT_EQ(0, Dump(engine_));
+
+  for (long id = 10; id < 15; ++id) ASSERT_EQ(0, AddDoc(id, id + 1));
+  ASSERT_EQ(0, AddDoc(3, 100));
+  ASSERT_EQ(0, Delete(4));
+  // a doc without cid is logged, then its apply fails and it is aborted. The
+  // engine is called directly, deserialized docs carry every field
+  has_cid_ = false;
+  Doc aborted = MakeDoc(20, 0, 200);
+  has_cid_ = true;
+  ASSERT_NE(0, Engine()->AddOrUpdate(aborted));
+  vector<long> expected = {3, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 0, 1};
+  ASSERT_EQ(expected, AllIds());
+  ASSERT_EQ(13, Engine()->GetDocsNum());
+
+  // the engine stops without a dump, the writes after it are in the log only
+  Close(engine_);
+  engine_ = OpenEngine();
+  ASSERT_NE(nullptr, engine_);
+  ASSERT_EQ(0, CreateTable());
+  // a replayed delete of the dump or the aborted doc would fail the load
+  ASSERT_EQ(0, Load(engine_));
+  ASSERT_EQ(expected, AllIds());
+  ASSERT_EQ(13, Engine()->GetDocsNum());
+
+  // the replayed writes are not logged again
+  Close(engine_);
+  engine_ = OpenEngine();
+  ASSERT_NE(nullptr, engine_);
+  ASSERT_EQ(0, CreateTable());
+  ASSERT_EQ(0, Load(engine_));
+  ASSERT_EQ(expected, AllIds());
+}
+
+}  // namespace Test
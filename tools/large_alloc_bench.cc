@@ -0,0 +1,197 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "large_alloc.h"
+#include "utils.h"
+
+/**
+ * Micro-benchmark of the large_alloc policies: random reads of vectors from
+ * one large array, as the raw vector fetches of re-ranking do. Each policy
+ * allocates its own array and reports the time per vector read together with
+ * the dTLB load misses and the node load misses (remote node reads) of the
+ * reading thread.
+ *
+ *   ./tools/large_alloc_bench [size_mb] [reads] [dimension]
+ *
+ * The counters are read with perf_event_open, they are n/a if it is not
+ * allowed (see /proc/sys/kernel/perf_event_paranoid). The hugetlb rows need
+ * reserved pages (/proc/sys/vm/nr_hugepages), otherwise they fall back to
+ * transparent huge pages. The numa rows run on machines of two or more nodes.
+ **/
+
+using namespace std;
+using namespace large_alloc;
+
+namespace {
+
+struct Result {
+  double ns_per_read;
+  long dtlb_misses;  // -1 if not counted
+  long node_misses;
+  double checksum;
+};
+
+int OpenCounter(uint64_t cache, uint64_t op, uint64_t result) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = cache | (op << 8) | (result << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // the calling thread on any cpu
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long ReadCounter(int fd) {
+  if (fd < 0) return -1;
+  long count = 0;
+  if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+  close(fd);
+  return count;
+}
+
+vector<int> NodeCpus(int node) {
+  vector<int> cpus;
+  ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+  string range;
+  while (getline(in, range, ',')) {
+    int begin = 0, end = 0;
+    int n = sscanf(range.c_str(), "%d-%d", &begin, &end);
+    if (n < 1) continue;
+    if (n == 1) end = begin;
+    for (int cpu = begin; cpu <= end; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+void PinToNode(int node) {
+  vector<int> cpus = NodeCpus(node);
+  if (cpus.size() == 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+// run_node < 0 leaves the thread where the scheduler puts it
+Result Run(size_t size, long reads, int dimension, int run_node) {
+  Result result = {0, -1, -1, 0};
+  if (run_node >= 0) PinToNode(run_node);
+
+  size_t row_bytes = dimension * sizeof(float);
+  size_t rows = size / row_bytes;
+  float *data = (float *)Alloc(rows * row_bytes);
+  if (data == nullptr) {
+    cerr << "alloc " << size << " bytes error" << endl;
+    return result;
+  }
+  // first touch from the running thread, as the engine does when adding
+  for (size_t i = 0; i < rows * dimension; ++i) data[i] = i % 251;
+  vector<float> query(dimension, 1.0f);
+
+  int dtlb = OpenCounter(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                         PERF_COUNT_HW_CACHE_RESULT_MISS);
+  int node = OpenCounter(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ,
+                         PERF_COUNT_HW_CACHE_RESULT_MISS);
+  if (dtlb >= 0) ioctl(dtlb, PERF_EVENT_IOC_ENABLE, 0);
+  if (node >= 0) ioctl(node, PERF_EVENT_IOC_ENABLE, 0);
+
+  // xorshift, the same rows for every policy
+  uint64_t x = 88172645463325252ULL;
+  double sum = 0;
+  double begin = utils::getmillisecs();
+  for (long i = 0; i < reads; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const float *row = data + (x % rows) * dimension;
+    float dist = 0;
+    for (int d = 0; d < dimension; ++d) {
+      float diff = row[d] - query[d];
+      dist += diff * diff;
+    }
+    sum += dist;
+  }
+  double cost_ms = utils::getmillisecs() - begin;
+
+  if (dtlb >= 0) ioctl(dtlb, PERF_EVENT_IOC_DISABLE, 0);
+  if (node >= 0) ioctl(node, PERF_EVENT_IOC_DISABLE, 0);
+  result.dtlb_misses = ReadCounter(dtlb);
+  result.node_misses = ReadCounter(node);
+  result.ns_per_read = cost_ms * 1e6 / reads;
+  result.checksum = sum;
+  Free(data, rows * row_bytes);
+  return result;
+}
+
+string Count(long n) { return n < 0 ? "n/a" : to_string(n); }
+
+void Report(const string &name, HugePage huge_page, NumaPolicy numa_policy,
+            int numa_node, int run_node, size_t size, long reads,
+            int dimension) {
+  SetPolicy(huge_page, numa_policy, numa_node);
+  Result result;
+  // a new thread for each row, so that the pinning of a row is not kept
+  std::thread t([&]() { result = Run(size, reads, dimension, run_node); });
+  t.join();
+  printf("%-28s %12.1f %16s %16s %14.0f\n", name.c_str(), result.ns_per_read,
+         Count(result.dtlb_misses).c_str(), Count(result.node_misses).c_str(),
+         result.checksum);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t size_mb = argc > 1 ? atol(argv[1]) : 4096;
+  long reads = argc > 2 ? atol(argv[2]) : 10000000;
+  int dimension = argc > 3 ? atoi(argv[3]) : 128;
+  if (size_mb == 0 || reads <= 0 || dimension <= 0) {
+    cerr << "Usage: " << argv[0] << " [size_mb] [reads] [dimension]" << endl;
+    return -1;
+  }
+  size_t size = size_mb << 20;
+  int nodes = NumaNodeNum();
+  printf("size=%luM, reads=%ld, dimension=%d, numa nodes=%d\n", size_mb, reads,
+         dimension, nodes);
+  printf("%-28s %12s %16s %16s %14s\n", "policy", "ns/read", "dTLB misses",
+         "node misses", "checksum");
+
+  Report("malloc", HugePage::None, NumaPolicy::Default, 0, -1, size, reads,
+         dimension);
+  Report("transparent huge pages", HugePage::Transparent, NumaPolicy::Default,
+         0, -1, size, reads, dimension);
+  Report("hugetlb 2M", HugePage::Hugetlb2M, NumaPolicy::Default, 0, -1, size,
+         reads, dimension);
+  Report("hugetlb 1G", HugePage::Hugetlb1G, NumaPolicy::Default, 0, -1, size,
+         reads, dimension);
+  if (nodes > 1) {
+    // the memory is on node 0, the reads run on node 0 or on node 1
+    Report("bind node 0, local reads", HugePage::Transparent, NumaPolicy::Bind,
+           0, 0, size, reads, dimension);
+    Report("bind node 0, remote reads", HugePage::Transparent,
+           NumaPolicy::Bind, 0, 1, size, reads, dimension);
+    Report("interleave", HugePage::Transparent, NumaPolicy::Interleave, 0, 0,
+           size, reads, dimension);
+  }
+  return 0;
+}
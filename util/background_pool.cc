@@ -0,0 +1,136 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "background_pool.h"
+
+#include <system_error>
+
+#include "log.h"
+#include "utils.h"
+
+namespace tig_gamma {
+
+BackgroundPool::BackgroundPool() { next_id_ = 1; }
+
+BackgroundPool *BackgroundPool::GetInstance() {
+  // never deleted, the tasks of the engines left at exit may still run
+  static std::mutex mutex;
+  static BackgroundPool *instance = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (instance == nullptr) {
+    BackgroundPool *pool = new (std::nothrow) BackgroundPool();
+    if (pool != nullptr && pool->Init(kBackgroundThreads) == 0) {
+      instance = pool;
+    } else {
+      LOG(ERROR) << "init background pool error";
+      // the threads started are left waiting for tasks
+    }
+  }
+  return instance;
+}
+
+int BackgroundPool::Init(int threads) {
+  for (int i = 0; i < threads; ++i) {
+    try {
+      threads_.emplace_back(&BackgroundPool::Handler, this);
+    } catch (std::system_error &e) {
+      LOG(ERROR) << "create background thread error: " << e.what();
+      return -1;
+    }
+  }
+  LOG(INFO) << "background pool started, threads=" << threads;
+  return 0;
+}
+
+long BackgroundPool::Add(std::function<long()> task, long delay_ms) {
+  long id = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    id = next_id_++;
+    Task &t = tasks_[id];
+    t.fn = task;
+    t.next_ms = utils::getmillisecs() + delay_ms;
+    t.running = false;
+    t.woken = false;
+    t.removed = false;
+  }
+  cv_.notify_one();
+  return id;
+}
+
+void BackgroundPool::Wake(long id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tasks_.find(id);
+    if (it == tasks_.end()) return;
+    if (it->second.running) {
+      it->second.woken = true;
+      return;
+    }
+    it->second.next_ms = 0;
+  }
+  cv_.notify_one();
+}
+
+void BackgroundPool::Remove(long id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = tasks_.find(id);
+  if (it == tasks_.end()) return;
+  if (not it->second.running) {
+    tasks_.erase(it);
+    return;
+  }
+  it->second.removed = true;
+  done_cv_.wait(lock, [this, id] { return tasks_.count(id) == 0; });
+}
+
+size_t BackgroundPool::TaskNum() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.size();
+}
+
+void BackgroundPool::Handler() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // the earliest due task that is not running
+    long id = 0;
+    Task *task = nullptr;
+    for (auto &it : tasks_) {
+      if (it.second.running) continue;
+      if (task == nullptr || it.second.next_ms < task->next_ms) {
+        id = it.first;
+        task = &it.second;
+      }
+    }
+    if (task == nullptr) {
+      cv_.wait(lock);
+      continue;
+    }
+    double now = utils::getmillisecs();
+    if (task->next_ms > now) {
+      cv_.wait_for(lock,
+                   std::chrono::milliseconds((long)(task->next_ms - now) + 1));
+      continue;
+    }
+
+    // the node is not erased while it is running
+    task->running = true;
+    lock.unlock();
+    long wait_ms = task->fn();
+    lock.lock();
+    task->running = false;
+    if (task->removed || wait_ms < 0) {
+      tasks_.erase(id);
+      done_cv_.notify_all();
+    } else {
+      task->next_ms = task->woken ? 0 : utils::getmillisecs() + wait_ms;
+      task->woken = false;
+    }
+  }
+}
+
+}  // namespace tig_gamma
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef BACKGROUND_POOL_H_
+#define BACKGROUND_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tig_gamma {
+
+// threads of the background pool, shared by all the tables of the process
+const static int kBackgroundThreads = 4;
+
+/** runs the periodic background work of the tables (flush, compaction,
+ * prefetch and wal sync) on a few threads of the process instead of
+ * threads per table. A task returns the ms to wait before its next run,
+ * < 0 to end, and never runs on two threads at once.
+ */
+class BackgroundPool {
+ public:
+  static BackgroundPool *GetInstance();
+
+  /**
+   * @param task  returns the ms to wait before the next run, < 0 to end
+   * @param delay_ms  ms to wait before the first run
+   * @return task id, > 0
+   */
+  long Add(std::function<long()> task, long delay_ms);
+
+  // run the task as soon as a thread is free
+  void Wake(long id);
+
+  // waits for the running task to return, never call it from the task
+  void Remove(long id);
+
+  size_t TaskNum();
+
+ private:
+  BackgroundPool();
+
+  int Init(int threads);
+
+  void Handler();
+
+  struct Task {
+    std::function<long()> fn;
+    double next_ms;
+    bool running;
+    bool woken;    // woken while running
+    bool removed;  // removed while running
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cv_;       // the threads wait for due tasks
+  std::condition_variable done_cv_;  // Remove waits for the running task
+  std::map<long, Task> tasks_;
+  long next_id_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace tig_gamma
+
+#endif
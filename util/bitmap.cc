@@ -6,11 +6,42 @@
  */
 
 #include "bitmap.h"
+
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
 
 namespace bitmap {
 
+namespace {
+
+const long kPageBytes = 4096;
+const uint8_t kCommitted = 1;
+const uint8_t kDirty = 2;
+
+long PopCount(const char *data, long n) {
+  long count = 0;
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < n; i++) count += __builtin_popcount((uint8_t)data[i]);
+  return count;
+}
+
+}  // namespace
+
 int create(char *&bitmap, int &bytes_count, int size) {
   bytes_count = (size >> 3) + 1;
   bitmap = (char *)malloc(bytes_count);
@@ -29,4 +60,152 @@ void set(char *bitmap, int id) { bitmap[id >> 3] |= (0x1 << (id & 0x7)); }
 
 void unset(char *bitmap, int id) { bitmap[id >> 3] &= ~(0x1 << (id & 0x7)); }
 
+LazyBitmap::LazyBitmap() {
+  data_ = nullptr;
+  bytes_count_ = 0;
+}
+
+LazyBitmap::~LazyBitmap() {
+  if (data_ != nullptr) munmap(data_, bytes_count_);
+}
+
+int LazyBitmap::Init(int size) {
+  if (data_ != nullptr) return -1;
+  long bytes_count = ((long)size >> 3) + 1;
+  // untouched anonymous pages read as zeros and take no memory
+  void *p = mmap(nullptr, bytes_count, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) return -1;
+  data_ = (char *)p;
+  bytes_count_ = bytes_count;
+  std::vector<std::atomic<uint8_t>> pages((bytes_count + kPageBytes - 1) /
+                                          kPageBytes);
+  for (std::atomic<uint8_t> &page : pages) page.store(0);
+  pages_.swap(pages);
+  return 0;
+}
+
+void LazyBitmap::Touch(int id, uint8_t state) {
+  std::atomic<uint8_t> &page = pages_[(id >> 3) / kPageBytes];
+  if ((page.load(std::memory_order_relaxed) & state) != state) {
+    page.fetch_or(state, std::memory_order_release);
+  }
+}
+
+void LazyBitmap::Set(int id) {
+  Touch(id, kCommitted | kDirty);
+  set(data_, id);
+}
+
+void LazyBitmap::Unset(int id) {
+  std::atomic<uint8_t> &page = pages_[(id >> 3) / kPageBytes];
+  if ((page.load(std::memory_order_acquire) & kCommitted) == 0) return;
+  Touch(id, kDirty);
+  unset(data_, id);
+}
+
+long LazyBitmap::Count(int size) const {
+  long full_bytes = std::min((long)size >> 3, bytes_count_);
+  long count = 0;
+  for (size_t p = 0; p < pages_.size(); p++) {
+    long begin = p * kPageBytes;
+    if (begin >= full_bytes) break;
+    if ((pages_[p].load(std::memory_order_acquire) & kCommitted) == 0) continue;
+    count += PopCount(data_ + begin, std::min(kPageBytes, full_bytes - begin));
+  }
+  int rest = size & 0x7;
+  if (rest > 0 && full_bytes < bytes_count_ &&
+      (pages_[full_bytes / kPageBytes].load(std::memory_order_acquire) &
+       kCommitted)) {
+    count += __builtin_popcount((uint8_t)data_[full_bytes] & ((1 << rest) - 1));
+  }
+  return count;
+}
+
+long LazyBitmap::MemBytes() const {
+  long pages = 0;
+  for (const std::atomic<uint8_t> &page : pages_) {
+    if (page.load(std::memory_order_relaxed) & kCommitted) pages++;
+  }
+  return pages * kPageBytes;
+}
+
+int LazyBitmap::OpenDumped(const std::string &path) {
+  if (dumped_path_ == "") return -1;
+  if (dumped_path_ == path) return open(path.c_str(), O_WRONLY);
+#ifdef FICLONE
+  // the clone shares the blocks of the last dump until they are written
+  int src = open(dumped_path_.c_str(), O_RDONLY);
+  if (src < 0) return -1;
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd >= 0 && ioctl(fd, FICLONE, src) != 0) {
+    close(fd);
+    unlink(path.c_str());
+    fd = -1;
+  }
+  close(src);
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+int LazyBitmap::Dump(const std::string &path, int size) {
+  long bytes = std::min(((long)size >> 3) + 1, bytes_count_);
+  int fd = OpenDumped(path);
+  bool full = fd < 0;
+  if (full) fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+  // the dirty bit is cleared before the page is read, a bit set meanwhile
+  // dirties it again for the next dump
+  for (size_t p = 0; p < pages_.size(); p++) {
+    long begin = p * kPageBytes;
+    if (begin >= bytes) break;
+    uint8_t state =
+        pages_[p].fetch_and((uint8_t)~kDirty, std::memory_order_acq_rel);
+    if ((state & kCommitted) == 0 || (not full && (state & kDirty) == 0)) {
+      continue;
+    }
+    long len = std::min(kPageBytes, bytes - begin);
+    // the bits above size are written by a later dump
+    if (len < kPageBytes) {
+      pages_[p].fetch_or(kDirty, std::memory_order_relaxed);
+    }
+    if (pwrite(fd, data_ + begin, len, begin) != len) {
+      close(fd);
+      dumped_path_ = "";
+      return -1;
+    }
+  }
+  int ret = ftruncate(fd, bytes);
+  close(fd);
+  dumped_path_ = ret == 0 ? path : "";
+  return ret;
+}
+
+int LazyBitmap::Load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  long bytes = std::min((long)st.st_size, bytes_count_);
+  char page[kPageBytes];
+  for (long begin = 0; begin < bytes; begin += kPageBytes) {
+    long len = std::min(kPageBytes, bytes - begin);
+    if (pread(fd, page, len, begin) != len) {
+      close(fd);
+      return -1;
+    }
+    if (PopCount(page, len) == 0) continue;
+    memcpy(data_ + begin, page, len);
+    pages_[begin / kPageBytes].fetch_or(kCommitted, std::memory_order_release);
+  }
+  close(fd);
+  dumped_path_ = path;
+  return 0;
+}
+
 } // namespace bitmap
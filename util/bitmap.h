@@ -8,6 +8,12 @@
 #ifndef BITMAP_H_
 #define BITMAP_H_
 
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
 namespace bitmap {
 
 /* init a bitmap of which the total length is size */
@@ -22,6 +28,53 @@ void set(char *bitmap, int id);
 /* assume id not exceed the total size of bitmap */
 void unset(char *bitmap, int id);
 
+/** a bitmap whose address space is reserved at once and whose memory is
+ * committed page by page when a bit of the page is set first, so Data() can
+ * be shared with the readers of test() and a small table costs little.
+ */
+class LazyBitmap {
+ public:
+  LazyBitmap();
+
+  ~LazyBitmap();
+
+  int Init(int size);
+
+  const char *Data() const { return data_; }
+
+  bool Test(int id) const { return test(data_, id); }
+
+  void Set(int id);
+
+  void Unset(int id);
+
+  // number of set bits of [0, size)
+  long Count(int size) const;
+
+  long MemBytes() const;
+
+  /** write the bits of [0, size), the pages never set are left as holes of
+   * the file. Only the pages changed since the last dump or load are written
+   * if path is the file of it, or a clone of that file can be made */
+  int Dump(const std::string &path, int size);
+
+  // the zero pages of the file are not committed
+  int Load(const std::string &path);
+
+ private:
+  void Touch(int id, uint8_t state);
+
+  // the file the pages not dirty are in, the last one dumped or loaded
+  int OpenDumped(const std::string &path);
+
+  char *data_;
+  long bytes_count_;
+  // kCommitted and kDirty bits of each page, they are set by the writer
+  // while Count, MemBytes and Dump read them
+  std::vector<std::atomic<uint8_t>> pages_;
+  std::string dumped_path_;
+};
+
 } // namespace bitmap
 
 #endif
@@ -0,0 +1,497 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "large_alloc.h"
+
+#include <assert.h>
+#include <malloc.h>
+#include <omp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace large_alloc {
+
+namespace {
+
+const size_t kHugePage2M = 2UL << 20;
+const size_t kHugePage1G = 1UL << 30;
+// modes of mbind, numaif.h is not required
+const int kMpolBind = 2;
+const int kMpolInterleave = 3;
+const int kMaxNumaNodes = 1024;
+
+HugePage huge_page_ = HugePage::None;
+NumaPolicy numa_policy_ = NumaPolicy::Default;
+int numa_node_ = 0;
+std::atomic<bool> hugetlb_warned_(false);
+
+std::mutex mappings_mutex_;
+std::unordered_map<void *, size_t> mappings_;  // address -> mapped bytes
+
+// see SetMallocThresholds
+const int kMmapThreshold = 256 * 1024;
+const int kTrimThreshold = 32 * 1024 * 1024;
+// the heap is trimmed only if it has more free memory than it
+const size_t kHeapTrimMinBytes = 64UL << 20;
+
+/* the blocks of a size class are carved from 2M slabs which are never
+ * unmapped, the free blocks are returned by madvise so that the long lived
+ * structures don't fragment the malloc heap and the number of mappings is
+ * bounded */
+const size_t kSlabBytes = kHugePage2M;
+// 4K, 6K, 8K, 12K, ... 2M, two classes per power of two
+const int kClassNum = 19;
+
+struct SizeClass {
+  std::mutex mutex;
+  std::vector<void *> free_blocks;      // resident
+  std::vector<void *> returned_blocks;  // not resident
+  size_t block_num = 0;  // carved from the slabs
+};
+
+SizeClass classes_[kClassNum];
+// slab address -> size class, the slabs are kSlabBytes aligned
+std::mutex slabs_mutex_;
+std::unordered_map<uintptr_t, int> slabs_;
+std::atomic<size_t> returned_bytes_(0);
+std::atomic<long> reclaims_(0);
+
+inline size_t RoundUp(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+// parse a list of sysfs like "0-3,8,10-11"
+std::vector<int> ParseList(const std::string &path) {
+  std::vector<int> ids;
+  std::ifstream f(path);
+  std::string list;
+  if (!f.is_open() || !std::getline(f, list)) return ids;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    std::string item = list.substr(pos, end - pos);
+    int first = 0, last = 0;
+    int n = sscanf(item.c_str(), "%d-%d", &first, &last);
+    if (n == 1) last = first;
+    for (int i = first; n >= 1 && i <= last; i++) ids.push_back(i);
+    pos = end + 1;
+  }
+  return ids;
+}
+
+std::vector<int> OnlineNodes() {
+  return ParseList("/sys/devices/system/node/online");
+}
+
+void *MapHugetlb(size_t size, size_t page_size, int page_shift,
+                 size_t &mapped) {
+  mapped = RoundUp(size, page_size);
+  void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                     (page_shift << MAP_HUGE_SHIFT),
+                 -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+// map 2M aligned so that the transparent huge pages can back all of it
+void *MapAligned(size_t size, size_t &mapped) {
+  mapped = RoundUp(size, kHugePage2M);
+  size_t len = mapped + kHugePage2M;
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return nullptr;
+  uintptr_t begin = (uintptr_t)p;
+  uintptr_t aligned = RoundUp(begin, kHugePage2M);
+  if (aligned > begin) munmap(p, aligned - begin);
+  size_t tail = begin + len - (aligned + mapped);
+  if (tail > 0) munmap((void *)(aligned + mapped), tail);
+  return (void *)aligned;
+}
+
+inline size_t ClassBytes(int c) {
+  size_t base = kArenaAllocBytes << (c / 2);
+  return c % 2 ? base + base / 2 : base;
+}
+
+int SizeClassOf(size_t size) {
+  int c = 0;
+  while (ClassBytes(c) < size) c++;
+  return c;
+}
+
+void Mbind(void *addr, size_t len);
+
+size_t ResidentBytes() {
+  std::ifstream f("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  if (!(f >> pages >> resident)) return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// the bytes of the malloc heap and its free ones, false if malloc can't tell
+bool HeapBytes(size_t &bytes, size_t &free_bytes) {
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2();
+  bytes = info.arena + info.hblkhd;
+  free_bytes = info.fordblks;
+#else
+  // the fields are int, they wrap above 4G
+  struct mallinfo info = mallinfo();
+  bytes = (size_t)(unsigned int)info.arena + (unsigned int)info.hblkhd;
+  free_bytes = (unsigned int)info.fordblks;
+#endif
+  return true;
+#else
+  static std::once_flag once;
+  std::call_once(once, []() {
+    LOG(WARNING) << "malloc heap stats are not supported, the heap is not "
+                    "trimmed and its bytes are reported as 0";
+  });
+  bytes = free_bytes = 0;
+  return false;
+#endif
+}
+
+void *ArenaAlloc(size_t size) {
+  int c = SizeClassOf(size);
+  size_t block = ClassBytes(c);
+  SizeClass &cls = classes_[c];
+  std::lock_guard<std::mutex> lock(cls.mutex);
+  std::vector<void *> *blocks = &cls.free_blocks;
+  if (blocks->size() == 0) blocks = &cls.returned_blocks;
+  if (blocks->size() == 0) {
+    size_t mapped = 0;
+    void *slab = MapAligned(kSlabBytes, mapped);
+    if (slab == nullptr) {
+      LOG(ERROR) << "mmap slab error, size class=" << block
+                 << ", err=" << strerror(errno);
+      return nullptr;
+    }
+    Mbind(slab, mapped);
+    {
+      std::lock_guard<std::mutex> lock(slabs_mutex_);
+      slabs_[(uintptr_t)slab] = c;
+    }
+    // untouched, so they are not resident
+    for (size_t off = mapped; off >= block; off -= block) {
+      blocks->push_back((char *)slab + off - block);
+      cls.block_num++;
+    }
+  }
+  void *p = blocks->back();
+  blocks->pop_back();
+  return p;
+}
+
+// size class of the slab of ptr, -1 if it isn't an arena block
+int SlabClassOf(void *ptr) {
+  uintptr_t slab = (uintptr_t)ptr & ~(uintptr_t)(kSlabBytes - 1);
+  std::lock_guard<std::mutex> lock(slabs_mutex_);
+  auto it = slabs_.find(slab);
+  return it == slabs_.end() ? -1 : it->second;
+}
+
+void ArenaFree(void *ptr, int c) {
+  SizeClass &cls = classes_[c];
+  std::lock_guard<std::mutex> lock(cls.mutex);
+  cls.free_blocks.push_back(ptr);
+}
+
+size_t ReclaimArenas(size_t retain_bytes) {
+  size_t returned = 0;
+  for (int c = 0; c < kClassNum; c++) {
+    size_t block = ClassBytes(c);
+    SizeClass &cls = classes_[c];
+    std::vector<void *> blocks;
+    {
+      std::lock_guard<std::mutex> lock(cls.mutex);
+      size_t retain = retain_bytes / kClassNum / block;
+      // the most recently freed blocks are kept, they are reused first
+      size_t n = cls.free_blocks.size();
+      n = n > retain ? n - retain : 0;
+      blocks.assign(cls.free_blocks.begin(), cls.free_blocks.begin() + n);
+      cls.free_blocks.erase(cls.free_blocks.begin(),
+                            cls.free_blocks.begin() + n);
+    }
+    if (blocks.size() == 0) continue;
+    // no lock is held while the pages are dropped
+    for (void *p : blocks) madvise(p, block, MADV_DONTNEED);
+    returned += blocks.size() * block;
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    cls.returned_blocks.insert(cls.returned_blocks.end(), blocks.begin(),
+                               blocks.end());
+  }
+  return returned;
+}
+
+void Mbind(void *addr, size_t len) {
+  if (numa_policy_ == NumaPolicy::Default) return;
+  unsigned long mask[kMaxNumaNodes / 64] = {0};
+  int mode = kMpolBind;
+  if (numa_policy_ == NumaPolicy::Interleave) {
+    for (int node : OnlineNodes()) {
+      if (node < kMaxNumaNodes) mask[node / 64] |= 1UL << (node % 64);
+    }
+    mode = kMpolInterleave;
+  } else {
+    mask[numa_node_ / 64] |= 1UL << (numa_node_ % 64);
+  }
+  if (syscall(SYS_mbind, addr, len, mode, mask, kMaxNumaNodes, 0)) {
+    LOG(WARNING) << "mbind error, policy=" << (int)numa_policy_
+                 << ", err=" << strerror(errno);
+  }
+}
+
+// cpus of the bound node, false if the numa policy is not Bind
+bool BoundCpus(cpu_set_t &set) {
+  if (numa_policy_ != NumaPolicy::Bind) return false;
+  std::vector<int> cpus = ParseList("/sys/devices/system/node/node" +
+                                    std::to_string(numa_node_) + "/cpulist");
+  if (cpus.size() == 0) return false;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  return true;
+}
+
+}  // namespace
+
+void SetPolicy(HugePage huge_page, NumaPolicy numa_policy, int numa_node) {
+  if (huge_page > HugePage::Hugetlb1G) huge_page = HugePage::None;
+  if (numa_policy > NumaPolicy::Bind) numa_policy = NumaPolicy::Default;
+  if (numa_policy == NumaPolicy::Bind) {
+    std::vector<int> nodes = OnlineNodes();
+    if (numa_node < 0 || numa_node >= kMaxNumaNodes ||
+        std::find(nodes.begin(), nodes.end(), numa_node) == nodes.end()) {
+      LOG(ERROR) << "numa node " << numa_node << " is not online, ignored";
+      numa_policy = NumaPolicy::Default;
+    }
+  }
+  huge_page_ = huge_page;
+  numa_policy_ = numa_policy;
+  numa_node_ = numa_node;
+  LOG(INFO) << "large alloc huge page=" << (int)huge_page
+            << ", numa policy=" << (int)numa_policy
+            << ", numa node=" << numa_node << ", numa nodes=" << NumaNodeNum();
+}
+
+void SetMallocThresholds() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+#ifdef __GLIBC__
+    mallopt(M_MMAP_THRESHOLD, kMmapThreshold);
+    mallopt(M_TRIM_THRESHOLD, kTrimThreshold);
+    LOG(INFO) << "malloc mmap threshold=" << kMmapThreshold
+              << ", trim threshold=" << kTrimThreshold;
+#endif
+  });
+}
+
+void *Alloc(size_t size) {
+  if (size < kArenaAllocBytes) return malloc(size);
+  if (size < kLargeAllocBytes) return ArenaAlloc(size);
+  if (huge_page_ == HugePage::None && numa_policy_ == NumaPolicy::Default) {
+    return malloc(size);
+  }
+
+  size_t mapped = 0;
+  void *p = nullptr;
+  if (huge_page_ == HugePage::Hugetlb1G && size >= kHugePage1G) {
+    p = MapHugetlb(size, kHugePage1G, 30, mapped);
+  }
+  if (p == nullptr && (huge_page_ == HugePage::Hugetlb1G ||
+                       huge_page_ == HugePage::Hugetlb2M)) {
+    p = MapHugetlb(size, kHugePage2M, 21, mapped);
+    if (p == nullptr && !hugetlb_warned_.exchange(true)) {
+      LOG(WARNING) << "no reserved huge pages, use transparent huge pages";
+    }
+  }
+  if (p == nullptr) {
+    p = MapAligned(size, mapped);
+    if (p == nullptr) {
+      LOG(ERROR) << "mmap error, size=" << size << ", err=" << strerror(errno);
+      return nullptr;
+    }
+    if (huge_page_ != HugePage::None) madvise(p, mapped, MADV_HUGEPAGE);
+  }
+  Mbind(p, mapped);
+
+  std::lock_guard<std::mutex> lock(mappings_mutex_);
+  mappings_[p] = mapped;
+  return p;
+}
+
+void *Realloc(void *ptr, size_t old_size, size_t new_size) {
+  int c = ptr ? SlabClassOf(ptr) : -1;
+  if (c < 0 && old_size < kArenaAllocBytes && new_size < kArenaAllocBytes) {
+    return realloc(ptr, new_size);
+  }
+  if (c >= 0 && new_size >= kArenaAllocBytes && new_size < kLargeAllocBytes &&
+      SizeClassOf(new_size) == c) {
+    return ptr;
+  }
+  void *p = Alloc(new_size);
+  if (p == nullptr) return nullptr;
+  if (ptr) {
+    memcpy(p, ptr, std::min(old_size, new_size));
+    Free(ptr, old_size);
+  }
+  return p;
+}
+
+void Free(void *ptr, size_t size) {
+  if (ptr == nullptr) return;
+  int c = SlabClassOf(ptr);
+  if (c >= 0) {
+    if (size < kArenaAllocBytes || size >= kLargeAllocBytes ||
+        SizeClassOf(size) != c) {
+      LOG(ERROR) << "free size " << size << " of a " << ClassBytes(c)
+                 << " bytes arena block";
+      assert(false);
+    }
+    ArenaFree(ptr, c);
+    return;
+  }
+  if (size >= kArenaAllocBytes && size < kLargeAllocBytes) {
+    LOG(ERROR) << "free size " << size << " of a block not in the arenas";
+    assert(false);
+    return;  // leaked rather than freed to the wrong allocator
+  }
+  if (size >= kLargeAllocBytes) {
+    size_t mapped = 0;
+    {
+      std::lock_guard<std::mutex> lock(mappings_mutex_);
+      auto it = mappings_.find(ptr);
+      if (it != mappings_.end()) {
+        mapped = it->second;
+        mappings_.erase(it);
+      }
+    }
+    if (mapped > 0) {
+      munmap(ptr, mapped);
+      return;
+    }
+  }
+  free(ptr);
+}
+
+void PinThread() {
+  static thread_local bool pinned = false;
+  if (pinned || numa_policy_ != NumaPolicy::Bind) return;
+  pinned = true;
+
+  cpu_set_t set;
+  if (!BoundCpus(set)) return;
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    LOG(WARNING) << "pin thread to numa node " << numa_node_
+                 << " error, err=" << strerror(errno);
+  }
+}
+
+void PinOmpThreads() {
+  static thread_local bool pinned = false;
+  if (pinned || numa_policy_ != NumaPolicy::Bind) return;
+  pinned = true;
+
+  // the thread numbered 0 is the calling one
+#pragma omp parallel
+  if (omp_get_thread_num() != 0) PinThread();
+}
+
+ScopePin::ScopePin() : pinned_(false) {
+  cpu_set_t set;
+  if (!BoundCpus(set)) return;
+  if (sched_getaffinity(0, sizeof(saved_), &saved_)) return;
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    LOG(WARNING) << "pin thread to numa node " << numa_node_
+                 << " error, err=" << strerror(errno);
+    return;
+  }
+  pinned_ = true;
+}
+
+ScopePin::~ScopePin() {
+  if (pinned_ && sched_setaffinity(0, sizeof(saved_), &saved_)) {
+    LOG(WARNING) << "restore thread affinity error, err=" << strerror(errno);
+  }
+}
+
+int NumaNodeNum() {
+  int n = OnlineNodes().size();
+  return n > 0 ? n : 1;
+}
+
+void *Scratch(int slot, size_t size) {
+  // larger buffers are released when a smaller one is asked for
+  const size_t kMaxKeptBytes = 16UL << 20;
+  static thread_local std::vector<char> buffers[kScratchSlots];
+  std::vector<char> &buffer = buffers[slot];
+  if (buffer.capacity() > kMaxKeptBytes && size <= kMaxKeptBytes) {
+    std::vector<char>().swap(buffer);
+  }
+  if (buffer.size() < size) buffer.resize(size);
+  return buffer.data();
+}
+
+void GetMemStats(MemStats &stats) {
+  memset(&stats, 0, sizeof(stats));
+  HeapBytes(stats.heap_bytes, stats.heap_free_bytes);
+  for (int c = 0; c < kClassNum; c++) {
+    size_t block = ClassBytes(c);
+    SizeClass &cls = classes_[c];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    stats.arena_bytes += (cls.block_num - cls.returned_blocks.size()) * block;
+    stats.arena_free_bytes += cls.free_blocks.size() * block;
+  }
+  stats.returned_bytes = returned_bytes_;
+  stats.reclaims = reclaims_;
+}
+
+size_t Reclaim(size_t retain_bytes, bool trim_heap) {
+  size_t returned = ReclaimArenas(retain_bytes);
+#ifdef __GLIBC__
+  // the free chunks stay in the heap after their pages are dropped, so the
+  // returned bytes are measured by the resident ones
+  size_t heap_bytes = 0, heap_free_bytes = 0;
+  if (trim_heap && HeapBytes(heap_bytes, heap_free_bytes) &&
+      heap_free_bytes > retain_bytes + kHeapTrimMinBytes) {
+    size_t before = ResidentBytes();
+    malloc_trim(retain_bytes);
+    size_t after = ResidentBytes();
+    if (before > after) returned += before - after;
+  }
+#endif
+  if (returned > 0) {
+    returned_bytes_ += returned;
+    reclaims_++;
+  }
+  return returned;
+}
+
+}  // namespace large_alloc
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef LARGE_ALLOC_H_
+#define LARGE_ALLOC_H_
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace large_alloc {
+
+const size_t kLargeAllocBytes = 2 * 1024 * 1024;
+// [kArenaAllocBytes, kLargeAllocBytes) are served by the size class arenas,
+// smaller allocations by malloc
+const size_t kArenaAllocBytes = 4 * 1024;
+
+enum class HugePage : uint8_t {
+  None = 0,
+  Transparent,  // madvise(MADV_HUGEPAGE)
+  Hugetlb2M,    // reserved pages of hugetlbfs, transparent if there is none
+  Hugetlb1G
+};
+
+enum class NumaPolicy : uint8_t {
+  Default = 0,  // first touch
+  Interleave,   // pages are spread over all nodes
+  Bind          // pages are on one node, the search threads run on it
+};
+
+/* set the process wide policy, it applies to the later allocations */
+void SetPolicy(HugePage huge_page, NumaPolicy numa_policy, int numa_node);
+
+/* fix the glibc mmap and trim thresholds of the process, the dynamic ones
+ * grow with the freed mmapped blocks and move the large request buffers into
+ * the heap. It is applied once, the later calls do nothing */
+void SetMallocThresholds();
+
+/* the memory is not initialized */
+void *Alloc(size_t size);
+
+/* the first min(old_size, new_size) bytes are kept */
+void *Realloc(void *ptr, size_t old_size, size_t new_size);
+
+/* size must be the one passed to Alloc or Realloc, an arena block is freed
+ * to the size class of its slab whatever the size */
+void Free(void *ptr, size_t size);
+
+/* pin the calling thread to the cpus of the bound node, it does nothing if
+ * the numa policy is not Bind or the thread is pinned already. It is kept
+ * for the life of the thread, only the threads of the engine are pinned */
+void PinThread();
+
+/* pin the openmp worker threads of the calling thread with PinThread, the
+ * calling thread itself is not pinned. The workers are reused by the later
+ * parallel regions of the thread, so it does nothing after the first call
+ * on a thread */
+void PinOmpThreads();
+
+/* pin a thread the engine does not own, like PinThread, while it is in the
+ * scope and restore its affinity when it leaves */
+class ScopePin {
+ public:
+  ScopePin();
+
+  ~ScopePin();
+
+ private:
+  bool pinned_;
+  cpu_set_t saved_;
+};
+
+int NumaNodeNum();
+
+/* buffer of the calling thread reused across the requests, it is valid until
+ * the next call with the same slot on the thread */
+void *Scratch(int slot, size_t size);
+const int kScratchSlots = 4;
+
+struct MemStats {
+  size_t heap_bytes;        // obtained by malloc from the system
+  size_t heap_free_bytes;   // free in the malloc heap, the fragmentation
+  size_t arena_bytes;       // resident in the size class arenas
+  size_t arena_free_bytes;  // resident and not allocated
+  size_t returned_bytes;    // returned to the system since the start
+  long reclaims;
+};
+
+void GetMemStats(MemStats &stats);
+
+/* return the free memory above retain_bytes to the system, the malloc heap
+ * is trimmed only if its free memory is large enough to be worth the stall.
+ * The trim holds the malloc locks while it walks the heap, so it is skipped
+ * with trim_heap false while requests are running. It returns the bytes
+ * returned */
+size_t Reclaim(size_t retain_bytes, bool trim_heap = true);
+
+}  // namespace large_alloc
+
+#endif
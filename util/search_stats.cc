@@ -0,0 +1,72 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "search_stats.h"
+
+namespace search_stats {
+
+namespace {
+
+const char *kStageNames[kStageNum] = {"filter",    "quantize", "search",
+                                      "pack",      "serialize", "total",
+                                      "rerank"};
+
+}  // namespace
+
+Histogram::Histogram() {
+  for (int i = 0; i < kBuckets; i++) buckets_[i] = 0;
+  count_ = 0;
+  max_ = 0;
+}
+
+int Histogram::Bucket(long us) {
+  if (us < (1L << kSubBits)) return (int)us;
+  int exp = 63 - __builtin_clzl(us);
+  int sub = (int)(us >> (exp - kSubBits)) & ((1 << kSubBits) - 1);
+  return ((exp - kSubBits + 1) << kSubBits) + sub;
+}
+
+long Histogram::BucketUpper(int bucket) {
+  if (bucket < (1 << kSubBits)) return bucket;
+  int exp = (bucket >> kSubBits) + kSubBits - 1;
+  long sub = bucket & ((1 << kSubBits) - 1);
+  return (((1L << kSubBits) + sub + 1) << (exp - kSubBits)) - 1;
+}
+
+void Histogram::Record(long us) {
+  if (us < 0) us = 0;
+  buckets_[Bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  long max = max_.load(std::memory_order_relaxed);
+  while (us > max &&
+         !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+long Histogram::Percentile(double p) const {
+  long count = Count();
+  if (count == 0) return 0;
+  long rank = (long)(p * count);
+  if (rank < 1) rank = 1;
+  long seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      long upper = BucketUpper(i);
+      return upper < Max() ? upper : Max();
+    }
+  }
+  return Max();
+}
+
+SearchStats::SearchStats() {
+  for (int i = 0; i < kCounterNum; i++) counters_[i] = 0;
+}
+
+const char *StageName(Stage stage) { return kStageNames[(int)stage]; }
+
+}  // namespace search_stats
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef SEARCH_STATS_H_
+#define SEARCH_STATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace search_stats {
+
+enum class Stage : uint8_t {
+  Filter = 0,  // range and term filters
+  Quantize,    // coarse quantization of the ivf indexes
+  Search,      // vector search of all fields, quantization included
+  Pack,        // fetch the fields of the results
+  Serialize,   // response to flatbuffers
+  Total,       // admitted to packed
+  Rerank       // recalled vectors ranked by their raw vectors, per query
+};
+const int kStageNum = 7;
+
+enum class Counter : uint8_t {
+  ListsProbed = 0,  // inverted lists scanned
+  CodesScanned,     // distances computed by the list scans
+  Reranked          // recalled vectors ranked by their raw vectors
+};
+const int kCounterNum = 3;
+
+/** lock-free latency histogram in microseconds, the buckets are 8 linear
+ * sub buckets per power of two, so a percentile is within 12.5%
+ */
+class Histogram {
+ public:
+  Histogram();
+
+  void Record(long us);
+
+  long Count() const { return count_.load(std::memory_order_relaxed); }
+
+  long Max() const { return max_.load(std::memory_order_relaxed); }
+
+  // upper bound of the bucket of the percentile, p in (0, 1]
+  long Percentile(double p) const;
+
+ private:
+  const static int kSubBits = 3;
+  const static int kBuckets = 64 << kSubBits;
+
+  static int Bucket(long us);
+
+  static long BucketUpper(int bucket);
+
+  std::atomic<long> buckets_[kBuckets];
+  std::atomic<long> count_;
+  std::atomic<long> max_;
+};
+
+/** stage latencies and work counters of the searches of one engine, the
+ * engine passes it down to its indexes through the retrieval context
+ */
+class SearchStats {
+ public:
+  SearchStats();
+
+  void Record(Stage stage, long us) { histograms_[(int)stage].Record(us); }
+
+  void Add(Counter counter, long n) {
+    counters_[(int)counter].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  const Histogram &GetHistogram(Stage stage) const {
+    return histograms_[(int)stage];
+  }
+
+  long GetCounter(Counter counter) const {
+    return counters_[(int)counter].load(std::memory_order_relaxed);
+  }
+
+ private:
+  Histogram histograms_[kStageNum];
+  std::atomic<long> counters_[kCounterNum];
+};
+
+const char *StageName(Stage stage);
+
+}  // namespace search_stats
+
+#endif
@@ -166,6 +166,27 @@ struct FileIO {
   std::string Path() { return path; }
 };
 
+/** keeps the bytes of a background job within bytes_per_sec, Consume sleeps
+ * when the job is ahead of its budget. bytes_per_sec <= 0 is unlimited.
+ */
+struct IoThrottle {
+  long bytes_per_sec;
+  long bytes;
+  double begin_ms;
+
+  explicit IoThrottle(long bytes_per_sec_)
+      : bytes_per_sec(bytes_per_sec_), bytes(0), begin_ms(getmillisecs()) {}
+
+  void Consume(long n) {
+    if (bytes_per_sec <= 0) return;
+    bytes += n;
+    double ahead_ms = bytes * 1e3 / bytes_per_sec - (getmillisecs() - begin_ms);
+    if (ahead_ms >= 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds((long)ahead_ms));
+    }
+  }
+};
+
 template <typename callable, class... arguments>
 void AsyncWait(int after, callable &&f, arguments &&... args) {
   std::function<typename std::result_of<callable(arguments...)>::type()> task(
@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include "error_code.h"
+#include "large_alloc.h"
 
 using std::string;
 #ifdef WITH_ROCKSDB
@@ -32,7 +33,7 @@ MemoryRawVector::MemoryRawVector(VectorMetaInfo *meta_info,
 
 MemoryRawVector::~MemoryRawVector() {
   for (int i = 0; i < nsegments_; i++) {
-    CHECK_DELETE_ARRAY(segments_[i]);
+    large_alloc::Free(segments_[i], (size_t)segment_size_ * vector_byte_size_);
   }
   CHECK_DELETE_ARRAY(segments_);
 }
@@ -77,8 +78,8 @@ int MemoryRawVector::ExtendSegments() {
     LOG(ERROR) << this->desc_ << "segment number can't be > " << kMaxSegments;
     return LIMIT_ERR;
   }
-  segments_[nsegments_] =
-      new (std::nothrow) uint8_t[segment_size_ * vector_byte_size_];
+  segments_[nsegments_] = (uint8_t *)large_alloc::Alloc(
+      (size_t)segment_size_ * vector_byte_size_);
   current_segment_ = segments_[nsegments_];
   if (current_segment_ == nullptr) {
     LOG(ERROR) << this->desc_
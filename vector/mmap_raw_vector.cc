@@ -51,23 +51,43 @@ int MmapRawVector::InitStore(std::string &vec_name) {
   options.segment_size = store_params_.segment_size;
   options.fixed_value_bytes = vector_byte_size_;
   options.seg_block_capacity = seg_block_capacity;
+  options.sync_policy = (disk_io::SyncPolicy)store_params_.sync_policy;
+  options.sync_interval_ms = store_params_.sync_interval_ms;
+  options.table_id = store_params_.table_id;
   storage_mgr_ = new StorageManager(vec_dir, BlockType::VectorBlockType, options);
-#ifdef WITH_ZFP
-  if(!store_params_.compress.IsEmpty()) {
+  if (!store_params_.compress.IsEmpty()) {
     if (meta_info_->DataType() != VectorValueType::FLOAT) {
       LOG(ERROR) << "data type is not float, compress is unsupported";
       return PARAM_ERR;
     }
-    int res = storage_mgr_->UseCompress(CompressType::Zfp, meta_info_->Dimension());
-    if(res == 0) {
-      LOG(INFO) << "Storage_manager use zfp compress vector";
+    // zfp is the default for the compress params which only set a rate
+    std::string type = "zfp";
+    store_params_.compress.GetString("type", type);
+    CompressType compress_type = CompressType::NotCompress;
+    if (type == "zfp") {
+      compress_type = CompressType::Zfp;
+    } else if (type == "fp16") {
+      compress_type = CompressType::Fp16;
+    } else if (type == "bf16") {
+      compress_type = CompressType::Bf16;
+    } else if (type == "sq8") {
+      compress_type = CompressType::Sq8;
     } else {
-      LOG(INFO) << "ZFP initialization failed, not use zfp";
+      LOG(ERROR) << "unsupported compress type=" << type;
+      return PARAM_ERR;
+    }
+    double rate = -1;
+    store_params_.compress.GetDouble("rate", rate);
+    int res = storage_mgr_->UseCompress(compress_type, meta_info_->Dimension(),
+                                        rate);
+    if (res == 0) {
+      LOG(INFO) << "Storage_manager use " << type << " compress vector";
+    } else {
+      LOG(INFO) << type << " initialization failed, not use compress";
     }
-  }else {
-    LOG(INFO) << "store_params_.compress.IsEmpty() is true, not use zfp";
+  } else {
+    LOG(INFO) << "store_params_.compress.IsEmpty() is true, not use compress";
   }
-#endif
   int ret = storage_mgr_->Init(store_params_.cache_size, vec_name);
   if (ret) {
     LOG(ERROR) << "init gamma db error, ret=" << ret;
@@ -105,6 +125,20 @@ int MmapRawVector::GetCacheSize(uint32_t &cache_size) {
   return 0;
 }
 
+int MmapRawVector::Gets(const std::vector<int64_t> &vids,
+                        ScopeVectors &vecs) const {
+  if (vids.size() > 1) storage_mgr_->Prefetch(vids);
+  return RawVector::Gets(vids, vecs);
+}
+
+int MmapRawVector::PrefetchHint(const std::vector<int64_t> &vids) const {
+  return storage_mgr_->PrefetchAsync(vids);
+}
+
+int MmapRawVector::Prefetch(const std::vector<int64_t> &vids) const {
+  return storage_mgr_->Prefetch(vids);
+}
+
 int MmapRawVector::GetVector(long vid, const uint8_t *&vec,
                              bool &deletable) const {
   deletable = true;
@@ -29,6 +29,13 @@ class MmapRawVector : public RawVector {
                       std::vector<int> &lens) override;
   int UpdateToStore(int vid, uint8_t *v, int len) override;
 
+  // loads the missing blocks of vids in one batch before reading them
+  int Gets(const std::vector<int64_t> &vids, ScopeVectors &vecs) const override;
+
+  int PrefetchHint(const std::vector<int64_t> &vids) const override;
+
+  int Prefetch(const std::vector<int64_t> &vids) const override;
+
   int AlterCacheSize(uint32_t cache_size) override;
 
   int GetCacheSize(uint32_t &cache_size) override;
@@ -40,7 +47,7 @@ class MmapRawVector : public RawVector {
   int Extend();
   std::string NextSegmentFilePath();
 
- private:
+ protected:
   friend MmapRawVectorIO;
   StorageManager *storage_mgr_;
 };
@@ -213,7 +213,14 @@ int RawVector::Init(std::string vec_name, bool has_source, bool multi_vids) {
   vector_byte_size_ = meta_info_->Dimension() * data_size_;
 
 #ifdef WITH_ZFP
+  std::string compress_type = "zfp";
+  store_params_.compress.GetString("type", compress_type);
   if (!store_params_.compress.IsEmpty() && allow_use_zpf) {
+    if (compress_type != "zfp") {
+      LOG(ERROR) << "compress type " << compress_type
+                 << " is only supported by mmap vectors";
+      return PARAM_ERR;
+    }
     if (meta_info_->DataType() != VectorValueType::FLOAT) {
       LOG(ERROR) << "data type is not float, compress is unsupported";
       return PARAM_ERR;
@@ -397,6 +404,30 @@ int StoreParams::Parse(utils::JsonParser &jp) {
     }
   }
 
+  if (!jp.GetInt("sync_policy", sync_policy)) {
+    if (sync_policy < 0 || sync_policy > 2) {
+      LOG(ERROR) << "invalid sync policy=" << sync_policy;
+      return -1;
+    }
+  }
+
+  if (!jp.GetInt("sync_interval_ms", sync_interval_ms)) {
+    if (sync_interval_ms <= 0) {
+      LOG(ERROR) << "invalid sync interval=" << sync_interval_ms;
+      return -1;
+    }
+  }
+
+  double hot_cache_size = 0;
+  if (!jp.GetDouble("hot_cache_size", hot_cache_size)) {
+    if (hot_cache_size > MAX_CACHE_SIZE || hot_cache_size < 0) {
+      LOG(ERROR) << "invalid hot cache size=" << hot_cache_size << "M"
+                 << ", limit size=" << MAX_CACHE_SIZE << "M";
+      return -1;
+    }
+    this->hot_cache_size = hot_cache_size;
+  }
+
   if (jp.Contains("compress") && jp.GetObject("compress", compress)) {
     LOG(ERROR) << "parse compress error";
     return -1;
@@ -408,6 +439,9 @@ int StoreParams::Parse(utils::JsonParser &jp) {
 int StoreParams::MergeRight(StoreParams &other) {
   cache_size = other.cache_size;
   segment_size = other.segment_size;
+  sync_policy = other.sync_policy;
+  sync_interval_ms = other.sync_interval_ms;
+  hot_cache_size = other.hot_cache_size;
   // compress.MergeRight(other.compress);
   return 0;
 }
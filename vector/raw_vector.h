@@ -31,10 +31,18 @@ struct StoreParams : DumpConfig {
   long cache_size;  // bytes
   int segment_size;
   utils::JsonParser compress;
+  int sync_policy;  // disk_io::SyncPolicy: 0 none, 1 interval, 2 batch
+  int sync_interval_ms;
+  long hot_cache_size;  // M, memory of the hot vectors of tiered storage
+  int table_id;  // cache quota of the table, set by the engine, not dumped
 
   StoreParams(std::string name_ = "") : DumpConfig(name_) {
     cache_size = 1024;  // 1024M
     segment_size = 500000;
+    sync_policy = 0;
+    sync_interval_ms = 1000;
+    hot_cache_size = 256;
+    table_id = -1;
   }
 
   StoreParams(const StoreParams &other) {
@@ -42,6 +50,10 @@ struct StoreParams : DumpConfig {
     cache_size = other.cache_size;
     segment_size = other.segment_size;
     compress = other.compress;
+    sync_policy = other.sync_policy;
+    sync_interval_ms = other.sync_interval_ms;
+    hot_cache_size = other.hot_cache_size;
+    table_id = other.table_id;
   }
 
   int Parse(const char *str);
@@ -53,6 +65,9 @@ struct StoreParams : DumpConfig {
     ss << "{";
     ss << "\"cache_size\":" << cache_size << ",";
     ss << "\"segment_size\":" << segment_size << ",";
+    ss << "\"sync_policy\":" << sync_policy << ",";
+    ss << "\"sync_interval_ms\":" << sync_interval_ms << ",";
+    ss << "\"hot_cache_size\":" << hot_cache_size << ",";
     ss << "\"compress\":" << compress.ToStr();
     ss << "}";
     return ss.str();
@@ -61,6 +76,9 @@ struct StoreParams : DumpConfig {
   int ToJson(utils::JsonParser &jp) {
     jp.PutDouble("cache_size", cache_size);
     jp.PutInt("segment_size", segment_size);
+    jp.PutInt("sync_policy", sync_policy);
+    jp.PutInt("sync_interval_ms", sync_interval_ms);
+    jp.PutDouble("hot_cache_size", hot_cache_size);
     jp.PutObject("compress", compress);
     return 0;
   }
@@ -140,6 +158,11 @@ class RawVector : public VectorReader {
    */
   int Add(int docid, struct Field &field);
 
+  // the value holds one vector of the dimension
+  bool ValidValueLen(size_t len) const {
+    return len == (size_t)data_size_ * meta_info_->Dimension();
+  }
+
   int Update(int docid, struct Field &field);
 
   virtual size_t GetStoreMemUsage() { return 0; }
@@ -10,6 +10,7 @@
 #include "memory_raw_vector.h"
 #include "mmap_raw_vector.h"
 #include "raw_vector.h"
+#include "tiered_raw_vector.h"
 
 #ifdef WITH_ROCKSDB
 #include "rocksdb_raw_vector.h"
@@ -51,6 +52,11 @@ class RawVectorFactory {
                                        docids_bitmap);
         vio = new MmapRawVectorIO((MmapRawVector *)raw_vector);
         break;
+      case VectorStorageType::Tiered:
+        raw_vector = new TieredRawVector(meta_info, root_path, store_params,
+                                         docids_bitmap);
+        vio = new MmapRawVectorIO((MmapRawVector *)raw_vector);
+        break;
 #ifdef WITH_ROCKSDB
       case VectorStorageType::RocksDB:
         raw_vector = new RocksDBRawVector(meta_info, root_path, store_params,
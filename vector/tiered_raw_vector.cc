@@ -0,0 +1,250 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "tiered_raw_vector.h"
+
+#include <string.h>
+
+#include "error_code.h"
+#include "log.h"
+
+namespace tig_gamma {
+
+TieredRawVector::TieredRawVector(VectorMetaInfo *meta_info,
+                                 const std::string &root_path,
+                                 const StoreParams &store_params,
+                                 const char *docids_bitmap)
+    : MmapRawVector(meta_info, root_path, store_params, docids_bitmap) {
+  shards_ = nullptr;
+  hot_cache_size_ = 0;
+  hot_hits_ = 0;
+  reads_ = 0;
+}
+
+TieredRawVector::~TieredRawVector() {
+  FreeShards();
+  CHECK_DELETE_ARRAY(shards_);
+}
+
+int TieredRawVector::InitStore(std::string &vec_name) {
+  int ret = MmapRawVector::InitStore(vec_name);
+  if (ret) return ret;
+
+  shards_ = new (std::nothrow) Shard[kTierShards];
+  if (shards_ == nullptr) {
+    LOG(ERROR) << "new tier shards error, name=" << meta_info_->Name();
+    return INTERNAL_ERR;
+  }
+  ret = InitShards(store_params_.hot_cache_size);
+  if (ret) return ret;
+  LOG(INFO) << "init tiered raw vector success! hot cache size="
+            << hot_cache_size_ << "M, hot slots="
+            << (long)shards_[0].capacity * kTierShards;
+  return 0;
+}
+
+int TieredRawVector::InitShards(long hot_cache_size) {
+  long slots = hot_cache_size * 1024 * 1024 / vector_byte_size_ / kTierShards;
+  for (int i = 0; i < kTierShards; i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    CHECK_DELETE_ARRAY(shard.arena);
+    shard.capacity = shard.used = shard.hand = 0;
+    shard.slots.clear();
+    shard.cold_counts.clear();
+    shard.slot_vids.clear();
+    shard.slot_counts.clear();
+    if (slots == 0) continue;
+
+    shard.arena = new (std::nothrow) uint8_t[slots * vector_byte_size_];
+    if (shard.arena == nullptr) {
+      LOG(ERROR) << "new hot arena error, slots=" << slots
+                 << ", name=" << meta_info_->Name();
+      return INTERNAL_ERR;
+    }
+    shard.capacity = (int)slots;
+    shard.slot_vids.resize(slots, -1);
+    shard.slot_counts.resize(slots, 0);
+  }
+  hot_cache_size_ = hot_cache_size;
+  return 0;
+}
+
+void TieredRawVector::FreeShards() {
+  if (shards_ == nullptr) return;
+  for (int i = 0; i < kTierShards; i++) {
+    CHECK_DELETE_ARRAY(shards_[i].arena);
+  }
+}
+
+int TieredRawVector::GetVector(long vid, const uint8_t *&vec,
+                               bool &deletable) const {
+  if (vid < 0) return MmapRawVector::GetVector(vid, vec, deletable);
+  Shard &shard = shards_[vid % kTierShards];
+  reads_.fetch_add(1, std::memory_order_relaxed);
+  long seq = 0;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    seq = shard.update_seq;
+    auto it = shard.slots.find(vid);
+    if (it != shard.slots.end()) {
+      int slot = it->second;
+      if (shard.slot_counts[slot] < 255) ++shard.slot_counts[slot];
+      // a copy, the slot may be reused once the lock is released
+      uint8_t *v = new (std::nothrow) uint8_t[vector_byte_size_];
+      if (v == nullptr) return INTERNAL_ERR;
+      memcpy(v, shard.arena + (size_t)slot * vector_byte_size_,
+             vector_byte_size_);
+      vec = v;
+      deletable = true;
+      hot_hits_.fetch_add(1, std::memory_order_relaxed);
+      return 0;
+    }
+  }
+
+  int ret = MmapRawVector::GetVector(vid, vec, deletable);
+  if (ret == 0 && vec != nullptr) Admit(shard, vid, vec, seq);
+  return ret;
+}
+
+void TieredRawVector::ColdVids(const std::vector<int64_t> &vids,
+                               std::vector<int64_t> &cold_vids) const {
+  cold_vids.reserve(vids.size());
+  for (int64_t vid : vids) {
+    if (vid < 0) continue;
+    Shard &shard = shards_[vid % kTierShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.slots.find(vid) == shard.slots.end()) cold_vids.push_back(vid);
+  }
+}
+
+int TieredRawVector::Gets(const std::vector<int64_t> &vids,
+                          ScopeVectors &vecs) const {
+  std::vector<int64_t> cold_vids;
+  ColdVids(vids, cold_vids);
+  if (cold_vids.size() > 1) storage_mgr_->Prefetch(cold_vids);
+  return RawVector::Gets(vids, vecs);
+}
+
+int TieredRawVector::PrefetchHint(const std::vector<int64_t> &vids) const {
+  std::vector<int64_t> cold_vids;
+  ColdVids(vids, cold_vids);
+  return storage_mgr_->PrefetchAsync(cold_vids);
+}
+
+int TieredRawVector::Prefetch(const std::vector<int64_t> &vids) const {
+  std::vector<int64_t> cold_vids;
+  ColdVids(vids, cold_vids);
+  return storage_mgr_->Prefetch(cold_vids);
+}
+
+void TieredRawVector::Admit(Shard &shard, long vid, const uint8_t *vec,
+                            long seq) const {
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.capacity == 0 || shard.slots.find(vid) != shard.slots.end()) {
+    return;
+  }
+  uint8_t &count = shard.cold_counts[vid];
+  if (count < 255) ++count;
+  if (count < kPromoteCount) {
+    if (shard.cold_counts.size() > (size_t)shard.capacity * 4 + 1024) {
+      DecayColdCounts(shard);
+    }
+    return;
+  }
+  // the vector may be older than an update which found no hot slot, the
+  // count is kept and the next read promotes it
+  if (shard.update_seq != seq) return;
+  uint8_t hot_count = count;
+
+  int slot = TakeSlot(shard);
+  if (slot < 0) return;
+  memcpy(shard.arena + (size_t)slot * vector_byte_size_, vec,
+         vector_byte_size_);
+  shard.slot_vids[slot] = vid;
+  shard.slot_counts[slot] = hot_count;
+  shard.slots[vid] = slot;
+  shard.cold_counts.erase(vid);
+}
+
+int TieredRawVector::TakeSlot(Shard &shard) const {
+  if (shard.used < shard.capacity) return shard.used++;
+
+  for (int i = 0; i < kClockMaxSteps; i++) {
+    int slot = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.capacity;
+    if (shard.slot_counts[slot] > 0) {
+      shard.slot_counts[slot] >>= 1;
+      continue;
+    }
+    shard.slots.erase(shard.slot_vids[slot]);
+    shard.slot_vids[slot] = -1;
+    return slot;
+  }
+  return -1;
+}
+
+void TieredRawVector::DecayColdCounts(Shard &shard) const {
+  for (auto it = shard.cold_counts.begin(); it != shard.cold_counts.end();) {
+    it->second >>= 1;
+    if (it->second == 0) {
+      it = shard.cold_counts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int TieredRawVector::UpdateToStore(int vid, uint8_t *v, int len) {
+  int ret = MmapRawVector::UpdateToStore(vid, v, len);
+  if (ret) return ret;
+
+  Shard &shard = shards_[vid % kTierShards];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  ++shard.update_seq;
+  auto it = shard.slots.find(vid);
+  if (it != shard.slots.end()) {
+    memcpy(shard.arena + (size_t)it->second * vector_byte_size_, v,
+           vector_byte_size_);
+  }
+  return 0;
+}
+
+size_t TieredRawVector::GetStoreMemUsage() {
+  if (shards_ == nullptr) return 0;
+  size_t bytes = 0;
+  for (int i = 0; i < kTierShards; i++) {
+    bytes += (size_t)shards_[i].capacity * vector_byte_size_;
+  }
+  return bytes;
+}
+
+int TieredRawVector::AlterHotCacheSize(uint32_t hot_cache_size) {
+  if (shards_ == nullptr) return -1;
+  int ret = InitShards(hot_cache_size);
+  LOG(INFO) << "alter hot cache size=" << hot_cache_size
+            << "M, name=" << meta_info_->Name() << ", ret=" << ret;
+  return ret;
+}
+
+int TieredRawVector::GetHotCacheSize(uint32_t &hot_cache_size) {
+  if (shards_ == nullptr) return -1;
+  hot_cache_size = (uint32_t)hot_cache_size_;
+  return 0;
+}
+
+void TieredRawVector::GetTierHits(long &hot_hits, long &hot_reads,
+                                  long &cold_hits, long &cold_reads) {
+  hot_hits = hot_hits_;
+  hot_reads = reads_;
+  size_t hits = 0, misses = 0;
+  if (storage_mgr_) storage_mgr_->GetCacheHits(hits, misses);
+  cold_hits = (long)hits;
+  cold_reads = (long)(hits + misses);
+}
+
+}  // namespace tig_gamma
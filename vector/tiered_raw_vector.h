@@ -0,0 +1,109 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef TIERED_RAW_VECTOR_H_
+#define TIERED_RAW_VECTOR_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mmap_raw_vector.h"
+
+namespace tig_gamma {
+
+const static int kTierShards = 16;
+// cold reads of a vector before it is promoted
+const static uint8_t kPromoteCount = 4;
+// max slots visited by the clock hand to find a victim
+const static int kClockMaxSteps = 64;
+
+/** all vectors are stored in mmap segments (the cold tier), the frequently
+ * read ones are copied into an in-memory arena (the hot tier) within
+ * hot_cache_size. A cold vector is promoted after kPromoteCount reads, the
+ * victim is chosen by a clock over the access counters of the hot slots,
+ * which are halved when the hand passes.
+ */
+class TieredRawVector : public MmapRawVector {
+ public:
+  TieredRawVector(VectorMetaInfo *meta_info, const std::string &root_path,
+                  const StoreParams &store_params, const char *docids_bitmap);
+  ~TieredRawVector();
+
+  int InitStore(std::string &vec_name) override;
+
+  int UpdateToStore(int vid, uint8_t *v, int len) override;
+
+  // only the cold vids are prefetched
+  int Gets(const std::vector<int64_t> &vids, ScopeVectors &vecs) const override;
+
+  int PrefetchHint(const std::vector<int64_t> &vids) const override;
+
+  int Prefetch(const std::vector<int64_t> &vids) const override;
+
+  size_t GetStoreMemUsage() override;
+
+  // unit: M, the hot vectors are dropped when it is altered
+  int AlterHotCacheSize(uint32_t hot_cache_size);
+
+  int GetHotCacheSize(uint32_t &hot_cache_size);
+
+  // reads of the hot tier and of the block cache of the cold tier
+  void GetTierHits(long &hot_hits, long &hot_reads, long &cold_hits,
+                   long &cold_reads);
+
+ protected:
+  int GetVector(long vid, const uint8_t *&vec, bool &deletable) const override;
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    uint8_t *arena;
+    int capacity;  // slots
+    int used;
+    int hand;
+    std::vector<long> slot_vids;
+    std::vector<uint8_t> slot_counts;
+    std::unordered_map<long, int> slots;  // vid -> slot
+    std::unordered_map<long, uint8_t> cold_counts;
+    // bumped by the updates of the shard, a cold read taken before an update
+    // is not promoted
+    long update_seq;
+
+    Shard()
+        : arena(nullptr), capacity(0), used(0), hand(0), update_seq(0) {}
+  };
+
+  int InitShards(long hot_cache_size);
+
+  void FreeShards();
+
+  /** count a cold read and promote the vector if it is hot enough, it is
+   * not promoted if the shard was updated after seq, the update_seq before
+   * the read
+   */
+  void Admit(Shard &shard, long vid, const uint8_t *vec, long seq) const;
+
+  // a free slot or the one of the demoted vector, -1 if none is found
+  int TakeSlot(Shard &shard) const;
+
+  void DecayColdCounts(Shard &shard) const;
+
+  void ColdVids(const std::vector<int64_t> &vids,
+                std::vector<int64_t> &cold_vids) const;
+
+  Shard *shards_;
+  long hot_cache_size_;  // M
+  mutable std::atomic<long> hot_hits_;
+  mutable std::atomic<long> reads_;
+};
+
+}  // namespace tig_gamma
+
+#endif  // TIERED_RAW_VECTOR_H_
@@ -7,6 +7,11 @@
 
 #include "vector_manager.h"
 
+#include <algorithm>
+#include <unordered_set>
+
+#include "faiss/utils/Heap.h"
+#include "faiss/utils/distances.h"
 #include "raw_vector_factory.h"
 #include "utils.h"
 
@@ -14,6 +19,11 @@ using namespace std;
 
 namespace tig_gamma {
 
+static const int kMinIndexChunk = 100;
+static const int kMaxIndexChunk = 100000;
+// cache name suffix of the hot tier of a tiered vector field
+static const char *kHotCacheSuffix = "_hot";
+
 static bool InnerProductCmp(const VectorDoc *a, const VectorDoc *b) {
   return a->score > b->score;
 }
@@ -24,11 +34,14 @@ static bool L2Cmp(const VectorDoc *a, const VectorDoc *b) {
 
 VectorManager::VectorManager(const VectorStorageType &store_type,
                              const char *docids_bitmap,
-                             const std::string &root_path)
+                             const std::string &root_path, int table_id)
     : default_store_type_(store_type),
       docids_bitmap_(docids_bitmap),
-      root_path_(root_path) {
+      root_path_(root_path),
+      table_id_(table_id) {
   table_created_ = false;
+  index_ms_per_vec_ = 0;
+  unindexed_search_limit_ = kUnindexedSearchLimit;
 }
 
 VectorManager::~VectorManager() { Close(); }
@@ -84,6 +97,8 @@ int VectorManager::CreateVectorTable(TableInfo &table,
         store_type = VectorStorageType::MemoryOnly;
       } else if (!strcasecmp("Mmap", store_type_str.c_str())) {
         store_type = VectorStorageType::Mmap;
+      } else if (!strcasecmp("Tiered", store_type_str.c_str())) {
+        store_type = VectorStorageType::Tiered;
 #ifdef WITH_ROCKSDB
       } else if (!strcasecmp("RocksDB", store_type_str.c_str())) {
         store_type = VectorStorageType::RocksDB;
@@ -126,6 +141,7 @@ int VectorManager::CreateVectorTable(TableInfo &table,
       LOG(INFO) << "after merge, store parameters [" << store_params.ToJsonStr()
                 << "]";
     }
+    store_params.table_id = table_id_;
 
     RawVector *vec = RawVectorFactory::Create(
         meta_info, store_type, vec_root_path, store_params, docids_bitmap_);
@@ -197,6 +213,50 @@ int VectorManager::AddToStore(int docid, std::vector<struct Field> &fields) {
   return ret;
 }
 
+int VectorManager::CheckFields(const std::vector<struct Field> &fields) {
+  for (const struct Field &field : fields) {
+    auto it = raw_vectors_.find(field.name);
+    if (it == raw_vectors_.end()) continue;
+    if (!it->second->ValidValueLen(field.value.size())) {
+      LOG(ERROR) << "invalid vector len=" << field.value.size()
+                 << ", field=" << field.name;
+      return PARAM_ERR;
+    }
+  }
+  return 0;
+}
+
+int VectorManager::BatchAddToStore(
+    int start_docid, const std::vector<std::vector<struct Field> *> &fields,
+    std::vector<int> &failed) {
+  std::vector<RawVector *> raw_vectors;
+  for (const auto &it : raw_vectors_) raw_vectors.push_back(it.second);
+  std::vector<std::vector<int>> vec_failed(raw_vectors.size());
+
+#pragma omp parallel for schedule(dynamic)
+  for (size_t v = 0; v < raw_vectors.size(); v++) {
+    RawVector *raw_vector = raw_vectors[v];
+    const std::string &name = raw_vector->MetaInfo()->Name();
+    for (size_t i = 0; i < fields.size(); i++) {
+      std::vector<struct Field> &doc_fields = *fields[i];
+      for (size_t j = 0; j < doc_fields.size(); j++) {
+        if (doc_fields[j].name != name) continue;
+        if (raw_vector->Add(start_docid + i, doc_fields[j])) {
+          vec_failed[v].push_back(i);
+        }
+        break;
+      }
+    }
+  }
+
+  for (std::vector<int> &f : vec_failed) {
+    failed.insert(failed.end(), f.begin(), f.end());
+  }
+  std::sort(failed.begin(), failed.end());
+  failed.erase(std::unique(failed.begin(), failed.end()), failed.end());
+  return failed.size() > 0 ? -1 : 0;
+}
+
 int VectorManager::Update(int docid, std::vector<Field> &fields) {
   for (size_t i = 0; i < fields.size(); i++) {
     string &name = fields[i].name;
@@ -260,7 +320,20 @@ int VectorManager::Indexing() {
   return ret;
 }
 
-int VectorManager::AddRTVecsToIndex() {
+int VectorManager::IndexChunkSize(int backlog, int freshness_ms) {
+  int chunk = kMaxIndexChunk;
+  if (index_ms_per_vec_ > 0) {
+    // a chunk becomes searchable at once, it should take half of freshness
+    chunk = (int)(freshness_ms / 2 / index_ms_per_vec_);
+  }
+  // freshness can't be kept with a big backlog, add it in fewer rounds
+  if (chunk < backlog / 10) chunk = backlog / 10;
+  if (chunk < kMinIndexChunk) chunk = kMinIndexChunk;
+  if (chunk > kMaxIndexChunk) chunk = kMaxIndexChunk;
+  return chunk < backlog ? chunk : backlog;
+}
+
+int VectorManager::AddRTVecsToIndex(int freshness_ms) {
   int ret = 0;
   for (const auto &iter : vector_indexes_) {
     RetrievalModel *retrieval_model = iter.second;
@@ -278,16 +351,10 @@ int VectorManager::AddRTVecsToIndex() {
       LOG(INFO) << "no extra vectors existed for indexing";
 #endif
     } else {
-      int MAX_NUM_PER_INDEX = 1000;
-      int index_count =
-          (total_stored_vecs - indexed_vec_count) / MAX_NUM_PER_INDEX + 1;
-
-      for (int i = 0; i < index_count; i++) {
+      while (retrieval_model->indexed_count_ < total_stored_vecs) {
         int start_docid = retrieval_model->indexed_count_;
         size_t count_per_index =
-            (i == (index_count - 1) ? total_stored_vecs - start_docid
-                                    : MAX_NUM_PER_INDEX);
-        if (count_per_index == 0) break;
+            IndexChunkSize(total_stored_vecs - start_docid, freshness_ms);
 
         std::vector<int> lens;
         ScopeVectors vector_head;
@@ -322,22 +389,31 @@ int VectorManager::AddRTVecsToIndex() {
             }
           }
         }
+        double start = utils::getmillisecs();
         if (!iter.second->Add(count_per_index, add_vec)) {
           LOG(ERROR) << "add index from docid " << start_docid << " error!";
           ret = -2;
-        } else {
-          retrieval_model->indexed_count_ += count_per_index;
+          break;
         }
+        retrieval_model->indexed_count_.fetch_add(count_per_index,
+                                                  std::memory_order_release);
+        double cost = (utils::getmillisecs() - start) / count_per_index;
+        index_ms_per_vec_ = index_ms_per_vec_ == 0
+                                ? cost
+                                : index_ms_per_vec_ * 0.8 + cost * 0.2;
       }
       if (ret == 0) {
         ret = total_stored_vecs - indexed_vec_count;
       }
     }
     std::vector<int64_t> vids;
+    std::unordered_set<int> popped_vids;
     int vid;
     while (retrieval_model->updated_vids_.try_pop(vid)) {
       if (bitmap::test(raw_vec->Bitmap(), raw_vec->VidMgr()->VID2DocID(vid)))
         continue;
+      // the latest vector is fetched, repeated updates are applied once
+      if (!popped_vids.insert(vid).second) continue;
       vids.push_back(vid);
       if (vids.size() >= 20000) break;
     }
@@ -399,6 +475,84 @@ int parse_index_search_result(int n, int k, VectorResult &result,
   return 0;
 }
 
+template <class C>
+void merge_unindexed(GammaSearchCondition *condition, const float *xi, int d,
+                     int start_vid, ScopeVectors &vec_head,
+                     std::vector<int> &lens, bool is_ip, int k, float *simi,
+                     int64_t *idxi) {
+  // results of the index are sorted, -1 marks the end
+  int nvalid = 0;
+  while (nvalid < k && idxi[nvalid] != -1) nvalid++;
+  std::vector<float> dis(simi, simi + nvalid);
+  std::vector<int64_t> ids(idxi, idxi + nvalid);
+  faiss::heap_heapify<C>(k, simi, idxi, dis.data(), ids.data(), nvalid);
+  // a batch being added sees its vectors in the index before the indexed
+  // count moves past them, they are not merged twice
+  std::vector<int64_t> seen;
+  for (int64_t id : ids) {
+    if (id >= start_vid) seen.push_back(id);
+  }
+
+  int vid = start_vid;
+  for (size_t s = 0; s < vec_head.Size(); s++) {
+    const float *y = reinterpret_cast<const float *>(vec_head.Get(s));
+    for (int j = 0; j < lens[s]; j++, vid++) {
+      if (!condition->IsValid(vid)) continue;
+      const float *yj = y + (size_t)j * d;
+      float dist = is_ip ? faiss::fvec_inner_product(xi, yj, d)
+                         : faiss::fvec_L2sqr(xi, yj, d);
+      if (!condition->IsSimilarScoreValid(dist)) continue;
+      if (C::cmp(simi[0], dist) &&
+          std::find(seen.begin(), seen.end(), vid) == seen.end()) {
+        faiss::heap_pop<C>(k, simi, idxi);
+        faiss::heap_push<C>(k, simi, idxi, dist, vid);
+      }
+    }
+  }
+  faiss::heap_reorder<C>(k, simi, idxi);
+}
+
+// brute-force the stored vectors which are not indexed yet, so they are
+// searchable before the indexing thread catches up. start is the indexed
+// count taken before the index was searched, the vectors indexed meanwhile
+// are brute-forced as well
+int search_unindexed(RetrievalModel *index, GammaSearchCondition *condition,
+                     int n, const float *x, int k, float *dists, int64_t *vids,
+                     int start, int limit) {
+  RawVector *raw_vec = dynamic_cast<RawVector *>(index->vector_);
+  if (raw_vec->MetaInfo()->DataType() != VectorValueType::FLOAT) return 0;
+  int end = raw_vec->MetaInfo()->Size();
+  // nothing is indexed, the index searches all vectors itself
+  if (limit <= 0 || start == 0 || start >= end) return 0;
+  if (end - start > limit) end = start + limit;
+
+  std::vector<int> lens;
+  ScopeVectors vec_head;
+  if (raw_vec->GetVectorHeader(start, end - start, vec_head, lens)) {
+    LOG(ERROR) << "get unindexed vectors error, start=" << start
+               << ", end=" << end;
+    return -1;
+  }
+  int d = raw_vec->MetaInfo()->Dimension();
+  bool is_ip = condition->metric_type == DistanceComputeType::INNER_PRODUCT;
+  int threads = condition->SearchThreads();
+
+#pragma omp parallel for if (n > 1) num_threads(threads)
+  for (int i = 0; i < n; i++) {
+    const float *xi = x + (size_t)i * d;
+    float *simi = dists + (size_t)i * k;
+    int64_t *idxi = vids + (size_t)i * k;
+    if (is_ip) {
+      merge_unindexed<faiss::CMin<float, int64_t>>(
+          condition, xi, d, start, vec_head, lens, is_ip, k, simi, idxi);
+    } else {
+      merge_unindexed<faiss::CMax<float, int64_t>>(
+          condition, xi, d, start, vec_head, lens, is_ip, k, simi, idxi);
+    }
+  }
+  return 0;
+}
+
 }  // namespace
 
 int VectorManager::Search(GammaQuery &query, GammaResult *results) {
@@ -457,6 +611,7 @@ int VectorManager::Search(GammaQuery &query, GammaResult *results) {
 
     const uint8_t *x =
         reinterpret_cast<const uint8_t *>(vec_query.value.c_str());
+    int indexed = index->indexed_count_.load(std::memory_order_acquire);
     int ret_vec = index->Search(query.condition, n, x, query.condition->topn,
                                 all_vector_results[i].dists,
                                 all_vector_results[i].docids);
@@ -466,6 +621,17 @@ int VectorManager::Search(GammaQuery &query, GammaResult *results) {
       LOG(ERROR) << "faild search of query " << index_name;
       return -3;
     } else {
+      if (not index->CoversUnindexed() &&
+          not query.condition->brute_force_search) {
+        if (search_unindexed(index, query.condition, n,
+                             reinterpret_cast<const float *>(x),
+                             query.condition->topn, all_vector_results[i].dists,
+                             all_vector_results[i].docids, indexed,
+                             unindexed_search_limit_)) {
+          LOG(ERROR) << "search unindexed vectors of " << index_name
+                     << " error, only the indexed are returned";
+        }
+      }
       parse_index_search_result(n, query.condition->topn, all_vector_results[i],
                                 index);
 
@@ -587,6 +753,24 @@ int VectorManager::Search(GammaQuery &query, GammaResult *results) {
   return ret;
 }
 
+int VectorManager::Prefetch(const std::vector<std::string> &fields,
+                            const std::vector<int64_t> &docids) {
+  int ret = 0;
+  for (const std::string &field : fields) {
+    auto iter = raw_vectors_.find(field);
+    if (iter == raw_vectors_.end() || iter->second == nullptr) continue;
+    RawVector *raw_vec = iter->second;
+    std::vector<int64_t> vids;
+    vids.reserve(docids.size());
+    for (int64_t docid : docids) {
+      int vid = raw_vec->VidMgr()->GetFirstVID(docid);
+      if (vid >= 0) vids.push_back(vid);
+    }
+    if (vids.size() > 1 && raw_vec->Prefetch(vids) < 0) ret = -1;
+  }
+  return ret;
+}
+
 int VectorManager::GetVector(
     const std::vector<std::pair<string, int>> &fields_ids,
     std::vector<string> &vec, bool is_bytearray) {
@@ -762,7 +946,47 @@ int VectorManager::MinIndexedNum() {
   return min;
 }
 
+int VectorManager::UnsearchedNum() {
+  int limit = unindexed_search_limit_;
+  if (limit < 0) limit = 0;
+  int unsearched = 0;
+  for (const auto &iter : vector_indexes_) {
+    RetrievalModel *index = iter.second;
+    if (index == nullptr || index->CoversUnindexed()) continue;
+    RawVector *raw_vec = dynamic_cast<RawVector *>(index->vector_);
+    int start = index->indexed_count_.load(std::memory_order_acquire);
+    int end = raw_vec->MetaInfo()->Size();
+    if (start == 0 || start >= end) continue;
+    int searched =
+        raw_vec->MetaInfo()->DataType() == VectorValueType::FLOAT ? limit : 0;
+    if (end - start > searched && end - start - searched > unsearched) {
+      unsearched = end - start - searched;
+    }
+  }
+  return unsearched;
+}
+
 int VectorManager::AlterCacheSize(struct CacheInfo &cache_info) {
+  // "<field>_hot" is the hot tier of a tiered vector field
+  const std::string &name = cache_info.field_name;
+  size_t suffix_len = strlen(kHotCacheSuffix);
+  if (raw_vectors_.find(name) == raw_vectors_.end() &&
+      name.size() > suffix_len &&
+      name.compare(name.size() - suffix_len, suffix_len, kHotCacheSuffix) ==
+          0) {
+    auto hot_ite = raw_vectors_.find(name.substr(0, name.size() - suffix_len));
+    TieredRawVector *tiered_vec =
+        hot_ite == raw_vectors_.end()
+            ? nullptr
+            : dynamic_cast<TieredRawVector *>(hot_ite->second);
+    if (tiered_vec && cache_info.cache_size >= 0) {
+      tiered_vec->AlterHotCacheSize((uint32_t)cache_info.cache_size);
+    } else {
+      LOG(INFO) << "field_name[" << name << "] error.";
+    }
+    return 0;
+  }
+
   auto ite = raw_vectors_.find(cache_info.field_name);
   if (ite != raw_vectors_.end()) {
     RawVector *raw_vec = ite->second;
@@ -788,8 +1012,42 @@ int VectorManager::GetAllCacheSize(Config &conf) {
     uint32_t cache_size = 0;
     if (0 != raw_vec->GetCacheSize(cache_size)) continue;
     conf.AddCacheInfo(ite->first, (int)cache_size);
+
+    TieredRawVector *tiered_vec = dynamic_cast<TieredRawVector *>(raw_vec);
+    uint32_t hot_cache_size = 0;
+    if (tiered_vec && tiered_vec->GetHotCacheSize(hot_cache_size) == 0) {
+      conf.AddCacheInfo(ite->first + kHotCacheSuffix, (int)hot_cache_size);
+    }
   }
   return 0;
 }
 
+void VectorManager::GetTierHitRatios(float &hot_hit_ratio,
+                                     float &cold_hit_ratio) {
+  long hot_hits = 0, hot_reads = 0, cold_hits = 0, cold_reads = 0;
+  for (auto &it : raw_vectors_) {
+    TieredRawVector *tiered_vec = dynamic_cast<TieredRawVector *>(it.second);
+    if (tiered_vec == nullptr) continue;
+    long hits, reads, disk_hits, disk_reads;
+    tiered_vec->GetTierHits(hits, reads, disk_hits, disk_reads);
+    hot_hits += hits;
+    hot_reads += reads;
+    cold_hits += disk_hits;
+    cold_reads += disk_reads;
+  }
+  hot_hit_ratio = hot_reads > 0 ? (float)hot_hits / hot_reads : 0;
+  cold_hit_ratio = cold_reads > 0 ? (float)cold_hits / cold_reads : 0;
+}
+
+void VectorManager::GetTombstoneRatios(
+    std::map<std::string, std::vector<float>> &ratios) {
+  for (const auto &iter : vector_indexes_) {
+    if (iter.second == nullptr) continue;
+    std::vector<float> bucket_ratios;
+    iter.second->GetTombstoneRatios(bucket_ratios);
+    if (bucket_ratios.size() == 0) continue;
+    ratios[iter.first].swap(bucket_ratios);
+  }
+}
+
 }  // namespace tig_gamma
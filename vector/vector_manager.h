@@ -9,6 +9,7 @@
 #ifndef VECTOR_MANAGER_H_
 #define VECTOR_MANAGER_H_
 
+#include <atomic>
 #include <map>
 #include <string>
 
@@ -20,21 +21,43 @@
 
 namespace tig_gamma {
 
+// default of the unindexed vectors brute-forced by a search of each index
+const static int kUnindexedSearchLimit = 10000;
+
 class VectorManager {
  public:
+  // the vector caches share the cache quota of table_id, -1 if they don't
   VectorManager(const VectorStorageType &store_type, const char *docids_bitmap,
-                const std::string &root_path);
+                const std::string &root_path, int table_id = -1);
   ~VectorManager();
 
   int CreateVectorTable(TableInfo &table, utils::JsonParser *jp);
 
   int AddToStore(int docid, std::vector<struct Field> &fields);
 
+  // check the vector fields of a doc before it is logged and stored
+  int CheckFields(const std::vector<struct Field> &fields);
+
+  /** add fields[i] as start_docid + i, the raw vectors are filled in
+   * parallel, each in docid order
+   *
+   * @param failed  positions of the docs which are failed to add
+   */
+  int BatchAddToStore(int start_docid,
+                      const std::vector<std::vector<struct Field> *> &fields,
+                      std::vector<int> &failed);
+
   int Update(int docid, std::vector<struct Field> &fields);
 
   int Indexing();
 
-  int AddRTVecsToIndex();
+  /** add the stored vectors which are not indexed to the indexes, the
+   * chunk size adapts to the backlog and the measured indexing cost
+   *
+   * @param freshness_ms  expected time from added to searchable
+   * @return number of vectors indexed by the last index, < 0 if error
+   */
+  int AddRTVecsToIndex(int freshness_ms);
 
   // int Add(int docid, const std::vector<Field *> &field_vecs);
   int Search(GammaQuery &query, GammaResult *results);
@@ -42,6 +65,10 @@ class VectorManager {
   int GetVector(const std::vector<std::pair<std::string, int>> &fields_ids,
                 std::vector<std::string> &vec, bool is_bytearray = false);
 
+  // load the vectors of docids of the fields in one batch per field
+  int Prefetch(const std::vector<std::string> &fields,
+               const std::vector<int64_t> &docids);
+
   void GetTotalMemBytes(long &index_total_mem_bytes,
                         long &vector_total_mem_bytes);
 
@@ -69,12 +96,31 @@ class VectorManager {
 
   int MinIndexedNum();
 
+  /** the stored vectors which are neither indexed nor brute-forced by the
+   * searches, max of the indexes
+   */
+  int UnsearchedNum();
+
+  int UnindexedSearchLimit() { return unindexed_search_limit_; }
+
+  // < 0 turns the brute-force of the unindexed vectors off
+  void SetUnindexedSearchLimit(int limit) { unindexed_search_limit_ = limit; }
+
   int AlterCacheSize(struct CacheInfo &cache_info);
 
   int GetAllCacheSize(Config &conf);
 
+  /** hit ratios of the tiered vector fields, the hot tier is the in-memory
+   * arena and the cold tier is the block cache of the disk segments
+   */
+  void GetTierHitRatios(float &hot_hit_ratio, float &cold_hit_ratio);
+
+  // tombstone ratios of the realtime buckets of each index, by index name
+  void GetTombstoneRatios(std::map<std::string, std::vector<float>> &ratios);
+
  private:
   void Close();  // release all resource
+  int IndexChunkSize(int backlog, int freshness_ms);
   inline std::string IndexName(const std::string &field_name,
                                const std::string &retrieval_type) {
     return field_name + "_" + retrieval_type;
@@ -85,10 +131,13 @@ class VectorManager {
   const char *docids_bitmap_;
   bool table_created_;
   std::string root_path_;
+  int table_id_;
 
   std::map<std::string, RawVector *> raw_vectors_;
   std::map<std::string, RetrievalModel *> vector_indexes_;
   std::vector<std::string> retrieval_types_;
+  double index_ms_per_vec_;  // moving average of indexing cost
+  std::atomic<int> unindexed_search_limit_;
 };
 
 }  // namespace tig_gamma